@@ -190,17 +190,16 @@ baudot_encode_table[0x60][2] = {
 
 
 /*
+ * *charsetp (the shift state):
  * 0 unknown state
  * 1 LTRS state
  * 2 FIGS state
  */
-static unsigned int baudot_charset = 0;		// FIXME
-
 
 void
-baudot_reset()
+baudot_reset( unsigned int *charsetp )
 {
-    baudot_charset = 1;
+    *charsetp = 1;
 }
 
 
@@ -210,24 +209,25 @@ baudot_reset()
  * the count of characters decoded and stuffed).
  */
 int
-baudot_decode( char *char_outp, unsigned char databits )
+baudot_decode( unsigned int *charsetp,
+	char *char_outp, unsigned char databits )
 {
     /* Baudot (RTTY) */
     assert( (databits & ~0x1F) == 0 );
 
     int stuff_char = 1;
     if ( databits == BAUDOT_FIGS ) {
-	baudot_charset = 2;
+	*charsetp = 2;
 	stuff_char = 0;
     } else if ( databits == BAUDOT_LTRS ) {
-	baudot_charset = 1;
+	*charsetp = 1;
 	stuff_char = 0;
     } else if ( databits == BAUDOT_SPACE ) {	/* RX un-shift on space */
-	baudot_charset = 1;
+	*charsetp = 1;
     }
     if ( stuff_char ) {
 	int t;
-	if ( baudot_charset == 1 )
+	if ( *charsetp == 1 )
 	    t = 0;
 	else
 	    t = 1;	// U.S. figs
@@ -250,7 +250,8 @@ baudot_skip_warning( char char_out )
  * Returns the number of 5-bit data words stuffed into *databits_outp (1 or 2)
  */
 int
-baudot_encode( unsigned int *databits_outp, char char_out )
+baudot_encode( unsigned int *charsetp,
+	unsigned int *databits_outp, char char_out )
 {
 
     char_out = toupper(char_out);
@@ -265,23 +266,23 @@ baudot_encode( unsigned int *databits_outp, char char_out )
 
     unsigned char charset_mask = baudot_encode_table[ind][1];
 
-    debug_log("I: (baudot_charset==%u)   input character '%c' 0x%02x charset_mask=%u\n", baudot_charset, char_out, char_out, charset_mask);
+    debug_log("I: (baudot_charset==%u)   input character '%c' 0x%02x charset_mask=%u\n", *charsetp, char_out, char_out, charset_mask);
 
-    if ( (baudot_charset & charset_mask ) == 0 ) {
+    if ( (*charsetp & charset_mask ) == 0 ) {
 	if ( charset_mask == 0 ) {
 	    baudot_skip_warning(char_out);
 	    return 0;
 	}
 
-	if ( baudot_charset == 0 )
-	    baudot_charset = 1;
+	if ( *charsetp == 0 )
+	    *charsetp = 1;
 
 	if ( charset_mask != 3 )
-	    baudot_charset = charset_mask;
+	    *charsetp = charset_mask;
 
-	if ( baudot_charset == 1 )
+	if ( *charsetp == 1 )
 	    databits_outp[n++] = BAUDOT_LTRS;
-	else if ( baudot_charset == 2 )
+	else if ( *charsetp == 2 )
 	    databits_outp[n++] = BAUDOT_FIGS;
 	else
 	    assert(0);
@@ -289,10 +290,10 @@ baudot_encode( unsigned int *databits_outp, char char_out )
 	debug_log("I: emit charset select 0x%02X\n", databits_outp[n-1]);
     }
 
-    if ( !( baudot_charset == 1 || baudot_charset == 2 ) ) {
+    if ( !( *charsetp == 1 || *charsetp == 2 ) ) {
 	fprintf(stderr, "E: baudot input character failed '%c' 0x%02x\n",
 		char_out, char_out);
-	fprintf(stderr, "E: baudot_charset==%u\n", baudot_charset);
+	fprintf(stderr, "E: baudot_charset==%u\n", *charsetp);
 	assert(0);
     }
 
@@ -300,7 +301,7 @@ baudot_encode( unsigned int *databits_outp, char char_out )
 
     /* TX un-shift on space */
     if ( char_out == ' ' )
-	baudot_charset = 1;
+	*charsetp = 1;
 
     return n;
 }
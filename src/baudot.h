@@ -18,8 +18,13 @@
  */
 
 
+/*
+ * The caller keeps the shift state *charsetp for each stream
+ * (start it at 0: unknown).
+ */
+
 void
-baudot_reset();
+baudot_reset( unsigned int *charsetp );
 
 /*
  * Returns 1 if *char_outp was stuffed with an output character
@@ -27,10 +32,12 @@ baudot_reset();
  * the count of characters decoded and stuffed).
  */
 int
-baudot_decode( char *char_outp, unsigned char databits );
+baudot_decode( unsigned int *charsetp,
+	char *char_outp, unsigned char databits );
 
 /*
  * Returns the number of 5-bit datawords stuffed into *databits_outp (1 or 2)
  */
 int
-baudot_encode( unsigned int *databits_outp, char char_out );
+baudot_encode( unsigned int *charsetp,
+	unsigned int *databits_outp, char char_out );
@@ -17,6 +17,9 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifndef DATABITS_H
+#define DATABITS_H
+
 // Reverses the ordering of the bits on an integer
 static inline unsigned long long
 bit_reverse(unsigned long long value,
@@ -43,48 +46,68 @@ bit_window(unsigned long long value,
 	return value;
 }
 
-typedef int (databits_encoder)(
+/*
+ * The encoder and decoder state for one stream (the Baudot shift state,
+ * and the Caller-ID message being collected).  Start it zeroed.
+ */
+typedef struct databits_state {
+	unsigned int	baudot_charset;
+	int		cid_msgtype;
+	int		cid_ndata;
+	unsigned char	cid_buf[256];
+} databits_state;
+
+typedef int (databits_encoder)( databits_state *dbs,
 	unsigned int *databits_outp, char char_out );
 
-typedef unsigned int (databits_decoder)(
+typedef unsigned int (databits_decoder)( databits_state *dbs,
 	char *dataout_p, unsigned int dataout_size,
 	unsigned long long bits, unsigned int n_databits );
 
 
 int
-databits_encode_ascii8( unsigned int *databits_outp, char char_out );
+databits_encode_ascii8( databits_state *dbs,
+	unsigned int *databits_outp, char char_out );
 
 unsigned int
-databits_decode_ascii8( char *dataout_p, unsigned int dataout_size,
+databits_decode_ascii8( databits_state *dbs,
+	char *dataout_p, unsigned int dataout_size,
 	unsigned long long bits, unsigned int n_databits );
 
 
-#include "baudot.h"
-#define databits_encode_baudot baudot_encode // from baudot.h
-//int
-//databits_encode_baudot( unsigned int *databits_outp, char char_out );
+int
+databits_encode_baudot( databits_state *dbs,
+	unsigned int *databits_outp, char char_out );
 
 unsigned int
-databits_decode_baudot( char *dataout_p, unsigned int dataout_size,
+databits_decode_baudot( databits_state *dbs,
+	char *dataout_p, unsigned int dataout_size,
 	unsigned long long bits, unsigned int n_databits );
 
 
 int
-databits_encode_binary( unsigned int *databits_outp, char char_out );
+databits_encode_binary( databits_state *dbs,
+	unsigned int *databits_outp, char char_out );
 
 unsigned int
-databits_decode_binary( char *dataout_p, unsigned int dataout_size,
+databits_decode_binary( databits_state *dbs,
+	char *dataout_p, unsigned int dataout_size,
 	unsigned long long bits, unsigned int n_databits );
 
 
 unsigned int
-databits_decode_callerid( char *dataout_p, unsigned int dataout_size,
+databits_decode_callerid( databits_state *dbs,
+	char *dataout_p, unsigned int dataout_size,
 	unsigned long long bits, unsigned int n_databits );
 
 unsigned int
-databits_decode_uic_ground( char *dataout_p, unsigned int dataout_size,
+databits_decode_uic_ground( databits_state *dbs,
+	char *dataout_p, unsigned int dataout_size,
 	unsigned long long bits, unsigned int n_databits );
 
 unsigned int
-databits_decode_uic_train( char *dataout_p, unsigned int dataout_size,
+databits_decode_uic_train( databits_state *dbs,
+	char *dataout_p, unsigned int dataout_size,
 	unsigned long long bits, unsigned int n_databits );
+
+#endif
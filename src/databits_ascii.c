@@ -25,7 +25,8 @@
 
 /* returns the number of datawords stuffed into *databits_outp */
 int
-databits_encode_ascii8( unsigned int *databits_outp, char char_out )
+databits_encode_ascii8( databits_state *dbs,
+	unsigned int *databits_outp, char char_out )
 {
     *databits_outp = char_out;
     return 1;
@@ -33,7 +34,8 @@ databits_encode_ascii8( unsigned int *databits_outp, char char_out )
 
 /* returns nbytes decoded */
 unsigned int
-databits_decode_ascii8( char *dataout_p, unsigned int dataout_size,
+databits_decode_ascii8( databits_state *dbs,
+	char *dataout_p, unsigned int dataout_size,
 	unsigned long long bits, unsigned int n_databits )
 {
     if ( ! dataout_p )	// databits processor reset: noop
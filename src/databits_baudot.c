@@ -25,16 +25,25 @@
 
 #include "baudot.h"
 
+/* returns the number of datawords stuffed into *databits_outp */
+int
+databits_encode_baudot( databits_state *dbs,
+	unsigned int *databits_outp, char char_out )
+{
+    return baudot_encode(&dbs->baudot_charset, databits_outp, char_out);
+}
+
 /* returns nbytes decoded */
 unsigned int
-databits_decode_baudot( char *dataout_p, unsigned int dataout_size,
+databits_decode_baudot( databits_state *dbs,
+	char *dataout_p, unsigned int dataout_size,
 	unsigned long long bits, unsigned int n_databits )
 {
     if ( ! dataout_p ) {	// databits processor reset: reset Baudot state
-	    baudot_reset();
+	    baudot_reset(&dbs->baudot_charset);
 	    return 0;
     }
     bits &= 0x1F;
-    return baudot_decode(dataout_p, bits);
+    return baudot_decode(&dbs->baudot_charset, dataout_p, bits);
 }
 
@@ -42,19 +42,18 @@ static const char *cid_datatype_names[] = {
     "Name:"
 };
 
-static int cid_msgtype = 0;
-static int cid_ndata = 0;
-static unsigned char cid_buf[256];
-
+// The message being collected is kept in the databits_state:
+//   cid_msgtype, cid_ndata, cid_buf[]
 
 static unsigned int
-decode_mdmf_callerid( char *dataout_p, unsigned int dataout_size )
+decode_mdmf_callerid( databits_state *dbs,
+	char *dataout_p, unsigned int dataout_size )
 {
     unsigned int dataout_n = 0;
     unsigned int cid_i = 0;
-    unsigned int cid_msglen = cid_buf[1];
+    unsigned int cid_msglen = dbs->cid_buf[1];
 
-    unsigned char *m = cid_buf + 2;
+    unsigned char *m = dbs->cid_buf + 2;
     while ( cid_i < cid_msglen ) {
 
 	unsigned int cid_datatype = *m++;
@@ -64,7 +63,7 @@ decode_mdmf_callerid( char *dataout_p, unsigned int dataout_size )
 	}
 
 	unsigned int cid_datalen = *m++;
-	if ( m + 2 + cid_datalen >= cid_buf + sizeof(cid_buf) ) {
+	if ( m + 2 + cid_datalen >= dbs->cid_buf + sizeof(dbs->cid_buf) ) {
 	    // FIXME: bad datastream -- print something here
 	    return 0;
 	}
@@ -119,12 +118,13 @@ decode_mdmf_callerid( char *dataout_p, unsigned int dataout_size )
 
 
 static unsigned int
-decode_sdmf_callerid( char *dataout_p, unsigned int dataout_size )
+decode_sdmf_callerid( databits_state *dbs,
+	char *dataout_p, unsigned int dataout_size )
 {
     unsigned int dataout_n = 0;
-    unsigned int cid_msglen = cid_buf[1];
+    unsigned int cid_msglen = dbs->cid_buf[1];
 
-    unsigned char *m = cid_buf + 2;
+    unsigned char *m = dbs->cid_buf + 2;
 
     dataout_n += sprintf(dataout_p+dataout_n, "%-6s ",
 			    cid_datatype_names[CID_DATA_DATETIME]);
@@ -146,48 +146,49 @@ decode_sdmf_callerid( char *dataout_p, unsigned int dataout_size )
 }
 
 static unsigned int
-decode_cid_reset()
+decode_cid_reset( databits_state *dbs )
 {
-    cid_msgtype = 0;
-    cid_ndata = 0;
+    dbs->cid_msgtype = 0;
+    dbs->cid_ndata = 0;
     return 0;
 }
 
 // FIXME: doesn't respect dataout_size at all!
 /* returns nbytes decoded */
 unsigned int
-databits_decode_callerid( char *dataout_p, unsigned int dataout_size,
+databits_decode_callerid( databits_state *dbs,
+	char *dataout_p, unsigned int dataout_size,
 	unsigned long long bits, unsigned int n_databits )
 {
     if ( ! dataout_p )	// databits processor reset
-	return decode_cid_reset();
+	return decode_cid_reset(dbs);
 
-    if ( cid_msgtype == 0 ) {
+    if ( dbs->cid_msgtype == 0 ) {
 	if ( bits == CID_MSG_MDMF )
-	    cid_msgtype = CID_MSG_MDMF;
+	    dbs->cid_msgtype = CID_MSG_MDMF;
 	else if ( bits == CID_MSG_SDMF )
-	    cid_msgtype = CID_MSG_SDMF;
+	    dbs->cid_msgtype = CID_MSG_SDMF;
 	else
 	    return 0;
-	cid_buf[cid_ndata++] = bits;
+	dbs->cid_buf[dbs->cid_ndata++] = bits;
 	return 0;
     }
 
-    if ( cid_ndata >= sizeof(cid_buf) ) {
+    if ( dbs->cid_ndata >= sizeof(dbs->cid_buf) ) {
 	// FIXME? buffer overflow; do what here?
-	return decode_cid_reset();
+	return decode_cid_reset(dbs);
     }
 
-    cid_buf[cid_ndata++] = bits;
+    dbs->cid_buf[dbs->cid_ndata++] = bits;
 
     // Collect input bytes until we've collected as many as the message
     // length byte says there will be, plus two (the message type byte
     // and the checksum byte)
-    unsigned long long cid_msglen = cid_buf[1];
-    if ( cid_ndata < cid_msglen + 2)
+    unsigned long long cid_msglen = dbs->cid_buf[1];
+    if ( dbs->cid_ndata < cid_msglen + 2)
 	return 0;
 
-    // Now we have a whole CID message in cid_buf[] -- decode it
+    // Now we have a whole CID message in dbs->cid_buf[] -- decode it
 
     // FIXME: check the checksum
 
@@ -195,15 +196,15 @@ databits_decode_callerid( char *dataout_p, unsigned int dataout_size,
 
     dataout_n += sprintf(dataout_p+dataout_n, "CALLER-ID\n");
 
-    if ( cid_msgtype == CID_MSG_MDMF )
-	dataout_n += decode_mdmf_callerid(dataout_p+dataout_n,
+    if ( dbs->cid_msgtype == CID_MSG_MDMF )
+	dataout_n += decode_mdmf_callerid(dbs, dataout_p+dataout_n,
 						dataout_size-dataout_n);
     else
-	dataout_n += decode_sdmf_callerid(dataout_p+dataout_n,
+	dataout_n += decode_sdmf_callerid(dbs, dataout_p+dataout_n,
 						dataout_size-dataout_n);
 
     // All done; reset for the next one
-    decode_cid_reset();
+    decode_cid_reset(dbs);
 
     return dataout_n;
 }
@@ -26,10 +26,182 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "fsk.h"
 
 
+/*
+ * The FFTW planner is not thread-safe (fftwf_execute() is), so creating
+ * and destroying plans is serialized across all threads.
+ */
+static pthread_mutex_t fftw_planner_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void
+fsk_fftw_planner_lock()
+{
+    pthread_mutex_lock(&fftw_planner_mutex);
+}
+
+void
+fsk_fftw_planner_unlock()
+{
+    pthread_mutex_unlock(&fftw_planner_mutex);
+}
+
+
+/*
+ * Shared FFTW plans (under fftw_planner_mutex)
+ */
+struct fsk_fft_plan {
+	struct fsk_fft_plan	*next;
+	int			fftsize;
+	int			inverse;
+	unsigned int		refcount;
+	fftwf_plan		plan;
+};
+
+static struct fsk_fft_plan *fft_plans;
+
+fftwf_plan
+fsk_fft_plan_get( int fftsize, int inverse )
+{
+    struct fsk_fft_plan *p;
+    fftwf_plan plan = NULL;
+
+    fsk_fftw_planner_lock();
+    for ( p=fft_plans; p; p=p->next )
+	if ( p->fftsize == fftsize && p->inverse == inverse )
+	    break;
+    if ( !p ) {
+	p = calloc(1, sizeof(*p));
+	// FFTW_ESTIMATE doesn't touch the arrays, but the plan does
+	// remember their alignment (see fsk_scratch_get())
+	float *r = fftwf_malloc(fftsize * sizeof(float));
+	fftwf_complex *c = fftwf_malloc((fftsize/2+1) * sizeof(fftwf_complex));
+	if ( p && r && c ) {
+	    if ( inverse )
+		p->plan = fftwf_plan_dft_c2r_1d(fftsize, c, r, FFTW_ESTIMATE);
+	    else
+		p->plan = fftwf_plan_dft_r2c_1d(fftsize, r, c, FFTW_ESTIMATE);
+	}
+	fftwf_free(r);
+	fftwf_free(c);
+	if ( p && p->plan ) {
+	    p->fftsize = fftsize;
+	    p->inverse = inverse;
+	    p->next = fft_plans;
+	    fft_plans = p;
+	} else {
+	    free(p);
+	    p = NULL;
+	}
+    }
+    if ( p ) {
+	p->refcount++;
+	plan = p->plan;
+    }
+    fsk_fftw_planner_unlock();
+
+    return plan;
+}
+
+void
+fsk_fft_plan_put( fftwf_plan plan )
+{
+    struct fsk_fft_plan **pp;
+
+    fsk_fftw_planner_lock();
+    for ( pp=&fft_plans; *pp; pp=&(*pp)->next )
+	if ( (*pp)->plan == plan )
+	    break;
+    assert( *pp );
+    struct fsk_fft_plan *p = *pp;
+    if ( --p->refcount == 0 ) {
+	*pp = p->next;
+	fftwf_destroy_plan(p->plan);
+	free(p);
+    }
+    fsk_fftw_planner_unlock();
+}
+
+
+/*
+ * Per-thread FFT work arrays
+ */
+struct fsk_scratch {
+	void		*buf[FSK_SCRATCH_NSLOTS];
+	size_t		size[FSK_SCRATCH_NSLOTS];
+	unsigned int	fftin_ndirty;	// FFTIN samples not known to be zero
+};
+
+static pthread_key_t scratch_key;
+static pthread_once_t scratch_key_once = PTHREAD_ONCE_INIT;
+
+static void
+scratch_free( void *arg )
+{
+    struct fsk_scratch *s = arg;
+    unsigned int i;
+    for ( i=0; i<FSK_SCRATCH_NSLOTS; i++ )
+	fftwf_free(s->buf[i]);
+    free(s);
+}
+
+static void
+scratch_key_create()
+{
+    pthread_key_create(&scratch_key, scratch_free);
+}
+
+static struct fsk_scratch *
+fsk_scratch()
+{
+    pthread_once(&scratch_key_once, scratch_key_create);
+    struct fsk_scratch *s = pthread_getspecific(scratch_key);
+    if ( !s ) {
+	s = calloc(1, sizeof(*s));
+	assert( s );
+	pthread_setspecific(scratch_key, s);
+    }
+    return s;
+}
+
+void *
+fsk_scratch_get( unsigned int slot, size_t nbytes )
+{
+    struct fsk_scratch *s = fsk_scratch();
+    if ( s->size[slot] < nbytes ) {
+	fftwf_free(s->buf[slot]);
+	s->buf[slot] = fftwf_malloc(nbytes);
+	assert( s->buf[slot] );
+	bzero(s->buf[slot], nbytes);
+	s->size[slot] = nbytes;
+	if ( slot == FSK_SCRATCH_FFTIN )
+	    s->fftin_ndirty = 0;
+    }
+    return s->buf[slot];
+}
+
+/*
+ * Load nsamples into the FFTIN array, zero-padded to fftsize.  Only the
+ * part dirtied since the last load is zeroed (fsk_bit_analyze() loads
+ * the same bit_nsamples over and over).
+ */
+static float *
+fsk_fftin_load( fsk_plan *fskp, const float *samples, unsigned int nsamples )
+{
+    float *fftin = fsk_scratch_get(FSK_SCRATCH_FFTIN,
+				fskp->fftsize * sizeof(float));
+    struct fsk_scratch *s = fsk_scratch();
+    memcpy(fftin, samples, nsamples * sizeof(float));
+    if ( s->fftin_ndirty > nsamples )
+	bzero(fftin + nsamples, (s->fftin_ndirty - nsamples) * sizeof(float));
+    s->fftin_ndirty = nsamples;
+    return fftin;
+}
+
+
 fsk_plan *
 fsk_plan_new(
 	float		sample_rate,
@@ -45,6 +217,8 @@ fsk_plan_new(
     fskp->sample_rate = sample_rate;
     fskp->f_mark = f_mark;
     fskp->f_space = f_space;
+    fskp->track = NULL;
+    fskp->no_prefilter = 0;
 
 #ifdef USE_FFT
     fskp->band_width = filter_bw;
@@ -66,25 +240,9 @@ fsk_plan_new(
 	    fskp->b_mark, fskp->b_space, fskp->fftsize);
 
 
-    // FIXME:
-    unsigned int pa_nchannels = 1;
-
-    // FIXME check these:
-    fskp->fftin  = fftwf_malloc(fskp->fftsize * sizeof(float) * pa_nchannels);
-    bzero(fskp->fftin, (fskp->fftsize * sizeof(float) * pa_nchannels));
-    fskp->fftout = fftwf_malloc(fskp->nbands * sizeof(fftwf_complex) * pa_nchannels);
-
-    /* complex fftw plan, works for N channels: */
-    fskp->fftplan = fftwf_plan_many_dft_r2c(
-	    /*rank*/1, &fskp->fftsize, /*howmany*/pa_nchannels,
-	    fskp->fftin, NULL, /*istride*/pa_nchannels, /*idist*/1,
-	    fskp->fftout, NULL, /*ostride*/1, /*odist*/fskp->nbands,
-	    FFTW_ESTIMATE);
-
+    fskp->fftplan = fsk_fft_plan_get(fskp->fftsize, /*inverse*/0);
     if ( !fskp->fftplan ) {
         fprintf(stderr, "fftwf_plan_dft_r2c_1d() failed\n");
-	fftwf_free(fskp->fftin);
-	fftwf_free(fskp->fftout);
 	free(fskp);
 	errno = EINVAL;
         return NULL;
@@ -97,9 +255,7 @@ fsk_plan_new(
 void
 fsk_plan_destroy( fsk_plan *fskp )
 {
-    fftwf_free(fskp->fftin);
-    fftwf_free(fskp->fftout);
-    fftwf_destroy_plan(fskp->fftplan);
+    fsk_fft_plan_put(fskp->fftplan);
     free(fskp);
 }
 
@@ -114,6 +270,29 @@ band_mag( fftwf_complex * const cplx, unsigned int band, float scalar )
 }
 
 
+/*
+ * Look up the mark and space magnitudes of these samples in the tone
+ * track, if there is one for this many.  Returns 0 if not.
+ */
+static inline int
+fsk_track_mags( fsk_plan *fskp, const float *samples, unsigned int nsamples,
+	float *mag_mark_outp, float *mag_space_outp )
+{
+    if ( !fskp->track || nsamples != fskp->track_window )
+	return 0;
+    unsigned long long pos = fskp->track_base_pos
+				+ (samples - fskp->track_base);
+    if ( pos < fskp->track_nsamples ) {
+	const float *mags = fskp->track + 2 * pos;
+	*mag_mark_outp  = mags[fskp->track_swap];
+	*mag_space_outp = mags[!fskp->track_swap];
+    } else {
+	*mag_mark_outp  = 0.0f;		// (past the end: zero-padded)
+	*mag_space_outp = 0.0f;
+    }
+    return 1;
+}
+
 static void
 fsk_bit_analyze( fsk_plan *fskp, float *samples, unsigned int bit_nsamples,
 	unsigned int *bit_outp,
@@ -121,13 +300,13 @@ fsk_bit_analyze( fsk_plan *fskp, float *samples, unsigned int bit_nsamples,
 	float *bit_noise_mag_outp
 	)
 {
-    // FIXME: Fast and loose ... don't bzero fftin, just assume its only ever
-    // been used for bit_nsamples so the remainder is still zeroed.  Sketchy.
-    //
-    // unsigned int pa_nchannels = 1;	// FIXME
-    // bzero(fskp->fftin, (fskp->fftsize * sizeof(float) * pa_nchannels));
+    float mag_mark, mag_space;
+    if ( fsk_track_mags(fskp, samples, bit_nsamples, &mag_mark, &mag_space) )
+	goto decide;
 
-    memcpy(fskp->fftin, samples, bit_nsamples * sizeof(float));
+    float *fftin = fsk_fftin_load(fskp, samples, bit_nsamples);
+    fftwf_complex *fftout = fsk_scratch_get(FSK_SCRATCH_FFTOUT,
+				fskp->nbands * sizeof(fftwf_complex));
 
     float magscalar = 2.0f / (float)bit_nsamples;
 
@@ -149,14 +328,15 @@ fsk_bit_analyze( fsk_plan *fskp, float *samples, unsigned int bit_nsamples,
 	unsigned int z = bit_nsamples /* not -1  ... explain */;
 	float w = a0
 		- a1 * cosf((2.0*M_PI*((float)i+zoff)) / z);
-	fskp->fftin[i] *= w;
+	fftin[i] *= w;
     }
 #endif
 
 
-    fftwf_execute(fskp->fftplan);
-    float mag_mark  = band_mag(fskp->fftout, fskp->b_mark,  magscalar);
-    float mag_space = band_mag(fskp->fftout, fskp->b_space, magscalar);
+    fftwf_execute_dft_r2c(fskp->fftplan, fftin, fftout);
+    mag_mark  = band_mag(fftout, fskp->b_mark,  magscalar);
+    mag_space = band_mag(fftout, fskp->b_space, magscalar);
+decide:
     // mark==1, space==0
     if ( mag_mark > mag_space ) {
 	*bit_outp = 1;
@@ -174,6 +354,81 @@ fsk_bit_analyze( fsk_plan *fskp, float *samples, unsigned int bit_nsamples,
 }
 
 
+/*
+ * Goertzel evaluation of just the mark and space bands.  The result is
+ * the same as band_mag() would find for b_mark and b_space in a
+ * (zero-padded) fftsize transform of these samples, but costs only two
+ * passes over the samples, so it is cheap enough to run for every bit
+ * while we are idle.
+ */
+static void
+fsk_tone_mags( fsk_plan *fskp, float *samples, unsigned int nsamples,
+	float *mag_mark_outp, float *mag_space_outp )
+{
+    if ( fsk_track_mags(fskp, samples, nsamples,
+				mag_mark_outp, mag_space_outp) )
+	return;
+
+    float coeff_mark  = 2.0f * cosf(2.0f * (float)M_PI
+				* fskp->b_mark / fskp->fftsize);
+    float coeff_space = 2.0f * cosf(2.0f * (float)M_PI
+				* fskp->b_space / fskp->fftsize);
+    float m1 = 0.0f, m2 = 0.0f;
+    float s1 = 0.0f, s2 = 0.0f;
+    unsigned int i;
+    for ( i=0; i<nsamples; i++ ) {
+	float m0 = samples[i] + coeff_mark * m1 - m2;
+	m2 = m1; m1 = m0;
+	float s0 = samples[i] + coeff_space * s1 - s2;
+	s2 = s1; s1 = s0;
+    }
+    float magscalar = 2.0f / (float)nsamples;
+    float pm = m1*m1 + m2*m2 - coeff_mark  * m1 * m2;
+    float ps = s1*s1 + s2*s2 - coeff_space * s1 * s2;
+    *mag_mark_outp  = sqrtf(pm > 0.0f ? pm : 0.0f) * magscalar;
+    *mag_space_outp = sqrtf(ps > 0.0f ? ps : 0.0f) * magscalar;
+}
+
+
+/*
+ * A sliding DFT of the mark and space bins: from one window to the next,
+ * drop the first sample, add the next one, and rotate.  It runs in double
+ * precision, from an exact start, so that its drift over one call stays
+ * far below the float rounding of the other ways of measuring the same.
+ */
+void
+fsk_tone_track( fsk_plan *fskp, const float *samples, size_t npos,
+	unsigned int window_nsamples, float *mags )
+{
+    unsigned int bands[2] = { fskp->b_mark, fskp->b_space };
+    float magscalar = 2.0f / (float)window_nsamples;
+    unsigned int t, n;
+    size_t i;
+
+    for ( t=0; t<2; t++ ) {
+	double w = 2 * M_PI * bands[t] / fskp->fftsize;
+	double rot_re = cos(w), rot_im = sin(w);	// e^(jw)
+	double in_re = cos(w * window_nsamples);	// e^(-jwL)
+	double in_im = -sin(w * window_nsamples);
+	double x_re = 0.0, x_im = 0.0;
+	for ( n=0; n<window_nsamples; n++ ) {
+	    x_re += samples[n] * cos(w * n);
+	    x_im -= samples[n] * sin(w * n);
+	}
+	for ( i=0; i<npos; i++ ) {
+	    mags[2 * i + t] = (float)hypot(x_re, x_im) * magscalar;
+	    if ( i + 1 == npos )
+		break;
+	    double a_re = x_re - samples[i]
+				+ samples[i + window_nsamples] * in_re;
+	    double a_im = x_im + samples[i + window_nsamples] * in_im;
+	    x_re = a_re * rot_re - a_im * rot_im;
+	    x_im = a_re * rot_im + a_im * rot_re;
+	}
+    }
+}
+
+
 /* returns confidence value [0.0 to INFINITY] */
 static float
 fsk_frame_analyze( fsk_plan *fskp, float *samples, float samples_per_bit,
@@ -445,6 +700,67 @@ fsk_frame_analyze( fsk_plan *fskp, float *samples, float samples_per_bit,
     return confidence;
 }
 
+/*
+ * Hard-decision prefilter for frame candidates.
+ *
+ * Make a cheap hard decision (mark louder than space, or vice versa) for
+ * each of the "required" (1/0) expect_bits, in turn, and give up on the
+ * frame at the first one which is the wrong tone.  This rejects most
+ * wrong frame offsets, and most noise, without the per-bit FFTs of
+ * fsk_frame_analyze(), and mostly after a bit or two.
+ *
+ * A bit only counts as a mismatch if the wrong tone is decisively louder
+ * (by FSK_PREFILTER_MARGIN), so that we never reject a frame which
+ * fsk_frame_analyze() would have accepted.
+ *
+ * The decisions are kept, by where the bit starts, for the rest of the
+ * fsk_find_frame() search: the frame offsets it tries are a step apart,
+ * so many of them share bit boundaries, and the decisions there are made
+ * only once.
+ */
+#define FSK_PREFILTER_MARGIN	1.05f
+#define FSK_PREFILTER_CACHE	256	// decisions kept (direct-mapped)
+
+struct fsk_prefilter_cache {
+	int		pos[FSK_PREFILTER_CACHE];	// bit start, or -1
+	signed char	heard[FSK_PREFILTER_CACHE];	// 1 mark, -1 space, 0
+};
+
+/* returns non-zero if the frame at samples+t is worth analyzing */
+static int
+fsk_frame_prefilter( fsk_plan *fskp, float *samples, unsigned int t,
+	float samples_per_bit,
+	unsigned long long expect_ones_mask,
+	unsigned long long expect_zeros_mask,
+	struct fsk_prefilter_cache *cache )
+{
+    unsigned int bit_nsamples = (float)(samples_per_bit + 0.5f);
+    unsigned long long required = expect_ones_mask | expect_zeros_mask;
+    int bitnum;
+
+    for ( bitnum=0; required>>bitnum; bitnum++ ) {
+	if ( ! ((required >> bitnum) & 1) )
+	    continue;
+	int pos = t + (unsigned int)(float)(samples_per_bit * bitnum + 0.5f);
+	unsigned int slot = pos % FSK_PREFILTER_CACHE;
+	if ( cache->pos[slot] != pos ) {
+	    float mag_mark, mag_space;
+	    fsk_tone_mags(fskp, samples+pos, bit_nsamples,
+		    &mag_mark, &mag_space);
+	    cache->pos[slot] = pos;
+	    cache->heard[slot] =
+		mag_mark > mag_space * FSK_PREFILTER_MARGIN ? 1
+		: mag_space > mag_mark * FSK_PREFILTER_MARGIN ? -1 : 0;
+	}
+	int heard = cache->heard[slot];
+	if ( heard == 1 && ((expect_zeros_mask >> bitnum) & 1) )
+	    return 0;
+	if ( heard == -1 && ((expect_ones_mask >> bitnum) & 1) )
+	    return 0;
+    }
+    return 1;
+}
+
 /* returns confidence value [0.0 to 1.0] */
 float
 fsk_find_frame( fsk_plan *fskp, float *samples, unsigned int frame_nsamples,
@@ -462,6 +778,20 @@ fsk_find_frame( fsk_plan *fskp, float *samples, unsigned int frame_nsamples,
 
     float samples_per_bit = (float)frame_nsamples / expect_n_bits;
 
+    // bitmasks of the required (1/0) expect_bits, for the prefilter
+    unsigned long long expect_ones_mask = 0, expect_zeros_mask = 0;
+    int bitnum;
+    assert( expect_n_bits <= 64 );
+    for ( bitnum=0; bitnum<expect_n_bits; bitnum++ ) {
+	if ( expect_bits_string[bitnum] == '1' )
+	    expect_ones_mask |= 1ULL << bitnum;
+	else if ( expect_bits_string[bitnum] == '0' )
+	    expect_zeros_mask |= 1ULL << bitnum;
+    }
+
+    struct fsk_prefilter_cache prefilter_cache;
+    memset(prefilter_cache.pos, 0xff, sizeof(prefilter_cache.pos));
+
     // try_step_nsamples = 1;	// pedantic TEST
 
     unsigned int best_t = 0;
@@ -481,6 +811,14 @@ fsk_find_frame( fsk_plan *fskp, float *samples, unsigned int frame_nsamples,
 	if ( t < 0 )
 	    continue;
 
+	if ( !fskp->no_prefilter
+		&& !fsk_frame_prefilter(fskp, samples, t, samples_per_bit,
+				expect_ones_mask, expect_zeros_mask,
+				&prefilter_cache) ) {
+	    debug_log("try fsk_frame_prefilter at t=%d: rejected\n", t);
+	    continue;
+	}
+
 	float c, ampl_out = 0.0;
 	unsigned long long bits_out = 0;
 	debug_log("try fsk_frame_analyze at t=%d\n", t);
@@ -535,6 +873,73 @@ fsk_find_frame( fsk_plan *fskp, float *samples, unsigned int frame_nsamples,
     return confidence;
 }
 
+/*
+ * Look for a known leader or preamble: a run of at least min_nbits bits
+ * matching the (repeating) preamble_bits_string pattern, e.g. "1" for a
+ * steady mark tone, "10" for alternating bits, or "11010101" for a repeated
+ * SAME 0xAB sync byte.  Each bit is a cheap hard decision (the louder of the
+ * mark and space tones, by at least min_bit_snr).  Since we don't know the
+ * bit timing yet, two interleaved bit streams are examined, stepping
+ * half a bit at a time, and any rotation of the pattern may match.
+ *
+ * returns the sample offset where the preamble begins, or -1
+ */
+int
+fsk_detect_preamble( fsk_plan *fskp, float *samples, unsigned int nsamples,
+	float samples_per_bit,
+	const char *preamble_bits_string,
+	unsigned int min_nbits,
+	float min_bit_snr )
+{
+    unsigned int pattern_len = strlen(preamble_bits_string);
+    unsigned int bit_nsamples = samples_per_bit + 0.5f;
+    float step_nsamples = samples_per_bit / 2.0f;
+
+    assert( pattern_len > 0 && pattern_len <= 64 );
+    assert( min_nbits > 0 );
+
+    unsigned int run[2][64];
+    memset(run, 0, sizeof(run));
+
+    unsigned int i;
+    for ( i=0; ; i++ ) {
+	unsigned int t = step_nsamples * i + 0.5f;
+	if ( t + bit_nsamples > nsamples )
+	    break;
+
+	float mag_mark, mag_space;
+	fsk_tone_mags(fskp, samples+t, bit_nsamples, &mag_mark, &mag_space);
+
+	char bit;
+	if ( mag_mark > mag_space * min_bit_snr )
+	    bit = '1';
+	else if ( mag_space > mag_mark * min_bit_snr )
+	    bit = '0';
+	else
+	    bit = '?';
+
+	unsigned int phase = i % 2;
+	unsigned int bitnum = i / 2;
+	unsigned int r;
+	for ( r=0; r<pattern_len; r++ ) {
+	    if ( bit != preamble_bits_string[(bitnum + r) % pattern_len] ) {
+		run[phase][r] = 0;
+		continue;
+	    }
+	    if ( ++run[phase][r] >= min_nbits ) {
+		unsigned int first = i - 2 * (min_nbits - 1);
+		debug_log("### PREAMBLE '%s' at t=%u\n",
+			preamble_bits_string,
+			(unsigned int)(step_nsamples * first + 0.5f));
+		return step_nsamples * first + 0.5f;
+	    }
+	}
+    }
+
+    return -1;
+}
+
+
 // #define FSK_AUTODETECT_MIN_FREQ		600
 // #define FSK_AUTODETECT_MAX_FREQ		5000
 
@@ -544,10 +949,10 @@ fsk_detect_carrier(fsk_plan *fskp, float *samples, unsigned int nsamples,
 {
     assert( nsamples <= fskp->fftsize );
 
-    unsigned int pa_nchannels = 1;	// FIXME
-    bzero(fskp->fftin, (fskp->fftsize * sizeof(float) * pa_nchannels));
-    memcpy(fskp->fftin, samples, nsamples * sizeof(float));
-    fftwf_execute(fskp->fftplan);
+    float *fftin = fsk_fftin_load(fskp, samples, nsamples);
+    fftwf_complex *fftout = fsk_scratch_get(FSK_SCRATCH_FFTOUT,
+				fskp->nbands * sizeof(fftwf_complex));
+    fftwf_execute_dft_r2c(fskp->fftplan, fftin, fftout);
     float magscalar = 1.0f / ((float)nsamples/2.0f);
     float max_mag = 0.0;
     int max_mag_band = -1;
@@ -564,7 +969,7 @@ fsk_detect_carrier(fsk_plan *fskp, float *samples, unsigned int nsamples,
 	 nbands = fskp->nbands:
 #endif
     for ( ; i<nbands; i++ ) {
-	float mag = band_mag(fskp->fftout, i,  magscalar);
+	float mag = band_mag(fftout, i,  magscalar);
 	if ( mag < min_mag_threshold )
 	    continue;
 	if ( max_mag < mag ) {
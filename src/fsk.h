@@ -39,10 +39,20 @@ struct fsk_plan {
 	float		band_width;
 	unsigned int	b_mark;
 	unsigned int	b_space;
-	fftwf_plan	fftplan;
-	float		*fftin;
-	fftwf_complex	*fftout;
+	fftwf_plan	fftplan;	// shared, see fsk_fft_plan_get()
 #endif
+
+	/* a precomputed tone track (see fsk_tone_track()), or NULL; the
+	 * samples passed in are at stream position track_base_pos from
+	 * track_base on */
+	const float	*track;		// [track_nsamples][2]: mark, space
+	unsigned long long track_nsamples;
+	unsigned int	track_window;
+	int		track_swap;	// (the other polarity)
+	const float	*track_base;
+	unsigned long long track_base_pos;
+
+	int		no_prefilter;	// (debug: analyze every frame position)
 };
 
 
@@ -57,6 +67,43 @@ fsk_plan_new(
 void
 fsk_plan_destroy( fsk_plan *fskp );
 
+/* serializes FFTW plan creation and destruction across threads */
+void
+fsk_fftw_planner_lock();
+
+void
+fsk_fftw_planner_unlock();
+
+/*
+ * FFTW plans are read-only once made, so one plan is shared by every
+ * fsk_plan (and sync correlator) with the same FFT size; execute them
+ * only with fftwf_execute_dft_r2c/_c2r() on fsk_scratch_get() arrays.
+ */
+fftwf_plan
+fsk_fft_plan_get( int fftsize, int inverse );
+
+void
+fsk_fft_plan_put( fftwf_plan plan );
+
+/*
+ * Per-thread FFT work arrays, shared by all of the channels a thread
+ * runs.  The contents are only valid until the next call for the same
+ * slot with a larger nbytes.
+ */
+enum {
+	FSK_SCRATCH_FFTIN,
+	FSK_SCRATCH_FFTOUT,
+	FSK_SCRATCH_SYNC_FFTIN,
+	FSK_SCRATCH_SYNC_FFTOUT,
+	FSK_SCRATCH_SYNC_PRODUCT,
+	FSK_SCRATCH_SYNC_CORR_COS,
+	FSK_SCRATCH_SYNC_CORR_SIN,
+	FSK_SCRATCH_NSLOTS
+};
+
+void *
+fsk_scratch_get( unsigned int slot, size_t nbytes );
+
 /* returns confidence value [0.0 to 1.0] */
 float
 fsk_find_frame( fsk_plan *fskp, float *samples, unsigned int frame_nsamples,
@@ -74,9 +121,61 @@ int
 fsk_detect_carrier(fsk_plan *fskp, float *samples, unsigned int nsamples,
 	float min_mag_threshold );
 
+/* returns the sample offset where the preamble begins, or -1 */
+int
+fsk_detect_preamble( fsk_plan *fskp, float *samples, unsigned int nsamples,
+	float samples_per_bit,
+	const char *preamble_bits_string,
+	unsigned int min_nbits,
+	float min_bit_snr );
+
 void
 fsk_set_tones_by_bandshift( fsk_plan *fskp, unsigned int b_mark, int b_shift );
 
+/*
+ * The mark and space magnitudes, as fsk_find_frame() measures them, of
+ * the window_nsamples samples from each of the npos positions of samples
+ * (which holds npos + window_nsamples - 1 samples, zero-padded past the
+ * end of the stream), into mags[2*i] and mags[2*i+1].
+ */
+void
+fsk_tone_track( fsk_plan *fskp, const float *samples, size_t npos,
+	unsigned int window_nsamples, float *mags );
+
+
+/*
+ * FFT-based sync word correlator (fsk_sync.c)
+ */
+
+typedef struct fsk_sync_correlator fsk_sync_correlator;
+
+fsk_sync_correlator *
+fsk_sync_correlator_new( fsk_plan *fskp, float samples_per_bit,
+	const char *sync_bits_string,
+	unsigned int nrepeat,
+	float repeat_nsamples,
+	unsigned int max_nsamples );
+
+void
+fsk_sync_correlator_destroy( fsk_sync_correlator *fscp );
+
+unsigned int
+fsk_sync_span_nsamples( fsk_sync_correlator *fscp );
+
+/* bytes of per-correlator (unshared) state */
+size_t
+fsk_sync_correlator_footprint( fsk_sync_correlator *fscp );
+
+/* returns the number of sync sequences found */
+unsigned int
+fsk_sync_correlate( fsk_sync_correlator *fscp,
+	float *samples, unsigned int nsamples,
+	float min_score,
+	unsigned int *sync_starts_outp,
+	float *sync_scores_outp,
+	unsigned int max_nsyncs,
+	unsigned int *scanned_nsamples_outp );
+
 
 // FIXME move this?:
 // #define FSK_DEBUG
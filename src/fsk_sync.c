@@ -0,0 +1,428 @@
+/*
+ * fsk_sync.c
+ *
+ * Copyright (C) 2011-2016 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <stdio.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "fsk.h"
+
+
+/*
+ * FFT-based sync word correlator
+ *
+ * When the sync sequence is known ahead of time (e.g. the 16 x 0xAB
+ * preamble of SAME, or the fixed UIC preamble), we can find every place
+ * it occurs in a large block of samples in one pass, by cross-correlating
+ * the block against a synthesized continuous-phase FSK template of the
+ * sync bits (overlap-save fast convolution), instead of sliding
+ * fsk_find_frame() along the block bit by bit.
+ *
+ * The template is correlated in quadrature (cos and sin), so the unknown
+ * carrier phase doesn't matter.  A sync sequence made of nrepeat copies
+ * of the same frame is scored non-coherently: the per-frame correlation
+ * magnitudes are summed, so a slight tone or rate offset over a long
+ * preamble doesn't destroy the match.  Scores are normalized by the
+ * signal energy, to the range [0.0 to 1.0].
+ */
+
+/*
+ * The template spectra (and the FFTW plans) are read-only, so they are
+ * shared by all of the correlators with the same parameters.
+ */
+struct fsk_sync_template {
+	struct fsk_sync_template *next;
+	unsigned int	refcount;
+
+	/* key */
+	float		sample_rate;
+	float		f_mark;
+	float		f_space;
+	float		samples_per_bit;
+	char		*sync_bits_string;
+
+	unsigned int	template_nsamples;	// one sync frame
+	float		template_energy;
+	int		fftsize;
+	fftwf_plan	fwd_plan;
+	fftwf_plan	inv_plan;
+	fftwf_complex	*tmpl_cos;	// conj spectra of the template
+	fftwf_complex	*tmpl_sin;
+};
+
+struct fsk_sync_correlator {
+	struct fsk_sync_template *tp;
+	unsigned int	template_nsamples;	// (tp->template_nsamples)
+	unsigned int	nrepeat;
+	float		repeat_nsamples;
+	unsigned int	span_nsamples;		// the whole sync sequence
+	unsigned int	max_nsamples;
+
+	float		*corr_mag;	// [max_nsamples]
+	double		*energy;	// [max_nsamples+1] running sum of x^2
+};
+
+static pthread_mutex_t sync_templates_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct fsk_sync_template *sync_templates;
+
+static void
+sync_template_free( struct fsk_sync_template *tp )
+{
+    if ( tp->fwd_plan )
+	fsk_fft_plan_put(tp->fwd_plan);
+    if ( tp->inv_plan )
+	fsk_fft_plan_put(tp->inv_plan);
+    fftwf_free(tp->tmpl_cos);
+    fftwf_free(tp->tmpl_sin);
+    free(tp->sync_bits_string);
+    free(tp);
+}
+
+static struct fsk_sync_template *
+sync_template_new( fsk_plan *fskp, float samples_per_bit,
+	const char *sync_bits_string )
+{
+    unsigned int n_bits = strlen(sync_bits_string);
+
+    struct fsk_sync_template *tp = calloc(1, sizeof(*tp));
+    if ( !tp )
+	return NULL;
+
+    tp->sample_rate = fskp->sample_rate;
+    tp->f_mark = fskp->f_mark;
+    tp->f_space = fskp->f_space;
+    tp->samples_per_bit = samples_per_bit;
+    tp->sync_bits_string = strdup(sync_bits_string);
+
+    tp->template_nsamples = samples_per_bit * n_bits + 0.5f;
+
+    // FFT block size: a power of two, comfortably larger than the template
+    tp->fftsize = 4096;
+    while ( tp->fftsize < tp->template_nsamples * 4 )
+	tp->fftsize *= 2;
+    unsigned int nbands = tp->fftsize / 2 + 1;
+
+    tp->tmpl_cos = fftwf_malloc(nbands * sizeof(fftwf_complex));
+    tp->tmpl_sin = fftwf_malloc(nbands * sizeof(fftwf_complex));
+    if ( !tp->sync_bits_string || !tp->tmpl_cos || !tp->tmpl_sin ) {
+	sync_template_free(tp);
+	errno = ENOMEM;
+	return NULL;
+    }
+
+    tp->fwd_plan = fsk_fft_plan_get(tp->fftsize, /*inverse*/0);
+    tp->inv_plan = fsk_fft_plan_get(tp->fftsize, /*inverse*/1);
+    if ( !tp->fwd_plan || !tp->inv_plan ) {
+	fprintf(stderr, "fsk_sync_correlator_new: fftw plan failed\n");
+	sync_template_free(tp);
+	errno = EINVAL;
+	return NULL;
+    }
+
+    float *fftin = fsk_scratch_get(FSK_SCRATCH_SYNC_FFTIN,
+				tp->fftsize * sizeof(float));
+    fftwf_complex *fftout = fsk_scratch_get(FSK_SCRATCH_SYNC_FFTOUT,
+				nbands * sizeof(fftwf_complex));
+
+    /*
+     * Synthesize the continuous-phase template, in quadrature, and keep
+     * the conjugate of its spectra (correlation == convolution with the
+     * time-reversed template).
+     */
+    int quadrature;
+    for ( quadrature=0; quadrature<2; quadrature++ ) {
+	fftwf_complex *tmpl = quadrature ? tp->tmpl_sin : tp->tmpl_cos;
+	float phase = 0.0f, energy = 0.0f;
+	unsigned int i;
+	memset(fftin, 0, tp->fftsize * sizeof(float));
+	for ( i=0; i<tp->template_nsamples; i++ ) {
+	    unsigned int bitnum = i / samples_per_bit;
+	    if ( bitnum >= n_bits )
+		bitnum = n_bits - 1;
+	    float f = sync_bits_string[bitnum] == '1'
+				? fskp->f_mark : fskp->f_space;
+	    float v = quadrature ? sinf(phase) : cosf(phase);
+	    fftin[i] = v;
+	    energy += v * v;
+	    phase = fmodf(phase + 2.0f * (float)M_PI * f / fskp->sample_rate,
+			    2.0f * (float)M_PI);
+	}
+	fftwf_execute_dft_r2c(tp->fwd_plan, fftin, fftout);
+	unsigned int b;
+	for ( b=0; b<nbands; b++ ) {
+	    tmpl[b][0] =  fftout[b][0];
+	    tmpl[b][1] = -fftout[b][1];
+	}
+	tp->template_energy += energy / 2.0f;
+    }
+
+    return tp;
+}
+
+static struct fsk_sync_template *
+sync_template_get( fsk_plan *fskp, float samples_per_bit,
+	const char *sync_bits_string )
+{
+    struct fsk_sync_template *tp;
+    pthread_mutex_lock(&sync_templates_mutex);
+    for ( tp=sync_templates; tp; tp=tp->next )
+	if ( tp->sample_rate == fskp->sample_rate
+		&& tp->f_mark == fskp->f_mark
+		&& tp->f_space == fskp->f_space
+		&& tp->samples_per_bit == samples_per_bit
+		&& strcmp(tp->sync_bits_string, sync_bits_string) == 0 )
+	    break;
+    if ( !tp ) {
+	tp = sync_template_new(fskp, samples_per_bit, sync_bits_string);
+	if ( tp ) {
+	    tp->next = sync_templates;
+	    sync_templates = tp;
+	}
+    }
+    if ( tp )
+	tp->refcount++;
+    pthread_mutex_unlock(&sync_templates_mutex);
+    return tp;
+}
+
+static void
+sync_template_put( struct fsk_sync_template *tp )
+{
+    struct fsk_sync_template **tpp;
+    pthread_mutex_lock(&sync_templates_mutex);
+    if ( --tp->refcount == 0 ) {
+	for ( tpp=&sync_templates; *tpp!=tp; tpp=&(*tpp)->next )
+	    ;
+	*tpp = tp->next;
+	sync_template_free(tp);
+    }
+    pthread_mutex_unlock(&sync_templates_mutex);
+}
+
+
+fsk_sync_correlator *
+fsk_sync_correlator_new( fsk_plan *fskp, float samples_per_bit,
+	const char *sync_bits_string,
+	unsigned int nrepeat,
+	float repeat_nsamples,
+	unsigned int max_nsamples )
+{
+    unsigned int n_bits = strlen(sync_bits_string);
+    assert( n_bits > 0 );
+    assert( nrepeat > 0 );
+
+    fsk_sync_correlator *fscp = calloc(1, sizeof(fsk_sync_correlator));
+    if ( !fscp )
+	return NULL;
+
+    fscp->tp = sync_template_get(fskp, samples_per_bit, sync_bits_string);
+    if ( !fscp->tp ) {
+	fsk_sync_correlator_destroy(fscp);
+	return NULL;
+    }
+
+    fscp->template_nsamples = fscp->tp->template_nsamples;
+    fscp->nrepeat = nrepeat;
+    fscp->repeat_nsamples = repeat_nsamples;
+    fscp->span_nsamples = repeat_nsamples * (nrepeat - 1) + 0.5f
+				+ fscp->template_nsamples;
+    fscp->max_nsamples = max_nsamples;
+
+    fscp->corr_mag = malloc(max_nsamples * sizeof(float));
+    fscp->energy   = malloc((max_nsamples + 1) * sizeof(double));
+    if ( !fscp->corr_mag || !fscp->energy ) {
+	fsk_sync_correlator_destroy(fscp);
+	errno = ENOMEM;
+	return NULL;
+    }
+
+    debug_log("sync correlator: template=%u nrepeat=%u span=%u fftsize=%d\n",
+	    fscp->template_nsamples, nrepeat, fscp->span_nsamples,
+	    fscp->tp->fftsize);
+
+    return fscp;
+}
+
+void
+fsk_sync_correlator_destroy( fsk_sync_correlator *fscp )
+{
+    if ( fscp->tp )
+	sync_template_put(fscp->tp);
+    free(fscp->corr_mag);
+    free(fscp->energy);
+    free(fscp);
+}
+
+size_t
+fsk_sync_correlator_footprint( fsk_sync_correlator *fscp )
+{
+    return sizeof(*fscp) + fscp->max_nsamples * sizeof(float)
+		+ (fscp->max_nsamples + 1) * sizeof(double);
+}
+
+unsigned int
+fsk_sync_span_nsamples( fsk_sync_correlator *fscp )
+{
+    return fscp->span_nsamples;
+}
+
+static void
+correlate_product( struct fsk_sync_template *tp, fftwf_complex *fftout,
+	fftwf_complex *tmpl, fftwf_complex *product, float *corr_outp )
+{
+    unsigned int nbands = tp->fftsize / 2 + 1;
+    unsigned int b;
+    for ( b=0; b<nbands; b++ ) {
+	float re = fftout[b][0], im = fftout[b][1];
+	product[b][0] = re * tmpl[b][0] - im * tmpl[b][1];
+	product[b][1] = re * tmpl[b][1] + im * tmpl[b][0];
+    }
+    fftwf_execute_dft_c2r(tp->inv_plan, product, corr_outp);
+}
+
+static float
+sync_score( fsk_sync_correlator *fscp, unsigned int t )
+{
+    float mag = 0.0f;
+    double energy = 0.0;
+    unsigned int k;
+    for ( k=0; k<fscp->nrepeat; k++ ) {
+	unsigned int tk = t + (unsigned int)(fscp->repeat_nsamples * k + 0.5f);
+	mag += fscp->corr_mag[tk];
+	energy += sqrt((fscp->energy[tk + fscp->template_nsamples]
+			- fscp->energy[tk]) * fscp->tp->template_energy);
+    }
+    if ( energy <= 0.0 )
+	return 0.0f;
+    return mag / energy;
+}
+
+/*
+ * Scans for sync sequences beginning at samples[0] through
+ * samples[nsamples-span], and reports the start of each one found with
+ * a score >= min_score (up to max_nsyncs of them).
+ *
+ * *scanned_nsamples_outp is set to the number of start positions which
+ * were completely examined; the caller may skip past those.
+ *
+ * returns the number of sync sequences found
+ */
+unsigned int
+fsk_sync_correlate( fsk_sync_correlator *fscp,
+	float *samples, unsigned int nsamples,
+	float min_score,
+	unsigned int *sync_starts_outp,
+	float *sync_scores_outp,
+	unsigned int max_nsyncs,
+	unsigned int *scanned_nsamples_outp )
+{
+    *scanned_nsamples_outp = 0;
+    if ( nsamples > fscp->max_nsamples )
+	nsamples = fscp->max_nsamples;
+    if ( nsamples < fscp->span_nsamples )
+	return 0;
+
+    unsigned int i;
+    fscp->energy[0] = 0.0;
+    for ( i=0; i<nsamples; i++ )
+	fscp->energy[i+1] = fscp->energy[i] + samples[i] * samples[i];
+
+    /*
+     * Overlap-save: each fftsize block yields correlation values for
+     * (fftsize - template_nsamples + 1) lags.
+     */
+    struct fsk_sync_template *tp = fscp->tp;
+    int fftsize = tp->fftsize;
+    unsigned int nbands = fftsize / 2 + 1;
+    float *fftin = fsk_scratch_get(FSK_SCRATCH_SYNC_FFTIN,
+				fftsize * sizeof(float));
+    fftwf_complex *fftout = fsk_scratch_get(FSK_SCRATCH_SYNC_FFTOUT,
+				nbands * sizeof(fftwf_complex));
+    fftwf_complex *product = fsk_scratch_get(FSK_SCRATCH_SYNC_PRODUCT,
+				nbands * sizeof(fftwf_complex));
+    float *corr_cos = fsk_scratch_get(FSK_SCRATCH_SYNC_CORR_COS,
+				fftsize * sizeof(float));
+    float *corr_sin = fsk_scratch_get(FSK_SCRATCH_SYNC_CORR_SIN,
+				fftsize * sizeof(float));
+
+    unsigned int n_lags = nsamples - fscp->template_nsamples + 1;
+    unsigned int block_nlags = fftsize - fscp->template_nsamples + 1;
+    float scale = 1.0f / fftsize;
+    unsigned int c;
+    for ( c=0; c<n_lags; c+=block_nlags ) {
+	unsigned int n = nsamples - c;
+	if ( n > fftsize )
+	    n = fftsize;
+	memcpy(fftin, samples + c, n * sizeof(float));
+	if ( n < fftsize )
+	    memset(fftin + n, 0, (fftsize - n) * sizeof(float));
+	fftwf_execute_dft_r2c(tp->fwd_plan, fftin, fftout);
+
+	correlate_product(tp, fftout, tp->tmpl_cos, product, corr_cos);
+	correlate_product(tp, fftout, tp->tmpl_sin, product, corr_sin);
+
+	unsigned int lag;
+	for ( lag=0; lag<block_nlags && c+lag<n_lags; lag++ )
+	    fscp->corr_mag[c+lag] = hypotf(corr_cos[lag],
+					corr_sin[lag]) * scale;
+    }
+
+    /*
+     * Pick peaks.  The score ramps up as more of the repeated frames
+     * line up (e.g. 15/16ths of the peak one frame early), so once the
+     * threshold is crossed, take the best score over the following
+     * span, then skip past the whole sync sequence.
+     */
+    unsigned int last_t = nsamples - fscp->span_nsamples;
+    unsigned int nsyncs = 0;
+    unsigned int t = 0;
+    while ( t <= last_t && nsyncs < max_nsyncs ) {
+	float score = sync_score(fscp, t);
+	if ( score < min_score ) {
+	    t++;
+	    continue;
+	}
+	if ( t + fscp->span_nsamples > last_t ) {
+	    // can't see the whole peak yet; rescan from here next time
+	    break;
+	}
+	unsigned int best_t = t, u;
+	float best_score = score;
+	for ( u=t+1; u<t+fscp->span_nsamples; u++ ) {
+	    float s = sync_score(fscp, u);
+	    if ( best_score < s ) {
+		best_score = s;
+		best_t = u;
+	    }
+	}
+	debug_log("### SYNC t=%u score=%.3f\n", best_t, best_score);
+	sync_starts_outp[nsyncs] = best_t;
+	sync_scores_outp[nsyncs] = best_score;
+	nsyncs++;
+	t = best_t + fscp->span_nsamples;
+    }
+
+    *scanned_nsamples_outp = t;
+    return nsyncs;
+}
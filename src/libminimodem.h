@@ -0,0 +1,418 @@
+/*
+ * libminimodem.h
+ *
+ * Copyright (C) 2011-2016 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * libminimodem: the minimodem receiver and transmitter, as reentrant
+ * context objects.  Each minimodem_rx or minimodem_tx keeps all of its
+ * own state, so any number of them may run at once, each on its own
+ * thread.  (A single context must not be used by two threads at once.)
+ */
+
+#ifndef LIBMINIMODEM_H
+#define LIBMINIMODEM_H
+
+#include <stddef.h>
+
+#include "simpleaudio.h"
+#include "databits.h"
+
+
+/*
+ * Modem configuration
+ *
+ * minimodem_config_init() fills in the defaults, leaving the tones,
+ * bandwidth and framing "unset" (0, or -1 where 0 is meaningful).
+ * Set any of those explicitly, then apply a {baudmode} with
+ * minimodem_config_set_baudmode(), then call minimodem_config_finish()
+ * to fill in everything still unset.
+ *
+ * The strings are copied by minimodem_rx_new(), not referenced.
+ */
+typedef struct minimodem_config {
+	unsigned int	sample_rate;
+	float		bfsk_data_rate;
+	float		bfsk_mark_f;
+	float		bfsk_space_f;
+	float		band_width;
+	unsigned int	bfsk_inverted_freqs;
+	int		bfsk_nstartbits;	// -1: unset
+	float		bfsk_nstopbits;		// -1: unset
+	unsigned int	bfsk_n_data_bits;
+	int		bfsk_msb_first;
+	int		invert_start_stop;
+	unsigned int	bfsk_do_rx_sync;
+	unsigned int	bfsk_do_tx_sync_bytes;
+	unsigned long long bfsk_sync_byte;
+	const char	*expect_data_string;	// fixed frame pattern, or NULL
+	int		autodetect_shift;
+	databits_encoder *bfsk_databits_encode;
+	databits_decoder *bfsk_databits_decode;
+
+	/* receive */
+	float		carrier_autodetect_threshold;	// 0: off
+	float		fsk_confidence_threshold;	// squelch
+	float		fsk_confidence_search_limit;	// performance vs. quality
+	int		adaptive_search;	// adapt the search per carrier
+	int		shed_load;		// shed work as the backlog grows
+	float		shed_load_deadline_ms;	//   (0: the capture buffer size)
+	unsigned int	rx_one;			// stop after the first carrier
+	int		preamble_detect;	// look for a leader while idle
+	const char	*preamble_bits_string;	//   (NULL: from the framing)
+	unsigned int	preamble_min_nbits;
+	float		preamble_min_snr;	//   per-bit tone ratio
+	int		no_prefilter;		// (debug: --Xno-prefilter)
+	int		sync_correlate;		// correlate for the sync sequence
+	float		sync_min_score;		//   [0.0 to 1.0]
+	const char	*sync_bits_string;
+
+	/* transmit */
+	int		tx_leader_bits_len;
+	int		tx_trailer_bits_len;
+} minimodem_config;
+
+void
+minimodem_config_init( minimodem_config *cfg );
+
+/* returns 0, or -1 if the {baudmode} can't be used in this direction */
+int
+minimodem_config_set_baudmode( minimodem_config *cfg,
+	const char *baudmode, int tx_mode );
+
+void
+minimodem_config_finish( minimodem_config *cfg );
+
+
+/*
+ * Receiver
+ *
+ * Decoded data bytes are passed to the data callback.  Carrier changes
+ * (and load shedding changes) are passed to the event callback.
+ */
+
+typedef struct minimodem_rx minimodem_rx;
+
+typedef enum {
+	MINIMODEM_RX_CARRIER,
+	MINIMODEM_RX_NOCARRIER,
+	MINIMODEM_RX_LOADSHED,
+} minimodem_rx_event_type;
+
+typedef struct minimodem_rx_event {
+	minimodem_rx_event_type	type;
+
+	/* the stream position (in samples) of CARRIER: the first frame;
+	 * NOCARRIER: the end of the last frame; LOADSHED: the search */
+	unsigned long long sample;
+
+	/* CARRIER */
+	float		carrier_freq;		// the mark tone
+	float		space_freq;		// the space tone
+	unsigned long long search;		// the frame search which found it
+
+	/* NOCARRIER: averages over the whole carrier */
+	unsigned int	nframes_decoded;
+	float		confidence;
+	float		amplitude;
+	float		throughput_rate;	// bps
+	int		rate_perfect;
+	float		effort;			// -1 if !adaptive_search
+
+	/* LOADSHED */
+	unsigned int	load_shed_level;
+	float		backlog_ms;
+} minimodem_rx_event;
+
+typedef void (minimodem_rx_data_fn)( void *arg,
+	const char *data, unsigned int nbytes );
+
+/* The most recently decoded frame, see minimodem_rx_last_frame() */
+typedef struct minimodem_rx_frame {
+	unsigned long long offset;		// stream position, in samples
+	unsigned int	nsamples;
+	float		confidence;
+	float		amplitude;
+	unsigned long long bits;		// the data bits
+} minimodem_rx_frame;
+
+typedef void (minimodem_rx_event_fn)( void *arg,
+	const minimodem_rx_event *ev );
+
+minimodem_rx *
+minimodem_rx_new( const minimodem_config *cfg,
+	minimodem_rx_data_fn *data_fn,
+	minimodem_rx_event_fn *event_fn,
+	void *cb_arg );
+
+void
+minimodem_rx_destroy( minimodem_rx *rx );
+
+/*
+ * Have samples_fn see the samples the receiver takes in, before it
+ * decodes them: each block minimodem_rx_run() reads, or is given to
+ * minimodem_rx_push().  pos is the stream position of samples[0].
+ */
+typedef void (minimodem_rx_samples_fn)( void *arg, unsigned long long pos,
+	const float *samples, size_t nsamples );
+
+void
+minimodem_rx_set_samples_fn( minimodem_rx *rx,
+	minimodem_rx_samples_fn *samples_fn, void *arg );
+
+/*
+ * Receive from sa until the end of the stream, until the first carrier
+ * ends (rx_one), or until minimodem_rx_stop().  sa must deliver
+ * SA_SAMPLE_FORMAT_FLOAT mono samples at cfg->sample_rate.
+ * Returns 0, or -1 on a read error.
+ */
+int
+minimodem_rx_run( minimodem_rx *rx, simpleaudio *sa );
+
+/*
+ * Alternatively, push samples (mono, at cfg->sample_rate) into the
+ * receiver in blocks of any size, e.g. from an SDR or VoIP chain.  The
+ * callbacks are called from within minimodem_rx_push().  No memory is
+ * allocated per call.  Returns 1 once the receiver is done (rx_one, or
+ * minimodem_rx_stop()), after which further samples are ignored, else 0.
+ */
+int
+minimodem_rx_push( minimodem_rx *rx, const float *samples, size_t nsamples );
+
+/*
+ * At the end of a stream: decode whatever samples are still buffered,
+ * and end any carrier (NOCARRIER).  The receiver may then be reused for
+ * a new stream.  Returns as minimodem_rx_push().
+ */
+int
+minimodem_rx_flush( minimodem_rx *rx );
+
+/*
+ * The stream position (in samples) the next frame search starts at; all
+ * the samples before it have been decoded.  In a callback, a position
+ * from the start of the frame search which made it to the end of its
+ * frame.
+ */
+unsigned long long
+minimodem_rx_tell( const minimodem_rx *rx );
+
+/*
+ * The frame the receiver decoded last.  In a data callback, the frame
+ * whose data it is (a frame may produce no data, e.g. a Baudot shift).
+ */
+const minimodem_rx_frame *
+minimodem_rx_last_frame( const minimodem_rx *rx );
+
+/*
+ * Start the (new or flushed) receiver's stream at position pos instead of
+ * 0, e.g. to decode a stream in pieces: once idle (no carrier), a
+ * receiver searches for frames at the same stream positions however far
+ * back it started, so a piece starting in a quiet gap decodes as it
+ * would within the whole stream.
+ */
+void
+minimodem_rx_seek( minimodem_rx *rx, unsigned long long pos );
+
+/*
+ * If the receiver is idle (no carrier), sets *posp to its stream position
+ * and returns 1: then it carries nothing over to the frames ahead, so a
+ * new receiver minimodem_rx_seek()'d to *posp, and fed the stream from
+ * there, decodes just as this one goes on to (without --preamble,
+ * --sync-correlate, --auto-carrier or --rx-one, which look ahead, or
+ * stop, in ways which depend on where decoding began).  Otherwise, returns
+ * 0.
+ */
+int
+minimodem_rx_checkpoint( const minimodem_rx *rx, unsigned long long *posp );
+
+/*
+ * Start the (new or flushed) receiver's stream at position pos, the frame
+ * search which acquired a carrier with the mark and space tones given
+ * (all as its CARRIER event reported them), to pick that carrier up again
+ * with no carrier, preamble or sync detection first.  Unlike
+ * minimodem_rx_seek(), pos is searched as is, not moved onto the idle
+ * search positions.  Returns 0, or -1 (EINVAL) if the tones are out of
+ * the receiver's range.
+ */
+int
+minimodem_rx_resume( minimodem_rx *rx, unsigned long long pos,
+	float mark_f, float space_f );
+
+/*
+ * Spectral feature cache: the mark and space tone magnitudes which the
+ * receiver measures, for every sample position of a recording, in a
+ * memory-mapped file (8 bytes per sample).  A receiver decoding from it
+ * does no spectral work and needs no samples, so re-decoding a recording
+ * with other framing or threshold options is cheap.
+ *
+ * minimodem_rx_build_feature_cache() writes the cache of the whole
+ * stream sa for the receiver's sample rate, tones, bandwidth and baud
+ * rate to path, noting the size, inode and modification time of the
+ * recording file source that sa reads (if source is not NULL).  Returns
+ * 0, or -1 on an error (reported on stderr).
+ *
+ * minimodem_rx_open_feature_cache() maps the cache at path into the
+ * receiver.  Returns 0, or -1 with errno set: ESTALE if the cache was
+ * built for other parameters, or (if source is not NULL) from another
+ * recording than the file source now holds, EINVAL if the receiver's
+ * options (preamble detection, sync correlation, carrier autodetection)
+ * look at the samples in other ways.
+ *
+ * minimodem_rx_run_feature_cache() then decodes the whole recording, as
+ * minimodem_rx_run() would, from the cache alone.
+ */
+int
+minimodem_rx_build_feature_cache( minimodem_rx *rx, simpleaudio *sa,
+	const char *source, const char *path );
+
+int
+minimodem_rx_open_feature_cache( minimodem_rx *rx, const char *source,
+	const char *path );
+
+int
+minimodem_rx_run_feature_cache( minimodem_rx *rx );
+
+/*
+ * Or the same without a cache file: minimodem_features_new() computes the
+ * features of the whole stream sa for the receiver's parameters into an
+ * unlinked temporary file in $TMPDIR (or /tmp), mapped rather than held in
+ * memory, or returns NULL on an error, reported on stderr.  (That file
+ * takes 8 bytes per sample: about 1.4 GB per hour of 48 kHz input.)
+ * minimodem_rx_use_features() has a
+ * receiver use them, returning as minimodem_rx_open_feature_cache().
+ * Either cache also serves receivers of the other polarity (--inverted).
+ */
+typedef struct minimodem_features minimodem_features;
+
+minimodem_features *
+minimodem_features_new( minimodem_rx *rx, simpleaudio *sa );
+
+void
+minimodem_features_destroy( minimodem_features *f );
+
+int
+minimodem_rx_use_features( minimodem_rx *rx, const minimodem_features *f );
+
+/*
+ * The receiver's own (per-channel) memory, in bytes.  The FFTW plans and
+ * the sync correlation templates are shared by all receivers with the
+ * same parameters, and the FFT scratch arrays are per-thread, so neither
+ * is counted here.  At 48000 Hz, most of it is the sample buffer:
+ *   1200 or 300 baud:			 17 KB
+ *   rtty:				 75 KB
+ *   1200 baud, sync_correlate (16 sync bytes): 1.5 MB (correlation blocks)
+ */
+size_t
+minimodem_rx_footprint( const minimodem_rx *rx );
+
+/* async-signal-safe */
+void
+minimodem_rx_stop( minimodem_rx *rx );
+
+
+/*
+ * Wideband channelizer
+ *
+ * Finds the FSK pairs (of cfg's shift) in a wideband audio passband, e.g.
+ * several RTTY signals side by side, and decodes each one with its own
+ * receiver, built from cfg with its tones set to the pair's.  The tones
+ * cfg gives set only the shift and which tone is the mark.  When a pair
+ * is found, open_fn returns the callback arg for that sub-channel's data
+ * and event callbacks; close_fn (if not NULL) is called once it is gone
+ * again.  If open_fn returns NULL instead, the pair is skipped: it is
+ * not decoded, nor offered again until it has gone.  Push samples in blocks of any size, as minimodem_rx_push().
+ */
+
+typedef struct minimodem_channelizer minimodem_channelizer;
+
+typedef void *(minimodem_channel_open_fn)( void *arg,
+	unsigned int channel, float mark_f, float space_f );
+
+typedef void (minimodem_channel_close_fn)( void *arg, void *channel_arg );
+
+minimodem_channelizer *
+minimodem_channelizer_new( const minimodem_config *cfg,
+	unsigned int max_channels,
+	minimodem_channel_open_fn *open_fn,
+	minimodem_channel_close_fn *close_fn,
+	minimodem_rx_data_fn *data_fn,
+	minimodem_rx_event_fn *event_fn,
+	void *arg );
+
+/* closes (and flushes) every sub-channel first */
+void
+minimodem_channelizer_destroy( minimodem_channelizer *chz );
+
+void
+minimodem_channelizer_push( minimodem_channelizer *chz,
+	const float *samples, size_t nsamples );
+
+void
+minimodem_channelizer_flush( minimodem_channelizer *chz );
+
+
+/*
+ * Transmitter
+ */
+
+typedef struct minimodem_tx minimodem_tx;
+
+minimodem_tx *
+minimodem_tx_new( const minimodem_config *cfg, simpleaudio *sa_out );
+
+void
+minimodem_tx_destroy( minimodem_tx *tx );
+
+/* emits the leader and sync bytes first, if not already transmitting */
+void
+minimodem_tx_write( minimodem_tx *tx, const char *buf, size_t nbytes );
+
+/* emits idle (mark) tone */
+void
+minimodem_tx_idle( minimodem_tx *tx, size_t nsamples );
+
+/*
+ * emits the trailer, then flush_nsamples of silence
+ * (render context: ends the transmission once the queue drains)
+ */
+void
+minimodem_tx_stop( minimodem_tx *tx, size_t flush_nsamples );
+
+int
+minimodem_tx_transmitting( minimodem_tx *tx );
+
+/*
+ * Pull-style transmitter, e.g. for an audio callback: queue bytes with
+ * minimodem_tx_queue(), then have minimodem_tx_render() fill buffers of
+ * any size with mono float samples at cfg->sample_rate and amplitude
+ * mag.  Phase and framing continue across calls.  While the queue is
+ * empty the transmitter idles on the mark tone until minimodem_tx_stop()
+ * ends the transmission, then renders silence.  No memory is allocated
+ * after minimodem_tx_new_render().
+ */
+minimodem_tx *
+minimodem_tx_new_render( const minimodem_config *cfg,
+	size_t queue_size, float mag );
+
+/* returns the number of bytes queued (less than nbytes if full) */
+size_t
+minimodem_tx_queue( minimodem_tx *tx, const char *buf, size_t nbytes );
+
+void
+minimodem_tx_render( minimodem_tx *tx, float *samples, size_t nsamples );
+
+#endif
@@ -30,6 +30,7 @@
 #include <float.h>
 #include <assert.h>
 #include <signal.h>
+#include <errno.h>
 #include <sys/time.h>
 #include <sys/select.h>
 
@@ -40,99 +41,49 @@
 #endif
 
 #include "simpleaudio.h"
-#include "fsk.h"
-#include "databits.h"
+#include "libminimodem.h"
+#include "minimodem_daemon.h"
+#include "minimodem_channels.h"
+#include "minimodem_parallel.h"
+#include "minimodem_batch.h"
+#include "minimodem_survey.h"
+#include "minimodem_ensemble.h"
+#include "minimodem_hypotheses.h"
+#include "minimodem_records.h"
+#include "minimodem_index.h"
+#include "minimodem_flight.h"
+#include "minimodem_tee.h"
+#include "minimodem_checkpoint.h"
 
 char *program_name = "";
 
-int		tx_transmitting = 0;
 int		tx_print_eot = 0;
-int		tx_leader_bits_len = 2;
-int		tx_trailer_bits_len = 2;
 
-simpleaudio	*tx_sa_out;
-float		tx_bfsk_mark_f;
-unsigned int	tx_bit_nsamples;
-unsigned int	tx_flush_nsamples;
+// for the SIGALRM handler
+static minimodem_tx	*tx_stop_tx;
+static size_t		tx_flush_nsamples;
 
 void
 tx_stop_transmit_sighandler( int sig )
 {
     // fprintf(stderr, "alarm\n");
 
-    int j;
-    for ( j=0; j<tx_trailer_bits_len; j++ )
-	simpleaudio_tone(tx_sa_out, tx_bfsk_mark_f, tx_bit_nsamples);
+    minimodem_tx_stop(tx_stop_tx, tx_flush_nsamples);
 
-    if ( tx_flush_nsamples )
-	simpleaudio_tone(tx_sa_out, 0, tx_flush_nsamples);
-
-    tx_transmitting = 0;
     if ( tx_print_eot )
 	fprintf(stderr, "### EOT\n");
 }
 
 
-/*
- * rudimentary BFSK transmitter
- */
-
-static void fsk_transmit_frame(
-	simpleaudio *sa_out,
-	unsigned int bits,
-	unsigned int n_data_bits,
-	size_t bit_nsamples,
-	float bfsk_mark_f,
-	float bfsk_space_f,
-	float bfsk_nstartbits,
-	float bfsk_nstopbits,
-	int invert_start_stop,
-	int bfsk_msb_first
-	)
-{
-    int i;
-    if ( bfsk_nstartbits > 0 )
-	simpleaudio_tone(sa_out, invert_start_stop ? bfsk_mark_f : bfsk_space_f,
-			bit_nsamples * bfsk_nstartbits);	// start
-    for ( i=0; i<n_data_bits; i++ ) {				// data
-	unsigned int bit;
-	if (bfsk_msb_first) {
-		bit = ( bits >> (n_data_bits - i - 1) ) & 1;
-	} else {
-		bit = ( bits >> i ) & 1;
-	}
-
-	float tone_freq = bit == 1 ? bfsk_mark_f : bfsk_space_f;
-	simpleaudio_tone(sa_out, tone_freq, bit_nsamples);
-    }
-    if ( bfsk_nstopbits > 0 )
-	simpleaudio_tone(sa_out, invert_start_stop ? bfsk_space_f : bfsk_mark_f,
-			bit_nsamples * bfsk_nstopbits);		// stop
-}
-
 static void fsk_transmit_stdin(
-	simpleaudio *sa_out,
+	minimodem_tx *tx,
+	unsigned int sample_rate,
 	int tx_interactive,
 	float data_rate,
-	float bfsk_mark_f,
-	float bfsk_space_f,
-	int n_data_bits,
-	float bfsk_nstartbits,
-	float bfsk_nstopbits,
-	int invert_start_stop,
-	int bfsk_msb_first,
-	unsigned int bfsk_do_tx_sync_bytes,
-	unsigned int bfsk_sync_byte,
-	databits_encoder encode,
 	int txcarrier
 	)
 {
-    size_t sample_rate = simpleaudio_get_rate(sa_out);
-    size_t bit_nsamples = sample_rate / data_rate + 0.5f;
-
-    tx_sa_out = sa_out;
-    tx_bfsk_mark_f = bfsk_mark_f;
-    tx_bit_nsamples = bit_nsamples;
+    tx_stop_tx = tx;
     if ( tx_interactive )
 	tx_flush_nsamples = sample_rate/2; // 0.5 sec of zero samples to flush
     else
@@ -160,9 +111,8 @@ static void fsk_transmit_stdin(
     int fd = fileno(stdin);
     fd_set fdset;
 
-    tx_transmitting = 0;
     int end_of_file = 0;
-    unsigned char buf;
+    char buf;
     int n_read = 0;
     int idle = 0;
     while ( !end_of_file )
@@ -196,44 +146,9 @@ static void fsk_transmit_stdin(
 	    setitimer(ITIMER_REAL, &itv_zero, NULL);
 
 	if( !idle )
-	{
-	    // fprintf(stderr, "<c=%d>", c);
-	    unsigned int nwords;
-	    unsigned int bits[2];
-	    unsigned int j;
-	    nwords = encode(bits, buf);
-
-	    if ( !tx_transmitting )
-	    {
-	        tx_transmitting = 1;
-                /* emit leader tone (mark) */
-                for ( j=0; j<tx_leader_bits_len; j++ )
-                    simpleaudio_tone(sa_out, invert_start_stop ? bfsk_space_f : bfsk_mark_f, bit_nsamples);
-	    }
-	    if ( tx_transmitting < 2)
-	    {
-		tx_transmitting = 2;
-		/* emit "preamble" of sync bytes */
-		for ( j=0; j<bfsk_do_tx_sync_bytes; j++ )
-		    fsk_transmit_frame(sa_out, bfsk_sync_byte, n_data_bits,
-			    bit_nsamples, bfsk_mark_f, bfsk_space_f,
-			    bfsk_nstartbits, bfsk_nstopbits, invert_start_stop, 0);
-	    }
-
-	    /* emit data bits */
-	    for ( j=0; j<nwords; j++ )
-		fsk_transmit_frame(sa_out, bits[j], n_data_bits,
-			    bit_nsamples, bfsk_mark_f, bfsk_space_f,
-			    bfsk_nstartbits, bfsk_nstopbits, invert_start_stop, bfsk_msb_first);
-        }
-        else
-        {
-	    tx_transmitting = 1;
-            /* emit idle tone (mark) */
-	    simpleaudio_tone(sa_out,
-		    invert_start_stop ? bfsk_space_f : bfsk_mark_f,
-		    idle_carrier_usec * sample_rate / 1000000);
-	}
+	    minimodem_tx_write(tx, &buf, 1);
+	else
+	    minimodem_tx_idle(tx, idle_carrier_usec * sample_rate / 1000000);
 
 	if ( block_input )
 	    setitimer(ITIMER_REAL, &itv, NULL);
@@ -242,45 +157,134 @@ static void fsk_transmit_stdin(
 	setitimer(ITIMER_REAL, &itv_zero, NULL);
 	signal(SIGALRM, SIG_DFL);
     }
-    if ( !tx_transmitting )
+    if ( !minimodem_tx_transmitting(tx) )
 	return;
 
     tx_stop_transmit_sighandler(0);
 }
 
+/*
+ * --Xrender {n}: transmit stdin with minimodem_tx_queue() and
+ * minimodem_tx_render(), in blocks of n samples, instead of
+ * minimodem_tx_write() (to test the one against the other)
+ */
+static int
+tx_render_stdin( minimodem_tx *tx, simpleaudio *sa_out, sa_format_t format,
+	size_t block_nsamples )
+{
+    float *fbuf = malloc(block_nsamples * sizeof(float));
+    short *sbuf = malloc(block_nsamples * sizeof(short));
+    if ( !fbuf || !sbuf ) {
+	perror("malloc");
+	free(fbuf);
+	free(sbuf);
+	return -1;
+    }
+    char buf[256];
+    size_t buf_len = 0, buf_next = 0;
+    int end_of_file = 0;
+    int ret = 0;
+    while ( 1 ) {
+	if ( buf_next == buf_len && !end_of_file ) {
+	    ssize_t n_read = read(fileno(stdin), buf, sizeof(buf));
+	    if ( n_read <= 0 ) {
+		end_of_file = 1;
+		minimodem_tx_stop(tx, 0);
+	    } else {
+		buf_len = n_read;
+		buf_next = 0;
+	    }
+	}
+	if ( buf_next < buf_len )
+	    buf_next += minimodem_tx_queue(tx, buf + buf_next,
+						buf_len - buf_next);
+	else if ( end_of_file && !minimodem_tx_transmitting(tx) )
+	    break;
+
+	minimodem_tx_render(tx, fbuf, block_nsamples);
+
+	void *out = fbuf;
+	if ( format == SA_SAMPLE_FORMAT_S16 ) {
+	    size_t i;
+	    for ( i=0; i<block_nsamples; i++ )
+		sbuf[i] = lroundf(fbuf[i] * 32767.0f);
+	    out = sbuf;
+	}
+	if ( simpleaudio_write(sa_out, out, block_nsamples) < 0 ) {
+	    fprintf(stderr, "simpleaudio_write: error\n");
+	    ret = -1;
+	    break;
+	}
+    }
+    free(fbuf);
+    free(sbuf);
+    return ret;
+}
+
+
+/*
+ * receiver output: decoded data to stdout, carrier reports to stderr
+ * (or, with --records, both as records to stdout; the reports still
+ * go to stderr too)
+ */
+
+struct rx_output {
+	int	quiet_mode;
+	int	output_print_filter;
+	float	bfsk_data_rate;
+	minimodem_records	*records;
+	const minimodem_rx	*rx;		// (for records and flight)
+	minimodem_index		*index;
+	minimodem_flight	*flight;
+	minimodem_tee		*tee;
+	minimodem_checkpointer	*checkpointer;
+};
 
 static void
-report_no_carrier( fsk_plan *fskp,
-	unsigned int sample_rate,
-	float bfsk_data_rate,
-	float frame_n_bits,
-	unsigned int nframes_decoded,
-	size_t carrier_nsamples,
-	float confidence_total,
-	float amplitude_total )
+rx_output_data( void *arg, const char *dataoutbuf, unsigned int dataout_nbytes )
+{
+    struct rx_output *out = arg;
+
+    if ( out->flight )
+	minimodem_flight_frame(out->flight, minimodem_rx_last_frame(out->rx),
+				dataoutbuf, dataout_nbytes);
+
+    if ( out->records ) {
+	minimodem_records_frame(out->records, minimodem_rx_last_frame(out->rx),
+				dataoutbuf, dataout_nbytes);
+	return;
+    }
+
+    /*
+     * Print the output buffer to stdout
+     */
+    if ( out->output_print_filter == 0 ) {
+	if ( write(1, dataoutbuf, dataout_nbytes) < 0 )
+	    perror("write");
+    } else {
+	const char *p = dataoutbuf;
+	for ( ; dataout_nbytes; p++,dataout_nbytes-- ) {
+	    char printable_char = isprint(*p)||isspace(*p) ? *p : '.';
+	    if ( write(1, &printable_char, 1) < 0 )
+		perror("write");
+	}
+    }
+}
+
+static void
+report_no_carrier( const minimodem_rx_event *ev, float bfsk_data_rate )
 {
-    float nbits_decoded = nframes_decoded * frame_n_bits;
-#if 0
-    fprintf(stderr, "nframes_decoded=%u\n", nframes_decoded);
-    fprintf(stderr, "nbits_decoded=%f\n", nbits_decoded);
-    fprintf(stderr, "carrier_nsamples=%lu\n", carrier_nsamples);
-#endif
-    float throughput_rate =
-		nbits_decoded * sample_rate / (float)carrier_nsamples;
     fprintf(stderr, "\n### NOCARRIER ndata=%u confidence=%.3f ampl=%.3f bps=%.2f",
-	    nframes_decoded,
-	    (double)(confidence_total / nframes_decoded),
-	    (double)(amplitude_total / nframes_decoded),
-	    (double)(throughput_rate));
-#if 0
-    fprintf(stderr, " bits*sr=%llu rate*nsamp=%llu",
-	    (unsigned long long)(nbits_decoded * sample_rate + 0.5),
-	    (unsigned long long)(bfsk_data_rate * carrier_nsamples) );
-#endif
-    if ( (unsigned long long)(nbits_decoded * sample_rate + 0.5f) == (unsigned long long)(bfsk_data_rate * carrier_nsamples) ) {
+	    ev->nframes_decoded,
+	    (double)ev->confidence,
+	    (double)ev->amplitude,
+	    (double)ev->throughput_rate);
+    if ( ev->effort >= 0.0f )
+	fprintf(stderr, " effort=%.2f", (double)ev->effort);
+    if ( ev->rate_perfect ) {
 	fprintf(stderr, " (rate perfect) ###\n");
     } else {
-	float throughput_skew = (throughput_rate - bfsk_data_rate)
+	float throughput_skew = (ev->throughput_rate - bfsk_data_rate)
 			    / bfsk_data_rate;
 	fprintf(stderr, " (%.1f%% %s) ###\n",
 		(double)(fabsf(throughput_skew) * 100.0f),
@@ -289,6 +293,57 @@ report_no_carrier( fsk_plan *fskp,
     }
 }
 
+static void
+rx_output_event( void *arg, const minimodem_rx_event *ev )
+{
+    struct rx_output *out = arg;
+
+    if ( out->records )
+	minimodem_records_event(out->records, ev);
+    if ( out->index )
+	minimodem_index_event(out->index, ev);
+    if ( out->flight )
+	minimodem_flight_event(out->flight, ev);
+
+    if ( out->quiet_mode )
+	return;
+
+    switch ( ev->type ) {
+	case MINIMODEM_RX_CARRIER:
+	    if ( out->bfsk_data_rate >= 100 )
+		fprintf(stderr, "### CARRIER %u @ %.1f Hz ",
+			(unsigned int)(out->bfsk_data_rate + 0.5f),
+			(double)ev->carrier_freq);
+	    else
+		fprintf(stderr, "### CARRIER %.2f @ %.1f Hz ",
+			(double)(out->bfsk_data_rate),
+			(double)ev->carrier_freq);
+	    fprintf(stderr, "###\n");
+	    break;
+	case MINIMODEM_RX_NOCARRIER:
+	    report_no_carrier(ev, out->bfsk_data_rate);
+	    break;
+	case MINIMODEM_RX_LOADSHED:
+	    fprintf(stderr, "### LOADSHED %u backlog=%.0fms ###\n",
+		    ev->load_shed_level, (double)ev->backlog_ms);
+	    break;
+    }
+}
+
+static void
+rx_output_samples( void *arg, unsigned long long pos,
+	const float *samples, size_t nsamples )
+{
+    struct rx_output *out = arg;
+
+    if ( out->tee )
+	minimodem_tee_samples(out->tee, samples, nsamples);
+    if ( out->flight )
+	minimodem_flight_samples(out->flight, pos, samples, nsamples);
+    if ( out->checkpointer )
+	minimodem_checkpointer_update(out->checkpointer, out->rx);
+}
+
 void
 generate_test_tones( simpleaudio *sa_out, unsigned int duration_sec )
 {
@@ -301,6 +356,168 @@ generate_test_tones( simpleaudio *sa_out, unsigned int duration_sec )
     }
 }
 
+#if USE_SNDFILE
+
+/*
+ * Receive throughput: the CLI path (minimodem_rx_run pulling from a
+ * simpleaudio stream) vs. the push API, in large and small blocks.
+ */
+
+static void
+benchmark_rx_count_data( void *arg, const char *data, unsigned int nbytes )
+{
+    *(size_t *)arg += nbytes;
+}
+
+static void
+benchmark_rx_report( const char *name,
+	const struct timeval *tv_start, const struct timeval *tv_stop,
+	unsigned long long nframes, unsigned int sample_rate,
+	size_t ndecoded )
+{
+    unsigned long long runtime_usec, playtime_usec;
+    runtime_usec = (tv_stop->tv_sec - tv_start->tv_sec) * 1000000;
+    runtime_usec += tv_stop->tv_usec;
+    runtime_usec -= tv_start->tv_usec;
+    if ( !runtime_usec )
+	runtime_usec = 1;
+
+    playtime_usec = nframes * 1000000 / sample_rate;
+
+    unsigned long long performance = nframes * 1000000 / runtime_usec;
+
+    fprintf(stdout, "  %s\n", name);
+    fprintf(stdout, "    frames count:    \t%llu\n", nframes);
+    fprintf(stdout, "    audio playtime:  \t%2llu.%06llu sec\n",
+	    playtime_usec/1000000, playtime_usec%1000000);
+    fprintf(stdout, "    elapsed runtime: \t%2llu.%06llu sec\n",
+	    runtime_usec/1000000, runtime_usec%1000000);
+    fprintf(stdout, "    performance:     \t%llu samples/sec\n",
+	    performance);
+    fprintf(stdout, "    decoded bytes:   \t%zu\n", ndecoded);
+    fflush(stdout);
+}
+
+static int
+benchmark_rx( unsigned int sample_rate, int duration_sec )
+{
+    minimodem_config cfg;
+    minimodem_config_init(&cfg);
+    minimodem_config_set_baudmode(&cfg, "1200", 0);
+    minimodem_config_finish(&cfg);
+    cfg.sample_rate = sample_rate;
+
+    char path[] = "/tmp/minimodem-benchmark-XXXXXX.wav";
+    int fd = mkstemps(path, 4);
+    if ( fd < 0 ) {
+	perror("mkstemps");
+	return 0;
+    }
+    close(fd);
+
+    int ok = 0;
+    simpleaudio *sa;
+    minimodem_rx *rx = NULL;
+    float *samples = NULL;
+    size_t nsamples = 0;
+    struct timeval tv_start, tv_stop;
+    size_t ndecoded;
+
+    // generate the test signal
+    sa = simpleaudio_open_stream(SA_BACKEND_FILE, NULL, SA_STREAM_PLAYBACK,
+			SA_SAMPLE_FORMAT_FLOAT, sample_rate, 1,
+			program_name, path);
+    if ( ! sa )
+	goto out;
+    minimodem_tx *tx = minimodem_tx_new(&cfg, sa);
+    if ( ! tx ) {
+	simpleaudio_close(sa);
+	goto out;
+    }
+    const char text[] = "THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG 0123456789\n";
+    int i;
+    for ( i=0; i<cfg.bfsk_data_rate/10*duration_sec/(sizeof(text)-1); i++ )
+	minimodem_tx_write(tx, text, sizeof(text)-1);
+    minimodem_tx_stop(tx, sample_rate/2);
+    minimodem_tx_destroy(tx);
+    simpleaudio_close(sa);
+
+    // the CLI path
+    sa = simpleaudio_open_stream(SA_BACKEND_FILE, NULL, SA_STREAM_RECORD,
+			SA_SAMPLE_FORMAT_FLOAT, sample_rate, 1,
+			program_name, path);
+    if ( ! sa )
+	goto out;
+    ndecoded = 0;
+    rx = minimodem_rx_new(&cfg, benchmark_rx_count_data, NULL, &ndecoded);
+    if ( ! rx ) {
+	simpleaudio_close(sa);
+	goto out;
+    }
+    gettimeofday(&tv_start, NULL);
+    minimodem_rx_run(rx, sa);
+    gettimeofday(&tv_stop, NULL);
+    simpleaudio_close(sa);
+    minimodem_rx_destroy(rx);
+    rx = NULL;
+
+    // load the whole signal for the push API
+    sa = simpleaudio_open_stream(SA_BACKEND_FILE, NULL, SA_STREAM_RECORD,
+			SA_SAMPLE_FORMAT_FLOAT, sample_rate, 1,
+			program_name, path);
+    if ( ! sa )
+	goto out;
+    size_t samples_size = sample_rate * (duration_sec + 2);
+    samples = malloc(samples_size * sizeof(float));
+    if ( ! samples ) {
+	perror("malloc");
+	simpleaudio_close(sa);
+	goto out;
+    }
+    ssize_t r;
+    while ( nsamples < samples_size
+	    && (r = simpleaudio_read(sa, samples + nsamples,
+				samples_size - nsamples)) > 0 )
+	nsamples += r;
+    simpleaudio_close(sa);
+
+    // (the run's time was taken before this reading of the file)
+    benchmark_rx_report("receive-run-1200-FLOAT-mono", &tv_start, &tv_stop,
+				nsamples, sample_rate, ndecoded);
+
+    static const size_t block_sizes[] = { 4096, 160 };
+    int b;
+    for ( b=0; b<sizeof(block_sizes)/sizeof(block_sizes[0]); b++ ) {
+	size_t block_nsamples = block_sizes[b];
+	ndecoded = 0;
+	rx = minimodem_rx_new(&cfg, benchmark_rx_count_data, NULL, &ndecoded);
+	if ( ! rx )
+	    goto out;
+	gettimeofday(&tv_start, NULL);
+	size_t n;
+	for ( n=0; n<nsamples; n+=block_nsamples )
+	    minimodem_rx_push(rx, samples + n,
+		    nsamples - n < block_nsamples ? nsamples - n : block_nsamples);
+	minimodem_rx_flush(rx);
+	gettimeofday(&tv_stop, NULL);
+	char name[64];
+	snprintf(name, sizeof(name), "receive-push%zu-1200-FLOAT-mono",
+		block_nsamples);
+	benchmark_rx_report(name, &tv_start, &tv_stop,
+				nsamples, sample_rate, ndecoded);
+	minimodem_rx_destroy(rx);
+	rx = NULL;
+    }
+
+    ok = 1;
+out:
+    free(samples);
+    unlink(path);
+    return ok;
+}
+
+#endif /* USE_SNDFILE */
+
 static int
 benchmarks()
 {
@@ -320,14 +537,15 @@ benchmarks()
     simpleaudio *sa_out;
 
 
-    // enable the sine wave LUT
-    simpleaudio_tone_init(1024, 1.0);
+    // with the sine wave LUT
+    unsigned int sin_table_len = 1024;
 
     sa_out = simpleaudio_open_stream(backend, NULL, SA_STREAM_PLAYBACK,
 			SA_SAMPLE_FORMAT_S16, sample_rate, 1,
 			program_name, "generate-tones-lut1024-S16-mono");
     if ( ! sa_out )
 	return 0;
+    simpleaudio_tone_init(sa_out, sin_table_len, 1.0);
     generate_test_tones(sa_out, 10);
     simpleaudio_close(sa_out);
 
@@ -336,12 +554,12 @@ benchmarks()
 			program_name, "generate-tones-lut1024-FLOAT-mono");
     if ( ! sa_out )
 	return 0;
+    simpleaudio_tone_init(sa_out, sin_table_len, 1.0);
     generate_test_tones(sa_out, 10);
     simpleaudio_close(sa_out);
 
 
-    // disable the sine wave LUT
-    simpleaudio_tone_init(0, 1.0);
+    // without the sine wave LUT (the default for a new stream)
 
     sa_out = simpleaudio_open_stream(backend, NULL, SA_STREAM_PLAYBACK,
 			SA_SAMPLE_FORMAT_S16, sample_rate, 1,
@@ -359,17 +577,97 @@ benchmarks()
     generate_test_tones(sa_out, 10);
     simpleaudio_close(sa_out);
 
+#if USE_SNDFILE
+    if ( ! benchmark_rx(sample_rate, 10) )
+	return 0;
+#endif
 
     return 1;
 }
 
 
-static int rx_stop = 0;
+static minimodem_rx *rx_stop_rx;
+static volatile sig_atomic_t rx_stopped;
+
+#define MAX_RX_MODES	8
 
 void
 rx_stop_sighandler( int sig )
 {
-    rx_stop = 1;
+    rx_stopped = 1;
+    minimodem_rx_stop(rx_stop_rx);
+}
+
+static minimodem_flight *rx_flight;
+
+static void
+rx_flight_sighandler( int sig )
+{
+    minimodem_flight_request(rx_flight);
+}
+
+/*
+ * --feature-cache: decode the recording from "{filename}.mmcache", first
+ * (re)building that from sa if it is missing, or was built for other
+ * parameters or from another recording.
+ */
+static int
+rx_run_feature_cache( minimodem_rx *rx, simpleaudio *sa,
+	const char *filename )
+{
+    size_t path_len = strlen(filename) + sizeof(".mmcache");
+    char *path = malloc(path_len);
+    if ( !path ) {
+	perror("malloc");
+	return -1;
+    }
+    snprintf(path, path_len, "%s.mmcache", filename);
+
+    int ret = -1;
+    if ( minimodem_rx_open_feature_cache(rx, filename, path) < 0 ) {
+	if ( errno != ENOENT && errno != ESTALE ) {
+	    perror(path);
+	    goto out;
+	}
+	if ( minimodem_rx_build_feature_cache(rx, sa, filename, path) < 0 )
+	    goto out;
+	if ( minimodem_rx_open_feature_cache(rx, filename, path) < 0 ) {
+	    perror(path);
+	    goto out;
+	}
+    }
+    ret = minimodem_rx_run_feature_cache(rx);
+out:
+    free(path);
+    return ret;
+}
+
+/*
+ * --Xpush {n}: decode with minimodem_rx_push(), in blocks of n samples,
+ * instead of minimodem_rx_run() (to test the one against the other)
+ */
+static int
+rx_run_push( minimodem_rx *rx, simpleaudio *sa, size_t block_nsamples )
+{
+    float *buf = malloc(block_nsamples * sizeof(float));
+    if ( !buf ) {
+	perror("malloc");
+	return -1;
+    }
+    int ret = 0;
+    while ( 1 ) {
+	ssize_t r = simpleaudio_read(sa, buf, block_nsamples);
+	if ( r < 0 ) {
+	    fprintf(stderr, "simpleaudio_read: error\n");
+	    ret = -1;
+	    break;
+	}
+	if ( r == 0 || minimodem_rx_push(rx, buf, r) )
+	    break;
+    }
+    minimodem_rx_flush(rx);
+    free(buf);
+    return ret;
 }
 
 
@@ -423,7 +721,34 @@ usage()
     "		    --print-filter\n"
     "		    --print-eot\n"
     "		    --tx-carrier\n"
-    "		{baudmode}\n"
+    "		    --preamble[={bits}]\n"
+    "		    --preamble-snr {ratio}\n"
+    "		    --sync-correlate[={min_score}]\n"
+    "		    --adaptive-search\n"
+    "		    --shed-load[={deadline_ms}]\n"
+    "		    --daemon {config_file}\n"
+    "		    --channels {n}\n"
+    "		    --channel-output {pattern}\n"
+    "		    --channelize[={max_channels}]\n"
+    "		    --iq {iq_rate}\n"
+    "		    --iq-format {s16|float}\n"
+    "		    --iq-offset {freq}\n"
+    "		    --jobs {n}\n"
+    "		    --stats\n"
+    "		    --batch {file_list}\n"
+    "		    --batch-output {dir}\n"
+    "		    --survey     (--rx: no {baudmode})\n"
+    "		    --feature-cache\n"
+    "		    --ensemble {key=value,...}[:{key=value,...}...]\n"
+    "		    --hypotheses[={hypothesis}[:{hypothesis}...]]\n"
+    "		    --records {jsonl|binary}\n"
+    "		    --index\n"
+    "		    --segment {n}\n"
+    "		    --flight-recorder {dir}[,seconds={n}][,confidence={c}]\n"
+    "		    --tee {path}[,size={megabytes}][,time={seconds}]\n"
+    "		    --checkpoint {path}[,interval={seconds}]\n"
+    "		    --resume\n"
+    "		{baudmode}[,{baudmode}...]    (--rx: decode in each at once)\n"
     "	    any_number_N       Bell-like      N bps --ascii\n"
     "		    1200       Bell202     1200 bps --ascii\n"
     "		     300       Bell103      300 bps --ascii\n"
@@ -436,53 +761,6 @@ usage()
     exit(1);
 }
 
-int
-build_expect_bits_string( char *expect_bits_string,
-	int bfsk_nstartbits,
-	int bfsk_n_data_bits,
-	float bfsk_nstopbits,
-	int invert_start_stop,
-	int use_expect_bits,
-	unsigned long long expect_bits )
-{
-	// example expect_bits_string
-	//	  0123456789A
-	//	  isddddddddp	i == idle bit (a.k.a. prev_stop bit)
-	//			s == start bit  d == data bits  p == stop bit
-	// ebs = "10dddddddd1"  <-- expected mark/space framing pattern
-	//
-	// NOTE! expect_n_bits ends up being (frame_n_bits+1), because
-	// we expect the prev_stop bit in addition to this frame's own
-	// (start + n_data_bits + stop) bits.  But for each decoded frame,
-	// we will advance just frame_n_bits worth of samples, leaving us
-	// pointing at our stop bit -- it becomes the next frame's prev_stop.
-	//
-	//                  prev_stop--v
-	//                       start--v        v--stop
-	// char *expect_bits_string = "10dddddddd1";
-	//
-	char start_bit_value = invert_start_stop ? '1' : '0';
-	char stop_bit_value = invert_start_stop ? '0' : '1';
-	int j = 0;
-	if ( bfsk_nstopbits != 0.0f )
-	    expect_bits_string[j++] = stop_bit_value;
-	int i;
-	// Nb. only integer number of start bits works (for rx)
-	for ( i=0; i<bfsk_nstartbits; i++ )
-	    expect_bits_string[j++] = start_bit_value;
-	for ( i=0; i<bfsk_n_data_bits; i++,j++ ) {
-	    if ( use_expect_bits )
-		expect_bits_string[j] = ( (expect_bits>>i)&1 ) + '0';
-	    else
-		expect_bits_string[j] = 'd';
-	}
-	if ( bfsk_nstopbits != 0.0f )
-	    expect_bits_string[j++] = stop_bit_value;
-	expect_bits_string[j] = 0;
-
-	return j;
-}
-
 int
 main( int argc, char*argv[] )
 {
@@ -490,65 +768,51 @@ main( int argc, char*argv[] )
     int TX_mode = -1;
     int quiet_mode = 0;
     int output_print_filter = 0;
-    float band_width = 0;
-    float bfsk_mark_f = 0;
-    float bfsk_space_f = 0;
-    unsigned int bfsk_inverted_freqs = 0;
-    int bfsk_nstartbits = -1;
-    float bfsk_nstopbits = -1;
-    unsigned int bfsk_do_rx_sync = 0;
-    unsigned int bfsk_do_tx_sync_bytes = 0;
-    unsigned long long bfsk_sync_byte = -1;
-    unsigned int bfsk_n_data_bits = 0;
-    int bfsk_msb_first = 0;
-    char *expect_data_string = NULL;
-    char *expect_sync_string = NULL;
-    unsigned int expect_n_bits;
-    int invert_start_stop = 0;
-    int autodetect_shift;
     char *filename = NULL;
-
-    float	carrier_autodetect_threshold = 0.0;
-
-    // fsk_confidence_threshold : signal-to-noise squelch control
-    //
-    // The minimum SNR-ish confidence level seen as "a signal".
-    float fsk_confidence_threshold = 1.5;
-
-    // fsk_confidence_search_limit : performance vs. quality
-    //
-    // If we find a frame with confidence > confidence_search_limit,
-    // quit searching for a better frame.  confidence_search_limit has a
-    // dramatic effect on peformance (high value yields low performance, but
-    // higher decode quality, for noisy or hard-to-discern signals (Bell 103,
-    // or skewed rates).
-    float fsk_confidence_search_limit = 2.3f;
-    // float fsk_confidence_search_limit = INFINITY;  /* for test */
+    char *daemon_config = NULL;
+    char *channel_output = NULL;
+    unsigned int channelize_max = 0;
+    unsigned int iq_rate = 0;
+    sa_format_t iq_format = SA_SAMPLE_FORMAT_S16;
+    float iq_offset_f = 0.0;
+    unsigned int njobs = 0;
+    int print_stats = 0;
+    char *batch_list = NULL;
+    char *batch_output = NULL;
+    int survey = 0;
+    int feature_cache = 0;
+    char *ensemble = NULL;
+    int hypotheses = 0;
+    char *hypotheses_list = NULL;
+    char *records = NULL;
+    int write_index = 0;
+    unsigned int segment = 0;
+    char *flight = NULL;
+    char *tee = NULL;
+    char *checkpoint = NULL;
+    int resume = 0;
+
+    minimodem_config cfg;
+    minimodem_config_init(&cfg);
 
     sa_backend_t sa_backend = SA_BACKEND_SYSDEFAULT;
     char *sa_backend_device = NULL;
     sa_format_t sample_format = SA_SAMPLE_FORMAT_S16;
-    unsigned int sample_rate = 48000;
-    unsigned int nchannels = 1; // FIXME: only works with one channel
+    unsigned int nchannels = 1;
 
     float tx_amplitude = 1.0;
     unsigned int tx_sin_table_len = 4096;
 
-    unsigned int rx_one = 0;
     float rxnoise_factor = 0.0;
+    float xbacklog_ms = -1.0;
+    unsigned int xpush_nsamples = 0;
+    unsigned int xrender_nsamples = 0;
 
     int txcarrier = 0;
 
     int output_mode_binary = 0;
     int output_mode_raw_nbits = 0;
 
-    float	bfsk_data_rate = 0.0;
-    databits_encoder	*bfsk_databits_encode;
-    databits_decoder	*bfsk_databits_decode;
-
-    bfsk_databits_decode = databits_decode_ascii8;
-    bfsk_databits_encode = databits_encode_ascii8;
-
     /* validate the default system audio mechanism */
 #if !(USE_PULSEAUDIO || USE_ALSA)
 # define _MINIMODEM_NO_SYSTEM_AUDIO
@@ -581,8 +845,39 @@ main( int argc, char*argv[] )
 	MINIMODEM_OPT_BINARY_RAW,
 	MINIMODEM_OPT_PRINT_FILTER,
 	MINIMODEM_OPT_XRXNOISE,
+	MINIMODEM_OPT_XNOPREFILTER,
+	MINIMODEM_OPT_XBACKLOG,
+	MINIMODEM_OPT_XPUSH,
+	MINIMODEM_OPT_XRENDER,
 	MINIMODEM_OPT_PRINT_EOT,
-	MINIMODEM_OPT_TXCARRIER
+	MINIMODEM_OPT_TXCARRIER,
+	MINIMODEM_OPT_PREAMBLE,
+	MINIMODEM_OPT_PREAMBLE_SNR,
+	MINIMODEM_OPT_SYNC_CORRELATE,
+	MINIMODEM_OPT_ADAPTIVE_SEARCH,
+	MINIMODEM_OPT_SHED_LOAD,
+	MINIMODEM_OPT_DAEMON,
+	MINIMODEM_OPT_CHANNELS,
+	MINIMODEM_OPT_CHANNEL_OUTPUT,
+	MINIMODEM_OPT_CHANNELIZE,
+	MINIMODEM_OPT_IQ,
+	MINIMODEM_OPT_IQ_FORMAT,
+	MINIMODEM_OPT_IQ_OFFSET,
+	MINIMODEM_OPT_JOBS,
+	MINIMODEM_OPT_STATS,
+	MINIMODEM_OPT_BATCH,
+	MINIMODEM_OPT_BATCH_OUTPUT,
+	MINIMODEM_OPT_SURVEY,
+	MINIMODEM_OPT_FEATURE_CACHE,
+	MINIMODEM_OPT_ENSEMBLE,
+	MINIMODEM_OPT_HYPOTHESES,
+	MINIMODEM_OPT_RECORDS,
+	MINIMODEM_OPT_INDEX,
+	MINIMODEM_OPT_SEGMENT,
+	MINIMODEM_OPT_FLIGHT_RECORDER,
+	MINIMODEM_OPT_TEE,
+	MINIMODEM_OPT_CHECKPOINT,
+	MINIMODEM_OPT_RESUME
     };
 
     while ( 1 ) {
@@ -623,7 +918,38 @@ main( int argc, char*argv[] )
 	    { "print-filter",	0, 0, MINIMODEM_OPT_PRINT_FILTER },
 	    { "print-eot",	0, 0, MINIMODEM_OPT_PRINT_EOT },
 	    { "Xrxnoise",	1, 0, MINIMODEM_OPT_XRXNOISE },
+	    { "Xno-prefilter",	0, 0, MINIMODEM_OPT_XNOPREFILTER },
+	    { "Xbacklog",	1, 0, MINIMODEM_OPT_XBACKLOG },
+	    { "Xpush",		1, 0, MINIMODEM_OPT_XPUSH },
+	    { "Xrender",	1, 0, MINIMODEM_OPT_XRENDER },
 	    { "tx-carrier",      0, 0, MINIMODEM_OPT_TXCARRIER },
+	    { "preamble",	2, 0, MINIMODEM_OPT_PREAMBLE },
+	    { "preamble-snr",	1, 0, MINIMODEM_OPT_PREAMBLE_SNR },
+	    { "sync-correlate",	2, 0, MINIMODEM_OPT_SYNC_CORRELATE },
+	    { "adaptive-search", 0, 0, MINIMODEM_OPT_ADAPTIVE_SEARCH },
+	    { "shed-load",	2, 0, MINIMODEM_OPT_SHED_LOAD },
+	    { "daemon",		1, 0, MINIMODEM_OPT_DAEMON },
+	    { "channels",	1, 0, MINIMODEM_OPT_CHANNELS },
+	    { "channel-output",	1, 0, MINIMODEM_OPT_CHANNEL_OUTPUT },
+	    { "channelize",	2, 0, MINIMODEM_OPT_CHANNELIZE },
+	    { "iq",		1, 0, MINIMODEM_OPT_IQ },
+	    { "iq-format",	1, 0, MINIMODEM_OPT_IQ_FORMAT },
+	    { "iq-offset",	1, 0, MINIMODEM_OPT_IQ_OFFSET },
+	    { "jobs",		1, 0, MINIMODEM_OPT_JOBS },
+	    { "stats",		0, 0, MINIMODEM_OPT_STATS },
+	    { "batch",		1, 0, MINIMODEM_OPT_BATCH },
+	    { "batch-output",	1, 0, MINIMODEM_OPT_BATCH_OUTPUT },
+	    { "survey",		0, 0, MINIMODEM_OPT_SURVEY },
+	    { "feature-cache",	0, 0, MINIMODEM_OPT_FEATURE_CACHE },
+	    { "ensemble",	1, 0, MINIMODEM_OPT_ENSEMBLE },
+	    { "hypotheses",	2, 0, MINIMODEM_OPT_HYPOTHESES },
+	    { "records",	1, 0, MINIMODEM_OPT_RECORDS },
+	    { "index",		0, 0, MINIMODEM_OPT_INDEX },
+	    { "segment",	1, 0, MINIMODEM_OPT_SEGMENT },
+	    { "flight-recorder", 1, 0, MINIMODEM_OPT_FLIGHT_RECORDER },
+	    { "tee",		1, 0, MINIMODEM_OPT_TEE },
+	    { "checkpoint",	1, 0, MINIMODEM_OPT_CHECKPOINT },
+	    { "resume",		0, 0, MINIMODEM_OPT_RESUME },
 	    { 0 }
 	};
 	c = getopt_long(argc, argv, "Vtrc:l:ai875f:b:v:M:S:T:qA::R:",
@@ -645,37 +971,37 @@ main( int argc, char*argv[] )
 			TX_mode = 0;
 			break;
 	    case 'c':
-			fsk_confidence_threshold = atof(optarg);
+			cfg.fsk_confidence_threshold = atof(optarg);
 			break;
 	    case 'l':
-			fsk_confidence_search_limit = atof(optarg);
+			cfg.fsk_confidence_search_limit = atof(optarg);
 			break;
 	    case 'a':
-			carrier_autodetect_threshold = 0.001;
+			cfg.carrier_autodetect_threshold = 0.001;
 			break;
 	    case 'i':
-			bfsk_inverted_freqs = 1;
+			cfg.bfsk_inverted_freqs = 1;
 			break;
 	    case 'f':
 			filename = optarg;
 			break;
 	    case '8':
-			bfsk_n_data_bits = 8;
+			cfg.bfsk_n_data_bits = 8;
 			break;
 	    case '7':
-			bfsk_n_data_bits = 7;
+			cfg.bfsk_n_data_bits = 7;
 			break;
 	    case '5':
-			bfsk_n_data_bits = 5;
-			bfsk_databits_decode = databits_decode_baudot;
-			bfsk_databits_encode = databits_encode_baudot;
+			cfg.bfsk_n_data_bits = 5;
+			cfg.bfsk_databits_decode = databits_decode_baudot;
+			cfg.bfsk_databits_encode = databits_encode_baudot;
 			break;
 	    case MINIMODEM_OPT_MSBFIRST:
-			bfsk_msb_first = 1;
+			cfg.bfsk_msb_first = 1;
 			break;
 	    case 'b':
-			band_width = atof(optarg);
-			assert( band_width != 0 );
+			cfg.band_width = atof(optarg);
+			assert( cfg.band_width != 0 );
 			break;
 	    case 'v':
 			if ( optarg[0] == 'E' )
@@ -685,37 +1011,37 @@ main( int argc, char*argv[] )
 			assert( tx_amplitude > 0.0f );
 			break;
 	    case 'M':
-			bfsk_mark_f = atof(optarg);
-			assert( bfsk_mark_f > 0 );
+			cfg.bfsk_mark_f = atof(optarg);
+			assert( cfg.bfsk_mark_f > 0 );
 			break;
 	    case 'S':
-			bfsk_space_f = atof(optarg);
-			assert( bfsk_space_f > 0 );
+			cfg.bfsk_space_f = atof(optarg);
+			assert( cfg.bfsk_space_f > 0 );
 			break;
 	    case MINIMODEM_OPT_STARTBITS:
-			bfsk_nstartbits = atoi(optarg);
-			// Note: bfsk_nstartbits is limited by arrays
+			cfg.bfsk_nstartbits = atoi(optarg);
+			// Note: cfg.bfsk_nstartbits is limited by arrays
 		        //   expect_bits_string[32] and fsk.c:bit_something[32]
-			assert( bfsk_nstartbits >= 0 && bfsk_nstartbits <= 20 );
+			assert( cfg.bfsk_nstartbits >= 0 && cfg.bfsk_nstartbits <= 20 );
 			break;
 	    case MINIMODEM_OPT_STOPBITS:
-			bfsk_nstopbits = atof(optarg);
-			assert( bfsk_nstopbits >= 0 );
+			cfg.bfsk_nstopbits = atof(optarg);
+			assert( cfg.bfsk_nstopbits >= 0 );
 			break;
 	    case MINIMODEM_OPT_INVERT_START_STOP:
-			invert_start_stop = 1;
+			cfg.invert_start_stop = 1;
 			break;
 	    case MINIMODEM_OPT_SYNC_BYTE:
-			bfsk_do_rx_sync = 1;
-			bfsk_do_tx_sync_bytes = 16;
-			bfsk_sync_byte = strtol(optarg, NULL, 0);
+			cfg.bfsk_do_rx_sync = 1;
+			cfg.bfsk_do_tx_sync_bytes = 16;
+			cfg.bfsk_sync_byte = strtol(optarg, NULL, 0);
 			break;
 	    case 'q':
 			quiet_mode = 1;
 			break;
 	    case 'R':
-			sample_rate = atoi(optarg);
-			assert( sample_rate > 0 );
+			cfg.sample_rate = atoi(optarg);
+			assert( cfg.sample_rate > 0 );
 			break;
 	    case 'A':
 #if USE_ALSA
@@ -734,12 +1060,97 @@ main( int argc, char*argv[] )
 			sample_format = SA_SAMPLE_FORMAT_FLOAT;
 			break;
 	    case MINIMODEM_OPT_RX_ONE:
-			rx_one = 1;
+			cfg.rx_one = 1;
 			break;
 	    case MINIMODEM_OPT_BENCHMARKS:
 			benchmarks();
 			exit(0);
 			break;
+	    case MINIMODEM_OPT_DAEMON:
+			daemon_config = optarg;
+			break;
+	    case MINIMODEM_OPT_CHANNELS:
+			nchannels = atoi(optarg);
+			assert( nchannels > 0 );
+			break;
+	    case MINIMODEM_OPT_CHANNEL_OUTPUT:
+			channel_output = optarg;
+			break;
+	    case MINIMODEM_OPT_CHANNELIZE:
+			channelize_max = optarg ? atoi(optarg) : 8;
+			assert( channelize_max > 0 );
+			break;
+	    case MINIMODEM_OPT_IQ:
+			iq_rate = atoi(optarg);
+			assert( iq_rate > 0 );
+			break;
+	    case MINIMODEM_OPT_IQ_FORMAT:
+			if ( strcmp(optarg, "s16") == 0 )
+			    iq_format = SA_SAMPLE_FORMAT_S16;
+			else if ( strcmp(optarg, "float") == 0 )
+			    iq_format = SA_SAMPLE_FORMAT_FLOAT;
+			else
+			    usage();
+			break;
+	    case MINIMODEM_OPT_IQ_OFFSET:
+			iq_offset_f = atof(optarg);
+			break;
+	    case MINIMODEM_OPT_JOBS:
+			njobs = atoi(optarg);
+			assert( njobs > 0 );
+			break;
+	    case MINIMODEM_OPT_STATS:
+			print_stats = 1;
+			break;
+	    case MINIMODEM_OPT_BATCH:
+			batch_list = optarg;
+			break;
+	    case MINIMODEM_OPT_BATCH_OUTPUT:
+			batch_output = optarg;
+			break;
+	    case MINIMODEM_OPT_SURVEY:
+			survey = 1;
+			break;
+	    case MINIMODEM_OPT_FEATURE_CACHE:
+			feature_cache = 1;
+			break;
+	    case MINIMODEM_OPT_ENSEMBLE:
+			ensemble = optarg;
+			break;
+	    case MINIMODEM_OPT_HYPOTHESES:
+			hypotheses = 1;
+			hypotheses_list = optarg;
+			break;
+	    case MINIMODEM_OPT_RECORDS:
+			records = optarg;
+			if ( strcmp(records, "jsonl") != 0
+				&& strcmp(records, "binary") != 0 ) {
+			    fprintf(stderr, "E: --records takes jsonl or binary\n");
+			    return 1;
+			}
+			break;
+	    case MINIMODEM_OPT_INDEX:
+			write_index = 1;
+			break;
+	    case MINIMODEM_OPT_SEGMENT:
+			segment = atoi(optarg);
+			if ( segment == 0 ) {
+			    fprintf(stderr, "E: --segment takes a segment number, from 1\n");
+			    return 1;
+			}
+			break;
+	    case MINIMODEM_OPT_FLIGHT_RECORDER:
+			flight = optarg;
+			break;
+	    case MINIMODEM_OPT_TEE:
+			tee = optarg;
+			break;
+	    case MINIMODEM_OPT_CHECKPOINT:
+			checkpoint = optarg;
+			break;
+	    case MINIMODEM_OPT_RESUME:
+			resume = 1;
+			break;
 	    case MINIMODEM_OPT_BINARY_OUTPUT:
 			output_mode_binary = 1;
 			break;
@@ -752,12 +1163,54 @@ main( int argc, char*argv[] )
 	    case MINIMODEM_OPT_XRXNOISE:
 			rxnoise_factor = atof(optarg);
 			break;
+	    case MINIMODEM_OPT_XNOPREFILTER:
+			cfg.no_prefilter = 1;
+			break;
+	    case MINIMODEM_OPT_XBACKLOG:
+			xbacklog_ms = atof(optarg);
+			assert( xbacklog_ms >= 0.0f );
+			break;
+	    case MINIMODEM_OPT_XPUSH:
+			xpush_nsamples = atoi(optarg);
+			assert( xpush_nsamples > 0 );
+			break;
+	    case MINIMODEM_OPT_XRENDER:
+			xrender_nsamples = atoi(optarg);
+			assert( xrender_nsamples > 0 );
+			break;
 	    case MINIMODEM_OPT_TXCARRIER:
 			txcarrier = 1;
 			break;
 	    case MINIMODEM_OPT_PRINT_EOT:
 			tx_print_eot = 1;
 			break;
+	    case MINIMODEM_OPT_PREAMBLE:
+			cfg.preamble_detect = 1;
+			if ( optarg ) {
+			    cfg.preamble_bits_string = optarg;
+			    assert( strlen(optarg) > 0 && strlen(optarg) <= 64 );
+			    assert( strspn(optarg, "01") == strlen(optarg) );
+			}
+			break;
+	    case MINIMODEM_OPT_PREAMBLE_SNR:
+			cfg.preamble_min_snr = atof(optarg);
+			assert( cfg.preamble_min_snr >= 1.0f );
+			break;
+	    case MINIMODEM_OPT_ADAPTIVE_SEARCH:
+			cfg.adaptive_search = 1;
+			break;
+	    case MINIMODEM_OPT_SHED_LOAD:
+			cfg.shed_load = 1;
+			if ( optarg )
+			    cfg.shed_load_deadline_ms = atof(optarg);
+			assert( cfg.shed_load_deadline_ms >= 0.0f );
+			break;
+	    case MINIMODEM_OPT_SYNC_CORRELATE:
+			cfg.sync_correlate = 1;
+			if ( optarg )
+			    cfg.sync_min_score = atof(optarg);
+			assert( cfg.sync_min_score > 0.0f && cfg.sync_min_score <= 1.0f );
+			break;
 	    default:
 			usage();
 	}
@@ -769,7 +1222,76 @@ main( int argc, char*argv[] )
     if ( TX_mode == 0 )
 	sample_format = SA_SAMPLE_FORMAT_FLOAT;
 
-    if ( filename ) {
+    if ( daemon_config ) {
+	if ( TX_mode == 1 || optind != argc ) {
+	    fprintf(stderr, "E: --daemon takes its sources and {baudmode}s from {config_file}\n");
+	    usage();
+	}
+	return minimodem_daemon(daemon_config, quiet_mode);
+    }
+
+    if ( feature_cache && (TX_mode || !filename || strcmp(filename, "-") == 0
+		|| iq_rate || batch_list || survey) ) {
+	fprintf(stderr, "E: --feature-cache takes --rx and a --file\n");
+	return 1;
+    }
+
+    if ( ensemble && TX_mode ) {
+	fprintf(stderr, "E: --ensemble takes --rx\n");
+	return 1;
+    }
+    if ( hypotheses && TX_mode ) {
+	fprintf(stderr, "E: --hypotheses takes --rx\n");
+	return 1;
+    }
+    if ( records && (TX_mode || batch_list || survey) ) {
+	fprintf(stderr, "E: --records takes --rx\n");
+	return 1;
+    }
+    if ( (write_index || segment) && (TX_mode || !filename
+		|| strcmp(filename, "-") == 0 || iq_rate || batch_list
+		|| survey) ) {
+	fprintf(stderr, "E: --index and --segment take --rx and a --file\n");
+	return 1;
+    }
+    if ( flight && (TX_mode || batch_list || survey) ) {
+	fprintf(stderr, "E: --flight-recorder takes --rx\n");
+	return 1;
+    }
+    if ( tee && (TX_mode || batch_list || survey) ) {
+	fprintf(stderr, "E: --tee takes --rx\n");
+	return 1;
+    }
+    if ( write_index && segment ) {
+	fprintf(stderr, "E: --index and --segment can't be combined\n");
+	return 1;
+    }
+    if ( checkpoint && (TX_mode || !filename || strcmp(filename, "-") == 0
+		|| iq_rate || batch_list || survey) ) {
+	fprintf(stderr, "E: --checkpoint takes --rx and a --file\n");
+	return 1;
+    }
+    if ( resume && !checkpoint ) {
+	fprintf(stderr, "E: --resume takes a --checkpoint\n");
+	return 1;
+    }
+
+    if ( batch_list ) {
+	if ( TX_mode || filename || iq_rate || nchannels != 1
+		|| channelize_max ) {
+	    fprintf(stderr, "E: --batch takes --rx, and its files from {file_list}\n");
+	    return 1;
+	}
+#if !USE_SNDFILE
+	fprintf(stderr, "E: This build of minimodem was configured without sndfile,\nE:   so the --batch flag is not supported.\n");
+	exit(1);
+#endif
+    } else if ( iq_rate ) {
+	if ( TX_mode || !filename ) {
+	    fprintf(stderr, "E: --iq takes --rx and a --file (or \"-\" for stdin)\n");
+	    return 1;
+	}
+    } else if ( filename ) {
 #if !USE_SNDFILE
 	fprintf(stderr, "E: This build of minimodem was configured without sndfile,\nE:   so the --file flag is not supported.\n");
 	exit(1);
@@ -790,6 +1312,31 @@ main( int argc, char*argv[] )
     }
 #endif
 
+    /*
+     * Survey mode: find the transmissions and their parameters
+     */
+
+    if ( survey ) {
+	if ( TX_mode || optind != argc || nchannels != 1 || iq_rate
+		|| channelize_max || batch_list ) {
+	    fprintf(stderr, "E: --survey takes --rx and mono input, and no {baudmode}\n");
+	    return 1;
+	}
+	if ( filename )
+	    sa_backend = SA_BACKEND_FILE;
+	simpleaudio *sa = simpleaudio_open_stream(sa_backend, sa_backend_device,
+				SA_STREAM_RECORD, sample_format,
+				cfg.sample_rate, 1, program_name,
+				filename ? filename : "input audio");
+	if ( ! sa )
+	    return 1;
+	if ( rxnoise_factor != 0.0f )
+	    simpleaudio_set_rxnoise(sa, rxnoise_factor);
+	int ret = minimodem_survey_run(sa, &cfg, quiet_mode);
+	simpleaudio_close(sa);
+	return ret;
+    }
+
     if (optind + 1 !=  argc) {
 	fprintf(stderr, "E: *** Must specify {baudmode} (try \"300\") ***\n");
 	usage();
@@ -797,143 +1344,67 @@ main( int argc, char*argv[] )
 
     modem_mode = argv[optind++];
 
-
-    if ( strncasecmp(modem_mode, "rtty",5)==0 ) {
-	bfsk_databits_decode = databits_decode_baudot;
-	bfsk_databits_encode = databits_encode_baudot;
-	bfsk_data_rate = 45.45;
-	if ( bfsk_n_data_bits == 0 )
-	    bfsk_n_data_bits = 5;
-	if ( bfsk_nstopbits < 0 )
-	    bfsk_nstopbits = 1.5;
-    } else if ( strncasecmp(modem_mode, "tdd",4)==0 ) {
-	bfsk_databits_decode = databits_decode_baudot;
-	bfsk_databits_encode = databits_encode_baudot;
-	bfsk_data_rate = 45.45;
-	if ( bfsk_n_data_bits == 0 )
-	    bfsk_n_data_bits = 5;
-	if ( bfsk_nstopbits < 0 )
-	    bfsk_nstopbits = 2.0;
-	bfsk_mark_f = 1400;
-	bfsk_space_f = 1800;
-    } else if ( strncasecmp(modem_mode, "same",5)==0 ) {
-	// http://www.nws.noaa.gov/nwr/nwrsame.htm
-	bfsk_data_rate = 520.0 + 5/6.0;
-	bfsk_n_data_bits = 8;
-	bfsk_nstartbits = 0;
-	bfsk_nstopbits = 0;
-	bfsk_do_rx_sync = 1;
-	bfsk_do_tx_sync_bytes = 16;
-	bfsk_sync_byte = 0xAB;
-	bfsk_mark_f = 2083.0 + 1/3.0;
-	bfsk_space_f = 1562.5;
-	band_width = bfsk_data_rate;
-    } else if ( strncasecmp(modem_mode, "caller",6)==0 ) {
-	if ( TX_mode ) {
-	    fprintf(stderr, "E: callerid --tx mode is not supported.\n");
-	    return 1;
-	}
-	if ( carrier_autodetect_threshold > 0.0f )
-	    fprintf(stderr, "W: callerid with --auto-carrier is not recommended.\n");
-	bfsk_databits_decode = databits_decode_callerid;
-	bfsk_data_rate = 1200;
-	bfsk_n_data_bits = 8;
-    } else if ( strncasecmp(modem_mode, "uic", 3) == 0 ) {
-	if ( TX_mode ) {
-	    fprintf(stderr, "E: uic-751-3 --tx mode is not supported.\n");
+    /*
+     * {baudmode}[,{baudmode}...]: receive in several modes at once, each
+     * mode's config built from the same options
+     */
+    char *mode_names[MAX_RX_MODES];
+    minimodem_config mode_cfgs[MAX_RX_MODES];
+    unsigned int nmodes = 0;
+    char *mode_saveptr;
+    char *mode;
+    for ( mode = strtok_r(modem_mode, ",", &mode_saveptr); mode;
+		mode = strtok_r(NULL, ",", &mode_saveptr) ) {
+	if ( nmodes == MAX_RX_MODES ) {
+	    fprintf(stderr, "E: at most %u {baudmode}s at once\n",
+			MAX_RX_MODES);
 	    return 1;
 	}
-	// http://ec.europa.eu/transport/rail/interoperability/doc/ccs-tsi-en-annex.pdf
-	if (tolower(modem_mode[4]) == 't')
-	    bfsk_databits_decode = databits_decode_uic_train;
-	else
-	    bfsk_databits_decode = databits_decode_uic_ground;
-	bfsk_data_rate = 600;
-	bfsk_n_data_bits = 39;
-	bfsk_mark_f = 1300;
-	bfsk_space_f = 1700;
-	bfsk_nstartbits = 8;
-	bfsk_nstopbits = 0;
-	expect_data_string = "11110010ddddddddddddddddddddddddddddddddddddddd";
-	expect_n_bits = 47;
-    } else {
-	bfsk_data_rate = atof(modem_mode);
-	if ( bfsk_n_data_bits == 0 )
-	    bfsk_n_data_bits = 8;
+	mode_names[nmodes] = mode;
+	mode_cfgs[nmodes++] = cfg;
     }
-    if ( bfsk_data_rate == 0.0f )
+    if ( nmodes == 0 )
 	usage();
+    if ( nmodes > 1 && TX_mode ) {
+	fprintf(stderr, "E: --tx takes a single {baudmode}\n");
+	return 1;
+    }
 
+    unsigned int i;
+    for ( i=0; i<nmodes; i++ ) {
+	minimodem_config *mcfg = &mode_cfgs[i];
 
-    if ( output_mode_binary || output_mode_raw_nbits )
-	bfsk_databits_decode = databits_decode_binary;
-
-    if ( output_mode_raw_nbits ) {
-	bfsk_nstartbits = 0;
-	bfsk_nstopbits = 0;
-	bfsk_n_data_bits = output_mode_raw_nbits;
-    }
+	if ( minimodem_config_set_baudmode(mcfg, mode_names[i], TX_mode) < 0 )
+	    return 1;
+	if ( mcfg->bfsk_data_rate == 0.0f )
+	    usage();
 
-    if ( bfsk_data_rate >= 400 ) {
-	/*
-	 * Bell 202:     baud=1200 mark=1200 space=2200
-	 */
-	autodetect_shift = - ( bfsk_data_rate * 5 / 6 );
-	if ( bfsk_mark_f == 0 )
-	    bfsk_mark_f  = bfsk_data_rate / 2 + 600;
-	if ( bfsk_space_f == 0 )
-	    bfsk_space_f = bfsk_mark_f - autodetect_shift;
-	if ( band_width == 0 )
-	    band_width = 200;
-    } else if ( bfsk_data_rate >= 100 ) {
-	/*
-	 * Bell 103:     baud=300 mark=1270 space=1070
-	 * ITU-T V.21:   baud=300 mark=1280 space=1080
-	 */
-	autodetect_shift = 200;
-	if ( bfsk_mark_f == 0 )
-	    bfsk_mark_f  = 1270;
-	if ( bfsk_space_f == 0 )
-	    bfsk_space_f = bfsk_mark_f - autodetect_shift;
-	if ( band_width == 0 )
-	    band_width = 50;	// close enough
-    } else {
-	/*
-	 * RTTY:     baud=45.45 mark/space=variable shift=-170
-	 */
-	autodetect_shift = 170;
-	if ( bfsk_mark_f == 0 )
-	    bfsk_mark_f  = 1585;
-	if ( bfsk_space_f == 0 )
-	    bfsk_space_f = bfsk_mark_f - autodetect_shift;
-	if ( band_width == 0 ) {
-	    band_width = 10;	// FIXME chosen arbitrarily
-	}
-    }
 
-    // defaults: 1 start bit, 1 stop bit
-    if ( bfsk_nstartbits < 0 )
-	bfsk_nstartbits = 1;
-    if ( bfsk_nstopbits < 0 )
-	bfsk_nstopbits = 1.0;
+	if ( output_mode_binary || output_mode_raw_nbits )
+	    mcfg->bfsk_databits_decode = databits_decode_binary;
 
-    // do not transmit any leader tone if no start bits
-    if ( bfsk_nstartbits == 0 )
-	tx_leader_bits_len = 0;
+	if ( output_mode_raw_nbits ) {
+	    mcfg->bfsk_nstartbits = 0;
+	    mcfg->bfsk_nstopbits = 0;
+	    mcfg->bfsk_n_data_bits = output_mode_raw_nbits;
+	}
 
-    if ( bfsk_inverted_freqs ) {
-	float t = bfsk_mark_f;
-	bfsk_mark_f = bfsk_space_f;
-	bfsk_space_f = t;
+	minimodem_config_finish(mcfg);
     }
+    cfg = mode_cfgs[0];
 
-    /* restrict band_width to <= data rate (FIXME?) */
-    if ( band_width > bfsk_data_rate )
-	band_width = bfsk_data_rate;
+    /*
+     * Batch mode: decode each of a list of files
+     */
 
-    // sanitize confidence search limit
-    if ( fsk_confidence_search_limit < fsk_confidence_threshold )
-	fsk_confidence_search_limit = fsk_confidence_threshold;
+    if ( batch_list ) {
+	if ( nmodes > 1 ) {
+	    fprintf(stderr, "E: --batch takes a single {baudmode}\n");
+	    return 1;
+	}
+	return minimodem_batch_run(batch_list, &cfg, njobs, batch_output,
+				quiet_mode, output_print_filter);
+    }
 
     char *stream_name = NULL;
 
@@ -947,7 +1418,10 @@ main( int argc, char*argv[] )
      */
     if ( TX_mode ) {
 
-	simpleaudio_tone_init(tx_sin_table_len, tx_amplitude);
+	if ( nchannels != 1 ) {
+	    fprintf(stderr, "E: --channels is only for --rx\n");
+	    return 1;
+	}
 
 	int tx_interactive = 0;
 	if ( ! stream_name ) {
@@ -958,25 +1432,36 @@ main( int argc, char*argv[] )
 	simpleaudio *sa_out;
 	sa_out = simpleaudio_open_stream(sa_backend, sa_backend_device,
 					SA_STREAM_PLAYBACK,
-					sample_format, sample_rate, nchannels,
+					sample_format, cfg.sample_rate, nchannels,
 					program_name, stream_name);
 	if ( ! sa_out )
 	    return 1;
 
-	fsk_transmit_stdin(sa_out, tx_interactive,
-				bfsk_data_rate,
-				bfsk_mark_f, bfsk_space_f,
-				bfsk_n_data_bits,
-				bfsk_nstartbits,
-				bfsk_nstopbits,
-				invert_start_stop,
-				bfsk_msb_first,
-				bfsk_do_tx_sync_bytes,
-				bfsk_sync_byte,
-				bfsk_databits_encode,
-				txcarrier
-				);
+	simpleaudio_tone_init(sa_out, tx_sin_table_len, tx_amplitude);
+
+	if ( xrender_nsamples ) {
+	    minimodem_tx *tx = minimodem_tx_new_render(&cfg, 64, tx_amplitude);
+	    if ( ! tx ) {
+		simpleaudio_close(sa_out);
+		return 1;
+	    }
+	    int ret = tx_render_stdin(tx, sa_out, sample_format,
+					xrender_nsamples);
+	    minimodem_tx_destroy(tx);
+	    simpleaudio_close(sa_out);
+	    return ret ? 1 : 0;
+	}
+
+	minimodem_tx *tx = minimodem_tx_new(&cfg, sa_out);
+	if ( ! tx ) {
+	    simpleaudio_close(sa_out);
+	    return 1;
+	}
+
+	fsk_transmit_stdin(tx, simpleaudio_get_rate(sa_out),
+				tx_interactive, cfg.bfsk_data_rate, txcarrier);
 
+	minimodem_tx_destroy(tx);
 	simpleaudio_close(sa_out);
 
 	return 0;
@@ -990,464 +1475,398 @@ main( int argc, char*argv[] )
 	stream_name = "input audio";
 
     simpleaudio *sa;
-    sa = simpleaudio_open_stream(sa_backend, sa_backend_device,
+    if ( iq_rate ) {
+	// iq_offset_f to the middle of the pair, or of the passband
+	float audio_f = channelize_max ? cfg.sample_rate / 4.0f
+			: (cfg.bfsk_mark_f + cfg.bfsk_space_f) / 2;
+	if ( nchannels != 1 ) {
+	    fprintf(stderr, "E: --iq input is a single channel\n");
+	    return 1;
+	}
+	sa = simpleaudio_open_source_iq(filename, iq_format, iq_rate,
+				iq_offset_f, audio_f,
+				sample_format, cfg.sample_rate);
+    } else {
+	sa = simpleaudio_open_stream(sa_backend, sa_backend_device,
 				SA_STREAM_RECORD,
-				sample_format, sample_rate, nchannels,
+				sample_format, cfg.sample_rate, nchannels,
 				program_name, stream_name);
+    }
     if ( ! sa )
         return 1;
 
-    sample_rate = simpleaudio_get_rate(sa);
+    cfg.sample_rate = simpleaudio_get_rate(sa);
+    for ( i=0; i<nmodes; i++ )
+	mode_cfgs[i].sample_rate = cfg.sample_rate;
 
     if ( rxnoise_factor != 0.0f )
 	simpleaudio_set_rxnoise(sa, rxnoise_factor);
+    if ( xbacklog_ms >= 0.0f )
+	simpleaudio_set_xbacklog(sa, xbacklog_ms * cfg.sample_rate / 1000);
+
+    if ( cfg.shed_load ) {
+	size_t backlog_nsamples, capacity_nsamples;
+	if ( simpleaudio_get_backlog(sa, &backlog_nsamples,
+				&capacity_nsamples) < 0 ) {
+	    fprintf(stderr, "W: --shed-load has no effect for %s\n",
+			stream_name);
+	    cfg.shed_load = 0;
+	}
+    }
 
-    /*
-     * Prepare the input sample chunk rate
-     */
-    float nsamples_per_bit = sample_rate / bfsk_data_rate;
-
-
-    /*
-     * Prepare the fsk plan
-     */
+    if ( feature_cache ) {
+	// (the cache only holds what the plain frame search measures)
+	if ( nchannels > 1 || nmodes > 1 || channelize_max || njobs > 1
+		|| rxnoise_factor != 0.0f || cfg.preamble_detect
+		|| cfg.sync_correlate
+		|| cfg.carrier_autodetect_threshold > 0.0f ) {
+	    fprintf(stderr, "E: --feature-cache takes mono input and a single"
+			    " {baudmode}, and can't be combined with --jobs,"
+			    " --preamble, --sync-correlate or --auto-carrier\n");
+	    simpleaudio_close(sa);
+	    return 1;
+	}
+	cfg.shed_load = 0;
+    }
 
-    fsk_plan *fskp;
-    fskp = fsk_plan_new(sample_rate, bfsk_mark_f, bfsk_space_f, band_width);
-    if ( !fskp ) {
-        fprintf(stderr, "fsk_plan_new() failed\n");
-        return 1;
+    if ( records || write_index || segment || flight || tee ) {
+	// (one receiver's stream positions, or samples)
+	if ( nchannels > 1 || nmodes > 1 || channelize_max || njobs > 1
+		|| ensemble || hypotheses ) {
+	    fprintf(stderr, "E: --records, --index, --segment,"
+			    " --flight-recorder and --tee take mono input and"
+			    " a single {baudmode}, and can't be combined with"
+			    " --jobs, --ensemble or --hypotheses\n");
+	    simpleaudio_close(sa);
+	    return 1;
+	}
+    }
+    if ( (flight || tee) && feature_cache ) {
+	fprintf(stderr, "E: --flight-recorder and --tee can't be combined"
+			" with --feature-cache\n");
+	simpleaudio_close(sa);
+	return 1;
     }
 
-    /*
-     * Prepare the input sample buffer.  For 8-bit frames with prev/start/stop
-     * we need 11 data-bits worth of samples, and we will scan through one bits
-     * worth at a time, hence we need a minimum total input buffer size of 12
-     * data-bits.  */
-    unsigned int nbits = 0;
-    nbits += 1;			// prev stop bit (last whole stop bit)
-    nbits += bfsk_nstartbits;	// start bits
-    nbits += bfsk_n_data_bits;
-    nbits += 1;			// stop bit (first whole stop bit)
-
-    // FIXME EXPLAIN +1 goes with extra bit when scanning
-    size_t	samplebuf_size = ceilf(nsamples_per_bit) * (nbits+1);
-    samplebuf_size *= 2; // account for the half-buf filling method
-#define SAMPLE_BUF_DIVISOR 12
-#ifdef SAMPLE_BUF_DIVISOR
-    // For performance, use a larger samplebuf_size than necessary
-    if ( samplebuf_size < sample_rate / SAMPLE_BUF_DIVISOR )
-	samplebuf_size = sample_rate / SAMPLE_BUF_DIVISOR;
-#endif
-    float	*samplebuf = malloc(samplebuf_size * sizeof(float));
-    size_t	samples_nvalid = 0;
-    debug_log("samplebuf_size=%zu\n", samplebuf_size);
+    if ( checkpoint ) {
+	// (one receiver, decoding only from stream positions it could have
+	// got to anyway, with only its data as output)
+	if ( nchannels > 1 || nmodes > 1 || channelize_max || njobs > 1
+		|| ensemble || hypotheses || feature_cache || records
+		|| write_index || segment || flight || tee
+		|| rxnoise_factor != 0.0f || cfg.preamble_detect
+		|| cfg.sync_correlate || cfg.rx_one
+		|| cfg.carrier_autodetect_threshold > 0.0f ) {
+	    fprintf(stderr, "E: --checkpoint takes mono input and a single"
+			    " {baudmode}, and can't be combined with --jobs,"
+			    " --ensemble, --hypotheses, --feature-cache,"
+			    " --records, --index, --segment, --flight-recorder,"
+			    " --tee, --preamble, --sync-correlate, --rx-one or"
+			    " --auto-carrier\n");
+	    simpleaudio_close(sa);
+	    return 1;
+	}
+	cfg.shed_load = 0;
+    }
 
     /*
-     * Run the main loop
+     * --index: write "{filename}.mmindex" of the carriers decoded;
+     * --segment: decode one of them again, straight from where it was
+     * acquired
      */
 
-    int			ret = 0;
-
-    int			carrier = 0;
-    float		confidence_total = 0;
-    float		amplitude_total = 0;
-    unsigned int	nframes_decoded = 0;
-    size_t		carrier_nsamples = 0;
-
-    unsigned int	noconfidence = 0;
-    unsigned int	advance = 0;
-
-    // Fraction of nsamples_per_bit that we will "overscan"; range (0.0 .. 1.0)
-    float fsk_frame_overscan = 0.5;
-    //   should be != 0.0 (only the nyquist edge cases actually require this?)
-    // for handling of slightly faster-than-us rates:
-    //   should be >> 0.0 to allow us to lag back for faster-than-us rates
-    //   should be << 1.0 or we may lag backwards over whole bits
-    // for optimal analysis:
-    //   should be >= 0.5 (half a bit width) or we may not find the optimal bit
-    //   should be <  1.0 (a full bit width) or we may skip over whole bits
-    // for encodings without start/stop bits:
-    //     MUST be <= 0.5 or we may accidentally skip a bit
-    //
-    assert( fsk_frame_overscan >= 0.0f && fsk_frame_overscan < 1.0f );
-
-    // ensure that we overscan at least a single sample
-    unsigned int nsamples_overscan
-			= nsamples_per_bit * fsk_frame_overscan + 0.5f;
-    if ( fsk_frame_overscan > 0.0f && nsamples_overscan == 0 )
-	nsamples_overscan = 1;
-    debug_log("fsk_frame_overscan=%f nsamples_overscan=%u\n",
-	    fsk_frame_overscan, nsamples_overscan);
-
-    // n databits plus bfsk_startbit start bits plus bfsk_nstopbit stop bits:
-    float frame_n_bits = bfsk_n_data_bits + bfsk_nstartbits + bfsk_nstopbits;
-    unsigned int frame_nsamples = nsamples_per_bit * frame_n_bits + 0.5f;
-
-    char expect_data_string_buffer[64];
-    if (expect_data_string == NULL) {
-        expect_data_string = expect_data_string_buffer;
-        expect_n_bits = build_expect_bits_string(expect_data_string, bfsk_nstartbits, bfsk_n_data_bits, bfsk_nstopbits, invert_start_stop, 0, 0);
+    char *index_path = NULL;
+    minimodem_index_segment index_seg;
+    if ( write_index || segment ) {
+	size_t path_len = strlen(filename) + sizeof(".mmindex");
+	index_path = malloc(path_len);
+	if ( !index_path ) {
+	    perror("malloc");
+	    simpleaudio_close(sa);
+	    return 1;
+	}
+	snprintf(index_path, path_len, "%s.mmindex", filename);
     }
-    debug_log("eds = '%s' (%lu)\n", expect_data_string, strlen(expect_data_string));
-
-    char expect_sync_string_buffer[64];
-    if (expect_sync_string == NULL && bfsk_do_rx_sync && (long long) bfsk_sync_byte >= 0) {
-        expect_sync_string = expect_sync_string_buffer;
-        build_expect_bits_string(expect_sync_string, bfsk_nstartbits, bfsk_n_data_bits, bfsk_nstopbits, invert_start_stop, 1, bfsk_sync_byte);
-    } else {
-	expect_sync_string = expect_data_string;
+    if ( segment ) {
+	if ( feature_cache ) {
+	    fprintf(stderr, "E: --segment can't be combined with"
+			    " --feature-cache\n");
+	    simpleaudio_close(sa);
+	    return 1;
+	}
+	if ( minimodem_index_read_segment(index_path, filename, &cfg, segment,
+				&index_seg) < 0 ) {
+	    simpleaudio_close(sa);
+	    return 1;
+	}
+	if ( simpleaudio_seek(sa, index_seg.search) < 0 ) {
+	    fprintf(stderr, "E: %s: can't seek to sample %llu\n",
+		    filename, index_seg.search);
+	    simpleaudio_close(sa);
+	    return 1;
+	}
+	cfg.rx_one = 1;
+	cfg.shed_load = 0;
     }
-    debug_log("ess = '%s' (%lu)\n", expect_sync_string, strlen(expect_sync_string));
-
-	unsigned int expect_nsamples = nsamples_per_bit * expect_n_bits;
-    float track_amplitude = 0.0;
-    float peak_confidence = 0.0;
-
-    signal(SIGINT, rx_stop_sighandler);
-
-    while ( 1 ) {
 
-	if ( rx_stop )
-	    break;
-
-	debug_log("advance=%u\n", advance);
+    /*
+     * Channelizer: a receiver per FSK pair found in the passband
+     */
 
-	/* Shift the samples in samplebuf by 'advance' samples */
-	assert( advance <= samplebuf_size );
-	if ( advance == samplebuf_size ) {
-	    samples_nvalid = 0;
-	    advance = 0;
-	}
-	if ( advance ) {
-	    if ( advance > samples_nvalid )
-		break;
-	    memmove(samplebuf, samplebuf+advance,
-		    (samplebuf_size-advance)*sizeof(float));
-	    samples_nvalid -= advance;
+    if ( channelize_max ) {
+	if ( nchannels > 1 || nmodes > 1 ) {
+	    fprintf(stderr, "E: --channelize takes mono input and a single"
+			    " {baudmode}\n");
+	    simpleaudio_close(sa);
+	    return 1;
 	}
+	cfg.shed_load = 0;
+	int ret = minimodem_channelize_run(sa, &cfg, channelize_max,
+				channel_output, quiet_mode, output_print_filter);
+	simpleaudio_close(sa);
+	return ret;
+    }
 
-	if ( samples_nvalid < samplebuf_size/2 ) {
-	    float	*samples_readptr = samplebuf + samples_nvalid;
-	    size_t	read_nsamples = samplebuf_size/2;
-	    /* Read more samples into samplebuf (fill it) */
-	    assert ( read_nsamples > 0 );
-	    assert ( samples_nvalid + read_nsamples <= samplebuf_size );
-	    ssize_t r;
-	    r = simpleaudio_read(sa, samples_readptr, read_nsamples);
-	    debug_log("simpleaudio_read(samplebuf+%td, n=%zu) returns %zd\n",
-		    samples_readptr - samplebuf, read_nsamples, r);
-	    if ( r < 0 ) {
-		fprintf(stderr, "simpleaudio_read: error\n");
-		ret = -1;
-		break;
-	    }
-	    samples_nvalid += r;
-	}
+    /*
+     * Multi-channel or multi-mode input: a receiver per channel and mode
+     */
 
-	if ( samples_nvalid == 0 )
-	    break;
+    if ( nchannels > 1 || nmodes > 1 ) {
+	if ( cfg.shed_load )
+	    fprintf(stderr, "W: --shed-load has no effect with --channels"
+			    " or several {baudmode}s\n");
+	for ( i=0; i<nmodes; i++ )
+	    mode_cfgs[i].shed_load = 0;
+	int ret = minimodem_channels_run(sa, mode_cfgs,
+				(const char * const *)mode_names, nmodes,
+				channel_output, quiet_mode, output_print_filter);
+	simpleaudio_close(sa);
+	return ret;
+    }
 
-	/* Auto-detect carrier frequency */
-	static int carrier_band = -1;
-	if ( carrier_autodetect_threshold > 0.0f && carrier_band < 0 ) {
-	    unsigned int i;
-	    float nsamples_per_scan = nsamples_per_bit;
-	    if ( nsamples_per_scan > fskp->fftsize )
-		nsamples_per_scan = fskp->fftsize;
-	    for ( i=0; i+nsamples_per_scan<=samples_nvalid;
-						 i+=nsamples_per_scan ) {
-		carrier_band = fsk_detect_carrier(fskp,
-				    samplebuf+i, nsamples_per_scan,
-				    carrier_autodetect_threshold);
-		if ( carrier_band >= 0 )
-		    break;
-	    }
-	    advance = i + nsamples_per_scan;
-	    if ( advance > samples_nvalid )
-		advance = samples_nvalid;
-	    if ( carrier_band < 0 ) {
-		debug_log("autodetected carrier band not found\n");
-		continue;
-	    }
+    /*
+     * Prepare the receiver
+     */
 
-	    // default negative shift -- reasonable?
-	    int b_shift = - (float)(autodetect_shift + fskp->band_width/2.0f)
-						/ fskp->band_width;
-	    if ( bfsk_inverted_freqs )
-		b_shift *= -1;
-	    /* only accept a carrier as b_mark if it will not result
-	     * in a b_space band which is "too low". */
-	    int b_space = carrier_band + b_shift;
-	    if ( b_space < 1 || b_space >= fskp->nbands ) {
-		debug_log("autodetected space band out of range\n" );
-		carrier_band = -1;
-		continue;
-	    }
+    struct rx_output rx_out = {
+	.quiet_mode = quiet_mode,
+	.output_print_filter = output_print_filter,
+	.bfsk_data_rate = cfg.bfsk_data_rate,
+    };
 
-	    debug_log("### TONE freq=%.1f ###\n",
-		    carrier_band * fskp->band_width);
+    /*
+     * Ensemble decoding: several receiver variants, the best of each
+     */
 
-	    fsk_set_tones_by_bandshift(fskp, /*b_mark*/carrier_band, b_shift);
+    if ( ensemble ) {
+	if ( nchannels > 1 || nmodes > 1 || channelize_max || njobs > 1
+		|| feature_cache ) {
+	    fprintf(stderr, "E: --ensemble takes mono input and a single"
+			    " {baudmode}, and can't be combined with --jobs"
+			    " or --feature-cache\n");
+	    simpleaudio_close(sa);
+	    return 1;
 	}
+	cfg.shed_load = 0;
+	int ret = minimodem_ensemble_run(sa, &cfg, ensemble,
+				rx_output_data, rx_output_event, &rx_out,
+				print_stats);
+	simpleaudio_close(sa);
+	return ret;
+    }
 
-	/*
-	 * The main processing algorithm: scan samplesbuf for FSK frames,
-	 * looking at an entire frame at once.
-	 */
+    /*
+     * Framing and polarity hypotheses, from one spectral front end
+     */
 
-	debug_log( "--------------------------\n");
+    if ( hypotheses ) {
+	if ( nchannels > 1 || nmodes > 1 || channelize_max || njobs > 1
+		|| feature_cache || ensemble ) {
+	    fprintf(stderr, "E: --hypotheses takes mono input and a single"
+			    " {baudmode}, and can't be combined with --jobs,"
+			    " --feature-cache or --ensemble\n");
+	    simpleaudio_close(sa);
+	    return 1;
+	}
+	int ret = minimodem_hypotheses_run(sa, &cfg, hypotheses_list,
+				rx_output_data, rx_output_event, &rx_out,
+				quiet_mode);
+	simpleaudio_close(sa);
+	return ret;
+    }
 
-	if ( samples_nvalid < expect_nsamples )
-	    break;
+    /*
+     * Chunked parallel decoding of a recording
+     */
 
-	// try_max_nsamples
-	// serves two purposes
-	// 1. avoids finding a non-optimal first frame
-	// 2. allows us to track slightly slow signals
-	unsigned int try_max_nsamples;
-	if ( carrier )
-	    try_max_nsamples = nsamples_per_bit * 0.75f + 0.5f;
-	else
-	    try_max_nsamples = nsamples_per_bit;
-	try_max_nsamples += nsamples_overscan;
-
-	// FSK_ANALYZE_NSTEPS Try 3 frame positions across the try_max_nsamples
-	// range.  Using a larger nsteps allows for more accurate tracking of
-	// fast/slow signals (at decreased performance).  Note also
-	// FSK_ANALYZE_NSTEPS_FINE below, which refines the frame
-	// position upon first acquiring carrier, or if confidence falls.
-#define FSK_ANALYZE_NSTEPS		3
-	unsigned int try_step_nsamples = try_max_nsamples / FSK_ANALYZE_NSTEPS;
-	if ( try_step_nsamples == 0 )
-	    try_step_nsamples = 1;
-
-	float confidence, amplitude;
-	unsigned long long bits = 0;
-	/* Note: frame_start_sample is actually the sample where the
-	 * prev_stop bit begins (since the "frame" includes the prev_stop). */
-	unsigned int frame_start_sample = 0;
-
-	unsigned int try_first_sample;
-	float try_confidence_search_limit;
-
-	try_confidence_search_limit = fsk_confidence_search_limit;
-	try_first_sample = carrier ? nsamples_overscan : 0;
-
-	confidence = fsk_find_frame(fskp, samplebuf, expect_nsamples,
-			try_first_sample,
-			try_max_nsamples,
-			try_step_nsamples,
-			try_confidence_search_limit,
-			carrier ? expect_data_string : expect_sync_string,
-			&bits,
-			&amplitude,
-			&frame_start_sample
-			);
-
-	int do_refine_frame = 0;
-
-	if ( confidence < peak_confidence * 0.75f ) {
-	    do_refine_frame = 1;
-	    debug_log(" ... do_refine_frame rescan (confidence %.3f << %.3f peak)\n", confidence, peak_confidence);
-	    peak_confidence = 0;
+    if ( njobs > 1 ) {
+	// (these look ahead, or stop, in ways which depend on where
+	// decoding began)
+	if ( cfg.preamble_detect || cfg.sync_correlate || cfg.rx_one
+		|| cfg.carrier_autodetect_threshold > 0.0f ) {
+	    fprintf(stderr, "E: --jobs can't be combined with --preamble,"
+			    " --sync-correlate, --rx-one or --auto-carrier\n");
+	    simpleaudio_close(sa);
+	    return 1;
 	}
+	cfg.shed_load = 0;
+	int ret = minimodem_parallel_run(sa, &cfg, njobs,
+				rx_output_data, rx_output_event, &rx_out,
+				print_stats);
+	simpleaudio_close(sa);
+	return ret;
+    }
 
-	// no-confidence if amplitude drops abruptly to < 25% of the
-	// track_amplitude, which follows amplitude with hysteresis
-	if ( amplitude < track_amplitude * 0.25f ) {
-	    confidence = 0;
+    minimodem_rx *rx;
+    rx = minimodem_rx_new(&cfg, rx_output_data, rx_output_event, &rx_out);
+    if ( !rx ) {
+	simpleaudio_close(sa);
+	return 1;
+    }
+    if ( segment && minimodem_rx_resume(rx, index_seg.search,
+				index_seg.mark_f, index_seg.space_f) < 0 ) {
+	fprintf(stderr, "E: %s: segment %u's tones are out of range\n",
+		index_path, segment);
+	minimodem_rx_destroy(rx);
+	simpleaudio_close(sa);
+	return 1;
+    }
+    if ( records ) {
+	rx_out.rx = rx;
+	rx_out.records = minimodem_records_new(stdout,
+				strcmp(records, "binary") == 0
+				    ? MINIMODEM_RECORDS_BINARY
+				    : MINIMODEM_RECORDS_JSONL,
+				cfg.sample_rate);
+	if ( !rx_out.records ) {
+	    minimodem_rx_destroy(rx);
+	    simpleaudio_close(sa);
+	    return 1;
 	}
-
-#define FSK_MAX_NOCONFIDENCE_BITS	20
-
-	if ( confidence <= fsk_confidence_threshold ) {
-
-	    // FIXME: explain
-	    if ( ++noconfidence > FSK_MAX_NOCONFIDENCE_BITS )
-	    {
-		carrier_band = -1;
-		if ( carrier ) {
-		    if ( !quiet_mode )
-			report_no_carrier(fskp, sample_rate, bfsk_data_rate,
-			    frame_n_bits, nframes_decoded,
-			    carrier_nsamples, confidence_total, amplitude_total);
-		    carrier = 0;
-		    carrier_nsamples = 0;
-		    confidence_total = 0;
-		    amplitude_total = 0;
-		    nframes_decoded = 0;
-		    track_amplitude = 0.0;
-
-		    if ( rx_one )
-			break;
-		}
-	    }
-
-	    /* Advance the sample stream forward by try_max_nsamples so the
-	     * next time around the loop we continue searching from where
-	     * we left off this time.		*/
-	    advance = try_max_nsamples;
-	    debug_log("@ NOCONFIDENCE=%u advance=%u\n", noconfidence, advance);
-	    continue;
+    }
+    if ( write_index ) {
+	rx_out.index = minimodem_index_create(index_path, filename, &cfg);
+	if ( !rx_out.index ) {
+	    minimodem_rx_destroy(rx);
+	    simpleaudio_close(sa);
+	    return 1;
 	}
-
-	// Add a frame's worth of samples to the sample count
-	carrier_nsamples += frame_nsamples;
-
-	if ( carrier ) {
-
-	    // If we already had carrier, adjust sample count +start -overscan
-	    carrier_nsamples += frame_start_sample;
-	    carrier_nsamples -= nsamples_overscan;
-
-	} else {
-
-	    // We just acquired carrier.
-
-	    if ( !quiet_mode ) {
-		if ( bfsk_data_rate >= 100 )
-		    fprintf(stderr, "### CARRIER %u @ %.1f Hz ",
-			    (unsigned int)(bfsk_data_rate + 0.5f),
-			    (double)(fskp->b_mark * fskp->band_width));
-		else
-		    fprintf(stderr, "### CARRIER %.2f @ %.1f Hz ",
-			    (double)(bfsk_data_rate),
-			    (double)(fskp->b_mark * fskp->band_width));
-	    }
-
-	    if ( !quiet_mode )
-		fprintf(stderr, "###\n");
-
-	    carrier = 1;
-	    bfsk_databits_decode(0, 0, 0, 0); // reset the frame processor
-
-	    do_refine_frame = 1;
-	    debug_log(" ... do_refine_frame rescan (acquired carrier)\n");
+    }
+    if ( flight ) {
+	rx_out.rx = rx;
+	rx_out.flight = minimodem_flight_new(flight, cfg.sample_rate);
+	if ( !rx_out.flight ) {
+	    if ( rx_out.index )
+		minimodem_index_close(rx_out.index);
+	    minimodem_rx_destroy(rx);
+	    simpleaudio_close(sa);
+	    return 1;
 	}
-
-	if ( do_refine_frame )
-	{
-	    if ( confidence < INFINITY && try_step_nsamples > 1 ) {
-		// FSK_ANALYZE_NSTEPS_FINE:
-		// Scan again, but try harder to find the best frame.
-		// Since we found a valid confidence frame in the "sloppy"
-		// fsk_find_frame() call already, we're sure to find one at
-		// least as good this time.
-#define FSK_ANALYZE_NSTEPS_FINE		8
-		try_step_nsamples = try_max_nsamples / FSK_ANALYZE_NSTEPS_FINE;
-		if ( try_step_nsamples == 0 )
-		    try_step_nsamples = 1;
-		try_confidence_search_limit = INFINITY;
-		float confidence2, amplitude2;
-		unsigned long long bits2;
-		unsigned int frame_start_sample2;
-		confidence2 = fsk_find_frame(fskp, samplebuf, expect_nsamples,
-			    try_first_sample,
-			    try_max_nsamples,
-			    try_step_nsamples,
-			    try_confidence_search_limit,
-			    carrier ? expect_data_string : expect_sync_string,
-			    &bits2,
-			    &amplitude2,
-			    &frame_start_sample2
-			    );
-		if ( confidence2 > confidence ) {
-		    bits = bits2;
-		    amplitude = amplitude2;
-		    frame_start_sample = frame_start_sample2;
-		}
-	    }
+	rx_flight = rx_out.flight;
+	signal(SIGUSR1, rx_flight_sighandler);
+    }
+    if ( tee ) {
+	rx_out.tee = minimodem_tee_new(tee, cfg.sample_rate);
+	if ( !rx_out.tee ) {
+	    if ( rx_out.flight )
+		minimodem_flight_destroy(rx_out.flight);
+	    if ( rx_out.index )
+		minimodem_index_close(rx_out.index);
+	    minimodem_rx_destroy(rx);
+	    simpleaudio_close(sa);
+	    return 1;
 	}
-
-	track_amplitude = ( track_amplitude + amplitude ) / 2;
-	if ( peak_confidence < confidence )
-	    peak_confidence = confidence;
-	debug_log("@ confidence=%.3f peak_conf=%.3f amplitude=%.3f track_amplitude=%.3f\n",
-		confidence, peak_confidence, amplitude, track_amplitude );
-
-	confidence_total += confidence;
-	amplitude_total += amplitude;
-	nframes_decoded++;
-	noconfidence = 0;
-
-	// Advance the sample stream forward past the junk before the
-	// frame starts (frame_start_sample), and then past decoded frame
-	// (see also NOTE about frame_n_bits and expect_n_bits)...
-	// But actually advance just a bit less than that to allow
-	// for tracking slightly fast signals, hence - nsamples_overscan.
-	advance = frame_start_sample + frame_nsamples - nsamples_overscan;
-
-	debug_log("@ nsamples_per_bit=%.3f n_data_bits=%u "
-			" frame_start=%u advance=%u\n",
-		    nsamples_per_bit, bfsk_n_data_bits,
-		    frame_start_sample, advance);
-
-	// chop off the prev_stop bit
-	if ( bfsk_nstopbits != 0.0f )
-	    bits = bits >> 1;
-
-
-	/*
-	 * Send the raw data frame bits to the backend frame processor
-	 * for final conversion to output data bytes.
-	 */
-
-	// chop off framing bits
-	bits = bit_window(bits, bfsk_nstartbits, bfsk_n_data_bits);
-	if (bfsk_msb_first) {
-		bits = bit_reverse(bits, bfsk_n_data_bits);
+    }
+    if ( checkpoint ) {
+	rx_out.rx = rx;
+	rx_out.checkpointer = minimodem_checkpointer_new(checkpoint, &cfg, 1);
+	if ( !rx_out.checkpointer ) {
+	    minimodem_rx_destroy(rx);
+	    simpleaudio_close(sa);
+	    return 1;
 	}
-	debug_log("Input: %08x%08x - Databits: %u - Shift: %i\n", (unsigned int)(bits >> 32), (unsigned int)bits, bfsk_n_data_bits, bfsk_nstartbits);
-
-	unsigned int dataout_size = 4096;
-	char dataoutbuf[4096];
-	unsigned int dataout_nbytes = 0;
-
-	// suppress printing of bfsk_sync_byte bytes
-	if ( bfsk_do_rx_sync ) {
-	    if ( dataout_nbytes == 0 && bits == bfsk_sync_byte )
-		continue;
+    }
+    if ( resume ) {
+	minimodem_checkpoint ck;
+	int r = minimodem_checkpointer_read(rx_out.checkpointer, &ck);
+	if ( r >= 0 && !ck.done && simpleaudio_seek(sa, ck.sample) < 0 ) {
+	    fprintf(stderr, "E: %s: can't seek to sample %llu\n",
+		    filename, ck.sample);
+	    r = -1;
 	}
+	if ( r < 0 || ck.done ) {
+	    // (nothing left to decode, if it was done)
+	    minimodem_checkpointer_destroy(rx_out.checkpointer);
+	    minimodem_rx_destroy(rx);
+	    simpleaudio_close(sa);
+	    return r < 0 ? 1 : 0;
+	}
+	minimodem_rx_seek(rx, ck.sample);
+	if ( r > 0 && !quiet_mode )
+	    fprintf(stderr, "### RESUME sample=%llu output=%llu ###\n",
+		    ck.sample, ck.output);
+    }
+    if ( flight || tee || checkpoint )
+	minimodem_rx_set_samples_fn(rx, rx_output_samples, &rx_out);
 
-	dataout_nbytes += bfsk_databits_decode(dataoutbuf + dataout_nbytes,
-						dataout_size - dataout_nbytes,
-						bits, (int)bfsk_n_data_bits);
-
-	if ( dataout_nbytes == 0 )
-	    continue;
+    /*
+     * Run the main loop
+     */
 
-	/*
-	 * Print the output buffer to stdout
-	 */
-	if ( output_print_filter == 0 ) {
-	    if ( write(1, dataoutbuf, dataout_nbytes) < 0 )
-		perror("write");
-	} else {
-	    char *p = dataoutbuf;
-	    for ( ; dataout_nbytes; p++,dataout_nbytes-- ) {
-		char printable_char = isprint(*p)||isspace(*p) ? *p : '.';
-		if ( write(1, &printable_char, 1) < 0 )
-		    perror("write");
-	    }
-	}
+    rx_stop_rx = rx;
+    signal(SIGINT, rx_stop_sighandler);
 
-    } /* end of the main loop */
+    struct timeval tv_start, tv_stop;
+    gettimeofday(&tv_start, NULL);
 
-    free(samplebuf);
+    int ret;
+    if ( feature_cache )
+	ret = rx_run_feature_cache(rx, sa, filename);
+    else if ( xpush_nsamples )
+	ret = rx_run_push(rx, sa, xpush_nsamples);
+    else
+	ret = minimodem_rx_run(rx, sa);
 
     signal(SIGINT, SIG_DFL);
-
-    if ( carrier ) {
-	if ( !quiet_mode )
-	    report_no_carrier(fskp, sample_rate, bfsk_data_rate,
-		frame_n_bits, nframes_decoded,
-		carrier_nsamples, confidence_total, amplitude_total);
+    if ( flight )
+	signal(SIGUSR1, SIG_DFL);
+
+    if ( print_stats ) {
+	gettimeofday(&tv_stop, NULL);
+	double wall = (tv_stop.tv_sec - tv_start.tv_sec)
+			+ (tv_stop.tv_usec - tv_start.tv_usec) / 1e6;
+	double audio_sec = (double)minimodem_rx_tell(rx) / cfg.sample_rate;
+	fprintf(stderr, "### STATS audio=%.1fs wall=%.2fs speed=%.1fx"
+			" jobs=1 ###\n",
+		audio_sec, wall, wall > 0.0 ? audio_sec / wall : 0.0);
     }
 
+    unsigned long long end_sample = minimodem_rx_tell(rx);
+
     simpleaudio_close(sa);
 
-    fsk_plan_destroy(fskp);
+    minimodem_rx_destroy(rx);
+
+    if ( rx_out.records && minimodem_records_close(rx_out.records) < 0 )
+	ret = 1;
+    if ( rx_out.index && minimodem_index_close(rx_out.index) < 0 )
+	ret = 1;
+    if ( rx_out.flight )
+	minimodem_flight_destroy(rx_out.flight);
+    if ( rx_out.tee && minimodem_tee_destroy(rx_out.tee) < 0 )
+	ret = 1;
+    if ( rx_out.checkpointer ) {
+	// (a decode which ran to the end is done, not to be resumed)
+	minimodem_checkpoint ck = {
+	    .sample = end_sample,
+	    .done = 1,
+	};
+	if ( ret == 0 && !rx_stopped )
+	    minimodem_checkpointer_write(rx_out.checkpointer, &ck);
+	if ( minimodem_checkpointer_destroy(rx_out.checkpointer) < 0 )
+	    ret = 1;
+    }
+    free(index_path);
 
     return ret;
 }
@@ -0,0 +1,409 @@
+/*
+ * minimodem_batch.c
+ *
+ * minimodem - software audio Bell-type or RTTY FSK modem
+ *
+ * Copyright (C) 2011-2016 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE	// tdestroy
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <search.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "simpleaudio.h"
+#include "minimodem_batch.h"
+
+
+/*
+ * Batch decoding of many files.
+ *
+ * The worker threads each take the next path from the list (read as they
+ * go, so it may come from a pipe), and decode that file start to end with
+ * a receiver of their own.  A worker only destroys its previous file's
+ * receiver once the next one is made, so the FFT plan (shared by every
+ * receiver with the same FFT size, see fsk_fft_plan_get()) is made once
+ * per batch rather than once per file.  Each output path is claimed
+ * before it is opened, and a file whose output another file of the batch
+ * has claimed (the same basename from another directory, with
+ * --batch-output) fails rather than overwrite it.  On SIGINT the workers
+ * stop their files at the next block read, and take no more.
+ */
+
+struct batch {
+	FILE			*list;
+	const minimodem_config	*cfg;
+	const char		*output_dir;
+	int			quiet_mode;
+	int			output_print_filter;
+
+	pthread_mutex_t		lock;		// list, totals, outputs, stderr
+	void			*outputs;	// tsearch() tree of paths
+	unsigned int		nfiles;
+	unsigned int		nfailed;
+	unsigned long long	nsamples;
+	unsigned long long	nbytes;
+	unsigned int		ncarriers;
+};
+
+struct batch_file {
+	struct batch		*b;
+	FILE			*out;
+	minimodem_rx		*rx;
+	int			stopped;	// by SIGINT
+	unsigned long long	nbytes;
+	unsigned int		ncarriers;
+};
+
+struct batch_worker {
+	struct batch		*b;
+	pthread_t		thread;
+};
+
+static volatile sig_atomic_t batch_stop;
+
+static void
+batch_stop_sighandler( int sig )
+{
+    batch_stop = 1;
+}
+
+static double
+wall_sec( void )
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/*
+ * Output
+ */
+
+static void
+batch_rx_data( void *arg, const char *data, unsigned int nbytes )
+{
+    struct batch_file *bf = arg;
+
+    bf->nbytes += nbytes;
+    if ( bf->b->output_print_filter == 0 ) {
+	fwrite(data, 1, nbytes, bf->out);
+    } else {
+	for ( ; nbytes; data++,nbytes-- )
+	    fputc(isprint(*data)||isspace(*data) ? *data : '.', bf->out);
+    }
+}
+
+static void
+batch_rx_event( void *arg, const minimodem_rx_event *ev )
+{
+    struct batch_file *bf = arg;
+
+    if ( ev->type == MINIMODEM_RX_CARRIER )
+	bf->ncarriers++;
+}
+
+static void
+batch_rx_samples( void *arg, unsigned long long pos,
+	const float *samples, size_t nsamples )
+{
+    struct batch_file *bf = arg;
+
+    if ( batch_stop && !bf->stopped ) {
+	bf->stopped = 1;
+	minimodem_rx_stop(bf->rx);
+    }
+}
+
+static int
+batch_compare_path( const void *a, const void *b )
+{
+    return strcmp(a, b);
+}
+
+/* returns 0 if outpath was not already another file's output */
+static int
+batch_claim_output( struct batch *b, char *outpath )
+{
+    char *path = strdup(outpath);
+    if ( !path ) {
+	perror("malloc");
+	return -1;
+    }
+    pthread_mutex_lock(&b->lock);
+    char **node = tsearch(path, &b->outputs, batch_compare_path);
+    pthread_mutex_unlock(&b->lock);
+    if ( !node ) {
+	perror("malloc");
+	free(path);
+	return -1;
+    }
+    if ( *node != path ) {
+	free(path);
+	return -1;
+    }
+    return 0;
+}
+
+static FILE *
+batch_open_output( struct batch *b, const char *path )
+{
+    const char *output_dir = b->output_dir;
+    const char *base = path;
+    if ( output_dir ) {
+	base = strrchr(path, '/');
+	base = base ? base + 1 : path;
+    }
+
+    size_t outlen = (output_dir ? strlen(output_dir) + 1 : 0)
+			+ strlen(base) + sizeof(".txt");
+    char *outpath = malloc(outlen);
+    if ( !outpath ) {
+	perror("malloc");
+	return NULL;
+    }
+    if ( output_dir )
+	snprintf(outpath, outlen, "%s/%s.txt", output_dir, base);
+    else
+	snprintf(outpath, outlen, "%s.txt", base);
+    FILE *f = NULL;
+    if ( batch_claim_output(b, outpath) < 0 ) {
+	pthread_mutex_lock(&b->lock);
+	fprintf(stderr, "E: %s: %s is another file's output\n",
+		path, outpath);
+	pthread_mutex_unlock(&b->lock);
+    } else {
+	f = fopen(outpath, "w");
+	if ( !f )
+	    perror(outpath);
+    }
+    free(outpath);
+    return f;
+}
+
+
+/*
+ * Workers
+ */
+
+/* the next path from the list, or NULL at its end */
+static char *
+batch_next_path( struct batch *b, char **linep, size_t *line_sizep )
+{
+    char *path = NULL;
+
+    pthread_mutex_lock(&b->lock);
+    while ( !batch_stop ) {
+	ssize_t len = getline(linep, line_sizep, b->list);
+	if ( len < 0 )
+	    break;
+	while ( len > 0 && ((*linep)[len-1] == '\n'
+				|| (*linep)[len-1] == '\r') )
+	    (*linep)[--len] = 0;
+	if ( len > 0 ) {
+	    path = *linep;
+	    break;
+	}
+    }
+    pthread_mutex_unlock(&b->lock);
+
+    return path;
+}
+
+/*
+ * Decode the file path; *rxp is the worker's previous receiver, replaced
+ * by this file's.  Returns 0 on success.
+ */
+static int
+batch_decode( struct batch *b, const char *path,
+	struct batch_file *bf, minimodem_rx **rxp,
+	unsigned long long *nsamplesp )
+{
+    int ret = 1;
+
+    simpleaudio *sa = simpleaudio_open_stream(SA_BACKEND_FILE, NULL,
+				SA_STREAM_RECORD, SA_SAMPLE_FORMAT_FLOAT,
+				b->cfg->sample_rate, 1,
+				"minimodem", (char *)path);
+    if ( !sa )
+	return 1;
+
+    minimodem_config cfg = *b->cfg;
+    cfg.sample_rate = simpleaudio_get_rate(sa);
+    cfg.shed_load = 0;
+
+    bf->out = batch_open_output(b, path);
+    if ( !bf->out )
+	goto out;
+
+    minimodem_rx *rx = minimodem_rx_new(&cfg,
+				batch_rx_data, batch_rx_event, bf);
+    if ( !rx )
+	goto out;
+    if ( *rxp )
+	minimodem_rx_destroy(*rxp);
+    *rxp = rx;
+    bf->rx = rx;
+    minimodem_rx_set_samples_fn(rx, batch_rx_samples, bf);
+
+    if ( minimodem_rx_run(rx, sa) == 0 && !bf->stopped )
+	ret = 0;
+    *nsamplesp = minimodem_rx_tell(rx);
+
+out:
+    if ( bf->out && fclose(bf->out) != 0 ) {
+	perror(path);
+	ret = 1;
+    }
+    simpleaudio_close(sa);
+    return ret;
+}
+
+static void *
+batch_worker( void *arg )
+{
+    struct batch_worker *bw = arg;
+    struct batch *b = bw->b;
+    minimodem_rx *rx = NULL;
+    char *line = NULL;
+    size_t line_size = 0;
+    const char *path;
+
+    // leave SIGINT to the main thread
+    sigset_t sigs;
+    sigfillset(&sigs);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+    while ( (path = batch_next_path(b, &line, &line_size)) ) {
+	struct batch_file bf = { .b = b };
+	unsigned long long nsamples = 0;
+	int failed = batch_decode(b, path, &bf, &rx, &nsamples);
+
+	pthread_mutex_lock(&b->lock);
+	b->nfiles++;
+	if ( failed ) {
+	    b->nfailed++;
+	    fprintf(stderr, "%s: ### BATCH %s ###\n",
+		    path, bf.stopped ? "stopped" : "failed");
+	} else {
+	    b->nsamples += nsamples;
+	    b->nbytes += bf.nbytes;
+	    b->ncarriers += bf.ncarriers;
+	    if ( !b->quiet_mode )
+		fprintf(stderr, "%s: ### BATCH samples=%llu bytes=%llu"
+				" carriers=%u ###\n",
+			path, nsamples, bf.nbytes, bf.ncarriers);
+	}
+	pthread_mutex_unlock(&b->lock);
+    }
+
+    if ( rx )
+	minimodem_rx_destroy(rx);
+    free(line);
+    return NULL;
+}
+
+
+int
+minimodem_batch_run( const char *list_path, const minimodem_config *cfg,
+	unsigned int njobs, const char *output_dir,
+	int quiet_mode, int output_print_filter )
+{
+    unsigned int w;
+
+    struct batch b = {
+	.cfg = cfg,
+	.output_dir = output_dir,
+	.quiet_mode = quiet_mode,
+	.output_print_filter = output_print_filter,
+    };
+
+    if ( strcmp(list_path, "-") == 0 ) {
+	b.list = stdin;
+    } else {
+	b.list = fopen(list_path, "r");
+	if ( !b.list ) {
+	    perror(list_path);
+	    return 1;
+	}
+    }
+
+    if ( njobs == 0 ) {
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	njobs = ncpus > 0 ? ncpus : 1;
+    }
+    struct batch_worker *workers = calloc(njobs, sizeof(*workers));
+    if ( !workers ) {
+	perror("malloc");
+	if ( b.list != stdin )
+	    fclose(b.list);
+	return 1;
+    }
+    pthread_mutex_init(&b.lock, NULL);
+
+    batch_stop = 0;
+    signal(SIGINT, batch_stop_sighandler);
+
+    double t_start = wall_sec();
+
+    int ret = 0;
+    for ( w=0; w<njobs; w++ ) {
+	workers[w].b = &b;
+	if ( pthread_create(&workers[w].thread, NULL,
+				batch_worker, &workers[w]) != 0 ) {
+	    perror("pthread_create");
+	    ret = 1;
+	    break;
+	}
+    }
+    unsigned int nstarted = w;
+    for ( w=0; w<nstarted; w++ )
+	pthread_join(workers[w].thread, NULL);
+
+    double wall = wall_sec() - t_start;
+
+    signal(SIGINT, SIG_DFL);
+
+    if ( b.nfailed )
+	ret = 1;
+
+    fprintf(stderr, "### BATCH files=%u failed=%u samples=%llu bytes=%llu"
+		    " carriers=%u wall=%.2fs files/s=%.1f samples/s=%.0f"
+		    " jobs=%u ###\n",
+	    b.nfiles, b.nfailed, b.nsamples, b.nbytes, b.ncarriers, wall,
+	    wall > 0.0 ? b.nfiles / wall : 0.0,
+	    wall > 0.0 ? b.nsamples / wall : 0.0,
+	    nstarted);
+
+    tdestroy(b.outputs, free);
+    pthread_mutex_destroy(&b.lock);
+    free(workers);
+    if ( b.list != stdin )
+	fclose(b.list);
+    return ret;
+}
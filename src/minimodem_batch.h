@@ -0,0 +1,38 @@
+/*
+ * minimodem_batch.h
+ *
+ * Copyright (C) 2011-2016 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MINIMODEM_BATCH_H
+#define MINIMODEM_BATCH_H
+
+#include "libminimodem.h"
+
+/*
+ * Decode each of the audio files listed, one path per line, in the file
+ * list_path ("-" for stdin), on njobs worker threads (0 for one per CPU).
+ * File path's data goes to "path.txt", or with output_dir, to
+ * "output_dir/basename.txt".  Reports each file on stderr (unless
+ * quiet_mode) and a summary of the whole batch at the end.  Returns the
+ * process exit status, 1 if any file could not be decoded.
+ */
+int
+minimodem_batch_run( const char *list_path, const minimodem_config *cfg,
+	unsigned int njobs, const char *output_dir,
+	int quiet_mode, int output_print_filter );
+
+#endif
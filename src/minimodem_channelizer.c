@@ -0,0 +1,596 @@
+/*
+ * minimodem_channelizer.c
+ *
+ * minimodem - software audio Bell-type or RTTY FSK modem
+ *
+ * Copyright (C) 2011-2016 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "libminimodem.h"
+#include "fsk.h"
+
+
+/*
+ * Wideband channelizer
+ *
+ * An overlap-save (fast convolution) filter bank.  Each frame of fftsize
+ * input samples (advancing by fftsize/2) gets one forward FFT, shared by
+ * every sub-channel.  A sub-channel copies the bins around its FSK pair,
+ * weighted by its (raised cosine edged) band-pass response, down to an
+ * IF of a quarter of its decimated sample rate, then an inverse FFT of
+ * fftsize/decimate points gives it fftsize/2/decimate new real samples at
+ * that rate.  So beyond the shared FFT, a sub-channel costs one small
+ * inverse FFT per frame, plus its receiver running at the low rate.
+ *
+ * The same forward FFTs, power-averaged over about half a second, are
+ * searched for pairs of bands a {baudmode} shift apart both holding
+ * power well above the noise floor: each such pair not already covered
+ * gets a new sub-channel (up to max_channels).  A
+ * sub-channel whose pair hasn't been seen for a while, and which has no
+ * carrier, is closed again.
+ */
+
+#define CHZ_DETECT_SEC		0.5f	// spectrum averaging time
+#define CHZ_RETIRE_SEC		20.0f	// idle time before closing
+#define CHZ_DETECT_SNR		10.0f	// tone power vs. the median (10 dB)
+#define CHZ_DETECT_RANGE	1e-3f	//   and vs. the strongest (-30 dB)
+#define CHZ_MAX_PEAKS		64	// candidate pairs per round
+
+struct chz_sub {
+	struct minimodem_channelizer *chz;
+	unsigned int	n;
+	float		center_f;		// input frequencies
+	int		shift_nbins;		// input bin - IF bin
+	unsigned int	b_lo, b_hi;		// input bins passed
+	float		*gain;			// [b_hi - b_lo + 1]
+	minimodem_rx	*rx;			// NULL: skipped
+	void		*cb_arg;
+	int		carrier;
+	unsigned int	last_seen;		// detection round
+};
+
+struct minimodem_channelizer {
+	minimodem_config	cfg;
+	unsigned int		max_channels;
+	minimodem_channel_open_fn	*open_fn;
+	minimodem_channel_close_fn	*close_fn;
+	minimodem_rx_data_fn	*data_fn;
+	minimodem_rx_event_fn	*event_fn;
+	void			*arg;
+
+	float		shift;			// |mark - space|
+	float		sub_band_width;		// flat passband
+	float		sub_taper;		//   plus this, each side
+	unsigned int	fftsize;
+	unsigned int	decimate;
+	unsigned int	sub_fftsize;		// fftsize / decimate
+	float		bin_width;		// Hz, both sides
+	float		min_center_f, max_center_f;	// (tones inside)
+
+	fftwf_plan	fwd_plan, inv_plan;
+	float		*frame;			// [fftsize]
+	fftwf_complex	*spectrum;		// [fftsize/2+1]
+	fftwf_complex	*sub_spectrum;		// [sub_fftsize/2+1]
+	float		*sub_samples;		// [sub_fftsize]
+	size_t		frame_nfill;		// new samples in the 2nd half
+	unsigned long long nframes;
+
+	fftwf_complex	*history;		// the last detect_nframes
+						//   spectra, by frame number
+	float		*power;			// [fftsize/2+1]
+	float		*power_sorted;
+	double		*power_cum;		// [fftsize/2+1]
+	float		*score;			// [fftsize/2]
+	unsigned int	power_nframes, detect_nframes;
+	unsigned int	round, retire_nrounds;
+
+	struct chz_sub	**subs;			// [max_channels]
+	unsigned int	nsubs;
+	unsigned int	next_n;
+};
+
+
+/*
+ * Sub-channels
+ */
+
+static void
+chz_sub_data( void *arg, const char *data, unsigned int nbytes )
+{
+    struct chz_sub *sub = arg;
+    sub->chz->data_fn(sub->cb_arg, data, nbytes);
+}
+
+static void
+chz_sub_event( void *arg, const minimodem_rx_event *ev )
+{
+    struct chz_sub *sub = arg;
+    if ( ev->type == MINIMODEM_RX_CARRIER )
+	sub->carrier = 1;
+    else if ( ev->type == MINIMODEM_RX_NOCARRIER )
+	sub->carrier = 0;
+    sub->chz->event_fn(sub->cb_arg, ev);
+}
+
+static void
+chz_sub_close( struct minimodem_channelizer *chz, unsigned int i )
+{
+    struct chz_sub *sub = chz->subs[i];
+
+    if ( sub->rx ) {
+	minimodem_rx_flush(sub->rx);
+	minimodem_rx_destroy(sub->rx);
+	if ( chz->close_fn )
+	    chz->close_fn(chz->arg, sub->cb_arg);
+    }
+    free(sub->gain);
+    free(sub);
+
+    chz->subs[i] = chz->subs[--chz->nsubs];
+}
+
+static void
+chz_sub_run( struct minimodem_channelizer *chz, struct chz_sub *sub,
+	const fftwf_complex *x, unsigned long long frame )
+{
+    if ( !sub->rx )
+	return;
+
+    unsigned int sub_nbins = chz->sub_fftsize / 2 + 1;
+    fftwf_complex *y = chz->sub_spectrum;
+    memset(y, 0, sub_nbins * sizeof(fftwf_complex));
+
+    // The bin shift turns each frame's phase by pi * shift_nbins (the
+    // frames are half an FFT apart): undo that to keep it continuous.
+    float sign = (sub->shift_nbins & 1) && (frame & 1) ? -1.0f : 1.0f;
+
+    unsigned int b;
+    for ( b=sub->b_lo; b<=sub->b_hi; b++ ) {
+	float g = sign * sub->gain[b - sub->b_lo];
+	unsigned int k = b - sub->shift_nbins;
+	y[k][0] = x[b][0] * g;
+	y[k][1] = x[b][1] * g;
+    }
+
+    fftwf_execute_dft_c2r(chz->inv_plan, y, chz->sub_samples);
+
+    // overlap-save: the first half is wrapped around, the second is new
+    minimodem_rx_push(sub->rx, chz->sub_samples + chz->sub_fftsize / 2,
+			chz->sub_fftsize / 2);
+}
+
+
+static int
+chz_sub_open( struct minimodem_channelizer *chz, float center_f )
+{
+    minimodem_config *cfg = &chz->cfg;
+
+    struct chz_sub *sub = calloc(1, sizeof(*sub));
+    if ( !sub )
+	return -1;
+    sub->chz = chz;
+    sub->n = ++chz->next_n;
+    sub->center_f = center_f;
+    sub->last_seen = chz->round;
+
+    // move the center bin to the IF bin (a quarter of the sub rate)
+    unsigned int b_center = center_f / chz->bin_width + 0.5f;
+    unsigned int b_if = chz->sub_fftsize / 4;
+    sub->shift_nbins = (int)b_center - (int)b_if;
+
+    float half_width = chz->sub_band_width / 2 + chz->sub_taper;
+    unsigned int b_half = ceilf(half_width / chz->bin_width);
+    assert( b_half < b_if );
+    // (the passband may be cut off at 0 Hz or at the Nyquist rate)
+    sub->b_lo = b_center > b_half ? b_center - b_half : 1;
+    sub->b_hi = b_center + b_half;
+    if ( sub->b_hi > chz->fftsize / 2 - 1 )
+	sub->b_hi = chz->fftsize / 2 - 1;
+
+    sub->gain = malloc((sub->b_hi - sub->b_lo + 1) * sizeof(float));
+    if ( !sub->gain ) {
+	free(sub);
+	return -1;
+    }
+    unsigned int b;
+    for ( b=sub->b_lo; b<=sub->b_hi; b++ ) {
+	float d = fabsf(b * chz->bin_width - center_f)
+			- chz->sub_band_width / 2;
+	float g;
+	if ( d <= 0.0f )
+	    g = 1.0f;
+	else if ( d < chz->sub_taper )
+	    g = 0.5f * (1.0f + cosf(M_PI * d / chz->sub_taper));
+	else
+	    g = 0.0f;
+	// (and the inverse FFT's scaling)
+	sub->gain[b - sub->b_lo] = g / chz->fftsize;
+    }
+
+    float mark_f, space_f;
+    if ( cfg->bfsk_mark_f > cfg->bfsk_space_f ) {
+	mark_f = center_f + chz->shift / 2;
+	space_f = center_f - chz->shift / 2;
+    } else {
+	mark_f = center_f - chz->shift / 2;
+	space_f = center_f + chz->shift / 2;
+    }
+
+    minimodem_config sub_cfg = *cfg;
+    float if_offset = sub->shift_nbins * chz->bin_width;
+    sub_cfg.sample_rate = cfg->sample_rate / chz->decimate;
+    sub_cfg.bfsk_mark_f = mark_f - if_offset;
+    sub_cfg.bfsk_space_f = space_f - if_offset;
+    sub_cfg.bfsk_inverted_freqs = 0;	// (already applied)
+
+    // A pair the application can't take is kept, undecoded, so that it
+    // isn't offered again for as long as it is seen.
+    sub->cb_arg = chz->open_fn(chz->arg, sub->n, mark_f, space_f);
+    if ( !sub->cb_arg ) {
+	chz->subs[chz->nsubs++] = sub;
+	return 0;
+    }
+    sub->rx = minimodem_rx_new(&sub_cfg, chz_sub_data, chz_sub_event, sub);
+    if ( !sub->rx ) {
+	if ( chz->close_fn )
+	    chz->close_fn(chz->arg, sub->cb_arg);
+	free(sub->gain);
+	free(sub);
+	return -1;
+    }
+
+    chz->subs[chz->nsubs++] = sub;
+
+    // Catch up on the frames the pair was found in, so as not to miss
+    // the start of the transmission.
+    unsigned int nbins = chz->fftsize / 2 + 1;
+    unsigned long long frame = chz->nframes > chz->detect_nframes
+			? chz->nframes - chz->detect_nframes : 0;
+    for ( ; frame<chz->nframes; frame++ )
+	chz_sub_run(chz, sub, chz->history
+			+ (frame % chz->detect_nframes) * nbins, frame);
+    return 0;
+}
+
+/*
+ * Detection
+ */
+
+static int
+chz_compare_float( const void *a, const void *b )
+{
+    float fa = *(const float *)a, fb = *(const float *)b;
+    return fa < fb ? -1 : fa > fb;
+}
+
+/* the power weighted mean bin within hw bins of b */
+static float
+chz_centroid( struct minimodem_channelizer *chz, unsigned int b,
+	unsigned int hw )
+{
+    double sum = 0.0, moment = 0.0;
+    unsigned int k;
+    for ( k=b-hw; k<=b+hw; k++ ) {
+	sum += chz->power[k];
+	moment += (double)k * chz->power[k];
+    }
+    return sum > 0.0 ? moment / sum : b;
+}
+
+static void
+chz_detect( struct minimodem_channelizer *chz )
+{
+    unsigned int b_max = chz->fftsize / 2 - 1;
+    unsigned int nbins = b_max;		// 1 .. b_max
+    unsigned int b, c, i;
+
+    memcpy(chz->power_sorted, chz->power + 1, nbins * sizeof(float));
+    qsort(chz->power_sorted, nbins, sizeof(float), chz_compare_float);
+    float median = chz->power_sorted[nbins / 2];
+    if ( chz->power_sorted[nbins - 1] <= 0.0f )
+	return;		// silence
+
+    // The power within a baud (or half the shift) of each bin; the tones
+    // of a pair only show as spectral lines for wide shifts, but there is
+    // always energy around them.
+    float band_width = fminf(chz->cfg.bfsk_data_rate, chz->shift / 2);
+    unsigned int hw = band_width / 2 / chz->bin_width + 0.5f;
+    if ( hw < 1 )
+	hw = 1;
+    double *cum = chz->power_cum;
+    cum[0] = 0.0;
+    for ( b=0; b<=b_max; b++ )
+	cum[b+1] = cum[b] + chz->power[b];
+
+    // A center scores the weaker of the powers around its two tones.
+    float half_shift_nbins = chz->shift / 2 / chz->bin_width;
+    unsigned int c_min = ceilf(chz->min_center_f / chz->bin_width);
+    unsigned int c_max = chz->max_center_f / chz->bin_width;
+    float *score = chz->score;
+    float max_score = 0.0f;
+    for ( c=0; c<=b_max; c++ ) {
+	score[c] = 0.0f;
+	int lo = (int)(c - half_shift_nbins + 0.5f);
+	int hi = (int)(c + half_shift_nbins + 0.5f);
+	if ( c < c_min || c > c_max || lo - (int)hw < 1
+		|| hi + hw > b_max )
+	    continue;
+	double e_lo = cum[lo + hw + 1] - cum[lo - hw];
+	double e_hi = cum[hi + hw + 1] - cum[hi - hw];
+	score[c] = fmin(e_lo, e_hi);
+	if ( score[c] > max_score )
+	    max_score = score[c];
+    }
+    float threshold = fmaxf(median * (2 * hw + 1) * CHZ_DETECT_SNR,
+			max_score * CHZ_DETECT_RANGE);
+
+    // The candidates: scores above the threshold which are the highest
+    // within half a shift.
+    unsigned int nms_nbins = half_shift_nbins;
+    float cand_f[CHZ_MAX_PEAKS], cand_s[CHZ_MAX_PEAKS];
+    unsigned int ncands = 0;
+    for ( c=1; c<b_max && ncands<CHZ_MAX_PEAKS; c++ ) {
+	float s = score[c];
+	if ( s <= threshold )
+	    continue;
+	unsigned int lo = c > nms_nbins ? c - nms_nbins : 0;
+	unsigned int hi = c + nms_nbins < b_max ? c + nms_nbins : b_max;
+	unsigned int k;
+	for ( k=lo; k<=hi; k++ )
+	    if ( score[k] > s || (score[k] == s && k < c) )
+		break;
+	if ( k <= hi )
+	    continue;
+	// (refined to halfway between the tones' power centroids)
+	unsigned int b_lo = c - half_shift_nbins + 0.5f;
+	unsigned int b_hi = c + half_shift_nbins + 0.5f;
+	cand_f[ncands] = (chz_centroid(chz, b_lo, hw)
+			+ chz_centroid(chz, b_hi, hw)) / 2 * chz->bin_width;
+	cand_s[ncands++] = s;
+    }
+
+    // Take them strongest first, skipping any whose band overlaps a
+    // stronger one's (its keying sidebands).
+    int used[CHZ_MAX_PEAKS] = { 0 };
+    while ( 1 ) {
+	int best = -1;
+	for ( i=0; i<ncands; i++ )
+	    if ( !used[i] && (best < 0 || cand_s[i] > cand_s[best]) )
+		best = i;
+	if ( best < 0 )
+	    break;
+	float center_f = cand_f[best];
+	for ( i=0; i<ncands; i++ )
+	    if ( fabsf(cand_f[i] - center_f) < chz->sub_band_width )
+		used[i] = 1;
+
+	unsigned int s;
+	for ( s=0; s<chz->nsubs; s++ )
+	    if ( fabsf(chz->subs[s]->center_f - center_f) < chz->shift / 2 )
+		break;
+	if ( s < chz->nsubs )
+	    chz->subs[s]->last_seen = chz->round;
+	else if ( chz->nsubs < chz->max_channels )
+	    chz_sub_open(chz, center_f);
+    }
+}
+
+static void
+chz_retire( struct minimodem_channelizer *chz )
+{
+    unsigned int i;
+
+    // close the quiet ones
+    for ( i=0; i<chz->nsubs; ) {
+	struct chz_sub *sub = chz->subs[i];
+	if ( !sub->carrier
+		&& chz->round - sub->last_seen > chz->retire_nrounds )
+	    chz_sub_close(chz, i);
+	else
+	    i++;
+    }
+}
+
+static void
+chz_run_frame( struct minimodem_channelizer *chz )
+{
+    unsigned int nbins = chz->fftsize / 2 + 1;
+    unsigned int b, i;
+
+    fftwf_execute_dft_r2c(chz->fwd_plan, chz->frame, chz->spectrum);
+
+    // (Hann windowed for the detection, by convolving with its three
+    // nonzero bins: the frame itself can't be, and the leakage of the
+    // strong pairs would look like weaker ones)
+    const fftwf_complex *x = chz->spectrum;
+    for ( b=1; b<nbins-1; b++ ) {
+	float re = 0.5f * x[b][0] - 0.25f * (x[b-1][0] + x[b+1][0]);
+	float im = 0.5f * x[b][1] - 0.25f * (x[b-1][1] + x[b+1][1]);
+	chz->power[b] += re * re + im * im;
+    }
+
+    for ( i=0; i<chz->nsubs; i++ )
+	chz_sub_run(chz, chz->subs[i], chz->spectrum, chz->nframes);
+
+    memcpy(chz->history + (chz->nframes % chz->detect_nframes) * nbins,
+		chz->spectrum, nbins * sizeof(fftwf_complex));
+    chz->nframes++;
+
+    if ( ++chz->power_nframes == chz->detect_nframes ) {
+	chz_detect(chz);
+	chz_retire(chz);
+	chz->round++;
+	memset(chz->power, 0, nbins * sizeof(float));
+	chz->power_nframes = 0;
+    }
+
+    // slide the frame along by half
+    memcpy(chz->frame, chz->frame + chz->fftsize / 2,
+		chz->fftsize / 2 * sizeof(float));
+    chz->frame_nfill = 0;
+}
+
+
+/*
+ * API
+ */
+
+minimodem_channelizer *
+minimodem_channelizer_new( const minimodem_config *cfg,
+	unsigned int max_channels,
+	minimodem_channel_open_fn *open_fn,
+	minimodem_channel_close_fn *close_fn,
+	minimodem_rx_data_fn *data_fn,
+	minimodem_rx_event_fn *event_fn,
+	void *arg )
+{
+    minimodem_channelizer *chz = calloc(1, sizeof(*chz));
+    if ( !chz )
+	return NULL;
+
+    chz->cfg = *cfg;
+    chz->max_channels = max_channels;
+    chz->open_fn = open_fn;
+    chz->close_fn = close_fn;
+    chz->data_fn = data_fn;
+    chz->event_fn = event_fn;
+    chz->arg = arg;
+
+    float sample_rate = cfg->sample_rate;
+    chz->shift = fabsf(cfg->bfsk_mark_f - cfg->bfsk_space_f);
+    chz->sub_band_width = chz->shift + 3 * cfg->bfsk_data_rate;
+    chz->sub_taper = chz->sub_band_width / 4;
+
+    // bins fine enough for the pair detection, and for the filter's
+    // impulse response to fit in the half frame overlap-save discards
+    chz->fftsize = 256;
+    while ( chz->fftsize < 16 * sample_rate / chz->shift )
+	chz->fftsize *= 2;
+    chz->bin_width = sample_rate / chz->fftsize;
+
+    // decimate as far as leaves 4x the sub-channel bandwidth
+    chz->decimate = 1;
+    while ( sample_rate / (chz->decimate * 2) >= 4 * chz->sub_band_width
+	    && chz->fftsize / (chz->decimate * 2) >= 64 )
+	chz->decimate *= 2;
+    chz->sub_fftsize = chz->fftsize / chz->decimate;
+
+    chz->min_center_f = chz->shift / 2 + cfg->bfsk_data_rate;
+    chz->max_center_f = sample_rate / 2 - chz->min_center_f;
+    if ( chz->max_center_f <= chz->min_center_f
+	    || sample_rate / chz->decimate < 4 * chz->sub_band_width ) {
+	fprintf(stderr, "E: the sample rate is too low to channelize"
+			" this {baudmode}\n");
+	free(chz);
+	return NULL;
+    }
+
+    float hop_sec = chz->fftsize / 2 / sample_rate;
+    chz->detect_nframes = CHZ_DETECT_SEC / hop_sec + 0.5f;
+    if ( chz->detect_nframes == 0 )
+	chz->detect_nframes = 1;
+    chz->retire_nrounds = CHZ_RETIRE_SEC / CHZ_DETECT_SEC;
+
+    unsigned int nbins = chz->fftsize / 2 + 1;
+    chz->fwd_plan = fsk_fft_plan_get(chz->fftsize, /*inverse*/0);
+    chz->inv_plan = fsk_fft_plan_get(chz->sub_fftsize, /*inverse*/1);
+    chz->frame = fftwf_malloc(chz->fftsize * sizeof(float));
+    chz->spectrum = fftwf_malloc(nbins * sizeof(fftwf_complex));
+    chz->sub_spectrum = fftwf_malloc((chz->sub_fftsize / 2 + 1)
+					* sizeof(fftwf_complex));
+    chz->sub_samples = fftwf_malloc(chz->sub_fftsize * sizeof(float));
+    chz->history = fftwf_malloc(chz->detect_nframes * nbins
+					* sizeof(fftwf_complex));
+    chz->power = calloc(nbins, sizeof(float));
+    chz->power_sorted = malloc(nbins * sizeof(float));
+    chz->power_cum = malloc(nbins * sizeof(double));
+    chz->score = malloc(nbins * sizeof(float));
+    chz->subs = calloc(max_channels, sizeof(struct chz_sub *));
+    if ( !chz->fwd_plan || !chz->inv_plan || !chz->frame || !chz->spectrum
+	    || !chz->sub_spectrum || !chz->sub_samples || !chz->history
+	    || !chz->power || !chz->power_sorted || !chz->power_cum
+	    || !chz->score || !chz->subs ) {
+	minimodem_channelizer_destroy(chz);
+	return NULL;
+    }
+    // the first frame starts half a frame before the stream does
+    memset(chz->frame, 0, chz->fftsize * sizeof(float));
+
+    return chz;
+}
+
+void
+minimodem_channelizer_destroy( minimodem_channelizer *chz )
+{
+    while ( chz->nsubs )
+	chz_sub_close(chz, chz->nsubs - 1);
+    if ( chz->fwd_plan )
+	fsk_fft_plan_put(chz->fwd_plan);
+    if ( chz->inv_plan )
+	fsk_fft_plan_put(chz->inv_plan);
+    fftwf_free(chz->frame);
+    fftwf_free(chz->spectrum);
+    fftwf_free(chz->sub_spectrum);
+    fftwf_free(chz->sub_samples);
+    fftwf_free(chz->history);
+    free(chz->power);
+    free(chz->power_sorted);
+    free(chz->power_cum);
+    free(chz->score);
+    free(chz->subs);
+    free(chz);
+}
+
+void
+minimodem_channelizer_push( minimodem_channelizer *chz,
+	const float *samples, size_t nsamples )
+{
+    size_t half = chz->fftsize / 2;
+    while ( nsamples ) {
+	size_t n = half - chz->frame_nfill;
+	if ( n > nsamples )
+	    n = nsamples;
+	memcpy(chz->frame + half + chz->frame_nfill, samples,
+		n * sizeof(float));
+	chz->frame_nfill += n;
+	samples += n;
+	nsamples -= n;
+	if ( chz->frame_nfill == half )
+	    chz_run_frame(chz);
+    }
+}
+
+void
+minimodem_channelizer_flush( minimodem_channelizer *chz )
+{
+    size_t half = chz->fftsize / 2;
+    unsigned int i;
+
+    if ( chz->frame_nfill ) {
+	memset(chz->frame + half + chz->frame_nfill, 0,
+		(half - chz->frame_nfill) * sizeof(float));
+	chz_run_frame(chz);
+    }
+    for ( i=0; i<chz->nsubs; i++ )
+	if ( chz->subs[i]->rx )
+	    minimodem_rx_flush(chz->subs[i]->rx);
+}
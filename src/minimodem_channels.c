@@ -0,0 +1,617 @@
+/*
+ * minimodem_channels.c
+ *
+ * minimodem - software audio Bell-type or RTTY FSK modem
+ *
+ * Copyright (C) 2011-2016 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "minimodem_channels.h"
+
+
+/*
+ * Multi-channel, multi-mode receive.
+ *
+ * Each (channel, mode) pair is a "lane", with its own minimodem_rx.  The
+ * main thread reads a block of interleaved frames and deinterleaves it,
+ * in one pass, into one buffer per channel, which all of that channel's
+ * lanes then read.  The worker threads each push their share of the
+ * lanes (lane l belongs to worker l % nworkers) through the lanes'
+ * receivers, while the main thread reads and deinterleaves the next
+ * block into the other set of buffers.
+ *
+ * A channel's lanes share its output, and without an output pattern all
+ * the channels share stdout.  Wherever several lanes share an output,
+ * each lane collects its data into lines and writes them whole, prefixed
+ * with its label, under the output's lock (the channel's out_lock, or
+ * stdout_lock); a line is cut short at the end of a carrier or after
+ * LANE_LINE_MAX bytes.
+ */
+
+#define LANE_LINE_MAX	256
+
+struct channel {
+	unsigned int		n;		// from 1
+	FILE			*out;		// shared by the channel's lanes
+	pthread_mutex_t		out_lock;	// (if labeled, and not stdout)
+	float			*buf[2];
+};
+
+struct lane {
+	struct channels		*m;
+	struct channel		*ch;
+	char			label[32];	// "ch2", "1200" or "ch2/1200"
+	float			bfsk_data_rate;
+	minimodem_rx		*rx;
+	int			done;
+
+	int			labeled;	// label each line of output
+	size_t			line_len;
+	char			line[LANE_LINE_MAX + 1];	// + '\n'
+
+	/* stats (only touched by the lane's worker) */
+	unsigned long long	nsamples;
+	unsigned long long	nbytes;
+	unsigned int		ncarriers;
+};
+
+struct channels {
+	struct channel		*chans;
+	unsigned int		nchannels;
+	struct lane		*lanes;
+	unsigned int		nlanes;
+	unsigned int		nworkers;
+	int			quiet_mode;
+	int			output_print_filter;
+
+	pthread_mutex_t		lock;
+	pthread_cond_t		go_cond;	// main -> workers
+	pthread_cond_t		done_cond;	// workers -> main
+	unsigned long		gen;		// block number; buf[gen & 1]
+	size_t			block_nframes[2];
+	int			eof;
+	unsigned int		nbusy;		// workers still on this block
+};
+
+struct channel_worker {
+	struct channels		*m;
+	unsigned int		w;
+	pthread_t		thread;
+};
+
+static volatile sig_atomic_t channels_stop;
+
+static pthread_mutex_t stdout_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+channels_stop_sighandler( int sig )
+{
+    channels_stop = 1;
+}
+
+
+/*
+ * Output
+ */
+
+static void
+lane_write_line( struct lane *lane )
+{
+    struct channel *ch = lane->ch;
+    if ( lane->line_len == 0 )
+	return;
+    pthread_mutex_t *lock = ch->out == stdout ? &stdout_lock : &ch->out_lock;
+    pthread_mutex_lock(lock);
+    fprintf(ch->out, "%s: ", lane->label);
+    fwrite(lane->line, 1, lane->line_len, ch->out);
+    if ( lane->line[lane->line_len - 1] != '\n' )
+	fputc('\n', ch->out);
+    pthread_mutex_unlock(lock);
+    lane->line_len = 0;
+}
+
+static void
+lane_rx_data( void *arg, const char *data, unsigned int nbytes )
+{
+    struct lane *lane = arg;
+    FILE *out = lane->ch->out;
+
+    lane->nbytes += nbytes;
+    if ( lane->labeled ) {
+	for ( ; nbytes; data++,nbytes-- ) {
+	    char c = *data;
+	    if ( lane->m->output_print_filter && !isprint(c) && !isspace(c) )
+		c = '.';
+	    if ( c != '\n' && lane->line_len == LANE_LINE_MAX )
+		lane_write_line(lane);
+	    lane->line[lane->line_len++] = c;
+	    if ( c == '\n' )
+		lane_write_line(lane);
+	}
+    } else if ( lane->m->output_print_filter == 0 ) {
+	fwrite(data, 1, nbytes, out);
+    } else {
+	for ( ; nbytes; data++,nbytes-- )
+	    fputc(isprint(*data)||isspace(*data) ? *data : '.', out);
+    }
+}
+
+static void
+lane_rx_event( void *arg, const minimodem_rx_event *ev )
+{
+    struct lane *lane = arg;
+    float bfsk_data_rate = lane->bfsk_data_rate;
+
+    if ( ev->type == MINIMODEM_RX_CARRIER )
+	lane->ncarriers++;
+    if ( ev->type == MINIMODEM_RX_NOCARRIER && lane->labeled )
+	lane_write_line(lane);
+
+    if ( lane->m->quiet_mode )
+	return;
+
+    // as the daemon's, prefixed with the lane's label
+    switch ( ev->type ) {
+	case MINIMODEM_RX_CARRIER:
+	    if ( bfsk_data_rate >= 100 )
+		fprintf(stderr, "%s: ### CARRIER %u @ %.1f Hz ###\n",
+			lane->label, (unsigned int)(bfsk_data_rate + 0.5f),
+			(double)ev->carrier_freq);
+	    else
+		fprintf(stderr, "%s: ### CARRIER %.2f @ %.1f Hz ###\n",
+			lane->label, (double)bfsk_data_rate,
+			(double)ev->carrier_freq);
+	    break;
+	case MINIMODEM_RX_NOCARRIER:
+	    fprintf(stderr, "%s: ### NOCARRIER ndata=%u confidence=%.3f"
+			" ampl=%.3f bps=%.2f ###\n",
+		    lane->label, ev->nframes_decoded,
+		    (double)ev->confidence, (double)ev->amplitude,
+		    (double)ev->throughput_rate);
+	    break;
+	case MINIMODEM_RX_LOADSHED:
+	    break;
+    }
+}
+
+
+/*
+ * Workers
+ */
+
+static void *
+channel_worker( void *arg )
+{
+    struct channel_worker *cw = arg;
+    struct channels *m = cw->m;
+    unsigned long gen = 0;
+    unsigned int l;
+    int eof;
+
+    // leave SIGINT to the main thread
+    sigset_t sigs;
+    sigfillset(&sigs);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+    do {
+	pthread_mutex_lock(&m->lock);
+	while ( m->gen == gen )
+	    pthread_cond_wait(&m->go_cond, &m->lock);
+	gen = m->gen;
+	eof = m->eof;
+	size_t nframes = m->block_nframes[gen & 1];
+	pthread_mutex_unlock(&m->lock);
+
+	for ( l=cw->w; l<m->nlanes; l+=m->nworkers ) {
+	    struct lane *lane = &m->lanes[l];
+	    if ( lane->done )
+		continue;
+	    if ( nframes ) {
+		lane->nsamples += nframes;
+		if ( minimodem_rx_push(lane->rx, lane->ch->buf[gen & 1],
+					nframes) )
+		    lane->done = 1;
+	    }
+	    if ( eof && !lane->done ) {
+		minimodem_rx_flush(lane->rx);
+		lane->done = 1;
+	    }
+	    fflush(lane->ch->out);
+	}
+
+	pthread_mutex_lock(&m->lock);
+	if ( --m->nbusy == 0 )
+	    pthread_cond_signal(&m->done_cond);
+	pthread_mutex_unlock(&m->lock);
+    } while ( !eof );
+
+    return NULL;
+}
+
+/* called with m->lock held */
+static void
+channels_wait_idle( struct channels *m )
+{
+    while ( m->nbusy )
+	pthread_cond_wait(&m->done_cond, &m->lock);
+}
+
+static int
+channels_all_done( struct channels *m )
+{
+    unsigned int l;
+    for ( l=0; l<m->nlanes; l++ )
+	if ( !m->lanes[l].done )
+	    return 0;
+    return 1;
+}
+
+
+/*
+ * Setup
+ */
+
+static int
+channel_check_pattern( const char *output_pattern )
+{
+    // the pattern is used as a format: allow exactly one "%u"
+    const char *p = strchr(output_pattern, '%');
+    if ( !p || strncmp(p, "%u", 2) != 0 || strchr(p + 2, '%') ) {
+	fprintf(stderr, "E: --channel-output {pattern} must contain"
+			" exactly one %%u\n");
+	return -1;
+    }
+    return 0;
+}
+
+static FILE *
+channel_open_output( const char *output_pattern, unsigned int n )
+{
+    if ( !output_pattern )
+	return stdout;
+    if ( channel_check_pattern(output_pattern) < 0 )
+	return NULL;
+
+    size_t pathlen = strlen(output_pattern) + 16;
+    char *path = malloc(pathlen);
+    if ( !path ) {
+	perror("malloc");
+	return NULL;
+    }
+    snprintf(path, pathlen, output_pattern, n);
+    FILE *f = fopen(path, "w");
+    if ( !f )
+	perror(path);
+    free(path);
+    return f;
+}
+
+int
+minimodem_channels_run( simpleaudio *sa,
+	const minimodem_config *cfgs, const char * const *mode_names,
+	unsigned int nmodes, const char *output_pattern,
+	int quiet_mode, int output_print_filter )
+{
+    unsigned int nchannels = simpleaudio_get_channels(sa);
+    unsigned int c, i, l, w;
+    int ret = 1;
+
+    struct channels m = {
+	.nchannels = nchannels,
+	.nlanes = nchannels * nmodes,
+	.quiet_mode = quiet_mode,
+	.output_print_filter = output_print_filter,
+    };
+    pthread_mutex_init(&m.lock, NULL);
+    pthread_cond_init(&m.go_cond, NULL);
+    pthread_cond_init(&m.done_cond, NULL);
+
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    m.nworkers = ncpus > 0 && ncpus < m.nlanes ? ncpus : m.nlanes;
+
+    // 100 ms blocks
+    size_t block_nframes = cfgs[0].sample_rate / 10;
+    if ( block_nframes == 0 )
+	block_nframes = 1;
+
+    // mono input is read straight into the channel buffers
+    float *ibuf = NULL;
+    if ( nchannels > 1 )
+	ibuf = malloc(block_nframes * nchannels * sizeof(float));
+    m.chans = calloc(nchannels, sizeof(struct channel));
+    if ( m.chans )
+	for ( c=0; c<nchannels; c++ )
+	    pthread_mutex_init(&m.chans[c].out_lock, NULL);
+    m.lanes = calloc(m.nlanes, sizeof(struct lane));
+    struct channel_worker *workers = calloc(m.nworkers,
+					sizeof(struct channel_worker));
+    if ( (nchannels > 1 && !ibuf) || !m.chans || !m.lanes || !workers ) {
+	perror("malloc");
+	goto out;
+    }
+
+    for ( c=0; c<nchannels; c++ ) {
+	struct channel *ch = &m.chans[c];
+	ch->n = c + 1;
+	ch->buf[0] = malloc(block_nframes * sizeof(float));
+	ch->buf[1] = malloc(block_nframes * sizeof(float));
+	if ( !ch->buf[0] || !ch->buf[1] ) {
+	    perror("malloc");
+	    goto out;
+	}
+	ch->out = channel_open_output(output_pattern, ch->n);
+	if ( !ch->out )
+	    goto out;
+    }
+
+    for ( c=0; c<nchannels; c++ ) {
+	for ( i=0; i<nmodes; i++ ) {
+	    struct lane *lane = &m.lanes[c * nmodes + i];
+	    lane->m = &m;
+	    lane->ch = &m.chans[c];
+	    lane->bfsk_data_rate = cfgs[i].bfsk_data_rate;
+	    lane->labeled = nmodes > 1 || (nchannels > 1 && !output_pattern);
+	    if ( nchannels > 1 && nmodes > 1 )
+		snprintf(lane->label, sizeof(lane->label), "ch%u/%s",
+			lane->ch->n, mode_names[i]);
+	    else if ( nchannels > 1 )
+		snprintf(lane->label, sizeof(lane->label), "ch%u",
+			lane->ch->n);
+	    else
+		snprintf(lane->label, sizeof(lane->label), "%s",
+			mode_names[i]);
+	    lane->rx = minimodem_rx_new(&cfgs[i],
+				lane_rx_data, lane_rx_event, lane);
+	    if ( !lane->rx )
+		goto out;
+	}
+    }
+
+    for ( w=0; w<m.nworkers; w++ ) {
+	workers[w].m = &m;
+	workers[w].w = w;
+	if ( pthread_create(&workers[w].thread, NULL,
+				channel_worker, &workers[w]) != 0 ) {
+	    perror("pthread_create");
+	    m.nworkers = w;
+	    goto stop_workers;
+	}
+    }
+
+    channels_stop = 0;
+    signal(SIGINT, channels_stop_sighandler);
+
+    ret = 0;
+    int eof = 0;
+    while ( !eof ) {
+	unsigned int k = (m.gen + 1) & 1;	// the buffers not in use
+
+	ssize_t r = simpleaudio_read(sa, ibuf ? ibuf : m.chans[0].buf[k],
+				block_nframes);
+	if ( r < 0 ) {
+	    fprintf(stderr, "simpleaudio_read: error\n");
+	    ret = 1;
+	}
+	if ( r <= 0 || channels_stop ) {
+	    r = 0;
+	    eof = 1;
+	}
+
+	// deinterleave
+	if ( ibuf ) {
+	    const float *p = ibuf;
+	    size_t n;
+	    for ( n=0; n<(size_t)r; n++ )
+		for ( c=0; c<nchannels; c++ )
+		    m.chans[c].buf[k][n] = *p++;
+	}
+
+	pthread_mutex_lock(&m.lock);
+	channels_wait_idle(&m);
+	if ( channels_all_done(&m) )
+	    eof = 1;
+	m.block_nframes[k] = r;
+	m.eof = eof;
+	m.nbusy = m.nworkers;
+	m.gen++;
+	pthread_cond_broadcast(&m.go_cond);
+	pthread_mutex_unlock(&m.lock);
+    }
+
+    signal(SIGINT, SIG_DFL);
+
+stop_workers:
+    if ( !m.eof ) {
+	// tell any workers already started to quit
+	pthread_mutex_lock(&m.lock);
+	channels_wait_idle(&m);
+	m.block_nframes[(m.gen + 1) & 1] = 0;
+	m.eof = 1;
+	m.nbusy = m.nworkers;
+	m.gen++;
+	pthread_cond_broadcast(&m.go_cond);
+	pthread_mutex_unlock(&m.lock);
+    }
+    for ( w=0; w<m.nworkers; w++ )
+	pthread_join(workers[w].thread, NULL);
+
+    if ( !quiet_mode && ret == 0 )
+	for ( l=0; l<m.nlanes; l++ )
+	    fprintf(stderr, "%s: ### STATS samples=%llu bytes=%llu"
+			    " carriers=%u ###\n",
+		    m.lanes[l].label, m.lanes[l].nsamples,
+		    m.lanes[l].nbytes, m.lanes[l].ncarriers);
+
+out:
+    if ( m.lanes ) {
+	for ( l=0; l<m.nlanes; l++ )
+	    if ( m.lanes[l].rx )
+		minimodem_rx_destroy(m.lanes[l].rx);
+	free(m.lanes);
+    }
+    if ( m.chans ) {
+	for ( c=0; c<nchannels; c++ ) {
+	    struct channel *ch = &m.chans[c];
+	    if ( ch->out && ch->out != stdout )
+		fclose(ch->out);
+	    pthread_mutex_destroy(&ch->out_lock);
+	    free(ch->buf[0]);
+	    free(ch->buf[1]);
+	}
+	free(m.chans);
+    }
+    free(workers);
+    free(ibuf);
+    pthread_cond_destroy(&m.done_cond);
+    pthread_cond_destroy(&m.go_cond);
+    pthread_mutex_destroy(&m.lock);
+    return ret;
+}
+
+
+/*
+ * Channelizer: a lane per FSK pair found in the passband
+ */
+
+struct chz_lane {
+	struct lane		lane;
+	struct channel		ch;
+};
+
+struct chz_run {
+	struct channels		m;		// (only for the lanes' options)
+	const char		*output_pattern;
+	float			bfsk_data_rate;
+	int			error;		// a sub-channel was skipped
+};
+
+static void *
+chz_lane_open( void *arg, unsigned int n, float mark_f, float space_f )
+{
+    struct chz_run *run = arg;
+    struct chz_lane *cl = calloc(1, sizeof(*cl));
+    if ( !cl ) {
+	perror("malloc");
+	run->error = 1;
+	return NULL;
+    }
+
+    cl->ch.n = n;
+    cl->ch.out = channel_open_output(run->output_pattern, n);
+    if ( !cl->ch.out ) {
+	fprintf(stderr, "ch%u: ### CHANNEL skipped ###\n", n);
+	free(cl);
+	run->error = 1;
+	return NULL;
+    }
+    cl->lane.m = &run->m;
+    cl->lane.ch = &cl->ch;
+    cl->lane.bfsk_data_rate = run->bfsk_data_rate;
+    // (side by side signals on stdout would interleave)
+    cl->lane.labeled = !run->output_pattern;
+    snprintf(cl->lane.label, sizeof(cl->lane.label), "ch%u", n);
+
+    if ( !run->m.quiet_mode )
+	fprintf(stderr, "%s: ### CHANNEL mark=%.1f space=%.1f Hz ###\n",
+		cl->lane.label, (double)mark_f, (double)space_f);
+    return &cl->lane;
+}
+
+static void
+chz_lane_close( void *arg, void *channel_arg )
+{
+    struct chz_run *run = arg;
+    struct chz_lane *cl = channel_arg;
+
+    if ( cl->lane.labeled )
+	lane_write_line(&cl->lane);
+    if ( !run->m.quiet_mode )
+	fprintf(stderr, "%s: ### STATS bytes=%llu carriers=%u ###\n",
+		cl->lane.label, cl->lane.nbytes, cl->lane.ncarriers);
+    if ( cl->ch.out != stdout )
+	fclose(cl->ch.out);
+    else
+	fflush(stdout);
+    free(cl);
+}
+
+int
+minimodem_channelize_run( simpleaudio *sa, const minimodem_config *cfg,
+	unsigned int max_channels, const char *output_pattern,
+	int quiet_mode, int output_print_filter )
+{
+    struct chz_run run = {
+	.m = {
+	    .quiet_mode = quiet_mode,
+	    .output_print_filter = output_print_filter,
+	},
+	.output_pattern = output_pattern,
+	.bfsk_data_rate = cfg->bfsk_data_rate,
+    };
+    int ret = 0;
+
+    if ( output_pattern && channel_check_pattern(output_pattern) < 0 )
+	return 1;
+
+    minimodem_channelizer *chz = minimodem_channelizer_new(cfg, max_channels,
+			chz_lane_open, chz_lane_close,
+			lane_rx_data, lane_rx_event, &run);
+    if ( !chz )
+	return 1;
+
+    // 100 ms blocks
+    size_t block_nsamples = cfg->sample_rate / 10;
+    float *buf = malloc(block_nsamples * sizeof(float));
+    if ( !buf ) {
+	perror("malloc");
+	minimodem_channelizer_destroy(chz);
+	return 1;
+    }
+
+    channels_stop = 0;
+    signal(SIGINT, channels_stop_sighandler);
+
+    while ( !channels_stop ) {
+	ssize_t r = simpleaudio_read(sa, buf, block_nsamples);
+	if ( r < 0 ) {
+	    fprintf(stderr, "simpleaudio_read: error\n");
+	    ret = 1;
+	}
+	if ( r <= 0 )
+	    break;
+	minimodem_channelizer_push(chz, buf, r);
+	fflush(stdout);
+    }
+
+    signal(SIGINT, SIG_DFL);
+
+    minimodem_channelizer_flush(chz);
+    minimodem_channelizer_destroy(chz);
+    free(buf);
+    return run.error ? 1 : ret;
+}
@@ -0,0 +1,55 @@
+/*
+ * minimodem_channels.h
+ *
+ * Copyright (C) 2011-2016 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MINIMODEM_CHANNELS_H
+#define MINIMODEM_CHANNELS_H
+
+#include "simpleaudio.h"
+#include "libminimodem.h"
+
+/*
+ * Receive every channel of the (interleaved, float) multi-channel stream
+ * sa independently, and each of them in each of the nmodes modes given
+ * by cfgs[] (named by mode_names[]), each (channel, mode) with its own
+ * receiver.  Runs until the end of the stream, until every receiver is
+ * done (rx_one), or until SIGINT.  Channel n's data goes to the file
+ * named by output_pattern with its "%u" replaced by n (counting from 1),
+ * or to stdout if output_pattern is NULL.  Where several receivers share
+ * an output (more than one mode, or more than one channel to stdout), the
+ * data goes out a line at a time, each prefixed with its channel ("ch2")
+ * and/or mode.  Returns the process exit status.
+ */
+int
+minimodem_channels_run( simpleaudio *sa,
+	const minimodem_config *cfgs, const char * const *mode_names,
+	unsigned int nmodes, const char *output_pattern,
+	int quiet_mode, int output_print_filter );
+
+/*
+ * Receive from the mono stream sa with a minimodem_channelizer: each FSK
+ * pair found (up to max_channels) is decoded as channel n (counting from
+ * 1), its data going to the file named by output_pattern as above, or to
+ * stdout if output_pattern is NULL.  Returns the process exit status.
+ */
+int
+minimodem_channelize_run( simpleaudio *sa, const minimodem_config *cfg,
+	unsigned int max_channels, const char *output_pattern,
+	int quiet_mode, int output_print_filter );
+
+#endif
@@ -0,0 +1,277 @@
+/*
+ * minimodem_checkpoint.c
+ *
+ * minimodem - software audio Bell-type or RTTY FSK modem
+ *
+ * Copyright (C) 2011-2016 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "minimodem_checkpoint.h"
+
+
+#define CHECKPOINT_MAGIC	"MMCHKPT1"
+
+struct minimodem_checkpointer {
+	char		*path;
+	char		*tmp_path;
+	double		interval;	// seconds
+	struct timespec	last;
+	minimodem_config cfg;
+	int		output_fd;
+	int		output_is_file;
+	int		error;
+};
+
+static double
+checkpoint_elapsed( const struct timespec *since )
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec)
+		+ (now.tv_nsec - since->tv_nsec) / 1e9;
+}
+
+minimodem_checkpointer *
+minimodem_checkpointer_new( const char *spec, const minimodem_config *cfg,
+	int output_fd )
+{
+    minimodem_checkpointer *cp = calloc(1, sizeof(*cp));
+    char *opts = cp ? strdup(spec) : NULL;
+    if ( !opts ) {
+	perror("malloc");
+	free(cp);
+	return NULL;
+    }
+    cp->interval = MINIMODEM_CHECKPOINT_INTERVAL;
+
+    char *saveptr, *key;
+    char *path = strtok_r(opts, ",", &saveptr);
+    if ( !path ) {
+	fprintf(stderr, "E: --checkpoint takes a {path}\n");
+	goto fail;
+    }
+    cp->path = strdup(path);
+    cp->tmp_path = malloc(strlen(path) + sizeof(".tmp"));
+    if ( !cp->path || !cp->tmp_path ) {
+	perror("malloc");
+	goto fail;
+    }
+    sprintf(cp->tmp_path, "%s.tmp", path);
+    while ( (key = strtok_r(NULL, ",", &saveptr)) ) {
+	char *value = strchr(key, '=');
+	if ( value )
+	    *value++ = 0;
+	if ( value && strcmp(key, "interval") == 0 ) {
+	    cp->interval = atof(value);
+	    if ( cp->interval >= 0.0 )
+		continue;
+	}
+	fprintf(stderr, "E: --checkpoint: bad option '%s%s%s'\n",
+		key, value ? "=" : "", value ? value : "");
+	goto fail;
+    }
+
+    struct stat st;
+    cp->cfg = *cfg;
+    cp->output_fd = output_fd;
+    cp->output_is_file = fstat(output_fd, &st) == 0 && S_ISREG(st.st_mode);
+    // (appended to, its offset is where the next output goes once there
+    // is any; seek there now, for a checkpoint taken before then)
+    if ( cp->output_is_file && (fcntl(output_fd, F_GETFL) & O_APPEND)
+	    && lseek(output_fd, 0, SEEK_END) < 0 ) {
+	perror("output");
+	goto fail;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &cp->last);
+    free(opts);
+    return cp;
+
+fail:
+    free(opts);
+    free(cp->path);
+    free(cp->tmp_path);
+    free(cp);
+    return NULL;
+}
+
+int
+minimodem_checkpointer_read( minimodem_checkpointer *cp,
+	minimodem_checkpoint *ck )
+{
+    memset(ck, 0, sizeof(*ck));
+
+    int ret = 0;
+    FILE *f = fopen(cp->path, "r");
+    if ( !f && errno != ENOENT ) {
+	perror(cp->path);
+	return -1;
+    }
+    if ( f ) {
+	const minimodem_config *cfg = &cp->cfg;
+	char line[256];
+	unsigned int rate;
+	float baud, mark_f, space_f;
+	ret = -1;
+	if ( !fgets(line, sizeof(line), f)
+		|| sscanf(line, CHECKPOINT_MAGIC " rate=%u baud=%f mark=%f"
+				" space=%f", &rate, &baud,
+				&mark_f, &space_f) != 4 ) {
+	    fprintf(stderr, "E: %s: not a minimodem checkpoint\n", cp->path);
+	} else if ( rate != cfg->sample_rate
+		|| fabsf(baud - cfg->bfsk_data_rate) > 0.001f
+		|| fabsf(mark_f - cfg->bfsk_mark_f) > 0.001f
+		|| fabsf(space_f - cfg->bfsk_space_f) > 0.001f ) {
+	    fprintf(stderr, "E: %s: checkpointed at %u Hz, %.3f bps,"
+			    " mark %.3f Hz, space %.3f Hz\n",
+		    cp->path, rate, (double)baud,
+		    (double)mark_f, (double)space_f);
+	} else if ( !fgets(line, sizeof(line), f)
+		|| sscanf(line, "sample=%llu output=%llu done=%d",
+			&ck->sample, &ck->output, &ck->done) != 3 ) {
+	    fprintf(stderr, "E: %s: bad checkpoint\n", cp->path);
+	} else {
+	    ret = 1;
+	}
+	fclose(f);
+	if ( ret < 0 )
+	    return -1;
+    }
+
+    // (with no checkpoint, whatever the output already holds is kept)
+    if ( ret > 0 && cp->output_is_file ) {
+	struct stat st;
+	if ( fstat(cp->output_fd, &st) < 0 ) {
+	    perror("fstat");
+	    return -1;
+	}
+	if ( (unsigned long long)st.st_size < ck->output ) {
+	    fprintf(stderr, "E: %s: the output has %llu bytes, not the %llu"
+			    " it had then (append to it, with >>)\n",
+		    cp->path, (unsigned long long)st.st_size, ck->output);
+	    return -1;
+	}
+	if ( ftruncate(cp->output_fd, ck->output) < 0
+		|| lseek(cp->output_fd, ck->output, SEEK_SET) < 0 ) {
+	    perror("output");
+	    return -1;
+	}
+    }
+    return ret;
+}
+
+/* sync the directory too, so that the rename survives a crash */
+static void
+checkpoint_sync_dir( const char *path )
+{
+    const char *slash = strrchr(path, '/');
+    char *dir = slash ? strndup(path, slash - path + 1) : strdup(".");
+    if ( !dir )
+	return;
+    int fd = open(dir, O_RDONLY);
+    if ( fd >= 0 ) {
+	fsync(fd);
+	close(fd);
+    }
+    free(dir);
+}
+
+int
+minimodem_checkpointer_write( minimodem_checkpointer *cp,
+	const minimodem_checkpoint *ck )
+{
+    const minimodem_config *cfg = &cp->cfg;
+    unsigned long long output = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &cp->last);
+
+    // (the checkpoint can't be on disk before the output it counts)
+    if ( cp->output_is_file ) {
+	off_t off = lseek(cp->output_fd, 0, SEEK_CUR);
+	if ( off < 0 || fsync(cp->output_fd) < 0 ) {
+	    perror("output");
+	    goto fail;
+	}
+	output = off;
+    }
+
+    char buf[256];
+    int len = snprintf(buf, sizeof(buf),
+	    CHECKPOINT_MAGIC " rate=%u baud=%.3f mark=%.3f space=%.3f\n"
+	    "sample=%llu output=%llu done=%d\n",
+	    cfg->sample_rate, (double)cfg->bfsk_data_rate,
+	    (double)cfg->bfsk_mark_f, (double)cfg->bfsk_space_f,
+	    ck->sample, output, ck->done);
+    int fd = open(cp->tmp_path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if ( fd < 0 ) {
+	perror(cp->tmp_path);
+	goto fail;
+    }
+    if ( write(fd, buf, len) != len || fsync(fd) < 0 ) {
+	perror(cp->tmp_path);
+	close(fd);
+	unlink(cp->tmp_path);
+	goto fail;
+    }
+    close(fd);
+    if ( rename(cp->tmp_path, cp->path) < 0 ) {
+	perror(cp->path);
+	unlink(cp->tmp_path);
+	goto fail;
+    }
+    checkpoint_sync_dir(cp->path);
+    return 0;
+
+fail:
+    cp->error = 1;
+    return -1;
+}
+
+void
+minimodem_checkpointer_update( minimodem_checkpointer *cp,
+	const minimodem_rx *rx )
+{
+    minimodem_checkpoint ck = { 0 };
+
+    if ( cp->error || checkpoint_elapsed(&cp->last) < cp->interval )
+	return;
+    if ( !minimodem_rx_checkpoint(rx, &ck.sample) )
+	return;		// (not now, but as soon as it is idle)
+    minimodem_checkpointer_write(cp, &ck);
+}
+
+int
+minimodem_checkpointer_destroy( minimodem_checkpointer *cp )
+{
+    int ret = cp->error ? -1 : 0;
+    free(cp->path);
+    free(cp->tmp_path);
+    free(cp);
+    return ret;
+}
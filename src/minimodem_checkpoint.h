@@ -0,0 +1,90 @@
+/*
+ * minimodem_checkpoint.h
+ *
+ * Copyright (C) 2011-2016 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MINIMODEM_CHECKPOINT_H
+#define MINIMODEM_CHECKPOINT_H
+
+#include "libminimodem.h"
+
+/*
+ * Checkpoints of a long decode of a recording: a text file, replaced
+ * every so often (atomically, and synced to disk with the output so far)
+ * with where the receiver had got to and the offset in the output file
+ * (which may have held other output before the decode began) it had
+ * written up to:
+ *
+ *   MMCHKPT1 rate=48000 baud=1200.000 mark=1200.000 space=2200.000
+ *   sample=123456000 output=81920 done=0
+ *
+ * A checkpoint is only taken while the receiver is idle (see
+ * minimodem_rx_checkpoint()), so decoding again from its sample position,
+ * after the output is cut back to that offset, produces the rest of the
+ * output just as the interrupted decode would have.  done=1 marks a decode
+ * which ran to the end of the recording.
+ */
+
+#define MINIMODEM_CHECKPOINT_INTERVAL	60	// seconds, by default
+
+typedef struct minimodem_checkpoint {
+	unsigned long long sample;
+	unsigned long long output;	// offset in the output file
+	int		done;
+} minimodem_checkpoint;
+
+typedef struct minimodem_checkpointer minimodem_checkpointer;
+
+/*
+ * Checkpoints, per spec "{path}[,interval={seconds}]", of a decode with
+ * cfg whose output goes to output_fd.  Returns NULL on an error (reported
+ * on stderr).
+ */
+minimodem_checkpointer *
+minimodem_checkpointer_new( const char *spec, const minimodem_config *cfg,
+	int output_fd );
+
+/*
+ * Reads the checkpoint to resume from into ck (all 0 if there is none
+ * yet, so resume from the start, after whatever the output holds), and
+ * cuts the output back to its offset then (if it is a file).  Returns 1,
+ * or 0 if there was no checkpoint, or -1 on an error (reported on stderr).
+ */
+int
+minimodem_checkpointer_read( minimodem_checkpointer *cp,
+	minimodem_checkpoint *ck );
+
+/*
+ * From the decode loop: takes a checkpoint if one is due and rx is idle.
+ */
+void
+minimodem_checkpointer_update( minimodem_checkpointer *cp,
+	const minimodem_rx *rx );
+
+/*
+ * Takes checkpoint ck now, at the output's current offset (ck->output is
+ * not used).  Returns 0, or -1 on an error.
+ */
+int
+minimodem_checkpointer_write( minimodem_checkpointer *cp,
+	const minimodem_checkpoint *ck );
+
+/* Frees cp; returns -1 if any checkpoint failed (reported on stderr). */
+int
+minimodem_checkpointer_destroy( minimodem_checkpointer *cp );
+
+#endif
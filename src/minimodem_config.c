@@ -0,0 +1,211 @@
+/*
+ * minimodem_config.c
+ *
+ * Copyright (C) 2011-2016 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "libminimodem.h"
+
+
+void
+minimodem_config_init( minimodem_config *cfg )
+{
+    memset(cfg, 0, sizeof(*cfg));
+
+    cfg->sample_rate = 48000;
+    cfg->bfsk_nstartbits = -1;
+    cfg->bfsk_nstopbits = -1;
+    cfg->bfsk_sync_byte = -1;
+    cfg->bfsk_databits_decode = databits_decode_ascii8;
+    cfg->bfsk_databits_encode = databits_encode_ascii8;
+
+    // fsk_confidence_threshold : signal-to-noise squelch control
+    //
+    // The minimum SNR-ish confidence level seen as "a signal".
+    cfg->fsk_confidence_threshold = 1.5;
+
+    // fsk_confidence_search_limit : performance vs. quality
+    //
+    // If we find a frame with confidence > confidence_search_limit,
+    // quit searching for a better frame.  confidence_search_limit has a
+    // dramatic effect on peformance (high value yields low performance, but
+    // higher decode quality, for noisy or hard-to-discern signals (Bell 103,
+    // or skewed rates).
+    cfg->fsk_confidence_search_limit = 2.3f;
+    // cfg->fsk_confidence_search_limit = INFINITY;  /* for test */
+
+    // preamble_min_snr : the --preamble detector's per-bit hard decision
+    //
+    // The louder of the mark and space tones must be this many times the
+    // other for a leader or preamble bit to count.  Unlike the frame
+    // search's confidence, this is a single bit's tone ratio, so it is a
+    // setting of its own (which happens to start out at the same value).
+    cfg->preamble_min_snr = 1.5f;
+
+    cfg->sync_min_score = 0.5f;
+
+    cfg->tx_leader_bits_len = 2;
+    cfg->tx_trailer_bits_len = 2;
+}
+
+int
+minimodem_config_set_baudmode( minimodem_config *cfg,
+	const char *modem_mode, int TX_mode )
+{
+    if ( strncasecmp(modem_mode, "rtty",5)==0 ) {
+	cfg->bfsk_databits_decode = databits_decode_baudot;
+	cfg->bfsk_databits_encode = databits_encode_baudot;
+	cfg->bfsk_data_rate = 45.45;
+	if ( cfg->bfsk_n_data_bits == 0 )
+	    cfg->bfsk_n_data_bits = 5;
+	if ( cfg->bfsk_nstopbits < 0 )
+	    cfg->bfsk_nstopbits = 1.5;
+    } else if ( strncasecmp(modem_mode, "tdd",4)==0 ) {
+	cfg->bfsk_databits_decode = databits_decode_baudot;
+	cfg->bfsk_databits_encode = databits_encode_baudot;
+	cfg->bfsk_data_rate = 45.45;
+	if ( cfg->bfsk_n_data_bits == 0 )
+	    cfg->bfsk_n_data_bits = 5;
+	if ( cfg->bfsk_nstopbits < 0 )
+	    cfg->bfsk_nstopbits = 2.0;
+	cfg->bfsk_mark_f = 1400;
+	cfg->bfsk_space_f = 1800;
+    } else if ( strncasecmp(modem_mode, "same",5)==0 ) {
+	// http://www.nws.noaa.gov/nwr/nwrsame.htm
+	cfg->bfsk_data_rate = 520.0 + 5/6.0;
+	cfg->bfsk_n_data_bits = 8;
+	cfg->bfsk_nstartbits = 0;
+	cfg->bfsk_nstopbits = 0;
+	cfg->bfsk_do_rx_sync = 1;
+	cfg->bfsk_do_tx_sync_bytes = 16;
+	cfg->bfsk_sync_byte = 0xAB;
+	cfg->bfsk_mark_f = 2083.0 + 1/3.0;
+	cfg->bfsk_space_f = 1562.5;
+	cfg->band_width = cfg->bfsk_data_rate;
+    } else if ( strncasecmp(modem_mode, "caller",6)==0 ) {
+	if ( TX_mode ) {
+	    fprintf(stderr, "E: callerid --tx mode is not supported.\n");
+	    return -1;
+	}
+	if ( cfg->carrier_autodetect_threshold > 0.0f )
+	    fprintf(stderr, "W: callerid with --auto-carrier is not recommended.\n");
+	cfg->bfsk_databits_decode = databits_decode_callerid;
+	cfg->bfsk_data_rate = 1200;
+	cfg->bfsk_n_data_bits = 8;
+	// channel seizure: 30 bytes of 0x55 (alternating bits)
+	if ( !cfg->preamble_bits_string )
+	    cfg->preamble_bits_string = "10";
+    } else if ( strncasecmp(modem_mode, "uic", 3) == 0 ) {
+	if ( TX_mode ) {
+	    fprintf(stderr, "E: uic-751-3 --tx mode is not supported.\n");
+	    return -1;
+	}
+	// http://ec.europa.eu/transport/rail/interoperability/doc/ccs-tsi-en-annex.pdf
+	if (tolower(modem_mode[4]) == 't')
+	    cfg->bfsk_databits_decode = databits_decode_uic_train;
+	else
+	    cfg->bfsk_databits_decode = databits_decode_uic_ground;
+	cfg->bfsk_data_rate = 600;
+	cfg->bfsk_n_data_bits = 39;
+	cfg->bfsk_mark_f = 1300;
+	cfg->bfsk_space_f = 1700;
+	cfg->bfsk_nstartbits = 8;
+	cfg->bfsk_nstopbits = 0;
+	cfg->expect_data_string = "11110010ddddddddddddddddddddddddddddddddddddddd";
+	// fixed 8-bit preamble, sent once per message
+	if ( !cfg->preamble_bits_string ) {
+	    cfg->preamble_bits_string = "11110010";
+	    cfg->preamble_min_nbits = 8;
+	}
+	cfg->sync_bits_string = "11110010";
+    } else {
+	cfg->bfsk_data_rate = atof(modem_mode);
+	if ( cfg->bfsk_n_data_bits == 0 )
+	    cfg->bfsk_n_data_bits = 8;
+    }
+    return 0;
+}
+
+void
+minimodem_config_finish( minimodem_config *cfg )
+{
+    if ( cfg->bfsk_data_rate >= 400 ) {
+	/*
+	 * Bell 202:     baud=1200 mark=1200 space=2200
+	 */
+	cfg->autodetect_shift = - ( cfg->bfsk_data_rate * 5 / 6 );
+	if ( cfg->bfsk_mark_f == 0 )
+	    cfg->bfsk_mark_f  = cfg->bfsk_data_rate / 2 + 600;
+	if ( cfg->bfsk_space_f == 0 )
+	    cfg->bfsk_space_f = cfg->bfsk_mark_f - cfg->autodetect_shift;
+	if ( cfg->band_width == 0 )
+	    cfg->band_width = 200;
+    } else if ( cfg->bfsk_data_rate >= 100 ) {
+	/*
+	 * Bell 103:     baud=300 mark=1270 space=1070
+	 * ITU-T V.21:   baud=300 mark=1280 space=1080
+	 */
+	cfg->autodetect_shift = 200;
+	if ( cfg->bfsk_mark_f == 0 )
+	    cfg->bfsk_mark_f  = 1270;
+	if ( cfg->bfsk_space_f == 0 )
+	    cfg->bfsk_space_f = cfg->bfsk_mark_f - cfg->autodetect_shift;
+	if ( cfg->band_width == 0 )
+	    cfg->band_width = 50;	// close enough
+    } else {
+	/*
+	 * RTTY:     baud=45.45 mark/space=variable shift=-170
+	 */
+	cfg->autodetect_shift = 170;
+	if ( cfg->bfsk_mark_f == 0 )
+	    cfg->bfsk_mark_f  = 1585;
+	if ( cfg->bfsk_space_f == 0 )
+	    cfg->bfsk_space_f = cfg->bfsk_mark_f - cfg->autodetect_shift;
+	if ( cfg->band_width == 0 ) {
+	    cfg->band_width = 10;	// FIXME chosen arbitrarily
+	}
+    }
+
+    // defaults: 1 start bit, 1 stop bit
+    if ( cfg->bfsk_nstartbits < 0 )
+	cfg->bfsk_nstartbits = 1;
+    if ( cfg->bfsk_nstopbits < 0 )
+	cfg->bfsk_nstopbits = 1.0;
+
+    // do not transmit any leader tone if no start bits
+    if ( cfg->bfsk_nstartbits == 0 )
+	cfg->tx_leader_bits_len = 0;
+
+    if ( cfg->bfsk_inverted_freqs ) {
+	float t = cfg->bfsk_mark_f;
+	cfg->bfsk_mark_f = cfg->bfsk_space_f;
+	cfg->bfsk_space_f = t;
+    }
+
+    /* restrict band_width to <= data rate (FIXME?) */
+    if ( cfg->band_width > cfg->bfsk_data_rate )
+	cfg->band_width = cfg->bfsk_data_rate;
+
+    // sanitize confidence search limit
+    if ( cfg->fsk_confidence_search_limit < cfg->fsk_confidence_threshold )
+	cfg->fsk_confidence_search_limit = cfg->fsk_confidence_threshold;
+}
@@ -0,0 +1,822 @@
+/*
+ * minimodem_daemon.c
+ *
+ * minimodem - software audio Bell-type or RTTY FSK modem
+ *
+ * Copyright (C) 2011-2016 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE	// pthread_setaffinity_np
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "minimodem_daemon.h"
+
+#if HAVE_SYS_EPOLL_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+
+#include "simpleaudio.h"
+#include "libminimodem.h"
+
+
+/*
+ * Daemon mode: many receive sources in one process.
+ *
+ * The main thread waits on an epoll set holding the poll descriptor of
+ * every source whose simpleaudio backend has one (ALSA).  A ready source
+ * is put on the work queue, and a worker thread reads what it has
+ * captured, pushes that through the source's minimodem_rx, then re-arms
+ * it (EPOLLONESHOT, so only one worker at a time ever touches a source).
+ * A source without a poll descriptor (audio file, FIFO, PulseAudio) gets
+ * a reader thread of its own instead, which may block in its reads for
+ * as long as the source is quiet without holding up the workers.  At
+ * shutdown a reader thread is cancelled, which it only allows while it
+ * is blocked reading, so a quiet FIFO cannot hold up the exit.
+ *
+ * The config file holds one directive per line ('#' starts a comment):
+ *
+ *	workers {n}
+ *	source {name} input={input} mode={baudmode} [key=value ...]
+ *
+ * input is alsa:[device], pulse:, or the path of an audio file or FIFO.
+ * The other source keys are output (a file, or "-" for stdout, the
+ * default), cpu, rate, mark, space, bandwidth, startbits, stopbits,
+ * confidence and limit, as the command line options of the same names.
+ *
+ * When several sources share stdout, each collects its data into lines
+ * and writes them whole, prefixed with its name, under the daemon's
+ * out_lock (as the lanes of minimodem_channels.c do); a line is cut short
+ * at the end of a carrier or after DAEMON_LINE_MAX bytes.
+ */
+
+#define DAEMON_LINE_MAX	256
+
+struct daemon_source {
+	struct daemon_source	*next;		// work queue link
+	struct daemon		*d;
+
+	char			*name;
+	char			*input;
+	char			*output;
+	char			*mode;
+	int			cpu;		// -1: any
+	minimodem_config	cfg;
+
+	simpleaudio		*sa;
+	int			pollfd;
+	minimodem_rx		*rx;
+	FILE			*out;
+	float			*buf;
+	size_t			buf_nsamples;
+	int			done;
+
+	int			labeled;	// label each line of output
+	size_t			line_len;
+	char			line[DAEMON_LINE_MAX + 1];	// + '\n'
+
+	pthread_t		reader;		// if pollfd < 0
+	int			has_reader;
+	int			cancelled;	// sa left mid-read
+
+	/* stats (under d->stats_lock) */
+	unsigned long long	nsamples;
+	unsigned long long	nbytes;
+	unsigned int		ncarriers;
+	unsigned long long	busy_usec;
+	size_t			max_backlog;
+};
+
+struct daemon {
+	struct daemon_source	**sources;
+	unsigned int		nsources;
+	unsigned int		nworkers;
+	int			quiet_mode;
+
+	int			epfd;
+	int			wake_pipe[2];
+
+	pthread_mutex_t		queue_lock;
+	pthread_cond_t		queue_cond;
+	struct daemon_source	*queue_head, *queue_tail;
+	int			queue_shutdown;
+	unsigned int		nactive;
+
+	pthread_mutex_t		stats_lock;
+	pthread_mutex_t		out_lock;	// stdout, if shared
+};
+
+static volatile sig_atomic_t daemon_stop;
+static volatile sig_atomic_t daemon_print_stats;
+
+static void
+daemon_stop_sighandler( int sig )
+{
+    daemon_stop = 1;
+}
+
+static void
+daemon_stats_sighandler( int sig )
+{
+    daemon_print_stats = 1;
+}
+
+
+/*
+ * Output
+ */
+
+static void
+daemon_write_line( struct daemon_source *src )
+{
+    if ( src->line_len == 0 )
+	return;
+    pthread_mutex_lock(&src->d->out_lock);
+    fprintf(src->out, "%s: ", src->name);
+    fwrite(src->line, 1, src->line_len, src->out);
+    if ( src->line[src->line_len - 1] != '\n' )
+	fputc('\n', src->out);
+    pthread_mutex_unlock(&src->d->out_lock);
+    src->line_len = 0;
+}
+
+static void
+daemon_rx_data( void *arg, const char *data, unsigned int nbytes )
+{
+    struct daemon_source *src = arg;
+    if ( src->labeled ) {
+	unsigned int i;
+	for ( i=0; i<nbytes; i++ ) {
+	    if ( data[i] != '\n' && src->line_len == DAEMON_LINE_MAX )
+		daemon_write_line(src);
+	    src->line[src->line_len++] = data[i];
+	    if ( data[i] == '\n' )
+		daemon_write_line(src);
+	}
+    } else {
+	fwrite(data, 1, nbytes, src->out);
+    }
+    pthread_mutex_lock(&src->d->stats_lock);
+    src->nbytes += nbytes;
+    pthread_mutex_unlock(&src->d->stats_lock);
+}
+
+static void
+daemon_rx_event( void *arg, const minimodem_rx_event *ev )
+{
+    struct daemon_source *src = arg;
+    float bfsk_data_rate = src->cfg.bfsk_data_rate;
+
+    if ( ev->type == MINIMODEM_RX_CARRIER ) {
+	pthread_mutex_lock(&src->d->stats_lock);
+	src->ncarriers++;
+	pthread_mutex_unlock(&src->d->stats_lock);
+    }
+    if ( ev->type == MINIMODEM_RX_NOCARRIER && src->labeled )
+	daemon_write_line(src);
+
+    if ( src->d->quiet_mode )
+	return;
+
+    // as the CLI's, but one line each, prefixed with the source name
+    switch ( ev->type ) {
+	case MINIMODEM_RX_CARRIER:
+	    if ( bfsk_data_rate >= 100 )
+		fprintf(stderr, "%s: ### CARRIER %u @ %.1f Hz ###\n",
+			src->name, (unsigned int)(bfsk_data_rate + 0.5f),
+			(double)ev->carrier_freq);
+	    else
+		fprintf(stderr, "%s: ### CARRIER %.2f @ %.1f Hz ###\n",
+			src->name, (double)bfsk_data_rate,
+			(double)ev->carrier_freq);
+	    break;
+	case MINIMODEM_RX_NOCARRIER:
+	    fprintf(stderr, "%s: ### NOCARRIER ndata=%u confidence=%.3f"
+			" ampl=%.3f bps=%.2f ###\n",
+		    src->name, ev->nframes_decoded,
+		    (double)ev->confidence, (double)ev->amplitude,
+		    (double)ev->throughput_rate);
+	    break;
+	case MINIMODEM_RX_LOADSHED:
+	    break;
+    }
+}
+
+static void
+daemon_report_stats( struct daemon *d )
+{
+    unsigned int i;
+    pthread_mutex_lock(&d->stats_lock);
+    for ( i=0; i<d->nsources; i++ ) {
+	struct daemon_source *src = d->sources[i];
+	float audio_sec = (float)src->nsamples / src->cfg.sample_rate;
+	float load = audio_sec > 0.0f
+		? src->busy_usec / 1e6f / audio_sec : 0.0f;
+	fprintf(stderr, "%s: ### STATS samples=%llu (%.1f sec) bytes=%llu"
+		    " carriers=%u load=%.1f%% max_backlog=%zu state=%zuB%s ###\n",
+		src->name, src->nsamples, (double)audio_sec, src->nbytes,
+		src->ncarriers, (double)(load * 100.0f), src->max_backlog,
+		minimodem_rx_footprint(src->rx),
+		src->done ? " (ended)" : "");
+    }
+    pthread_mutex_unlock(&d->stats_lock);
+}
+
+
+/*
+ * Work queue
+ */
+
+static void
+daemon_enqueue( struct daemon *d, struct daemon_source *src )
+{
+    pthread_mutex_lock(&d->queue_lock);
+    src->next = NULL;
+    if ( d->queue_tail )
+	d->queue_tail->next = src;
+    else
+	d->queue_head = src;
+    d->queue_tail = src;
+    pthread_cond_signal(&d->queue_cond);
+    pthread_mutex_unlock(&d->queue_lock);
+}
+
+/* returns NULL at shutdown */
+static struct daemon_source *
+daemon_dequeue( struct daemon *d )
+{
+    struct daemon_source *src;
+    pthread_mutex_lock(&d->queue_lock);
+    while ( !d->queue_head && !d->queue_shutdown )
+	pthread_cond_wait(&d->queue_cond, &d->queue_lock);
+    src = d->queue_shutdown ? NULL : d->queue_head;
+    if ( src ) {
+	d->queue_head = src->next;
+	if ( !d->queue_head )
+	    d->queue_tail = NULL;
+    }
+    pthread_mutex_unlock(&d->queue_lock);
+    return src;
+}
+
+static void
+daemon_source_ended( struct daemon *d )
+{
+    pthread_mutex_lock(&d->queue_lock);
+    d->nactive--;
+    pthread_mutex_unlock(&d->queue_lock);
+    // wake the main thread
+    char c = 0;
+    if ( write(d->wake_pipe[1], &c, 1) < 0 )
+	perror("write");
+}
+
+
+/*
+ * Workers
+ */
+
+static void
+daemon_source_service( struct daemon_source *src )
+{
+    struct daemon *d = src->d;
+    size_t nsamples = src->buf_nsamples;
+    size_t backlog = 0, capacity;
+
+    if ( src->pollfd >= 0
+	    && simpleaudio_get_backlog(src->sa, &backlog, &capacity) == 0 ) {
+	if ( backlog == 0 )
+	    return;	// spurious wakeup
+	if ( nsamples > backlog )
+	    nsamples = backlog;
+    }
+
+    // a reader thread may be cancelled here, and only here
+    if ( src->pollfd < 0 )
+	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    ssize_t r = simpleaudio_read(src->sa, src->buf, nsamples);
+    if ( src->pollfd < 0 )
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+    struct timeval tv_start, tv_stop;
+    gettimeofday(&tv_start, NULL);
+
+    if ( r < 0 )
+	fprintf(stderr, "%s: simpleaudio_read: error\n", src->name);
+    if ( r <= 0 ) {
+	minimodem_rx_flush(src->rx);
+	src->done = 1;
+    } else if ( minimodem_rx_push(src->rx, src->buf, r) ) {
+	src->done = 1;
+    }
+    fflush(src->out);
+
+    gettimeofday(&tv_stop, NULL);
+
+    pthread_mutex_lock(&d->stats_lock);
+    if ( r > 0 )
+	src->nsamples += r;
+    src->busy_usec += (tv_stop.tv_sec - tv_start.tv_sec) * 1000000LL
+			+ tv_stop.tv_usec - tv_start.tv_usec;
+    if ( src->max_backlog < backlog )
+	src->max_backlog = backlog;
+    pthread_mutex_unlock(&d->stats_lock);
+}
+
+static void *
+daemon_worker( void *arg )
+{
+    struct daemon *d = arg;
+
+    // leave the signals to the main thread
+    sigset_t sigs;
+    sigfillset(&sigs);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+    cpu_set_t all_cpus;
+    pthread_getaffinity_np(pthread_self(), sizeof(all_cpus), &all_cpus);
+    int cur_cpu = -1;
+
+    struct daemon_source *src;
+    while ( (src = daemon_dequeue(d)) ) {
+
+	if ( src->cpu != cur_cpu ) {
+	    if ( src->cpu >= 0 ) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(src->cpu, &cpus);
+		pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	    } else {
+		pthread_setaffinity_np(pthread_self(),
+				sizeof(all_cpus), &all_cpus);
+	    }
+	    cur_cpu = src->cpu;
+	}
+
+	daemon_source_service(src);
+
+	if ( src->done ) {
+	    daemon_source_ended(d);
+	} else {
+	    struct epoll_event ev = {
+		.events = EPOLLIN | EPOLLONESHOT,
+		.data.ptr = src,
+	    };
+	    if ( epoll_ctl(d->epfd, EPOLL_CTL_MOD, src->pollfd, &ev) < 0 ) {
+		perror("epoll_ctl");
+		src->done = 1;
+		daemon_source_ended(d);
+	    }
+	}
+    }
+
+    return NULL;
+}
+
+static void *
+daemon_reader( void *arg )
+{
+    struct daemon_source *src = arg;
+
+    sigset_t sigs;
+    sigfillset(&sigs);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+    if ( src->cpu >= 0 ) {
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(src->cpu, &cpus);
+	pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+
+    while ( !src->done )
+	daemon_source_service(src);
+    daemon_source_ended(src->d);
+
+    return NULL;
+}
+
+
+/*
+ * Config file
+ */
+
+static int
+daemon_source_set( struct daemon_source *src, const char *key, char *value )
+{
+    minimodem_config *cfg = &src->cfg;
+
+    if ( strcmp(key, "input") == 0 )
+	src->input = strdup(value);
+    else if ( strcmp(key, "output") == 0 )
+	src->output = strdup(value);
+    else if ( strcmp(key, "mode") == 0 )
+	src->mode = strdup(value);
+    else if ( strcmp(key, "cpu") == 0 )
+	src->cpu = atoi(value);
+    else if ( strcmp(key, "rate") == 0 )
+	cfg->sample_rate = atoi(value);
+    else if ( strcmp(key, "mark") == 0 )
+	cfg->bfsk_mark_f = atof(value);
+    else if ( strcmp(key, "space") == 0 )
+	cfg->bfsk_space_f = atof(value);
+    else if ( strcmp(key, "bandwidth") == 0 )
+	cfg->band_width = atof(value);
+    else if ( strcmp(key, "startbits") == 0 )
+	cfg->bfsk_nstartbits = atoi(value);
+    else if ( strcmp(key, "stopbits") == 0 )
+	cfg->bfsk_nstopbits = atof(value);
+    else if ( strcmp(key, "confidence") == 0 )
+	cfg->fsk_confidence_threshold = atof(value);
+    else if ( strcmp(key, "limit") == 0 )
+	cfg->fsk_confidence_search_limit = atof(value);
+    else
+	return -1;
+    return 0;
+}
+
+static int
+daemon_read_config( struct daemon *d, const char *config_path )
+{
+    FILE *f = fopen(config_path, "r");
+    if ( !f ) {
+	perror(config_path);
+	return -1;
+    }
+
+    char line[1024];
+    unsigned int lineno = 0;
+    while ( fgets(line, sizeof(line), f) ) {
+	lineno++;
+	char *p = strchr(line, '#');
+	if ( p )
+	    *p = 0;
+
+	char *saveptr;
+	char *directive = strtok_r(line, " \t\r\n", &saveptr);
+	if ( !directive )
+	    continue;
+
+	if ( strcmp(directive, "workers") == 0 ) {
+	    char *n = strtok_r(NULL, " \t\r\n", &saveptr);
+	    d->nworkers = n ? atoi(n) : 0;
+	    if ( d->nworkers == 0 )
+		goto bad_line;
+	    continue;
+	}
+
+	if ( strcmp(directive, "source") != 0 )
+	    goto bad_line;
+
+	char *name = strtok_r(NULL, " \t\r\n", &saveptr);
+	if ( !name )
+	    goto bad_line;
+
+	struct daemon_source *src = calloc(1, sizeof(*src));
+	if ( !src ) {
+	    perror("malloc");
+	    goto err_out;
+	}
+	src->d = d;
+	src->name = strdup(name);
+	src->cpu = -1;
+	src->pollfd = -1;
+	minimodem_config_init(&src->cfg);
+
+	d->sources = realloc(d->sources,
+			(d->nsources + 1) * sizeof(*d->sources));
+	if ( !d->sources ) {
+	    perror("malloc");
+	    goto err_out;
+	}
+	d->sources[d->nsources++] = src;
+
+	char *kv;
+	while ( (kv = strtok_r(NULL, " \t\r\n", &saveptr)) ) {
+	    char *value = strchr(kv, '=');
+	    if ( !value ) {
+		fprintf(stderr, "E: %s:%u: expected key=value, not '%s'\n",
+			config_path, lineno, kv);
+		goto err_out;
+	    }
+	    *value++ = 0;
+	    if ( daemon_source_set(src, kv, value) < 0 ) {
+		fprintf(stderr, "E: %s:%u: unknown source key '%s'\n",
+			config_path, lineno, kv);
+		goto err_out;
+	    }
+	}
+	if ( !src->input || !src->mode ) {
+	    fprintf(stderr, "E: %s:%u: source %s needs input= and mode=\n",
+		    config_path, lineno, src->name);
+	    goto err_out;
+	}
+	continue;
+
+bad_line:
+	fprintf(stderr, "E: %s:%u: syntax error\n", config_path, lineno);
+	goto err_out;
+    }
+
+    fclose(f);
+    if ( d->nsources == 0 ) {
+	fprintf(stderr, "E: %s: no sources\n", config_path);
+	return -1;
+    }
+    return 0;
+
+err_out:
+    fclose(f);
+    return -1;
+}
+
+static int
+daemon_source_open( struct daemon_source *src )
+{
+    minimodem_config *cfg = &src->cfg;
+
+    if ( minimodem_config_set_baudmode(cfg, src->mode, 0) < 0 )
+	return -1;
+    if ( cfg->bfsk_data_rate == 0.0f ) {
+	fprintf(stderr, "E: %s: bad mode '%s'\n", src->name, src->mode);
+	return -1;
+    }
+    minimodem_config_finish(cfg);
+
+    sa_backend_t backend = SA_BACKEND_FILE;
+    char *device = NULL;
+    char *stream_name = src->input;
+    if ( strncmp(src->input, "alsa:", 5) == 0 ) {
+	backend = SA_BACKEND_ALSA;
+	device = src->input[5] ? src->input + 5 : NULL;
+	stream_name = src->name;
+    } else if ( strncmp(src->input, "pulse:", 6) == 0 ) {
+	backend = SA_BACKEND_PULSEAUDIO;
+	device = src->input[6] ? src->input + 6 : NULL;
+	stream_name = src->name;
+    }
+
+    src->sa = simpleaudio_open_stream(backend, device, SA_STREAM_RECORD,
+				SA_SAMPLE_FORMAT_FLOAT, cfg->sample_rate, 1,
+				"minimodem", stream_name);
+    if ( !src->sa )
+	return -1;
+    cfg->sample_rate = simpleaudio_get_rate(src->sa);
+    src->pollfd = simpleaudio_get_pollfd(src->sa);
+
+    if ( !src->output || strcmp(src->output, "-") == 0 ) {
+	src->out = stdout;
+    } else {
+	src->out = fopen(src->output, "a");
+	if ( !src->out ) {
+	    perror(src->output);
+	    return -1;
+	}
+    }
+
+    // 50 ms per read
+    src->buf_nsamples = cfg->sample_rate / 20;
+    src->buf = malloc(src->buf_nsamples * sizeof(float));
+    if ( !src->buf ) {
+	perror("malloc");
+	return -1;
+    }
+
+    src->rx = minimodem_rx_new(cfg, daemon_rx_data, daemon_rx_event, src);
+    if ( !src->rx )
+	return -1;
+
+    return 0;
+}
+
+static void
+daemon_source_close( struct daemon_source *src )
+{
+    if ( src->rx )
+	minimodem_rx_destroy(src->rx);
+    if ( src->labeled )
+	daemon_write_line(src);
+    // (a backend interrupted mid-read may not be in a state to close)
+    if ( src->sa && !src->cancelled )
+	simpleaudio_close(src->sa);
+    if ( src->out && src->out != stdout )
+	fclose(src->out);
+    free(src->buf);
+    free(src->name);
+    free(src->input);
+    free(src->output);
+    free(src->mode);
+    free(src);
+}
+
+
+int
+minimodem_daemon( const char *config_path, int quiet_mode )
+{
+    struct daemon daemon = {
+	.quiet_mode = quiet_mode,
+	.epfd = -1,
+	.wake_pipe = { -1, -1 },
+	.queue_lock = PTHREAD_MUTEX_INITIALIZER,
+	.queue_cond = PTHREAD_COND_INITIALIZER,
+	.stats_lock = PTHREAD_MUTEX_INITIALIZER,
+	.out_lock = PTHREAD_MUTEX_INITIALIZER,
+    };
+    struct daemon *d = &daemon;
+    pthread_t *workers = NULL;
+    unsigned int nworkers_started = 0;
+    int ret = 1;
+    unsigned int i;
+
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    d->nworkers = ncpus > 0 ? ncpus : 1;
+
+    if ( daemon_read_config(d, config_path) < 0 )
+	goto out;
+
+    for ( i=0; i<d->nsources; i++ )
+	if ( daemon_source_open(d->sources[i]) < 0 ) {
+	    fprintf(stderr, "E: %s: cannot open source\n",
+		    d->sources[i]->name);
+	    goto out;
+	}
+
+    // label the output of the sources sharing stdout
+    unsigned int nstdout = 0;
+    for ( i=0; i<d->nsources; i++ )
+	if ( d->sources[i]->out == stdout )
+	    nstdout++;
+    for ( i=0; i<d->nsources; i++ )
+	d->sources[i]->labeled = nstdout > 1 && d->sources[i]->out == stdout;
+
+    d->epfd = epoll_create1(0);
+    if ( d->epfd < 0 || pipe(d->wake_pipe) < 0 ) {
+	perror("epoll");
+	goto out;
+    }
+    struct epoll_event ev = {
+	.events = EPOLLIN,
+	.data.ptr = NULL,
+    };
+    if ( epoll_ctl(d->epfd, EPOLL_CTL_ADD, d->wake_pipe[0], &ev) < 0 ) {
+	perror("epoll_ctl");
+	goto out;
+    }
+
+    d->nactive = d->nsources;
+    for ( i=0; i<d->nsources; i++ ) {
+	struct daemon_source *src = d->sources[i];
+	if ( src->pollfd >= 0 ) {
+	    ev.events = EPOLLIN | EPOLLONESHOT;
+	    ev.data.ptr = src;
+	    if ( epoll_ctl(d->epfd, EPOLL_CTL_ADD, src->pollfd, &ev) == 0 )
+		continue;
+	    src->pollfd = -1;	// e.g. a regular file: not pollable
+	}
+	if ( pthread_create(&src->reader, NULL, daemon_reader, src) != 0 ) {
+	    perror("pthread_create");
+	    goto out;
+	}
+	src->has_reader = 1;
+    }
+
+    signal(SIGINT, daemon_stop_sighandler);
+    signal(SIGTERM, daemon_stop_sighandler);
+    signal(SIGUSR1, daemon_stats_sighandler);
+
+    workers = calloc(d->nworkers, sizeof(pthread_t));
+    if ( !workers ) {
+	perror("malloc");
+	goto out;
+    }
+    for ( ; nworkers_started<d->nworkers; nworkers_started++ )
+	if ( pthread_create(&workers[nworkers_started], NULL,
+				daemon_worker, d) != 0 ) {
+	    perror("pthread_create");
+	    goto out;
+	}
+
+    /*
+     * The event loop
+     */
+    while ( !daemon_stop ) {
+	pthread_mutex_lock(&d->queue_lock);
+	unsigned int nactive = d->nactive;
+	pthread_mutex_unlock(&d->queue_lock);
+	if ( nactive == 0 )
+	    break;
+
+	if ( daemon_print_stats ) {
+	    daemon_print_stats = 0;
+	    daemon_report_stats(d);
+	}
+
+	struct epoll_event events[64];
+	int n = epoll_wait(d->epfd, events, 64, -1);
+	if ( n < 0 ) {
+	    if ( errno == EINTR )
+		continue;
+	    perror("epoll_wait");
+	    goto out;
+	}
+	int j;
+	for ( j=0; j<n; j++ ) {
+	    struct daemon_source *src = events[j].data.ptr;
+	    if ( src ) {
+		daemon_enqueue(d, src);
+	    } else {
+		char buf[64];
+		if ( read(d->wake_pipe[0], buf, sizeof(buf)) < 0 )
+		    perror("read");
+	    }
+	}
+    }
+
+    ret = 0;
+
+out:
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGUSR1, SIG_DFL);
+
+    pthread_mutex_lock(&d->queue_lock);
+    d->queue_shutdown = 1;
+    pthread_cond_broadcast(&d->queue_cond);
+    pthread_mutex_unlock(&d->queue_lock);
+    for ( i=0; i<nworkers_started; i++ )
+	pthread_join(workers[i], NULL);
+    free(workers);
+
+    for ( i=0; i<d->nsources; i++ ) {
+	struct daemon_source *src = d->sources[i];
+	void *retval;
+	if ( !src->has_reader )
+	    continue;
+	pthread_cancel(src->reader);
+	pthread_join(src->reader, &retval);
+	src->cancelled = retval == PTHREAD_CANCELED;
+    }
+
+    // end any carriers of the sources that were interrupted
+    for ( i=0; i<d->nsources; i++ ) {
+	struct daemon_source *src = d->sources[i];
+	if ( src->rx && !src->done ) {
+	    minimodem_rx_flush(src->rx);
+	    fflush(src->out);
+	}
+    }
+
+    if ( ret == 0 )
+	daemon_report_stats(d);
+
+    for ( i=0; i<d->nsources; i++ )
+	daemon_source_close(d->sources[i]);
+    free(d->sources);
+    if ( d->epfd >= 0 )
+	close(d->epfd);
+    if ( d->wake_pipe[0] >= 0 ) {
+	close(d->wake_pipe[0]);
+	close(d->wake_pipe[1]);
+    }
+
+    return ret;
+}
+
+#else /* !HAVE_SYS_EPOLL_H */
+
+int
+minimodem_daemon( const char *config_path, int quiet_mode )
+{
+    fprintf(stderr, "E: This build of minimodem was configured without epoll,\nE:   so the --daemon flag is not supported.\n");
+    return 1;
+}
+
+#endif /* HAVE_SYS_EPOLL_H */
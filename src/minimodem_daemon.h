@@ -0,0 +1,30 @@
+/*
+ * minimodem_daemon.h
+ *
+ * Copyright (C) 2011-2016 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MINIMODEM_DAEMON_H
+#define MINIMODEM_DAEMON_H
+
+/*
+ * Receive from all of the sources listed in config_path, until they have
+ * all ended or until SIGINT/SIGTERM.  Returns the process exit status.
+ */
+int
+minimodem_daemon( const char *config_path, int quiet_mode );
+
+#endif
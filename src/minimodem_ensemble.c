@@ -0,0 +1,673 @@
+/*
+ * minimodem_ensemble.c
+ *
+ * minimodem - software audio Bell-type or RTTY FSK modem
+ *
+ * Copyright (C) 2011-2016 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "minimodem_ensemble.h"
+
+
+/*
+ * Ensemble decoding.
+ *
+ * Each variant of the receiver is pushed the same 100 ms blocks of the
+ * stream, by the worker threads (variant v belongs to worker v % nworkers)
+ * while the main thread reads the next block, as for multi-mode input
+ * (see minimodem_channels.c).  The variants' callbacks are logged per
+ * carrier.
+ *
+ * Between blocks the main thread merges the carriers: the earliest one
+ * not yet merged, and every carrier of any variant overlapping it (or
+ * overlapping those, and so on) make up a transmission.  Once no variant
+ * can still start a carrier overlapping it, the transmission goes to the
+ * variant whose carriers there have the highest score, the sum of their
+ * frames' confidence (so that decoding more frames counts, as well as
+ * decoding them more cleanly), and that variant's logs are replayed.
+ */
+
+#define ENS_MAX_VARIANTS	16
+
+struct ens_log_rec {
+	int			is_event;
+	unsigned int		nbytes;
+	minimodem_rx_event	ev;
+};
+
+struct ens_carrier {
+	struct ens_carrier	*next;		// in the variant's stream order
+	unsigned long long	start, end;
+	float			score;
+	char			*log;		// ens_log_recs, each + data
+	size_t			log_len, log_size;
+};
+
+struct variant {
+	struct ensemble		*e;
+	unsigned int		n;		// from 1
+	char			*spec;
+	minimodem_rx		*rx;
+	int			done;
+	struct ens_carrier	*cur;		// the carrier in progress
+	struct ens_carrier	*carriers;	// ended, not yet merged
+	struct ens_carrier	**carriers_tail;
+
+	/* stats (only touched by the main thread) */
+	unsigned int		ncarriers;
+	unsigned int		nwon;
+	unsigned long long	nbytes_won;
+};
+
+struct ensemble {
+	struct variant		*vars;
+	unsigned int		nvars;
+	unsigned int		nworkers;
+	minimodem_rx_data_fn	*data_fn;
+	minimodem_rx_event_fn	*event_fn;
+	void			*cb_arg;
+	int			print_stats;
+	int			error;
+
+	float			*buf[2];
+	pthread_mutex_t		lock;
+	pthread_cond_t		go_cond;	// main -> workers
+	pthread_cond_t		done_cond;	// workers -> main
+	unsigned long		gen;		// block number; buf[gen & 1]
+	size_t			block_nsamples[2];
+	int			eof;
+	unsigned int		nbusy;		// workers still on this block
+};
+
+struct ens_worker {
+	struct ensemble		*e;
+	unsigned int		w;
+	pthread_t		thread;
+};
+
+static volatile sig_atomic_t ensemble_stop;
+
+static void
+ensemble_stop_sighandler( int sig )
+{
+    ensemble_stop = 1;
+}
+
+static double
+wall_sec( void )
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/*
+ * The variants' callbacks
+ */
+
+static void
+carrier_log( struct ensemble *e, struct ens_carrier *c,
+	const struct ens_log_rec *rec, const char *data )
+{
+    size_t need = c->log_len + sizeof(*rec) + rec->nbytes;
+    if ( need > c->log_size ) {
+	size_t size = c->log_size ? c->log_size * 2 : 1024;
+	while ( size < need )
+	    size *= 2;
+	char *log = realloc(c->log, size);
+	if ( !log ) {
+	    perror("malloc");
+	    e->error = 1;
+	    return;
+	}
+	c->log = log;
+	c->log_size = size;
+    }
+    memcpy(c->log + c->log_len, rec, sizeof(*rec));
+    memcpy(c->log + c->log_len + sizeof(*rec), data, rec->nbytes);
+    c->log_len = need;
+}
+
+static struct ens_carrier *
+var_carrier( struct variant *v )
+{
+    if ( !v->cur ) {
+	v->cur = calloc(1, sizeof(*v->cur));
+	if ( !v->cur ) {
+	    perror("malloc");
+	    v->e->error = 1;
+	    return NULL;
+	}
+	v->cur->start = minimodem_rx_tell(v->rx);
+    }
+    return v->cur;
+}
+
+static void
+var_rx_data( void *arg, const char *data, unsigned int nbytes )
+{
+    struct variant *v = arg;
+    struct ens_carrier *c = var_carrier(v);
+    if ( !c )
+	return;
+    struct ens_log_rec rec = { .is_event = 0, .nbytes = nbytes };
+    carrier_log(v->e, c, &rec, data);
+}
+
+static void
+var_rx_event( void *arg, const minimodem_rx_event *ev )
+{
+    struct variant *v = arg;
+    if ( ev->type == MINIMODEM_RX_LOADSHED )
+	return;
+    struct ens_carrier *c = var_carrier(v);
+    if ( !c )
+	return;
+    struct ens_log_rec rec = { .is_event = 1, .ev = *ev };
+    carrier_log(v->e, c, &rec, NULL);
+
+    if ( ev->type == MINIMODEM_RX_NOCARRIER ) {
+	c->end = minimodem_rx_tell(v->rx);
+	if ( c->end < c->start )
+	    c->end = c->start;
+	c->score = ev->confidence * ev->nframes_decoded;
+	*v->carriers_tail = c;
+	v->carriers_tail = &c->next;
+	v->cur = NULL;
+    }
+}
+
+
+/*
+ * Merging
+ */
+
+static unsigned long long
+carrier_replay( struct ensemble *e, const struct ens_carrier *c )
+{
+    unsigned long long nbytes = 0;
+    size_t off = 0;
+    while ( off < c->log_len ) {
+	struct ens_log_rec rec;
+	memcpy(&rec, c->log + off, sizeof(rec));
+	off += sizeof(rec);
+	if ( rec.is_event ) {
+	    if ( e->event_fn )
+		e->event_fn(e->cb_arg, &rec.ev);
+	} else {
+	    e->data_fn(e->cb_arg, c->log + off, rec.nbytes);
+	    nbytes += rec.nbytes;
+	}
+	off += rec.nbytes;
+    }
+    return nbytes;
+}
+
+static void
+carrier_free( struct ens_carrier *c )
+{
+    free(c->log);
+    free(c);
+}
+
+/*
+ * Pass on every transmission which no carrier still to come can overlap:
+ * those ending before each variant's carrier in progress, or else its
+ * next frame search, begins.  With final, pass on the rest.
+ */
+static void
+ensemble_merge( struct ensemble *e, int final )
+{
+    struct ens_carrier *group_next[ENS_MAX_VARIANTS];
+    unsigned int i;
+
+    unsigned long long horizon = ULLONG_MAX;
+    for ( i=0; !final && i<e->nvars; i++ ) {
+	struct variant *v = &e->vars[i];
+	if ( v->done )
+	    continue;
+	unsigned long long pos = v->cur ? v->cur->start
+					: minimodem_rx_tell(v->rx);
+	if ( horizon > pos )
+	    horizon = pos;
+    }
+
+    while ( 1 ) {
+	struct ens_carrier *first = NULL;
+	for ( i=0; i<e->nvars; i++ ) {
+	    struct ens_carrier *c = e->vars[i].carriers;
+	    if ( c && (!first || c->start < first->start) )
+		first = c;
+	}
+	if ( !first )
+	    break;
+
+	// gather the transmission: group_next[i] is then the first of
+	// variant i's carriers after it
+	unsigned long long group_end = first->end;
+	int grew;
+	for ( i=0; i<e->nvars; i++ )
+	    group_next[i] = e->vars[i].carriers;
+	do {
+	    grew = 0;
+	    for ( i=0; i<e->nvars; i++ ) {
+		struct ens_carrier *c;
+		for ( c=group_next[i]; c && c->start <= group_end;
+							c=c->next ) {
+		    if ( group_end < c->end )
+			group_end = c->end;
+		    grew = 1;
+		}
+		group_next[i] = c;
+	    }
+	} while ( grew );
+	if ( group_end >= horizon )
+	    break;
+
+	// the best variant there, and the runner-up
+	int best = -1;
+	float best_score = 0.0f, next_score = 0.0f;
+	for ( i=0; i<e->nvars; i++ ) {
+	    struct variant *v = &e->vars[i];
+	    struct ens_carrier *c;
+	    float score = 0.0f;
+	    if ( v->carriers == group_next[i] )
+		continue;
+	    for ( c=v->carriers; c!=group_next[i]; c=c->next )
+		score += c->score;
+	    if ( best < 0 || score > best_score ) {
+		next_score = best < 0 ? 0.0f : best_score;
+		best = i;
+		best_score = score;
+	    } else if ( score > next_score ) {
+		next_score = score;
+	    }
+	}
+
+	struct variant *bv = &e->vars[best];
+	struct ens_carrier *c;
+	for ( c=bv->carriers; c!=group_next[best]; c=c->next )
+	    bv->nbytes_won += carrier_replay(e, c);
+	bv->nwon++;
+	if ( e->print_stats )
+	    fprintf(stderr, "### ENSEMBLE variant=%u score=%.2f"
+			    " runner-up=%.2f ###\n",
+		    bv->n, (double)best_score, (double)next_score);
+
+	for ( i=0; i<e->nvars; i++ ) {
+	    struct variant *v = &e->vars[i];
+	    while ( v->carriers != group_next[i] ) {
+		c = v->carriers;
+		v->carriers = c->next;
+		v->ncarriers++;
+		carrier_free(c);
+	    }
+	    if ( !v->carriers )
+		v->carriers_tail = &v->carriers;
+	}
+    }
+}
+
+
+/*
+ * Workers
+ */
+
+static void *
+ensemble_worker( void *arg )
+{
+    struct ens_worker *ew = arg;
+    struct ensemble *e = ew->e;
+    unsigned long gen = 0;
+    unsigned int i;
+    int eof;
+
+    // leave SIGINT to the main thread
+    sigset_t sigs;
+    sigfillset(&sigs);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+    do {
+	pthread_mutex_lock(&e->lock);
+	while ( e->gen == gen )
+	    pthread_cond_wait(&e->go_cond, &e->lock);
+	gen = e->gen;
+	eof = e->eof;
+	size_t nsamples = e->block_nsamples[gen & 1];
+	pthread_mutex_unlock(&e->lock);
+
+	for ( i=ew->w; i<e->nvars; i+=e->nworkers ) {
+	    struct variant *v = &e->vars[i];
+	    if ( v->done )
+		continue;
+	    if ( nsamples && minimodem_rx_push(v->rx, e->buf[gen & 1],
+					nsamples) )
+		v->done = 1;
+	    if ( eof && !v->done ) {
+		minimodem_rx_flush(v->rx);
+		v->done = 1;
+	    }
+	}
+
+	pthread_mutex_lock(&e->lock);
+	if ( --e->nbusy == 0 )
+	    pthread_cond_signal(&e->done_cond);
+	pthread_mutex_unlock(&e->lock);
+    } while ( !eof );
+
+    return NULL;
+}
+
+/* called with e->lock held */
+static void
+ensemble_wait_idle( struct ensemble *e )
+{
+    while ( e->nbusy )
+	pthread_cond_wait(&e->done_cond, &e->lock);
+}
+
+static int
+ensemble_all_done( struct ensemble *e )
+{
+    unsigned int i;
+    for ( i=0; i<e->nvars; i++ )
+	if ( !e->vars[i].done )
+	    return 0;
+    return 1;
+}
+
+
+/*
+ * Setup
+ */
+
+/* parse value into out, if it is all a number in (min, max) */
+static int
+ensemble_parse_value( const char *value, double min, double max,
+	float *out )
+{
+    char *end;
+    errno = 0;
+    double d = strtod(value, &end);
+    if ( end == value || *end != 0 || errno || !(d > min && d < max) )
+	return -1;
+    *out = d;
+    return 0;
+}
+
+/*
+ * Apply the key=value overrides of spec (which is clobbered) to cfg, for
+ * the n'th variant, whose spec was orig_spec.
+ */
+static int
+ensemble_parse_variant( minimodem_config *cfg, char *spec,
+	unsigned int n, const char *orig_spec )
+{
+    double nyquist = cfg->sample_rate / 2.0;
+    char *saveptr, *key;
+    for ( key = strtok_r(spec, ",", &saveptr); key;
+		key = strtok_r(NULL, ",", &saveptr) ) {
+	char *value = strchr(key, '=');
+	if ( !value ) {
+	    fprintf(stderr, "E: --ensemble: variant %u \"%s\": expected"
+			" key=value, not '%s'\n", n, orig_spec, key);
+	    return -1;
+	}
+	*value++ = 0;
+	float *field;
+	double max = HUGE_VAL;
+	if ( strcmp(key, "bandwidth") == 0 )
+	    field = &cfg->band_width;
+	else if ( strcmp(key, "confidence") == 0 )
+	    field = &cfg->fsk_confidence_threshold;
+	else if ( strcmp(key, "limit") == 0 )
+	    field = &cfg->fsk_confidence_search_limit;
+	else if ( strcmp(key, "mark") == 0 ) {
+	    field = &cfg->bfsk_mark_f;
+	    max = nyquist;
+	} else if ( strcmp(key, "space") == 0 ) {
+	    field = &cfg->bfsk_space_f;
+	    max = nyquist;
+	} else {
+	    fprintf(stderr, "E: --ensemble: variant %u \"%s\": unknown"
+			" key '%s'\n", n, orig_spec, key);
+	    return -1;
+	}
+	if ( ensemble_parse_value(value, 0.0, max, field) < 0 ) {
+	    if ( max == HUGE_VAL )
+		fprintf(stderr, "E: --ensemble: variant %u \"%s\": %s must"
+			" be a number above 0, not '%s'\n",
+			n, orig_spec, key, value);
+	    else
+		fprintf(stderr, "E: --ensemble: variant %u \"%s\": %s must"
+			" be a frequency between 0 and %g Hz, not '%s'\n",
+			n, orig_spec, key, max, value);
+	    return -1;
+	}
+    }
+
+    // as minimodem_config_finish()
+    if ( cfg->band_width > cfg->bfsk_data_rate )
+	cfg->band_width = cfg->bfsk_data_rate;
+    if ( cfg->fsk_confidence_search_limit < cfg->fsk_confidence_threshold )
+	cfg->fsk_confidence_search_limit = cfg->fsk_confidence_threshold;
+    return 0;
+}
+
+static int
+ensemble_add_variant( struct ensemble *e, const minimodem_config *cfg,
+	const char *spec, size_t spec_len )
+{
+    if ( e->nvars == ENS_MAX_VARIANTS ) {
+	fprintf(stderr, "E: --ensemble: at most %u variants\n",
+		ENS_MAX_VARIANTS);
+	return -1;
+    }
+    struct variant *v = &e->vars[e->nvars];
+    v->e = e;
+    v->n = ++e->nvars;
+    v->carriers_tail = &v->carriers;
+    v->spec = strndup(spec, spec_len);
+    char *tmp = strndup(spec, spec_len);
+    if ( !v->spec || !tmp ) {
+	perror("malloc");
+	free(tmp);
+	return -1;
+    }
+
+    minimodem_config vcfg = *cfg;
+    int r = ensemble_parse_variant(&vcfg, tmp, v->n, v->spec);
+    free(tmp);
+    if ( r < 0 )
+	return -1;
+
+    v->rx = minimodem_rx_new(&vcfg, var_rx_data, var_rx_event, v);
+    return v->rx ? 0 : -1;
+}
+
+int
+minimodem_ensemble_run( simpleaudio *sa, const minimodem_config *cfg,
+	const char *variants,
+	minimodem_rx_data_fn *data_fn,
+	minimodem_rx_event_fn *event_fn,
+	void *cb_arg, int print_stats )
+{
+    unsigned int i, w;
+    unsigned long long nsamples_total = 0;
+    double t_start = wall_sec();
+    int ret = 1;
+
+    struct ensemble e = {
+	.data_fn = data_fn,
+	.event_fn = event_fn,
+	.cb_arg = cb_arg,
+	.print_stats = print_stats,
+    };
+    pthread_mutex_init(&e.lock, NULL);
+    pthread_cond_init(&e.go_cond, NULL);
+    pthread_cond_init(&e.done_cond, NULL);
+
+    // 100 ms blocks
+    size_t block_nsamples = cfg->sample_rate / 10;
+    if ( block_nsamples == 0 )
+	block_nsamples = 1;
+
+    e.vars = calloc(ENS_MAX_VARIANTS, sizeof(struct variant));
+    e.buf[0] = malloc(block_nsamples * sizeof(float));
+    e.buf[1] = malloc(block_nsamples * sizeof(float));
+    struct ens_worker *workers = calloc(ENS_MAX_VARIANTS,
+					sizeof(struct ens_worker));
+    if ( !e.vars || !e.buf[0] || !e.buf[1] || !workers ) {
+	perror("malloc");
+	goto out;
+    }
+
+    const char *spec = variants;
+    while ( 1 ) {
+	const char *end = strchr(spec, ':');
+	size_t len = end ? (size_t)(end - spec) : strlen(spec);
+	if ( ensemble_add_variant(&e, cfg, spec, len) < 0 )
+	    goto out;
+	if ( !end )
+	    break;
+	spec = end + 1;
+    }
+
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    e.nworkers = ncpus > 0 && ncpus < e.nvars ? ncpus : e.nvars;
+
+    for ( w=0; w<e.nworkers; w++ ) {
+	workers[w].e = &e;
+	workers[w].w = w;
+	if ( pthread_create(&workers[w].thread, NULL,
+				ensemble_worker, &workers[w]) != 0 ) {
+	    perror("pthread_create");
+	    e.nworkers = w;
+	    goto stop_workers;
+	}
+    }
+
+    ensemble_stop = 0;
+    signal(SIGINT, ensemble_stop_sighandler);
+
+    ret = 0;
+    int eof = 0;
+    while ( !eof ) {
+	unsigned int k = (e.gen + 1) & 1;	// the buffer not in use
+
+	ssize_t r = simpleaudio_read(sa, e.buf[k], block_nsamples);
+	if ( r < 0 ) {
+	    fprintf(stderr, "simpleaudio_read: error\n");
+	    ret = 1;
+	}
+	if ( r <= 0 || ensemble_stop ) {
+	    r = 0;
+	    eof = 1;
+	}
+	nsamples_total += r;
+
+	pthread_mutex_lock(&e.lock);
+	ensemble_wait_idle(&e);
+	ensemble_merge(&e, 0);
+	if ( ensemble_all_done(&e) )
+	    eof = 1;
+	e.block_nsamples[k] = r;
+	e.eof = eof;
+	e.nbusy = e.nworkers;
+	e.gen++;
+	pthread_cond_broadcast(&e.go_cond);
+	pthread_mutex_unlock(&e.lock);
+    }
+
+    signal(SIGINT, SIG_DFL);
+
+stop_workers:
+    if ( !e.eof ) {
+	// tell any workers already started to quit
+	pthread_mutex_lock(&e.lock);
+	ensemble_wait_idle(&e);
+	e.block_nsamples[(e.gen + 1) & 1] = 0;
+	e.eof = 1;
+	e.nbusy = e.nworkers;
+	e.gen++;
+	pthread_cond_broadcast(&e.go_cond);
+	pthread_mutex_unlock(&e.lock);
+    }
+    for ( w=0; w<e.nworkers; w++ )
+	pthread_join(workers[w].thread, NULL);
+
+    if ( ret == 0 ) {
+	ensemble_merge(&e, 1);
+	if ( e.error )
+	    ret = 1;
+    }
+
+    if ( print_stats && ret == 0 ) {
+	double wall = wall_sec() - t_start;
+	double audio_sec = (double)nsamples_total / cfg->sample_rate;
+	for ( i=0; i<e.nvars; i++ ) {
+	    struct variant *v = &e.vars[i];
+	    fprintf(stderr, "### ENSEMBLE variant=%u \"%s\" carriers=%u"
+			    " won=%u bytes=%llu ###\n",
+		    v->n, v->spec, v->ncarriers, v->nwon, v->nbytes_won);
+	}
+	fprintf(stderr, "### STATS audio=%.1fs wall=%.2fs speed=%.1fx"
+			" jobs=%u variants=%u ###\n",
+		audio_sec, wall, wall > 0.0 ? audio_sec / wall : 0.0,
+		e.nworkers, e.nvars);
+    }
+
+out:
+    if ( e.vars ) {
+	for ( i=0; i<e.nvars; i++ ) {
+	    struct variant *v = &e.vars[i];
+	    while ( v->carriers ) {
+		struct ens_carrier *c = v->carriers;
+		v->carriers = c->next;
+		carrier_free(c);
+	    }
+	    if ( v->cur )
+		carrier_free(v->cur);
+	    if ( v->rx )
+		minimodem_rx_destroy(v->rx);
+	    free(v->spec);
+	}
+	free(e.vars);
+    }
+    free(workers);
+    free(e.buf[0]);
+    free(e.buf[1]);
+    pthread_cond_destroy(&e.done_cond);
+    pthread_cond_destroy(&e.go_cond);
+    pthread_mutex_destroy(&e.lock);
+    return ret;
+}
@@ -0,0 +1,47 @@
+/*
+ * minimodem_ensemble.h
+ *
+ * Copyright (C) 2011-2016 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MINIMODEM_ENSEMBLE_H
+#define MINIMODEM_ENSEMBLE_H
+
+#include "simpleaudio.h"
+#include "libminimodem.h"
+
+/*
+ * Decode the (mono, float) stream sa with several variants of the
+ * receiver cfg at once, on a thread per CPU, and keep the best decode of
+ * each transmission.  variants is a ':'-separated list of variants, each
+ * a ','-separated list of key=value overrides of cfg (bandwidth,
+ * confidence, limit, mark, space); an empty variant is cfg itself.
+ *
+ * Each variant's carriers are collected; carriers of different variants
+ * which overlap in time are taken for the same transmission, and only
+ * the variant whose frames there add up to the most confidence is passed
+ * on to the data and event callbacks (from the calling thread, in stream
+ * order).  With print_stats, notes the winner of each transmission and
+ * the totals of each variant on stderr.  Returns the process exit status.
+ */
+int
+minimodem_ensemble_run( simpleaudio *sa, const minimodem_config *cfg,
+	const char *variants,
+	minimodem_rx_data_fn *data_fn,
+	minimodem_rx_event_fn *event_fn,
+	void *cb_arg, int print_stats );
+
+#endif
@@ -0,0 +1,458 @@
+/*
+ * minimodem_flight.c
+ *
+ * minimodem - software audio Bell-type or RTTY FSK modem
+ *
+ * Copyright (C) 2011-2016 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "simpleaudio.h"
+#include "minimodem_flight.h"
+
+
+#define FLIGHT_NTRACE		4096	// frames and events kept
+#define FLIGHT_MAX_PENDING	4	// dumps queued for the writer
+
+enum {
+	TRACE_FRAME,
+	TRACE_CARRIER,
+	TRACE_NOCARRIER,
+};
+
+struct flight_trace {
+	int		type;
+	unsigned long long sample;
+	unsigned int	count;		// frame: nsamples; nocarrier: frames
+	float		confidence;
+	float		amplitude;
+	float		value;		// carrier: freq; nocarrier: bps
+	unsigned long long bits;	// frame
+};
+
+/* a copy of the recording, for the writer */
+struct flight_dump {
+	struct flight_dump	*next;
+	unsigned int		seq;
+	char			reason[64];
+	time_t			when;
+	unsigned long long	start;
+	float			*samples;
+	size_t			nsamples;
+	struct flight_trace	*trace;
+	unsigned int		ntrace;
+};
+
+struct minimodem_flight {
+	char		*dir;
+	unsigned int	sample_rate;
+	float		min_confidence;
+
+	/* the recording (only touched from the receiver's callbacks) */
+	float		*ring;
+	size_t		ring_size;
+	size_t		ring_nvalid;
+	unsigned long long ring_end;	// stream position after the newest
+	struct flight_trace trace[FLIGHT_NTRACE];
+	unsigned int	trace_next;
+	unsigned int	trace_nvalid;
+	unsigned int	seq;
+
+	volatile sig_atomic_t requested;
+
+	/* the writer */
+	pthread_t	thread;
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	struct flight_dump *queue_head, *queue_tail;
+	unsigned int	npending;
+	int		shutdown;
+};
+
+
+/*
+ * The writer thread
+ */
+
+static int
+flight_write_trace( FILE *f, const struct flight_dump *d,
+	unsigned int sample_rate )
+{
+    char when[32];
+    strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", localtime(&d->when));
+    fprintf(f, "# minimodem flight recorder: %s at %s\n", d->reason, when);
+    fprintf(f, "rate=%u start=%llu nsamples=%zu\n",
+	    sample_rate, d->start, d->nsamples);
+    unsigned int i;
+    for ( i=0; i<d->ntrace; i++ ) {
+	const struct flight_trace *t = &d->trace[i];
+	switch ( t->type ) {
+	    case TRACE_FRAME:
+		fprintf(f, "frame sample=%llu nsamples=%u confidence=%.3f"
+			   " amplitude=%.3f bits=0x%llx\n",
+			t->sample, t->count, (double)t->confidence,
+			(double)t->amplitude, t->bits);
+		break;
+	    case TRACE_CARRIER:
+		fprintf(f, "carrier sample=%llu freq=%.1f\n",
+			t->sample, (double)t->value);
+		break;
+	    case TRACE_NOCARRIER:
+		fprintf(f, "nocarrier sample=%llu frames=%u confidence=%.3f"
+			   " amplitude=%.3f bps=%.2f\n",
+			t->sample, t->count, (double)t->confidence,
+			(double)t->amplitude, (double)t->value);
+		break;
+	}
+    }
+    return ferror(f) ? -1 : 0;
+}
+
+static void
+flight_write( minimodem_flight *fl, struct flight_dump *d )
+{
+    size_t path_len = strlen(fl->dir) + 64;
+    char *path = malloc(path_len);
+    if ( !path ) {
+	perror("malloc");
+	return;
+    }
+
+    snprintf(path, path_len, "%s/flight-%u-%llu.wav",
+	    fl->dir, d->seq, d->start);
+    simpleaudio *sa = simpleaudio_open_stream(SA_BACKEND_FILE, NULL,
+				SA_STREAM_PLAYBACK, SA_SAMPLE_FORMAT_FLOAT,
+				fl->sample_rate, 1, "minimodem", path);
+    if ( sa ) {
+	if ( d->nsamples && simpleaudio_write(sa, d->samples,
+				d->nsamples) != (ssize_t)d->nsamples )
+	    fprintf(stderr, "E: %s: write failed\n", path);
+	simpleaudio_close(sa);
+    }
+
+    snprintf(path, path_len, "%s/flight-%u-%llu.txt",
+	    fl->dir, d->seq, d->start);
+    FILE *f = fopen(path, "w");
+    if ( !f || (flight_write_trace(f, d, fl->sample_rate) < 0) | fclose(f) )
+	perror(path);
+
+    fprintf(stderr, "### FLIGHT %u %s ###\n", d->seq, d->reason);
+    free(path);
+}
+
+static void *
+flight_thread( void *arg )
+{
+    minimodem_flight *fl = arg;
+
+    pthread_mutex_lock(&fl->lock);
+    while ( 1 ) {
+	while ( !fl->queue_head && !fl->shutdown )
+	    pthread_cond_wait(&fl->cond, &fl->lock);
+	struct flight_dump *d = fl->queue_head;
+	if ( !d )
+	    break;		// (shut down, with nothing left to write)
+	fl->queue_head = d->next;
+	if ( !fl->queue_head )
+	    fl->queue_tail = NULL;
+	pthread_mutex_unlock(&fl->lock);
+
+	flight_write(fl, d);
+	free(d->samples);
+	free(d->trace);
+	free(d);
+
+	pthread_mutex_lock(&fl->lock);
+	fl->npending--;
+    }
+    pthread_mutex_unlock(&fl->lock);
+    return NULL;
+}
+
+
+/*
+ * The recording
+ */
+
+/* copy the recording, and queue it for the writer */
+static void
+flight_dump( minimodem_flight *fl, const char *reason )
+{
+    pthread_mutex_lock(&fl->lock);
+    int full = fl->npending == FLIGHT_MAX_PENDING;
+    if ( !full )
+	fl->npending++;
+    pthread_mutex_unlock(&fl->lock);
+    if ( full ) {
+	fprintf(stderr, "W: flight recorder: %u dumps still being written,"
+			" dropped one (%s)\n", FLIGHT_MAX_PENDING, reason);
+	return;
+    }
+
+    struct flight_dump *d = calloc(1, sizeof(*d));
+    size_t n = fl->ring_nvalid;
+    if ( d ) {
+	d->samples = malloc((n ? n : 1) * sizeof(float));
+	d->trace = malloc(fl->trace_nvalid * sizeof(*d->trace) + 1);
+    }
+    if ( !d || !d->samples || !d->trace ) {
+	perror("malloc");
+	if ( d ) {
+	    free(d->samples);
+	    free(d->trace);
+	    free(d);
+	}
+	pthread_mutex_lock(&fl->lock);
+	fl->npending--;
+	pthread_mutex_unlock(&fl->lock);
+	return;
+    }
+
+    d->seq = ++fl->seq;
+    snprintf(d->reason, sizeof(d->reason), "%s", reason);
+    d->when = time(NULL);
+    d->start = fl->ring_end - n;
+    d->nsamples = n;
+
+    // the ring, oldest first
+    size_t end = fl->ring_end % fl->ring_size;
+    size_t first = (end + fl->ring_size - n) % fl->ring_size;
+    size_t n1 = first + n <= fl->ring_size ? n : fl->ring_size - first;
+    memcpy(d->samples, fl->ring + first, n1 * sizeof(float));
+    memcpy(d->samples + n1, fl->ring, (n - n1) * sizeof(float));
+
+    // the trace of those samples, oldest first
+    unsigned int i;
+    for ( i=0; i<fl->trace_nvalid; i++ ) {
+	unsigned int j = (fl->trace_next + FLIGHT_NTRACE - fl->trace_nvalid
+				+ i) % FLIGHT_NTRACE;
+	if ( fl->trace[j].sample >= d->start )
+	    d->trace[d->ntrace++] = fl->trace[j];
+    }
+
+    pthread_mutex_lock(&fl->lock);
+    if ( fl->queue_tail )
+	fl->queue_tail->next = d;
+    else
+	fl->queue_head = d;
+    fl->queue_tail = d;
+    pthread_cond_signal(&fl->cond);
+    pthread_mutex_unlock(&fl->lock);
+}
+
+static void
+flight_check_request( minimodem_flight *fl )
+{
+    if ( fl->requested ) {
+	fl->requested = 0;
+	flight_dump(fl, "requested");
+    }
+}
+
+static struct flight_trace *
+flight_trace_add( minimodem_flight *fl, int type, unsigned long long sample )
+{
+    struct flight_trace *t = &fl->trace[fl->trace_next];
+    fl->trace_next = (fl->trace_next + 1) % FLIGHT_NTRACE;
+    if ( fl->trace_nvalid < FLIGHT_NTRACE )
+	fl->trace_nvalid++;
+    memset(t, 0, sizeof(*t));
+    t->type = type;
+    t->sample = sample;
+    return t;
+}
+
+void
+minimodem_flight_samples( minimodem_flight *fl, unsigned long long pos,
+	const float *samples, size_t nsamples )
+{
+    // (a jump in the stream starts the recording over)
+    if ( pos != fl->ring_end ) {
+	fl->ring_nvalid = 0;
+	fl->ring_end = pos;
+    }
+    if ( nsamples > fl->ring_size ) {
+	samples += nsamples - fl->ring_size;
+	fl->ring_end += nsamples - fl->ring_size;
+	nsamples = fl->ring_size;
+    }
+    size_t end = fl->ring_end % fl->ring_size;
+    size_t n1 = end + nsamples <= fl->ring_size
+			? nsamples : fl->ring_size - end;
+    memcpy(fl->ring + end, samples, n1 * sizeof(float));
+    memcpy(fl->ring, samples + n1, (nsamples - n1) * sizeof(float));
+    fl->ring_end += nsamples;
+    fl->ring_nvalid += nsamples;
+    if ( fl->ring_nvalid > fl->ring_size )
+	fl->ring_nvalid = fl->ring_size;
+
+    flight_check_request(fl);
+}
+
+void
+minimodem_flight_frame( minimodem_flight *fl,
+	const minimodem_rx_frame *frame,
+	const char *data, unsigned int nbytes )
+{
+    struct flight_trace *t = flight_trace_add(fl, TRACE_FRAME, frame->offset);
+    t->count = frame->nsamples;
+    t->confidence = frame->confidence;
+    t->amplitude = frame->amplitude;
+    t->bits = frame->bits;
+}
+
+void
+minimodem_flight_event( minimodem_flight *fl, const minimodem_rx_event *ev )
+{
+    struct flight_trace *t;
+
+    switch ( ev->type ) {
+	case MINIMODEM_RX_CARRIER:
+	    t = flight_trace_add(fl, TRACE_CARRIER, ev->sample);
+	    t->value = ev->carrier_freq;
+	    break;
+	case MINIMODEM_RX_NOCARRIER:
+	    t = flight_trace_add(fl, TRACE_NOCARRIER, ev->sample);
+	    t->count = ev->nframes_decoded;
+	    t->confidence = ev->confidence;
+	    t->amplitude = ev->amplitude;
+	    t->value = ev->throughput_rate;
+	    if ( ev->confidence < fl->min_confidence ) {
+		char reason[64];
+		snprintf(reason, sizeof(reason), "confidence=%.3f",
+			(double)ev->confidence);
+		flight_dump(fl, reason);
+	    }
+	    break;
+	default:
+	    break;
+    }
+
+    flight_check_request(fl);
+}
+
+void
+minimodem_flight_request( minimodem_flight *fl )
+{
+    fl->requested = 1;
+}
+
+minimodem_flight *
+minimodem_flight_new( const char *spec, unsigned int sample_rate )
+{
+    float seconds = 30.0f;
+    float min_confidence = 2.0f;
+
+    minimodem_flight *fl = calloc(1, sizeof(*fl));
+    char *opts = fl ? strdup(spec) : NULL;
+    if ( !opts ) {
+	perror("malloc");
+	free(fl);
+	return NULL;
+    }
+
+    char *saveptr, *key;
+    char *dir = strtok_r(opts, ",", &saveptr);
+    if ( !dir ) {
+	fprintf(stderr, "E: --flight-recorder takes a {dir}\n");
+	goto fail;
+    }
+    fl->dir = strdup(dir);
+    while ( (key = strtok_r(NULL, ",", &saveptr)) ) {
+	char *value = strchr(key, '=');
+	if ( value )
+	    *value++ = 0;
+	if ( value && strcmp(key, "seconds") == 0 ) {
+	    seconds = atof(value);
+	    if ( seconds > 0.0f )
+		continue;
+	} else if ( value && strcmp(key, "confidence") == 0 ) {
+	    min_confidence = atof(value);
+	    if ( min_confidence >= 0.0f )
+		continue;
+	}
+	fprintf(stderr, "E: --flight-recorder: bad option '%s%s%s'\n",
+		key, value ? "=" : "", value ? value : "");
+	goto fail;
+    }
+    if ( !fl->dir ) {
+	perror("malloc");
+	goto fail;
+    }
+    if ( access(fl->dir, W_OK) < 0 ) {
+	perror(fl->dir);
+	goto fail;
+    }
+
+    fl->sample_rate = sample_rate;
+    fl->min_confidence = min_confidence;
+    fl->ring_size = seconds * sample_rate;
+    if ( fl->ring_size == 0 )
+	fl->ring_size = 1;
+    fl->ring = malloc(fl->ring_size * sizeof(float));
+    if ( !fl->ring ) {
+	perror("malloc");
+	goto fail;
+    }
+
+    pthread_mutex_init(&fl->lock, NULL);
+    pthread_cond_init(&fl->cond, NULL);
+    if ( pthread_create(&fl->thread, NULL, flight_thread, fl) != 0 ) {
+	perror("pthread_create");
+	pthread_mutex_destroy(&fl->lock);
+	pthread_cond_destroy(&fl->cond);
+	goto fail;
+    }
+
+    free(opts);
+    return fl;
+
+fail:
+    free(opts);
+    free(fl->dir);
+    free(fl->ring);
+    free(fl);
+    return NULL;
+}
+
+void
+minimodem_flight_destroy( minimodem_flight *fl )
+{
+    flight_check_request(fl);
+
+    pthread_mutex_lock(&fl->lock);
+    fl->shutdown = 1;
+    pthread_cond_signal(&fl->cond);
+    pthread_mutex_unlock(&fl->lock);
+    pthread_join(fl->thread, NULL);
+
+    pthread_mutex_destroy(&fl->lock);
+    pthread_cond_destroy(&fl->cond);
+    free(fl->dir);
+    free(fl->ring);
+    free(fl);
+}
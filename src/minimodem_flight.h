@@ -0,0 +1,71 @@
+/*
+ * minimodem_flight.h
+ *
+ * Copyright (C) 2011-2016 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MINIMODEM_FLIGHT_H
+#define MINIMODEM_FLIGHT_H
+
+#include <stddef.h>
+
+#include "libminimodem.h"
+
+/*
+ * Flight recorder: keeps the last few seconds of a receiver's input
+ * samples, and a trace of the frames and carrier events decoded from
+ * them, in memory.  When a carrier ends with a low average confidence,
+ * or on minimodem_flight_request() (e.g. from SIGUSR1), it dumps them to
+ * "{dir}/flight-{n}-{sample}.wav" (the samples; {sample} is the stream
+ * position of the first) and "{dir}/flight-{n}-{sample}.txt" (the trace).
+ * The files are written by a thread of the recorder's own, so the
+ * receiver's callbacks only ever copy the recording.
+ */
+
+typedef struct minimodem_flight minimodem_flight;
+
+/*
+ * spec is "{dir}[,seconds={n}][,confidence={c}]": how much to keep
+ * (default 30 seconds), and the average confidence below which an ending
+ * carrier triggers a dump (default 2.0; 0 for none).  Returns NULL on an
+ * error (reported on stderr).
+ */
+minimodem_flight *
+minimodem_flight_new( const char *spec, unsigned int sample_rate );
+
+/* from the receiver's callbacks: its samples (see
+ * minimodem_rx_samples_fn), the data of each frame, and its events */
+void
+minimodem_flight_samples( minimodem_flight *fl, unsigned long long pos,
+	const float *samples, size_t nsamples );
+
+void
+minimodem_flight_frame( minimodem_flight *fl,
+	const minimodem_rx_frame *frame,
+	const char *data, unsigned int nbytes );
+
+void
+minimodem_flight_event( minimodem_flight *fl, const minimodem_rx_event *ev );
+
+/* Dump at the next callback; async-signal-safe. */
+void
+minimodem_flight_request( minimodem_flight *fl );
+
+/* Writes any dumps still pending (and one requested), then frees fl. */
+void
+minimodem_flight_destroy( minimodem_flight *fl );
+
+#endif
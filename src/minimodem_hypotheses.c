@@ -0,0 +1,246 @@
+/*
+ * minimodem_hypotheses.c
+ *
+ * minimodem - software audio Bell-type or RTTY FSK modem
+ *
+ * Copyright (C) 2011-2016 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "minimodem_hypotheses.h"
+
+
+/*
+ * Multi-hypothesis framing and polarity decoding.
+ *
+ * The hypotheses only differ in how they read the mark and space tone
+ * magnitudes (which tone is which, and how the bits make up a frame), so
+ * those are computed once, for the first hypothesis' receiver, into a
+ * minimodem_features.  Each hypothesis' receiver then decodes from it
+ * with no spectral work, just the frame searches.  The hypothesis which
+ * locks best is the one with the most total confidence, weighted by frame
+ * length: each frame's confidence times its bits, summed (as the --survey
+ * scores them), so that a framing decoding more of the signal, and more
+ * cleanly, wins.  It is decoded again, from the same features, for the
+ * output.
+ */
+
+#define HYP_MAX			16
+
+static const char hyp_default[] =
+	"ascii:inverted,ascii:ascii7:inverted,ascii7"
+	":baudot,stopbits=1.5:inverted,baudot,stopbits=1.5";
+
+struct hypothesis {
+	char			*spec;
+	minimodem_config	cfg;
+	float			frame_nbits;
+
+	unsigned int		ncarriers;
+	unsigned int		nframes;
+	double			confidence_total;
+	double			score;
+};
+
+static void
+hyp_rx_data( void *arg, const char *data, unsigned int nbytes )
+{
+}
+
+static void
+hyp_rx_event( void *arg, const minimodem_rx_event *ev )
+{
+    struct hypothesis *h = arg;
+
+    if ( ev->type != MINIMODEM_RX_NOCARRIER )
+	return;
+    h->ncarriers++;
+    h->nframes += ev->nframes_decoded;
+    h->confidence_total += (double)ev->confidence * ev->nframes_decoded;
+    h->score += (double)ev->confidence * ev->nframes_decoded
+						* h->frame_nbits;
+}
+
+/* apply the changes in spec (which is clobbered) to cfg */
+static int
+hyp_parse( minimodem_config *cfg, char *spec )
+{
+    char *saveptr, *key;
+    for ( key = strtok_r(spec, ",", &saveptr); key;
+		key = strtok_r(NULL, ",", &saveptr) ) {
+	char *value = strchr(key, '=');
+	if ( value )
+	    *value++ = 0;
+	if ( strcmp(key, "inverted") == 0 && !value ) {
+	    float t = cfg->bfsk_mark_f;
+	    cfg->bfsk_mark_f = cfg->bfsk_space_f;
+	    cfg->bfsk_space_f = t;
+	} else if ( strcmp(key, "invert-start-stop") == 0 && !value ) {
+	    cfg->invert_start_stop = !cfg->invert_start_stop;
+	} else if ( strcmp(key, "ascii") == 0 && !value ) {
+	    cfg->bfsk_n_data_bits = 8;
+	    cfg->bfsk_databits_decode = databits_decode_ascii8;
+	} else if ( strcmp(key, "ascii7") == 0 && !value ) {
+	    cfg->bfsk_n_data_bits = 7;
+	    cfg->bfsk_databits_decode = databits_decode_ascii8;
+	} else if ( strcmp(key, "baudot") == 0 && !value ) {
+	    cfg->bfsk_n_data_bits = 5;
+	    cfg->bfsk_databits_decode = databits_decode_baudot;
+	} else if ( strcmp(key, "startbits") == 0 && value ) {
+	    cfg->bfsk_nstartbits = atoi(value);
+	    if ( cfg->bfsk_nstartbits < 0 || cfg->bfsk_nstartbits > 20 )
+		goto bad;
+	} else if ( strcmp(key, "stopbits") == 0 && value ) {
+	    cfg->bfsk_nstopbits = atof(value);
+	    if ( cfg->bfsk_nstopbits < 0 )
+		goto bad;
+	} else {
+	    goto bad;
+	}
+	continue;
+bad:
+	fprintf(stderr, "E: --hypotheses: bad hypothesis '%s%s%s'\n",
+		key, value ? "=" : "", value ? value : "");
+	return -1;
+    }
+    return 0;
+}
+
+/* decode the whole of features with h, into the callbacks */
+static int
+hyp_decode( const struct hypothesis *h, const minimodem_features *features,
+	minimodem_rx_data_fn *data_fn,
+	minimodem_rx_event_fn *event_fn,
+	void *cb_arg )
+{
+    minimodem_rx *rx = minimodem_rx_new(&h->cfg, data_fn, event_fn, cb_arg);
+    if ( !rx )
+	return -1;
+    if ( minimodem_rx_use_features(rx, features) < 0 ) {
+	if ( errno == ESTALE )
+	    fprintf(stderr, "E: --hypotheses: '%s' needs another bit"
+			    " window than the first hypothesis\n", h->spec);
+	else
+	    fprintf(stderr, "E: --hypotheses can't be combined with"
+			    " --preamble, --sync-correlate or"
+			    " --auto-carrier\n");
+	minimodem_rx_destroy(rx);
+	return -1;
+    }
+    minimodem_rx_run_feature_cache(rx);
+    minimodem_rx_destroy(rx);
+    return 0;
+}
+
+int
+minimodem_hypotheses_run( simpleaudio *sa, const minimodem_config *cfg,
+	const char *hypotheses,
+	minimodem_rx_data_fn *data_fn,
+	minimodem_rx_event_fn *event_fn,
+	void *cb_arg, int quiet_mode )
+{
+    struct hypothesis hyps[HYP_MAX];
+    unsigned int nhyps = 0;
+    unsigned int i;
+    int ret = 1;
+
+    if ( !hypotheses )
+	hypotheses = hyp_default;
+
+    const char *spec = hypotheses;
+    while ( 1 ) {
+	const char *end = strchr(spec, ':');
+	size_t len = end ? (size_t)(end - spec) : strlen(spec);
+	if ( nhyps == HYP_MAX ) {
+	    fprintf(stderr, "E: --hypotheses: at most %u hypotheses\n",
+			HYP_MAX);
+	    goto out;
+	}
+	struct hypothesis *h = &hyps[nhyps];
+	memset(h, 0, sizeof(*h));
+	h->spec = strndup(spec, len);
+	char *tmp = strndup(spec, len);
+	if ( !h->spec || !tmp ) {
+	    perror("malloc");
+	    free(h->spec);
+	    free(tmp);
+	    goto out;
+	}
+	nhyps++;
+	h->cfg = *cfg;
+	int r = hyp_parse(&h->cfg, tmp);
+	free(tmp);
+	if ( r < 0 )
+	    goto out;
+	h->frame_nbits = h->cfg.bfsk_nstartbits + h->cfg.bfsk_n_data_bits
+				+ h->cfg.bfsk_nstopbits;
+	if ( !end )
+	    break;
+	spec = end + 1;
+    }
+
+    // the spectral front end, once
+    minimodem_rx *rx = minimodem_rx_new(&hyps[0].cfg, NULL, NULL, NULL);
+    if ( !rx )
+	goto out;
+    minimodem_features *features = minimodem_features_new(rx, sa);
+    minimodem_rx_destroy(rx);
+    if ( !features )
+	goto out;
+
+    int best = -1;
+    for ( i=0; i<nhyps; i++ ) {
+	struct hypothesis *h = &hyps[i];
+	if ( hyp_decode(h, features, hyp_rx_data, hyp_rx_event, h) < 0 )
+	    goto out_features;
+	if ( h->score > 0.0 && (best < 0 || h->score > hyps[best].score) )
+	    best = i;
+	if ( !quiet_mode )
+	    fprintf(stderr, "### HYPOTHESIS %u \"%s\" carriers=%u frames=%u"
+			    " confidence=%.3f score=%.1f ###\n",
+		    i + 1, h->spec, h->ncarriers, h->nframes,
+		    h->nframes ? h->confidence_total / h->nframes : 0.0,
+		    h->score);
+    }
+
+    if ( best < 0 ) {
+	if ( !quiet_mode )
+	    fprintf(stderr, "### NOLOCK ###\n");
+	ret = 0;
+	goto out_features;
+    }
+    if ( !quiet_mode )
+	fprintf(stderr, "### LOCK %d \"%s\" ###\n", best + 1,
+		hyps[best].spec);
+
+    if ( hyp_decode(&hyps[best], features, data_fn, event_fn, cb_arg) == 0 )
+	ret = 0;
+
+out_features:
+    minimodem_features_destroy(features);
+out:
+    for ( i=0; i<nhyps; i++ )
+	free(hyps[i].spec);
+    return ret;
+}
@@ -0,0 +1,44 @@
+/*
+ * minimodem_hypotheses.h
+ *
+ * Copyright (C) 2011-2016 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MINIMODEM_HYPOTHESES_H
+#define MINIMODEM_HYPOTHESES_H
+
+#include "simpleaudio.h"
+#include "libminimodem.h"
+
+/*
+ * Decode the (mono, float) stream sa under each of several framing and
+ * polarity hypotheses, all from one computation of the mark and space
+ * tone magnitudes (see minimodem_features_new()), and report which one
+ * locks.  hypotheses is a ':'-separated list of hypotheses, each a
+ * ','-separated list of changes to cfg (inverted, invert-start-stop,
+ * ascii, ascii7, baudot, startbits=N, stopbits=N); NULL for polarity x
+ * {ascii, ascii7, baudot}.  Reports each hypothesis' score on stderr
+ * (unless quiet_mode), then passes the best one's decode to the data and
+ * event callbacks.  Returns the process exit status.
+ */
+int
+minimodem_hypotheses_run( simpleaudio *sa, const minimodem_config *cfg,
+	const char *hypotheses,
+	minimodem_rx_data_fn *data_fn,
+	minimodem_rx_event_fn *event_fn,
+	void *cb_arg, int quiet_mode );
+
+#endif
@@ -0,0 +1,219 @@
+/*
+ * minimodem_index.c
+ *
+ * minimodem - software audio Bell-type or RTTY FSK modem
+ *
+ * Copyright (C) 2011-2016 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "minimodem_index.h"
+
+
+#define INDEX_MAGIC	"MMINDEX2"
+
+/*
+ * The recording an index is of, told apart from another one (or the
+ * same one rewritten) in its place as make and git do: by its size,
+ * inode and modification time.
+ */
+struct index_source {
+	unsigned long long size;
+	unsigned long long ino;
+	long long	mtime;
+	long		mtime_nsec;
+};
+
+static int
+index_source_stat( const char *source, struct index_source *src )
+{
+    struct stat st;
+    if ( stat(source, &st) < 0 ) {
+	perror(source);
+	return -1;
+    }
+    src->size = st.st_size;
+    src->ino = st.st_ino;
+    src->mtime = st.st_mtim.tv_sec;
+    src->mtime_nsec = st.st_mtim.tv_nsec;
+    return 0;
+}
+
+struct minimodem_index {
+	FILE		*f;
+	char		*path;
+	char		*tmp_path;
+	minimodem_index_segment seg;	// the carrier so far
+	int		error;
+};
+
+minimodem_index *
+minimodem_index_create( const char *path, const char *source,
+	const minimodem_config *cfg )
+{
+    // (taken first: a recording rewritten during the decode is not this)
+    struct index_source src;
+    if ( index_source_stat(source, &src) < 0 )
+	return NULL;
+
+    minimodem_index *idx = calloc(1, sizeof(*idx));
+    if ( !idx ) {
+	perror("malloc");
+	return NULL;
+    }
+    idx->path = strdup(path);
+    idx->tmp_path = malloc(strlen(path) + sizeof(".tmp"));
+    if ( !idx->path || !idx->tmp_path ) {
+	perror("malloc");
+	goto fail;
+    }
+    sprintf(idx->tmp_path, "%s.tmp", path);
+    idx->f = fopen(idx->tmp_path, "w");
+    if ( !idx->f ) {
+	perror(idx->tmp_path);
+	goto fail;
+    }
+    fprintf(idx->f, INDEX_MAGIC " rate=%u baud=%.3f"
+			" size=%llu ino=%llu mtime=%lld.%09ld\n",
+	    cfg->sample_rate, (double)cfg->bfsk_data_rate,
+	    src.size, src.ino, src.mtime, src.mtime_nsec);
+    return idx;
+
+fail:
+    free(idx->path);
+    free(idx->tmp_path);
+    free(idx);
+    return NULL;
+}
+
+void
+minimodem_index_event( minimodem_index *idx, const minimodem_rx_event *ev )
+{
+    minimodem_index_segment *seg = &idx->seg;
+
+    switch ( ev->type ) {
+	case MINIMODEM_RX_CARRIER:
+	    seg->search = ev->search;
+	    seg->start = ev->sample;
+	    seg->mark_f = ev->carrier_freq;
+	    seg->space_f = ev->space_freq;
+	    break;
+	case MINIMODEM_RX_NOCARRIER:
+	    seg->end = ev->sample;
+	    seg->nframes = ev->nframes_decoded;
+	    seg->confidence = ev->confidence;
+	    fprintf(idx->f, "segment search=%llu start=%llu end=%llu"
+			    " mark=%.3f space=%.3f frames=%u confidence=%.3f\n",
+		    seg->search, seg->start, seg->end,
+		    (double)seg->mark_f, (double)seg->space_f,
+		    seg->nframes, (double)seg->confidence);
+	    break;
+	default:
+	    break;
+    }
+}
+
+int
+minimodem_index_close( minimodem_index *idx )
+{
+    int ret = 0;
+    if ( ferror(idx->f) | fclose(idx->f) ) {
+	perror(idx->tmp_path);
+	unlink(idx->tmp_path);
+	ret = -1;
+    } else if ( rename(idx->tmp_path, idx->path) < 0 ) {
+	perror(idx->path);
+	unlink(idx->tmp_path);
+	ret = -1;
+    }
+    free(idx->path);
+    free(idx->tmp_path);
+    free(idx);
+    return ret;
+}
+
+int
+minimodem_index_read_segment( const char *path, const char *source,
+	const minimodem_config *cfg, unsigned int n,
+	minimodem_index_segment *seg )
+{
+    struct index_source src;
+    if ( index_source_stat(source, &src) < 0 )
+	return -1;
+
+    FILE *f = fopen(path, "r");
+    if ( !f ) {
+	perror(path);
+	return -1;
+    }
+
+    int ret = -1;
+    char line[256];
+    unsigned int rate;
+    float baud;
+    struct index_source isrc;
+    if ( !fgets(line, sizeof(line), f)
+	    || sscanf(line, INDEX_MAGIC " rate=%u baud=%f"
+			    " size=%llu ino=%llu mtime=%lld.%ld",
+		    &rate, &baud, &isrc.size, &isrc.ino,
+		    &isrc.mtime, &isrc.mtime_nsec) != 6 ) {
+	fprintf(stderr, "E: %s: not a minimodem index\n", path);
+	goto out;
+    }
+    if ( isrc.size != src.size || isrc.ino != src.ino
+	    || isrc.mtime != src.mtime || isrc.mtime_nsec != src.mtime_nsec ) {
+	fprintf(stderr, "E: %s: indexed from another recording than %s"
+			" (index it again)\n", path, source);
+	goto out;
+    }
+    if ( rate != cfg->sample_rate
+	    || fabsf(baud - cfg->bfsk_data_rate) > 0.001f ) {
+	fprintf(stderr, "E: %s: indexed at %u Hz, %.3f bps\n",
+		path, rate, (double)baud);
+	goto out;
+    }
+
+    unsigned int i = 0;
+    while ( fgets(line, sizeof(line), f) ) {
+	if ( ++i < n )
+	    continue;
+	if ( sscanf(line, "segment search=%llu start=%llu end=%llu"
+			  " mark=%f space=%f frames=%u confidence=%f",
+		    &seg->search, &seg->start, &seg->end,
+		    &seg->mark_f, &seg->space_f,
+		    &seg->nframes, &seg->confidence) != 7 ) {
+	    fprintf(stderr, "E: %s: bad segment %u\n", path, n);
+	    goto out;
+	}
+	ret = 0;
+	goto out;
+    }
+    fprintf(stderr, "E: %s: no segment %u (of %u)\n", path, n, i);
+
+out:
+    fclose(f);
+    return ret;
+}
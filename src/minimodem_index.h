@@ -0,0 +1,83 @@
+/*
+ * minimodem_index.h
+ *
+ * Copyright (C) 2011-2016 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MINIMODEM_INDEX_H
+#define MINIMODEM_INDEX_H
+
+#include "libminimodem.h"
+
+/*
+ * Carrier segment index: a text file with a line per carrier a decode of
+ * a recording found, giving where the receiver acquired it (the position
+ * of the frame search, and the tones), where its frames start and end,
+ * and how well they decoded:
+ *
+ *   MMINDEX2 rate=48000 baud=1200.000 size=9600044 ino=1835017 \
+ *	mtime=1760000000.123456789
+ *   segment search=0 start=40 end=25640 mark=1200.000 space=2200.000 \
+ *	frames=64 confidence=4.910
+ *
+ * (a segment per line).  The first line also notes the size, inode and
+ * modification time of the recording, so an index is not used for
+ * another recording in its place.  minimodem_rx_resume() picks a segment up again
+ * from its search position and tones, so one transmission can be decoded
+ * again without the rest of the recording.
+ */
+
+typedef struct minimodem_index_segment {
+	unsigned long long search;
+	unsigned long long start;
+	unsigned long long end;
+	float		mark_f;
+	float		space_f;
+	unsigned int	nframes;
+	float		confidence;
+} minimodem_index_segment;
+
+typedef struct minimodem_index minimodem_index;
+
+/*
+ * Start writing the index of a decode with cfg of the recording file
+ * source to path (to a temporary file, which minimodem_index_close()
+ * renames into place).  Returns NULL on an error (reported on stderr).
+ */
+minimodem_index *
+minimodem_index_create( const char *path, const char *source,
+	const minimodem_config *cfg );
+
+/* from a minimodem_rx_event_fn */
+void
+minimodem_index_event( minimodem_index *idx, const minimodem_rx_event *ev );
+
+/* Completes and frees idx; returns -1 on an error (reported on stderr). */
+int
+minimodem_index_close( minimodem_index *idx );
+
+/*
+ * Reads segment n (from 1) of the index at path, which must have been
+ * written by a decode with cfg's sample rate and baud rate, of the
+ * recording file source as it is now.  Returns 0, or -1 on an error
+ * (reported on stderr).
+ */
+int
+minimodem_index_read_segment( const char *path, const char *source,
+	const minimodem_config *cfg, unsigned int n,
+	minimodem_index_segment *seg );
+
+#endif
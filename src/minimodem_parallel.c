@@ -0,0 +1,651 @@
+/*
+ * minimodem_parallel.c
+ *
+ * minimodem - software audio Bell-type or RTTY FSK modem
+ *
+ * Copyright (C) 2011-2016 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "minimodem_parallel.h"
+
+
+/*
+ * Chunked parallel decoding.
+ *
+ * The main thread reads the stream and cuts it into segments in the
+ * middle of its quiet gaps (long enough for a carrier to drop and a frame
+ * search on either side).  Each segment is decoded by a worker thread
+ * with a receiver of its own, minimodem_rx_seek()ed to the segment's
+ * start, which logs its callbacks; the main thread replays the logs in
+ * stream order.
+ *
+ * An idle receiver searches at the same stream positions as one fed the
+ * whole stream, so a segment decodes exactly as it would sequentially if
+ * the receiver before it was idle at the cut.  Each worker checks that by
+ * decoding on into the next segment until it is past the cut.  If it was
+ * not idle there (the "gap" held a signal after all, or a segment was cut
+ * off at SEG_MAX_SEC), the main thread carries that receiver on through
+ * the next segment itself, in place of the next segment's worker, until
+ * it is.  Either way the output matches the sequential decode.
+ */
+
+#define SEG_READ_SEC		0.1f
+#define SEG_BLOCK_SEC		0.01f	// energy measuring blocks
+#define SEG_QUIET_RATIO		0.01f	// quiet: -20 dB from the loudest
+#define SEG_MIN_SEC		1.0f	// don't cut off shorter segments
+#define SEG_MAX_SEC		60.0f	// cut longer ones anyway
+#define SEG_PUSH_NSAMPLES	4096
+
+struct seg_decoder {
+	struct parallel		*p;
+	minimodem_rx		*rx;
+	int			direct;		// else into the log
+	char			*log;
+	size_t			log_len, log_size;
+	unsigned long long	cut;		// the next segment's start
+	int			carrier;
+	int			past_cut;	// a callback from past it
+};
+
+/* a logged callback, followed by nbytes of data */
+struct seg_log_rec {
+	int			is_event;
+	unsigned int		nbytes;
+	minimodem_rx_event	ev;
+};
+
+struct segment {
+	struct segment		*next;		// in stream order
+	struct segment		*queue_next;
+	unsigned long long	start;		// stream position
+	float			*samples;
+	size_t			nsamples, size;
+	int			filled, queued, done;
+
+	struct seg_decoder	*dec;
+	int			idle_at_cut;
+	size_t			tail_used;	// of the next's samples
+	double			cpu_sec;
+};
+
+struct parallel {
+	const minimodem_config	*cfg;
+	minimodem_rx_data_fn	*data_fn;
+	minimodem_rx_event_fn	*event_fn;
+	void			*cb_arg;
+
+	pthread_mutex_t		lock;
+	pthread_cond_t		queue_cond;	// main -> workers
+	pthread_cond_t		done_cond;	// workers -> main
+	struct segment		*queue, *queue_last;
+	int			eof;
+	int			error;		// (under lock: set from any thread)
+};
+
+static volatile sig_atomic_t parallel_stop;
+
+static void
+parallel_stop_sighandler( int sig )
+{
+    parallel_stop = 1;
+}
+
+static void
+parallel_set_error( struct parallel *p )
+{
+    pthread_mutex_lock(&p->lock);
+    p->error = 1;
+    pthread_mutex_unlock(&p->lock);
+}
+
+static int
+parallel_error( struct parallel *p )
+{
+    pthread_mutex_lock(&p->lock);
+    int error = p->error;
+    pthread_mutex_unlock(&p->lock);
+    return error;
+}
+
+static double
+thread_cpu_sec( void )
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double
+wall_sec( void )
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/*
+ * Decoders
+ */
+
+static void
+dec_log( struct seg_decoder *d, const struct seg_log_rec *rec,
+	const char *data )
+{
+    size_t need = d->log_len + sizeof(*rec) + rec->nbytes;
+    if ( need > d->log_size ) {
+	size_t size = d->log_size ? d->log_size * 2 : 4096;
+	while ( size < need )
+	    size *= 2;
+	char *log = realloc(d->log, size);
+	if ( !log ) {
+	    perror("malloc");
+	    parallel_set_error(d->p);
+	    return;
+	}
+	d->log = log;
+	d->log_size = size;
+    }
+    memcpy(d->log + d->log_len, rec, sizeof(*rec));
+    memcpy(d->log + d->log_len + sizeof(*rec), data, rec->nbytes);
+    d->log_len = need;
+}
+
+static void
+dec_rx_data( void *arg, const char *data, unsigned int nbytes )
+{
+    struct seg_decoder *d = arg;
+    if ( d->cut && minimodem_rx_tell(d->rx) >= d->cut )
+	d->past_cut = 1;
+    if ( d->direct ) {
+	d->p->data_fn(d->p->cb_arg, data, nbytes);
+	return;
+    }
+    struct seg_log_rec rec = { .is_event = 0, .nbytes = nbytes };
+    dec_log(d, &rec, data);
+}
+
+static void
+dec_rx_event( void *arg, const minimodem_rx_event *ev )
+{
+    struct seg_decoder *d = arg;
+    if ( ev->type == MINIMODEM_RX_CARRIER )
+	d->carrier = 1;
+    else if ( ev->type == MINIMODEM_RX_NOCARRIER )
+	d->carrier = 0;
+    if ( d->cut && minimodem_rx_tell(d->rx) >= d->cut )
+	d->past_cut = 1;
+    if ( d->direct ) {
+	if ( d->p->event_fn )
+	    d->p->event_fn(d->p->cb_arg, ev);
+	return;
+    }
+    struct seg_log_rec rec = { .is_event = 1, .ev = *ev };
+    dec_log(d, &rec, NULL);
+}
+
+static void
+dec_replay( struct seg_decoder *d )
+{
+    size_t off = 0;
+    while ( off < d->log_len ) {
+	struct seg_log_rec rec;
+	memcpy(&rec, d->log + off, sizeof(rec));
+	off += sizeof(rec);
+	if ( rec.is_event ) {
+	    if ( d->p->event_fn )
+		d->p->event_fn(d->p->cb_arg, &rec.ev);
+	} else {
+	    d->p->data_fn(d->p->cb_arg, d->log + off, rec.nbytes);
+	}
+	off += rec.nbytes;
+    }
+}
+
+static struct seg_decoder *
+dec_new( struct parallel *p, unsigned long long start )
+{
+    struct seg_decoder *d = calloc(1, sizeof(*d));
+    if ( !d )
+	return NULL;
+    d->p = p;
+    d->rx = minimodem_rx_new(p->cfg, dec_rx_data, dec_rx_event, d);
+    if ( !d->rx ) {
+	free(d);
+	return NULL;
+    }
+    minimodem_rx_seek(d->rx, start);
+    return d;
+}
+
+static void
+dec_destroy( struct seg_decoder *d )
+{
+    if ( !d )
+	return;
+    minimodem_rx_destroy(d->rx);
+    free(d->log);
+    free(d);
+}
+
+static void
+dec_push( struct seg_decoder *d, const float *samples, size_t nsamples )
+{
+    while ( nsamples ) {
+	size_t n = nsamples < SEG_PUSH_NSAMPLES ? nsamples : SEG_PUSH_NSAMPLES;
+	minimodem_rx_push(d->rx, samples, n);
+	samples += n;
+	nsamples -= n;
+    }
+}
+
+/*
+ * Decode seg from sample skip on, then (unless it is the last) on into
+ * the next segment until past the cut.  Returns whether the receiver was
+ * idle at the cut, i.e. the next segment decodes the same without it.
+ */
+static int
+dec_segment( struct seg_decoder *d, struct segment *seg, size_t skip,
+	size_t *tail_usedp )
+{
+    struct segment *next = seg->next;
+
+    d->cut = next ? next->start : 0;
+    d->past_cut = 0;
+    dec_push(d, seg->samples + skip, seg->nsamples - skip);
+
+    *tail_usedp = 0;
+    if ( !next ) {
+	minimodem_rx_flush(d->rx);
+	return 1;
+    }
+
+    size_t t = 0;
+    while ( t < next->nsamples && minimodem_rx_tell(d->rx) < d->cut ) {
+	size_t n = next->nsamples - t;
+	if ( n > SEG_PUSH_NSAMPLES )
+	    n = SEG_PUSH_NSAMPLES;
+	minimodem_rx_push(d->rx, next->samples + t, n);
+	t += n;
+    }
+    *tail_usedp = t;
+    return minimodem_rx_tell(d->rx) >= d->cut && !d->carrier && !d->past_cut;
+}
+
+
+/*
+ * Workers
+ */
+
+static void *
+parallel_worker( void *arg )
+{
+    struct parallel *p = arg;
+
+    // leave SIGINT to the main thread
+    sigset_t sigs;
+    sigfillset(&sigs);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+    while ( 1 ) {
+	pthread_mutex_lock(&p->lock);
+	while ( !p->queue && !p->eof )
+	    pthread_cond_wait(&p->queue_cond, &p->lock);
+	struct segment *seg = p->queue;
+	if ( seg ) {
+	    p->queue = seg->queue_next;
+	    if ( !p->queue )
+		p->queue_last = NULL;
+	}
+	pthread_mutex_unlock(&p->lock);
+	if ( !seg )
+	    break;
+
+	double cpu0 = thread_cpu_sec();
+	seg->dec = dec_new(p, seg->start);
+	if ( seg->dec )
+	    seg->idle_at_cut = dec_segment(seg->dec, seg, 0, &seg->tail_used);
+	else
+	    parallel_set_error(p);
+	seg->cpu_sec = thread_cpu_sec() - cpu0;
+
+	pthread_mutex_lock(&p->lock);
+	seg->done = 1;
+	pthread_cond_broadcast(&p->done_cond);
+	pthread_mutex_unlock(&p->lock);
+    }
+    return NULL;
+}
+
+static void
+parallel_queue( struct parallel *p, struct segment *seg )
+{
+    pthread_mutex_lock(&p->lock);
+    seg->queued = 1;
+    if ( p->queue_last )
+	p->queue_last->queue_next = seg;
+    else
+	p->queue = seg;
+    p->queue_last = seg;
+    pthread_cond_signal(&p->queue_cond);
+    pthread_mutex_unlock(&p->lock);
+}
+
+static struct segment *
+segment_new( unsigned long long start, size_t size )
+{
+    struct segment *seg = calloc(1, sizeof(*seg));
+    if ( !seg )
+	return NULL;
+    seg->start = start;
+    seg->size = size;
+    seg->samples = malloc(size * sizeof(float));
+    if ( !seg->samples ) {
+	free(seg);
+	return NULL;
+    }
+    return seg;
+}
+
+static void
+segment_free( struct segment *seg )
+{
+    dec_destroy(seg->dec);
+    free(seg->samples);
+    free(seg);
+}
+
+
+int
+minimodem_parallel_run( simpleaudio *sa, const minimodem_config *cfg,
+	unsigned int njobs,
+	minimodem_rx_data_fn *data_fn,
+	minimodem_rx_event_fn *event_fn,
+	void *cb_arg, int print_stats )
+{
+    unsigned int sample_rate = cfg->sample_rate;
+    unsigned int j;
+    int ret = 1;
+
+    struct parallel p = {
+	.cfg = cfg,
+	.data_fn = data_fn,
+	.event_fn = event_fn,
+	.cb_arg = cb_arg,
+    };
+    pthread_mutex_init(&p.lock, NULL);
+    pthread_cond_init(&p.queue_cond, NULL);
+    pthread_cond_init(&p.done_cond, NULL);
+
+    // A gap must hold the carrier drop (20 bits with no frame found) and
+    // a frame search either side of the cut.
+    float nsamples_per_bit = sample_rate / cfg->bfsk_data_rate;
+    float frame_nbits = cfg->bfsk_nstartbits + cfg->bfsk_n_data_bits
+			+ cfg->bfsk_nstopbits + 1;
+    size_t half_gap_nsamples = nsamples_per_bit * (24 + 2 * frame_nbits)
+			+ sample_rate / 10;
+    size_t block_nsamples = sample_rate * SEG_BLOCK_SEC;
+    size_t read_nsamples = sample_rate * SEG_READ_SEC;
+    size_t min_seg_nsamples = sample_rate * SEG_MIN_SEC;
+    size_t max_seg_nsamples = sample_rate * SEG_MAX_SEC;
+    unsigned int max_nsegs = 2 * njobs + 3;	// in memory at once
+    if ( block_nsamples == 0 )
+	block_nsamples = 1;
+
+    pthread_t *threads = calloc(njobs, sizeof(pthread_t));
+    struct segment *head = segment_new(0, read_nsamples * 4);
+    if ( !threads || !head ) {
+	perror("malloc");
+	free(threads);
+	if ( head )
+	    segment_free(head);
+	return 1;
+    }
+    struct segment *cur = head;
+    unsigned int nsegs = 1, nsegs_total = 1;
+
+    // the receiver carried on past a cut, if any
+    struct seg_decoder *carry = NULL;
+    size_t carry_skip = 0;
+
+    unsigned int nstarted = 0;
+    for ( j=0; j<njobs; j++ ) {
+	if ( pthread_create(&threads[j], NULL, parallel_worker, &p) != 0 ) {
+	    perror("pthread_create");
+	    goto out_join;
+	}
+	nstarted++;
+    }
+
+    parallel_stop = 0;
+    signal(SIGINT, parallel_stop_sighandler);
+
+    double wall0 = wall_sec();
+    double cpu_sec = 0.0;
+    unsigned long long nsamples_total = 0;
+    unsigned int nfallbacks = 0;
+
+    // the quiet gap detector
+    unsigned long long scan_pos = 0;
+    double block_energy = 0.0;
+    size_t block_fill = 0;
+    float max_block_energy = 0.0f;
+    int quiet_run = 0, quiet_run_cut = 0;
+    unsigned long long quiet_run_start = 0;
+
+    int eof = 0;
+    while ( 1 ) {
+
+	/* Read */
+	if ( !eof ) {
+	    if ( cur->nsamples + read_nsamples > cur->size ) {
+		size_t size = cur->size * 2;
+		float *samples = realloc(cur->samples, size * sizeof(float));
+		if ( !samples ) {
+		    perror("malloc");
+		    parallel_set_error(&p);
+		    break;
+		}
+		cur->samples = samples;
+		cur->size = size;
+	    }
+	    ssize_t r = simpleaudio_read(sa, cur->samples + cur->nsamples,
+					read_nsamples);
+	    if ( r < 0 ) {
+		fprintf(stderr, "simpleaudio_read: error\n");
+		parallel_set_error(&p);
+		r = 0;
+	    }
+	    cur->nsamples += r;
+	    nsamples_total += r;
+	    if ( r == 0 || parallel_stop )
+		eof = 1;
+	}
+
+	/* Cut at the quiet gaps */
+	unsigned long long end_pos = cur->start + cur->nsamples;
+	for ( ; scan_pos<end_pos; scan_pos++ ) {
+	    float x = cur->samples[scan_pos - cur->start];
+	    block_energy += x * x;
+	    if ( ++block_fill < block_nsamples )
+		continue;
+	    unsigned long long block_end = scan_pos + 1;
+	    if ( block_energy > max_block_energy )
+		max_block_energy = block_energy;
+	    int quiet = block_energy <= max_block_energy * SEG_QUIET_RATIO;
+	    block_energy = 0.0;
+	    block_fill = 0;
+
+	    unsigned long long cut = 0;
+	    if ( quiet ) {
+		if ( !quiet_run ) {
+		    quiet_run = 1;
+		    quiet_run_cut = 0;
+		    quiet_run_start = block_end - block_nsamples;
+		}
+		if ( !quiet_run_cut
+			&& block_end - quiet_run_start >= 2 * half_gap_nsamples
+			&& quiet_run_start + half_gap_nsamples - cur->start
+				>= min_seg_nsamples ) {
+		    cut = quiet_run_start + half_gap_nsamples;
+		    quiet_run_cut = 1;
+		}
+	    } else {
+		quiet_run = 0;
+	    }
+	    if ( !cut && block_end - cur->start >= max_seg_nsamples ) {
+		cut = block_end;
+		quiet_run = 0;
+	    }
+	    if ( !cut )
+		continue;
+
+	    // the samples from the cut on start the next segment
+	    size_t keep = cut - cur->start;
+	    size_t move = cur->nsamples - keep;
+	    struct segment *seg = segment_new(cut,
+			move + read_nsamples > read_nsamples * 4
+			    ? move + read_nsamples : read_nsamples * 4);
+	    if ( !seg ) {
+		perror("malloc");
+		parallel_set_error(&p);
+		break;
+	    }
+	    memcpy(seg->samples, cur->samples + keep, move * sizeof(float));
+	    seg->nsamples = move;
+	    cur->nsamples = keep;
+	    cur->next = seg;
+	    cur->filled = 1;
+	    nsegs++;
+	    nsegs_total++;
+
+	    // (the worker decodes on into the next segment)
+	    struct segment *s;
+	    for ( s=head; s!=cur; s=s->next )
+		if ( !s->queued )
+		    parallel_queue(&p, s);
+	    cur = seg;
+	}
+	if ( parallel_error(&p) )
+	    break;
+	if ( eof ) {
+	    cur->filled = 1;
+	    struct segment *s;
+	    for ( s=head; s; s=s->next )
+		if ( !s->queued )
+		    parallel_queue(&p, s);
+	    pthread_mutex_lock(&p.lock);
+	    p.eof = 1;
+	    pthread_cond_broadcast(&p.queue_cond);
+	    pthread_mutex_unlock(&p.lock);
+	}
+
+	/* Merge, in stream order */
+	while ( head && head->queued ) {
+	    pthread_mutex_lock(&p.lock);
+	    while ( !head->done && (eof || nsegs > max_nsegs) )
+		pthread_cond_wait(&p.done_cond, &p.lock);
+	    int done = head->done;
+	    pthread_mutex_unlock(&p.lock);
+	    if ( !done )
+		break;
+
+	    struct segment *seg = head;
+	    cpu_sec += seg->cpu_sec;
+	    if ( !seg->dec ) {
+		parallel_set_error(&p);
+		break;
+	    }
+	    if ( carry ) {
+		// the previous receiver wasn't idle at the cut: it goes on
+		double cpu0 = thread_cpu_sec();
+		carry->direct = 1;
+		size_t tail_used;
+		int idle = dec_segment(carry, seg, carry_skip, &tail_used);
+		cpu_sec += thread_cpu_sec() - cpu0;
+		nfallbacks++;
+		if ( idle ) {
+		    dec_destroy(carry);
+		    carry = NULL;
+		} else {
+		    carry_skip = tail_used;
+		}
+	    } else {
+		dec_replay(seg->dec);
+		if ( !seg->idle_at_cut ) {
+		    carry = seg->dec;
+		    carry_skip = seg->tail_used;
+		    seg->dec = NULL;
+		}
+	    }
+
+	    head = seg->next;
+	    segment_free(seg);
+	    nsegs--;
+	}
+
+	if ( parallel_error(&p) || !head )
+	    break;
+    }
+
+    signal(SIGINT, SIG_DFL);
+
+    int error = parallel_error(&p);
+    if ( print_stats && !error ) {
+	double wall = wall_sec() - wall0;
+	double audio_sec = (double)nsamples_total / sample_rate;
+	fprintf(stderr, "### STATS audio=%.1fs wall=%.2fs speed=%.1fx"
+			" jobs=%u segments=%u fallbacks=%u decode=%.2fs"
+			" scaling=%.2fx ###\n",
+		audio_sec, wall, wall > 0.0 ? audio_sec / wall : 0.0,
+		njobs, nsegs_total, nfallbacks, cpu_sec,
+		wall > 0.0 ? cpu_sec / wall : 0.0);
+    }
+
+    ret = error ? 1 : 0;
+
+out_join:
+    pthread_mutex_lock(&p.lock);
+    p.eof = 1;
+    p.queue = p.queue_last = NULL;
+    pthread_cond_broadcast(&p.queue_cond);
+    pthread_mutex_unlock(&p.lock);
+    for ( j=0; j<nstarted; j++ )
+	pthread_join(threads[j], NULL);
+    free(threads);
+
+    dec_destroy(carry);
+    while ( head ) {
+	struct segment *seg = head;
+	head = seg->next;
+	segment_free(seg);
+    }
+    pthread_mutex_destroy(&p.lock);
+    pthread_cond_destroy(&p.queue_cond);
+    pthread_cond_destroy(&p.done_cond);
+    return ret;
+}
@@ -0,0 +1,41 @@
+/*
+ * minimodem_parallel.h
+ *
+ * Copyright (C) 2011-2016 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MINIMODEM_PARALLEL_H
+#define MINIMODEM_PARALLEL_H
+
+#include "simpleaudio.h"
+#include "libminimodem.h"
+
+/*
+ * Decode the (mono, float) stream sa, e.g. a long recording, in segments
+ * cut at its quiet gaps, on njobs worker threads.  The data and event
+ * callbacks are called from the calling thread, in stream order, with
+ * exactly what one receiver decoding the whole stream would give them.
+ * With print_stats, reports the throughput and scaling on stderr at the
+ * end.  Returns the process exit status.
+ */
+int
+minimodem_parallel_run( simpleaudio *sa, const minimodem_config *cfg,
+	unsigned int njobs,
+	minimodem_rx_data_fn *data_fn,
+	minimodem_rx_event_fn *event_fn,
+	void *cb_arg, int print_stats );
+
+#endif
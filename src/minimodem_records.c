@@ -0,0 +1,240 @@
+/*
+ * minimodem_records.c
+ *
+ * minimodem - software audio Bell-type or RTTY FSK modem
+ *
+ * Copyright (C) 2011-2016 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "minimodem_records.h"
+
+
+#define RECORDS_BUFSIZE		65536
+#define RECORD_HEADER_SIZE	40
+
+enum {
+	RECORD_CARRIER = 1,
+	RECORD_FRAME,
+	RECORD_NOCARRIER,
+	RECORD_LOADSHED,
+};
+
+struct minimodem_records {
+	FILE			*f;
+	minimodem_records_format format;
+	unsigned int		sample_rate;
+	int			error;
+};
+
+static void
+put_le( unsigned char *p, uint64_t v, unsigned int nbytes )
+{
+    unsigned int i;
+    for ( i=0; i<nbytes; i++, v >>= 8 )
+	p[i] = v & 0xff;
+}
+
+static void
+put_le_float( unsigned char *p, float f )
+{
+    uint32_t v;
+    memcpy(&v, &f, sizeof(v));
+    put_le(p, v, 4);
+}
+
+static void
+records_write( minimodem_records *rec, const void *buf, size_t n )
+{
+    if ( n && fwrite(buf, n, 1, rec->f) != 1 && !rec->error ) {
+	perror("write");
+	rec->error = 1;
+    }
+}
+
+minimodem_records *
+minimodem_records_new( FILE *f, minimodem_records_format format,
+	unsigned int sample_rate )
+{
+    minimodem_records *rec = calloc(1, sizeof(*rec));
+    if ( !rec ) {
+	perror("malloc");
+	return NULL;
+    }
+    rec->f = f;
+    rec->format = format;
+    rec->sample_rate = sample_rate;
+    setvbuf(f, NULL, _IOFBF, RECORDS_BUFSIZE);
+
+    if ( format == MINIMODEM_RECORDS_BINARY ) {
+	unsigned char h[16];
+	memcpy(h, "MMREC001", 8);
+	put_le(h + 8, sample_rate, 4);
+	put_le(h + 12, RECORD_HEADER_SIZE, 4);
+	records_write(rec, h, sizeof(h));
+    }
+    return rec;
+}
+
+static int64_t
+records_time_us( void )
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* the JSONL fields common to every record */
+static void
+records_json_begin( minimodem_records *rec, const char *type,
+	unsigned long long sample )
+{
+    int64_t t_us = records_time_us();
+    if ( fprintf(rec->f, "{\"type\":\"%s\",\"sample\":%llu,\"t\":%.6f"
+			 ",\"time\":%lld.%06lld",
+		 type, sample, (double)sample / rec->sample_rate,
+		 (long long)(t_us / 1000000),
+		 (long long)(t_us % 1000000)) < 0 && !rec->error ) {
+	perror("write");
+	rec->error = 1;
+    }
+}
+
+static void
+records_binary( minimodem_records *rec, unsigned int type,
+	unsigned long long sample, unsigned int count,
+	float confidence, float amplitude, float value,
+	const char *data, unsigned int nbytes )
+{
+    unsigned char h[RECORD_HEADER_SIZE] = { 0 };
+    if ( nbytes > 0xffff )
+	nbytes = 0xffff;
+    h[0] = type;
+    put_le(h + 2, nbytes, 2);
+    put_le(h + 4, count, 4);
+    put_le(h + 8, sample, 8);
+    put_le(h + 16, (uint64_t)records_time_us(), 8);
+    put_le_float(h + 24, confidence);
+    put_le_float(h + 28, amplitude);
+    put_le_float(h + 32, value);
+    records_write(rec, h, sizeof(h));
+    records_write(rec, data, nbytes);
+}
+
+void
+minimodem_records_frame( minimodem_records *rec,
+	const minimodem_rx_frame *frame,
+	const char *data, unsigned int nbytes )
+{
+    if ( rec->format == MINIMODEM_RECORDS_BINARY ) {
+	records_binary(rec, RECORD_FRAME, frame->offset, frame->nsamples,
+		frame->confidence, frame->amplitude, 0.0f, data, nbytes);
+	return;
+    }
+
+    records_json_begin(rec, "frame", frame->offset);
+    fprintf(rec->f, ",\"nsamples\":%u,\"confidence\":%.3f"
+		    ",\"amplitude\":%.3f,\"data\":\"",
+	    frame->nsamples, (double)frame->confidence,
+	    (double)frame->amplitude);
+    // bytes outside of printable ASCII as \u00XX (i.e. as Latin-1)
+    unsigned int i;
+    for ( i=0; i<nbytes; i++ ) {
+	unsigned char c = data[i];
+	switch ( c ) {
+	    case '"':	fputs("\\\"", rec->f); break;
+	    case '\\':	fputs("\\\\", rec->f); break;
+	    case '\n':	fputs("\\n", rec->f); break;
+	    case '\r':	fputs("\\r", rec->f); break;
+	    case '\t':	fputs("\\t", rec->f); break;
+	    default:
+		if ( c < 0x20 || c >= 0x7f )
+		    fprintf(rec->f, "\\u%04x", c);
+		else
+		    putc(c, rec->f);
+	}
+    }
+    fputs("\"}\n", rec->f);
+}
+
+void
+minimodem_records_event( minimodem_records *rec,
+	const minimodem_rx_event *ev )
+{
+    int binary = rec->format == MINIMODEM_RECORDS_BINARY;
+
+    switch ( ev->type ) {
+	case MINIMODEM_RX_CARRIER:
+	    if ( binary ) {
+		records_binary(rec, RECORD_CARRIER, ev->sample, 0,
+			0.0f, 0.0f, ev->carrier_freq, NULL, 0);
+		break;
+	    }
+	    records_json_begin(rec, "carrier", ev->sample);
+	    fprintf(rec->f, ",\"freq\":%.1f}\n", (double)ev->carrier_freq);
+	    break;
+	case MINIMODEM_RX_NOCARRIER:
+	    if ( binary ) {
+		records_binary(rec, RECORD_NOCARRIER, ev->sample,
+			ev->nframes_decoded, ev->confidence, ev->amplitude,
+			ev->throughput_rate, NULL, 0);
+	    } else {
+		records_json_begin(rec, "nocarrier", ev->sample);
+		fprintf(rec->f, ",\"frames\":%u,\"confidence\":%.3f"
+				",\"amplitude\":%.3f,\"bps\":%.2f}\n",
+			ev->nframes_decoded, (double)ev->confidence,
+			(double)ev->amplitude, (double)ev->throughput_rate);
+	    }
+	    // the end of a transmission: let a reader of a pipe have it now
+	    if ( fflush(rec->f) != 0 && !rec->error ) {
+		perror("write");
+		rec->error = 1;
+	    }
+	    break;
+	case MINIMODEM_RX_LOADSHED:
+	    if ( binary ) {
+		records_binary(rec, RECORD_LOADSHED, ev->sample,
+			ev->load_shed_level, 0.0f, 0.0f, ev->backlog_ms,
+			NULL, 0);
+		break;
+	    }
+	    records_json_begin(rec, "loadshed", ev->sample);
+	    fprintf(rec->f, ",\"level\":%u,\"backlog_ms\":%.0f}\n",
+		    ev->load_shed_level, (double)ev->backlog_ms);
+	    break;
+    }
+}
+
+int
+minimodem_records_close( minimodem_records *rec )
+{
+    if ( fflush(rec->f) != 0 && !rec->error ) {
+	perror("write");
+	rec->error = 1;
+    }
+    int ret = rec->error || ferror(rec->f) ? -1 : 0;
+    free(rec);
+    return ret;
+}
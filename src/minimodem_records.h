@@ -0,0 +1,86 @@
+/*
+ * minimodem_records.h
+ *
+ * Copyright (C) 2011-2016 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MINIMODEM_RECORDS_H
+#define MINIMODEM_RECORDS_H
+
+#include <stdio.h>
+
+#include "libminimodem.h"
+
+/*
+ * Structured receiver output: a record per decoded frame and per carrier
+ * event, each stamped with its stream position in samples (and seconds)
+ * and the wall-clock time it was decoded at.
+ *
+ * JSONL is a JSON object per line:
+ *   {"type":"carrier","sample":N,"t":S,"time":T,"freq":F}
+ *   {"type":"frame","sample":N,"t":S,"time":T,"nsamples":n,
+ *	"confidence":C,"amplitude":A,"data":"..."}
+ *   {"type":"nocarrier","sample":N,"t":S,"time":T,"frames":n,
+ *	"confidence":C,"amplitude":A,"bps":B}
+ *   {"type":"loadshed","sample":N,"t":S,"time":T,"level":n,"backlog_ms":B}
+ *
+ * Binary is a 16 byte file header ("MMREC001", then u32 sample rate and
+ * u32 record header size) followed by the records, each a 40 byte header
+ * and then its data bytes, all little-endian:
+ *    0 u8  type (1 carrier, 2 frame, 3 nocarrier, 4 loadshed)
+ *    1 u8  0
+ *    2 u16 number of data bytes which follow
+ *    4 u32 frame: nsamples; nocarrier: frames; loadshed: level
+ *    8 u64 sample
+ *   16 i64 time, in microseconds since the epoch
+ *   24 f32 confidence
+ *   28 f32 amplitude
+ *   32 f32 carrier: freq; nocarrier: bps; loadshed: backlog_ms
+ *   36 u32 0
+ */
+
+typedef enum {
+	MINIMODEM_RECORDS_JSONL,
+	MINIMODEM_RECORDS_BINARY,
+} minimodem_records_format;
+
+typedef struct minimodem_records minimodem_records;
+
+/*
+ * Write records to f (which is fully buffered from here on; nothing may
+ * have been written to it yet).  The buffer is flushed at the end of
+ * each carrier and by minimodem_records_close().
+ */
+minimodem_records *
+minimodem_records_new( FILE *f, minimodem_records_format format,
+	unsigned int sample_rate );
+
+/* the decoded frame and its data (from a minimodem_rx_data_fn) */
+void
+minimodem_records_frame( minimodem_records *rec,
+	const minimodem_rx_frame *frame,
+	const char *data, unsigned int nbytes );
+
+/* from a minimodem_rx_event_fn */
+void
+minimodem_records_event( minimodem_records *rec,
+	const minimodem_rx_event *ev );
+
+/* Flushes and frees rec; returns -1 if any of the writes failed. */
+int
+minimodem_records_close( minimodem_records *rec );
+
+#endif
@@ -0,0 +1,1597 @@
+/*
+ * minimodem_rx.c
+ *
+ * minimodem - software audio Bell-type or RTTY FSK modem
+ *
+ * Copyright (C) 2011-2016 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <signal.h>
+#include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "libminimodem.h"
+#include "fsk.h"
+
+
+/*
+ * Adaptive search effort
+ *
+ * The search effort levels, from sloppiest to most pedantic.  Level 1 is
+ * the fixed FSK_ANALYZE_NSTEPS / FSK_ANALYZE_NSTEPS_FINE / --limit
+ * behavior.  A search_limit_scale of 0 means to accept the first frame
+ * found above the confidence threshold.
+ */
+static const struct search_effort {
+	unsigned int	nsteps;
+	unsigned int	nsteps_fine;
+	float		search_limit_scale;
+} search_efforts[] = {
+	{ 2,	 4,	0.0f },
+	{ 3,	 8,	1.0f },
+	{ 5,	12,	2.0f },
+	{ 8,	16,	INFINITY },
+};
+#define SEARCH_EFFORT_NLEVELS	(sizeof(search_efforts)/sizeof(search_efforts[0]))
+#define SEARCH_EFFORT_DEFAULT	1
+
+struct search_effort_ctl {
+	unsigned int	level;
+	unsigned int	nsteady;
+	float		confidence_avg;	// moving averages
+	float		skew_avg;	//   (skew in fractions of a bit)
+};
+
+static void
+search_effort_reset( struct search_effort_ctl *sec )
+{
+    sec->level = SEARCH_EFFORT_DEFAULT;
+    sec->nsteady = 0;
+    sec->confidence_avg = 0.0f;
+    sec->skew_avg = 0.0f;
+}
+
+/*
+ * Called for each decoded frame.  Raise the effort as soon as confidence
+ * falls below the search limit or the frame timing skews; lower it again
+ * only after a run of high-confidence frames with steady timing.
+ */
+static void
+search_effort_update( struct search_effort_ctl *sec,
+	float confidence, float confidence_search_limit, float skew )
+{
+// confidence can be INFINITY for perfect signals
+#define SEARCH_EFFORT_MAX_CONFIDENCE	1000.0f
+#define SEARCH_EFFORT_STEADY_NFRAMES	8
+    if ( confidence > SEARCH_EFFORT_MAX_CONFIDENCE )
+	confidence = SEARCH_EFFORT_MAX_CONFIDENCE;
+    sec->confidence_avg = sec->confidence_avg * 0.75f + confidence * 0.25f;
+    sec->skew_avg = sec->skew_avg * 0.75f + skew * 0.25f;
+
+    if ( confidence < confidence_search_limit || skew > 0.25f ) {
+	if ( sec->level < SEARCH_EFFORT_NLEVELS - 1 )
+	    sec->level++;
+	sec->nsteady = 0;
+    } else if ( sec->confidence_avg >= confidence_search_limit * 2
+		&& sec->skew_avg < 0.1f ) {
+	if ( ++sec->nsteady >= SEARCH_EFFORT_STEADY_NFRAMES ) {
+	    if ( sec->level > 0 )
+		sec->level--;
+	    sec->nsteady = 0;
+	}
+    } else {
+	sec->nsteady = 0;
+    }
+    debug_log("search effort: level=%u conf_avg=%.3f skew_avg=%.3f\n",
+	    sec->level, sec->confidence_avg, sec->skew_avg);
+}
+
+
+#define SYNC_CORRELATE_MAX_NSYNCS	64
+
+/*
+ * The receiver state, hot (per-frame) fields first.  Everything read-only
+ * and shareable (the FFTW plans, the sync correlator's template spectra)
+ * lives outside, shared by all receivers with the same parameters; see
+ * minimodem_rx_footprint() for what's left.
+ */
+#define RX_CACHELINE	64
+
+struct minimodem_rx {
+	/* sample buffer */
+	float		*samplebuf;
+	size_t		samplebuf_size;
+	size_t		samples_nvalid;
+	size_t		advance;			// pending, from samplebuf[0]
+	unsigned long long samplebuf_offset;	// stream offset of samplebuf[0]
+
+	/* per-frame search and carrier state */
+	fsk_plan	*fskp;
+	const char	*expect_data_string;
+	const char	*expect_sync_string;
+	float		nsamples_per_bit;
+	unsigned int	nsamples_overscan;
+	float		frame_n_bits;
+	unsigned int	frame_nsamples;
+	unsigned int	expect_n_bits;
+	unsigned int	expect_nsamples;
+	int		carrier;
+	int		carrier_band;
+	unsigned int	noconfidence;
+	float		track_amplitude;
+	float		peak_confidence;
+	int		preamble_found;
+	unsigned int	load_shed_level;
+	struct search_effort_ctl effort_ctl;
+
+	/* per-carrier totals */
+	float		confidence_total;
+	float		amplitude_total;
+	float		effort_total;
+	unsigned int	nframes_decoded;
+	size_t		carrier_nsamples;
+	minimodem_rx_frame last_frame;
+
+	databits_state	dbs;
+
+	volatile sig_atomic_t	stop;
+	int			done;		// rx_one, or stopped
+
+	minimodem_rx_data_fn	*data_fn;
+	minimodem_rx_event_fn	*event_fn;
+	void			*cb_arg;
+	minimodem_rx_samples_fn	*samples_fn;
+	void			*samples_arg;
+
+	/* --sync-correlate only */
+	fsk_sync_correlator	*fscp;
+	unsigned long long	*sync_starts;	// [SYNC_CORRELATE_MAX_NSYNCS]
+	unsigned int	sync_nfound, sync_next;
+	unsigned long long sync_scanned_end;
+	unsigned int	sync_backup_nsamples;
+
+	/* --feature-cache only */
+	void		*cache_map;
+	size_t		cache_map_size;
+
+	/* cold */
+	minimodem_config	cfg;
+	char		expect_data_string_buffer[64];
+	char		expect_sync_string_buffer[64];
+	char		preamble_bits_buffer[65];
+} __attribute__ ((aligned (RX_CACHELINE)));
+
+
+static int
+build_expect_bits_string( char *expect_bits_string,
+	int bfsk_nstartbits,
+	int bfsk_n_data_bits,
+	float bfsk_nstopbits,
+	int invert_start_stop,
+	int use_expect_bits,
+	unsigned long long expect_bits )
+{
+	// example expect_bits_string
+	//	  0123456789A
+	//	  isddddddddp	i == idle bit (a.k.a. prev_stop bit)
+	//			s == start bit  d == data bits  p == stop bit
+	// ebs = "10dddddddd1"  <-- expected mark/space framing pattern
+	//
+	// NOTE! expect_n_bits ends up being (frame_n_bits+1), because
+	// we expect the prev_stop bit in addition to this frame's own
+	// (start + n_data_bits + stop) bits.  But for each decoded frame,
+	// we will advance just frame_n_bits worth of samples, leaving us
+	// pointing at our stop bit -- it becomes the next frame's prev_stop.
+	//
+	//                  prev_stop--v
+	//                       start--v        v--stop
+	// char *expect_bits_string = "10dddddddd1";
+	//
+	char start_bit_value = invert_start_stop ? '1' : '0';
+	char stop_bit_value = invert_start_stop ? '0' : '1';
+	int j = 0;
+	if ( bfsk_nstopbits != 0.0f )
+	    expect_bits_string[j++] = stop_bit_value;
+	int i;
+	// Nb. only integer number of start bits works (for rx)
+	for ( i=0; i<bfsk_nstartbits; i++ )
+	    expect_bits_string[j++] = start_bit_value;
+	for ( i=0; i<bfsk_n_data_bits; i++,j++ ) {
+	    if ( use_expect_bits )
+		expect_bits_string[j] = ( (expect_bits>>i)&1 ) + '0';
+	    else
+		expect_bits_string[j] = 'd';
+	}
+	if ( bfsk_nstopbits != 0.0f )
+	    expect_bits_string[j++] = stop_bit_value;
+	expect_bits_string[j] = 0;
+
+	return j;
+}
+
+static void
+rx_samplebuf_grow( minimodem_rx *rx, size_t min_size )
+{
+    if ( rx->samplebuf_size >= min_size )
+	return;
+    rx->samplebuf_size = min_size;
+    rx->samplebuf = realloc(rx->samplebuf,
+				rx->samplebuf_size * sizeof(float));
+    assert( rx->samplebuf );
+}
+
+minimodem_rx *
+minimodem_rx_new( const minimodem_config *cfg,
+	minimodem_rx_data_fn *data_fn,
+	minimodem_rx_event_fn *event_fn,
+	void *cb_arg )
+{
+    minimodem_rx *rx;
+    if ( posix_memalign((void **)&rx, RX_CACHELINE, sizeof(minimodem_rx)) )
+	return NULL;
+    memset(rx, 0, sizeof(minimodem_rx));
+
+    rx->cfg = *cfg;
+    rx->data_fn = data_fn;
+    rx->event_fn = event_fn;
+    rx->cb_arg = cb_arg;
+    rx->carrier_band = -1;
+
+    unsigned int sample_rate = cfg->sample_rate;
+    float bfsk_nstopbits = cfg->bfsk_nstopbits;
+
+    /*
+     * Prepare the input sample chunk rate
+     */
+    float nsamples_per_bit = sample_rate / cfg->bfsk_data_rate;
+    rx->nsamples_per_bit = nsamples_per_bit;
+
+
+    /*
+     * Prepare the fsk plan
+     */
+
+    rx->fskp = fsk_plan_new(sample_rate, cfg->bfsk_mark_f, cfg->bfsk_space_f,
+				cfg->band_width);
+    if ( !rx->fskp ) {
+        fprintf(stderr, "fsk_plan_new() failed\n");
+	goto err_out;
+    }
+    rx->fskp->no_prefilter = cfg->no_prefilter;
+
+    /*
+     * Prepare the input sample buffer.  For 8-bit frames with prev/start/stop
+     * we need 11 data-bits worth of samples, and we will scan through one bits
+     * worth at a time, hence we need a minimum total input buffer size of 12
+     * data-bits.  */
+    unsigned int nbits = 0;
+    nbits += 1;			// prev stop bit (last whole stop bit)
+    nbits += cfg->bfsk_nstartbits;	// start bits
+    nbits += cfg->bfsk_n_data_bits;
+    nbits += 1;			// stop bit (first whole stop bit)
+
+    // FIXME EXPLAIN +1 goes with extra bit when scanning
+    size_t	samplebuf_size = ceilf(nsamples_per_bit) * (nbits+1);
+    samplebuf_size *= 2; // account for the half-buf filling method
+#define SAMPLE_BUF_DIVISOR 12
+#ifdef SAMPLE_BUF_DIVISOR
+    // For performance, use a larger samplebuf_size than necessary
+    if ( samplebuf_size < sample_rate / SAMPLE_BUF_DIVISOR )
+	samplebuf_size = sample_rate / SAMPLE_BUF_DIVISOR;
+#endif
+    rx_samplebuf_grow(rx, samplebuf_size);
+    debug_log("samplebuf_size=%zu\n", rx->samplebuf_size);
+
+    // Fraction of nsamples_per_bit that we will "overscan"; range (0.0 .. 1.0)
+    float fsk_frame_overscan = 0.5;
+    //   should be != 0.0 (only the nyquist edge cases actually require this?)
+    // for handling of slightly faster-than-us rates:
+    //   should be >> 0.0 to allow us to lag back for faster-than-us rates
+    //   should be << 1.0 or we may lag backwards over whole bits
+    // for optimal analysis:
+    //   should be >= 0.5 (half a bit width) or we may not find the optimal bit
+    //   should be <  1.0 (a full bit width) or we may skip over whole bits
+    // for encodings without start/stop bits:
+    //     MUST be <= 0.5 or we may accidentally skip a bit
+    //
+    assert( fsk_frame_overscan >= 0.0f && fsk_frame_overscan < 1.0f );
+
+    // ensure that we overscan at least a single sample
+    rx->nsamples_overscan = nsamples_per_bit * fsk_frame_overscan + 0.5f;
+    if ( fsk_frame_overscan > 0.0f && rx->nsamples_overscan == 0 )
+	rx->nsamples_overscan = 1;
+    debug_log("fsk_frame_overscan=%f nsamples_overscan=%u\n",
+	    fsk_frame_overscan, rx->nsamples_overscan);
+
+    // n databits plus bfsk_startbit start bits plus bfsk_nstopbit stop bits:
+    rx->frame_n_bits = cfg->bfsk_n_data_bits + cfg->bfsk_nstartbits
+				+ bfsk_nstopbits;
+    rx->frame_nsamples = nsamples_per_bit * rx->frame_n_bits + 0.5f;
+
+    if ( cfg->expect_data_string ) {
+	assert( strlen(cfg->expect_data_string)
+			< sizeof(rx->expect_data_string_buffer) );
+	strcpy(rx->expect_data_string_buffer, cfg->expect_data_string);
+	rx->expect_n_bits = strlen(cfg->expect_data_string);
+    } else {
+	rx->expect_n_bits = build_expect_bits_string(
+			rx->expect_data_string_buffer,
+			cfg->bfsk_nstartbits, cfg->bfsk_n_data_bits,
+			bfsk_nstopbits, cfg->invert_start_stop, 0, 0);
+    }
+    rx->expect_data_string = rx->expect_data_string_buffer;
+    debug_log("eds = '%s' (%lu)\n", rx->expect_data_string,
+	    strlen(rx->expect_data_string));
+
+    if ( cfg->bfsk_do_rx_sync && (long long) cfg->bfsk_sync_byte >= 0 ) {
+	build_expect_bits_string(rx->expect_sync_string_buffer,
+			cfg->bfsk_nstartbits, cfg->bfsk_n_data_bits,
+			bfsk_nstopbits, cfg->invert_start_stop,
+			1, cfg->bfsk_sync_byte);
+	rx->expect_sync_string = rx->expect_sync_string_buffer;
+    } else {
+	rx->expect_sync_string = rx->expect_data_string;
+    }
+    debug_log("ess = '%s' (%lu)\n", rx->expect_sync_string,
+	    strlen(rx->expect_sync_string));
+
+    rx->expect_nsamples = nsamples_per_bit * rx->expect_n_bits;
+
+    if ( cfg->preamble_detect ) {
+	if ( cfg->preamble_bits_string ) {
+	    // as set by the --preamble={bits} option or the {baudmode}
+	    assert( strlen(cfg->preamble_bits_string)
+			< sizeof(rx->preamble_bits_buffer) );
+	    strcpy(rx->preamble_bits_buffer, cfg->preamble_bits_string);
+	} else if ( rx->expect_sync_string != rx->expect_data_string ) {
+	    // repeated sync byte frames (less the leading prev_stop bit)
+	    strcpy(rx->preamble_bits_buffer,
+		    rx->expect_sync_string + (bfsk_nstopbits != 0.0f ? 1 : 0));
+	} else {
+	    // steady mark (idle) leader tone
+	    strcpy(rx->preamble_bits_buffer,
+		    cfg->invert_start_stop ? "0" : "1");
+	}
+	rx->cfg.preamble_bits_string = rx->preamble_bits_buffer;
+	if ( rx->cfg.preamble_min_nbits == 0 ) {
+	    unsigned int pattern_len = strlen(rx->preamble_bits_buffer);
+	    rx->cfg.preamble_min_nbits = pattern_len > 1 ? pattern_len * 2 : 2;
+	}
+	// we must be able to hold a whole preamble in the samplebuf,
+	// with room to spare for the half-buf filling method.
+	size_t preamble_nsamples = ceilf(nsamples_per_bit)
+				* (rx->cfg.preamble_min_nbits + 1);
+	rx_samplebuf_grow(rx, preamble_nsamples * 4);
+	debug_log("preamble = '%s' min_nbits=%u samplebuf_size=%zu\n",
+		rx->preamble_bits_buffer, rx->cfg.preamble_min_nbits,
+		rx->samplebuf_size);
+    }
+
+    if ( cfg->sync_correlate ) {
+	const char *sync_bits;
+	unsigned int sync_nrepeat;
+	if ( rx->expect_sync_string != rx->expect_data_string ) {
+	    // repeated sync byte frames (less the leading prev_stop bit).
+	    // Match only the last half of them, so that a clipped start of
+	    // the preamble still scores well.
+	    sync_bits = rx->expect_sync_string
+				+ (bfsk_nstopbits != 0.0f ? 1 : 0);
+	    sync_nrepeat = cfg->bfsk_do_tx_sync_bytes / 2;
+	} else if ( cfg->sync_bits_string ) {
+	    sync_bits = cfg->sync_bits_string;
+	    sync_nrepeat = 1;
+	} else {
+	    fprintf(stderr, "E: --sync-correlate requires a --sync-byte or a"
+			    " {baudmode} with a known preamble\n");
+	    goto err_out;
+	}
+	// The leading prev_stop bit belongs to the frame search's "frame".
+	if ( bfsk_nstopbits != 0.0f )
+	    rx->sync_backup_nsamples = nsamples_per_bit + 0.5f;
+
+	// Correlate over large blocks: make the samplebuf hold at least
+	// a couple of seconds worth (half of that is read at a time), and
+	// several whole sync sequences.
+	float sync_repeat_nsamples = nsamples_per_bit * rx->frame_n_bits;
+	size_t block_nsamples = sample_rate * 2;
+	size_t sync_span_nsamples = sync_repeat_nsamples * sync_nrepeat
+				+ nsamples_per_bit * strlen(sync_bits);
+	if ( block_nsamples < sync_span_nsamples * 8 )
+	    block_nsamples = sync_span_nsamples * 8;
+	rx_samplebuf_grow(rx, block_nsamples);
+	rx->sync_starts = malloc(SYNC_CORRELATE_MAX_NSYNCS
+				* sizeof(*rx->sync_starts));
+	if ( !rx->sync_starts )
+	    goto err_out;
+	rx->fscp = fsk_sync_correlator_new(rx->fskp, nsamples_per_bit,
+			sync_bits, sync_nrepeat, sync_repeat_nsamples,
+			rx->samplebuf_size);
+	if ( !rx->fscp ) {
+	    fprintf(stderr, "fsk_sync_correlator_new() failed\n");
+	    goto err_out;
+	}
+	debug_log("sync = '%s' x%u samplebuf_size=%zu\n",
+		sync_bits, sync_nrepeat, rx->samplebuf_size);
+    }
+
+    search_effort_reset(&rx->effort_ctl);
+
+    return rx;
+
+err_out:
+    minimodem_rx_destroy(rx);
+    return NULL;
+}
+
+void
+minimodem_rx_destroy( minimodem_rx *rx )
+{
+    if ( rx->fscp )
+	fsk_sync_correlator_destroy(rx->fscp);
+    if ( rx->fskp )
+	fsk_plan_destroy(rx->fskp);
+    if ( rx->cache_map )
+	munmap(rx->cache_map, rx->cache_map_size);
+    free(rx->sync_starts);
+    free(rx->samplebuf);
+    free(rx);
+}
+
+void
+minimodem_rx_set_samples_fn( minimodem_rx *rx,
+	minimodem_rx_samples_fn *samples_fn, void *arg )
+{
+    rx->samples_fn = samples_fn;
+    rx->samples_arg = arg;
+}
+
+size_t
+minimodem_rx_footprint( const minimodem_rx *rx )
+{
+    size_t nbytes = sizeof(minimodem_rx) + sizeof(fsk_plan)
+			+ rx->samplebuf_size * sizeof(float);
+    if ( rx->fscp )
+	nbytes += fsk_sync_correlator_footprint(rx->fscp)
+		+ SYNC_CORRELATE_MAX_NSYNCS * sizeof(*rx->sync_starts);
+    return nbytes;
+}
+
+void
+minimodem_rx_stop( minimodem_rx *rx )
+{
+    rx->stop = 1;
+}
+
+
+static void
+rx_report_no_carrier( minimodem_rx *rx )
+{
+    unsigned int sample_rate = rx->cfg.sample_rate;
+    float bfsk_data_rate = rx->cfg.bfsk_data_rate;
+    float nbits_decoded = rx->nframes_decoded * rx->frame_n_bits;
+    minimodem_rx_event ev = { .type = MINIMODEM_RX_NOCARRIER };
+
+    ev.sample = rx->last_frame.offset + rx->last_frame.nsamples;
+    ev.nframes_decoded = rx->nframes_decoded;
+    ev.confidence = rx->confidence_total / rx->nframes_decoded;
+    ev.amplitude = rx->amplitude_total / rx->nframes_decoded;
+    ev.throughput_rate = nbits_decoded * sample_rate
+				/ (float)rx->carrier_nsamples;
+    ev.rate_perfect = (unsigned long long)(nbits_decoded * sample_rate + 0.5f)
+	    == (unsigned long long)(bfsk_data_rate * rx->carrier_nsamples);
+    ev.effort = rx->cfg.adaptive_search
+		? rx->effort_total / rx->nframes_decoded : -1.0f;
+    if ( rx->event_fn )
+	rx->event_fn(rx->cb_arg, &ev);
+}
+
+
+static void
+rx_end_carrier( minimodem_rx *rx )
+{
+    rx_report_no_carrier(rx);
+    rx->carrier = 0;
+    rx->carrier_nsamples = 0;
+    rx->confidence_total = 0;
+    rx->amplitude_total = 0;
+    rx->effort_total = 0;
+    rx->nframes_decoded = 0;
+    rx->track_amplitude = 0.0;
+    rx->peak_confidence = 0;
+    search_effort_reset(&rx->effort_ctl);
+}
+
+
+/*
+ * Load shedding
+ *
+ * As the capture backlog approaches the deadline, shed decode work in
+ * steps (each level includes the ones below it):
+ *    1: skip the do_refine_frame rescan
+ *    2: try fewer frame positions per search
+ *    3: accept the first frame found above the confidence threshold
+ * A level is entered at level/4 of the deadline, and left again once the
+ * backlog drops an eighth of the deadline below that.
+ */
+#define LOAD_SHED_MAX_LEVEL	3
+
+static void
+load_shed_update( minimodem_rx *rx, simpleaudio *sa,
+	size_t deadline_nsamples )
+{
+    size_t backlog_nsamples, capacity_nsamples;
+    if ( simpleaudio_get_backlog(sa, &backlog_nsamples,
+				&capacity_nsamples) < 0 )
+	return;
+    backlog_nsamples += rx->samples_nvalid;
+
+    float fraction = (float)backlog_nsamples / deadline_nsamples;
+    unsigned int level = rx->load_shed_level;
+    unsigned int want = fraction * (LOAD_SHED_MAX_LEVEL + 1);
+    if ( want > LOAD_SHED_MAX_LEVEL )
+	want = LOAD_SHED_MAX_LEVEL;
+
+    if ( want > level )
+	level = want;
+    else if ( want < level && fraction < level * 0.25f - 0.125f )
+	level = want;
+
+    if ( level == rx->load_shed_level )
+	return;
+    rx->load_shed_level = level;
+
+    minimodem_rx_event ev = { .type = MINIMODEM_RX_LOADSHED };
+    ev.sample = rx->samplebuf_offset;
+    ev.load_shed_level = level;
+    ev.backlog_ms = backlog_nsamples * 1000.0f / rx->cfg.sample_rate;
+    if ( rx->event_fn )
+	rx->event_fn(rx->cb_arg, &ev);
+}
+
+
+/*
+ * Process the samplebuf at its current position, and set rx->advance.
+ * Returns 0 if the receiver is done (rx_one), else 1.
+ */
+static int
+rx_process( minimodem_rx *rx )
+{
+    minimodem_config *cfg = &rx->cfg;
+    fsk_plan *fskp = rx->fskp;
+    float *samplebuf = rx->samplebuf;
+    size_t samples_nvalid = rx->samples_nvalid;
+    float nsamples_per_bit = rx->nsamples_per_bit;
+    unsigned int nsamples_overscan = rx->nsamples_overscan;
+
+    fskp->track_base = samplebuf;
+    fskp->track_base_pos = rx->samplebuf_offset;
+
+    /* Auto-detect carrier frequency */
+    if ( cfg->carrier_autodetect_threshold > 0.0f && rx->carrier_band < 0 ) {
+	unsigned int i;
+	float nsamples_per_scan = nsamples_per_bit;
+	if ( nsamples_per_scan > fskp->fftsize )
+	    nsamples_per_scan = fskp->fftsize;
+	for ( i=0; i+nsamples_per_scan<=samples_nvalid;
+					     i+=nsamples_per_scan ) {
+	    rx->carrier_band = fsk_detect_carrier(fskp,
+				samplebuf+i, nsamples_per_scan,
+				cfg->carrier_autodetect_threshold);
+	    if ( rx->carrier_band >= 0 )
+		break;
+	}
+	rx->advance = i + nsamples_per_scan;
+	if ( rx->advance > samples_nvalid )
+	    rx->advance = samples_nvalid;
+	if ( rx->carrier_band < 0 ) {
+	    debug_log("autodetected carrier band not found\n");
+	    return 1;
+	}
+
+	// default negative shift -- reasonable?
+	int b_shift = - (float)(cfg->autodetect_shift + fskp->band_width/2.0f)
+						/ fskp->band_width;
+	if ( cfg->bfsk_inverted_freqs )
+	    b_shift *= -1;
+	/* only accept a carrier as b_mark if it will not result
+	 * in a b_space band which is "too low". */
+	int b_space = rx->carrier_band + b_shift;
+	if ( b_space < 1 || b_space >= fskp->nbands ) {
+	    debug_log("autodetected space band out of range\n" );
+	    rx->carrier_band = -1;
+	    return 1;
+	}
+
+	debug_log("### TONE freq=%.1f ###\n",
+		rx->carrier_band * fskp->band_width);
+
+	fsk_set_tones_by_bandshift(fskp, /*b_mark*/rx->carrier_band, b_shift);
+    }
+
+    /*
+     * The main processing algorithm: scan samplesbuf for FSK frames,
+     * looking at an entire frame at once.
+     */
+
+    debug_log( "--------------------------\n");
+
+    /*
+     * While idle, find every sync sequence in the samplebuf block in
+     * one pass, then jump straight to each one in turn and hand off to
+     * the fsk_find_frame() search there.
+     */
+    if ( rx->fscp && !rx->carrier && !rx->preamble_found ) {
+	while ( rx->sync_next < rx->sync_nfound
+		&& rx->sync_starts[rx->sync_next] < rx->samplebuf_offset )
+	    rx->sync_next++;
+	if ( rx->sync_next == rx->sync_nfound
+		&& rx->samplebuf_offset >= rx->sync_scanned_end ) {
+	    unsigned int starts[SYNC_CORRELATE_MAX_NSYNCS];
+	    float scores[SYNC_CORRELATE_MAX_NSYNCS];
+	    unsigned int scanned_nsamples, i;
+	    rx->sync_nfound = fsk_sync_correlate(rx->fscp,
+			    samplebuf, samples_nvalid, cfg->sync_min_score,
+			    starts, scores, SYNC_CORRELATE_MAX_NSYNCS,
+			    &scanned_nsamples);
+	    for ( i=0; i<rx->sync_nfound; i++ ) {
+		rx->sync_starts[i] = rx->samplebuf_offset + starts[i];
+		if ( rx->sync_starts[i] >= rx->sync_backup_nsamples )
+		    rx->sync_starts[i] -= rx->sync_backup_nsamples;
+	    }
+	    rx->sync_next = 0;
+	    rx->sync_scanned_end = rx->samplebuf_offset + scanned_nsamples;
+	}
+	if ( rx->sync_next < rx->sync_nfound ) {
+	    unsigned long long t = rx->sync_starts[rx->sync_next++];
+	    rx->preamble_found = 1;
+	    rx->noconfidence = 0;
+	    rx->advance = t > rx->samplebuf_offset
+				? t - rx->samplebuf_offset : 0;
+	    debug_log("@ SYNC advance=%zu\n", rx->advance);
+	    return 1;
+	}
+	if ( rx->sync_scanned_end > rx->samplebuf_offset )
+	    rx->advance = rx->sync_scanned_end - rx->samplebuf_offset;
+	else
+	    rx->advance = nsamples_per_bit;
+	if ( rx->advance > samples_nvalid )
+	    rx->advance = samples_nvalid;
+	debug_log("@ NOSYNC advance=%zu\n", rx->advance);
+	return 1;
+    }
+
+    /*
+     * While idle, look for the leader or preamble (cheaply) and only
+     * hand off to the full fsk_find_frame() search once we've found it.
+     */
+    if ( cfg->preamble_detect && !rx->carrier && !rx->preamble_found ) {
+	int t = fsk_detect_preamble(fskp, samplebuf, samples_nvalid,
+		    nsamples_per_bit, cfg->preamble_bits_string,
+		    cfg->preamble_min_nbits, cfg->preamble_min_snr);
+	if ( t < 0 ) {
+	    // Keep enough of the tail to rescan a partial preamble.
+	    unsigned int keep_nsamples
+		    = nsamples_per_bit * (cfg->preamble_min_nbits + 1);
+	    if ( samples_nvalid > keep_nsamples + nsamples_per_bit )
+		rx->advance = samples_nvalid - keep_nsamples;
+	    else
+		rx->advance = nsamples_per_bit;
+	    debug_log("@ NOPREAMBLE advance=%zu\n", rx->advance);
+	    return 1;
+	}
+	rx->preamble_found = 1;
+	rx->noconfidence = 0;
+	rx->advance = t;
+	debug_log("@ PREAMBLE advance=%zu\n", rx->advance);
+	return 1;
+    }
+
+    // try_max_nsamples
+    // serves two purposes
+    // 1. avoids finding a non-optimal first frame
+    // 2. allows us to track slightly slow signals
+    unsigned int try_max_nsamples;
+    if ( rx->carrier )
+	try_max_nsamples = nsamples_per_bit * 0.75f + 0.5f;
+    else
+	try_max_nsamples = nsamples_per_bit;
+    try_max_nsamples += nsamples_overscan;
+
+    // FSK_ANALYZE_NSTEPS Try 3 frame positions across the try_max_nsamples
+    // range.  Using a larger nsteps allows for more accurate tracking of
+    // fast/slow signals (at decreased performance).  Note also
+    // FSK_ANALYZE_NSTEPS_FINE below, which refines the frame
+    // position upon first acquiring carrier, or if confidence falls.
+#define FSK_ANALYZE_NSTEPS		3
+    unsigned int analyze_nsteps = FSK_ANALYZE_NSTEPS;
+    if ( cfg->adaptive_search )
+	analyze_nsteps = search_efforts[rx->effort_ctl.level].nsteps;
+    if ( rx->load_shed_level >= 2 && analyze_nsteps > 2 )
+	analyze_nsteps = 2;
+    unsigned int try_step_nsamples = try_max_nsamples / analyze_nsteps;
+    if ( try_step_nsamples == 0 )
+	try_step_nsamples = 1;
+
+    float confidence, amplitude;
+    unsigned long long bits = 0;
+    /* Note: frame_start_sample is actually the sample where the
+     * prev_stop bit begins (since the "frame" includes the prev_stop). */
+    unsigned int frame_start_sample = 0;
+
+    unsigned int try_first_sample;
+    float try_confidence_search_limit;
+
+    try_confidence_search_limit = cfg->fsk_confidence_search_limit;
+    if ( cfg->adaptive_search ) {
+	try_confidence_search_limit *=
+		    search_efforts[rx->effort_ctl.level].search_limit_scale;
+	if ( try_confidence_search_limit < cfg->fsk_confidence_threshold )
+	    try_confidence_search_limit = cfg->fsk_confidence_threshold;
+    }
+    if ( rx->load_shed_level >= 3 )
+	try_confidence_search_limit = cfg->fsk_confidence_threshold;
+    try_first_sample = rx->carrier ? nsamples_overscan : 0;
+
+    // Until we have carrier, look for the sync frame (if any).  Note
+    // that the refine rescan below must look for the same thing.
+    const char *expect_bits_string
+	    = rx->carrier ? rx->expect_data_string : rx->expect_sync_string;
+
+    confidence = fsk_find_frame(fskp, samplebuf, rx->expect_nsamples,
+		    try_first_sample,
+		    try_max_nsamples,
+		    try_step_nsamples,
+		    try_confidence_search_limit,
+		    expect_bits_string,
+		    &bits,
+		    &amplitude,
+		    &frame_start_sample
+		    );
+
+    int do_refine_frame = 0;
+
+    if ( confidence < rx->peak_confidence * 0.75f ) {
+	do_refine_frame = 1;
+	debug_log(" ... do_refine_frame rescan (confidence %.3f << %.3f peak)\n", confidence, rx->peak_confidence);
+	rx->peak_confidence = 0;
+    }
+
+    // no-confidence if amplitude drops abruptly to < 25% of the
+    // track_amplitude, which follows amplitude with hysteresis
+    if ( amplitude < rx->track_amplitude * 0.25f ) {
+	confidence = 0;
+    }
+
+#define FSK_MAX_NOCONFIDENCE_BITS	20
+
+    if ( confidence <= cfg->fsk_confidence_threshold ) {
+
+	// FIXME: explain
+	if ( ++rx->noconfidence > FSK_MAX_NOCONFIDENCE_BITS )
+	{
+	    rx->carrier_band = -1;
+	    rx->preamble_found = 0;
+	    if ( rx->carrier ) {
+		rx_end_carrier(rx);
+
+		if ( cfg->rx_one )
+		    return 0;
+	    }
+	}
+
+	/* Advance the sample stream forward by try_max_nsamples so the
+	 * next time around the loop we continue searching from where
+	 * we left off this time.  While idle, stay on the grid of
+	 * try_max_nsamples steps from the start of the stream, so that
+	 * where a carrier is found doesn't depend on where the previous
+	 * one ended (nor on where decoding began: minimodem_rx_seek()). */
+	rx->advance = try_max_nsamples;
+	if ( !rx->carrier )
+	    rx->advance -= rx->samplebuf_offset % try_max_nsamples;
+	debug_log("@ NOCONFIDENCE=%u advance=%zu\n", rx->noconfidence,
+		rx->advance);
+	return 1;
+    }
+
+    // Add a frame's worth of samples to the sample count
+    rx->carrier_nsamples += rx->frame_nsamples;
+
+    if ( rx->carrier ) {
+
+	// If we already had carrier, adjust sample count +start -overscan
+	rx->carrier_nsamples += frame_start_sample;
+	rx->carrier_nsamples -= nsamples_overscan;
+
+    } else {
+
+	// We just acquired carrier.
+
+	minimodem_rx_event ev = { .type = MINIMODEM_RX_CARRIER };
+	ev.sample = rx->samplebuf_offset + frame_start_sample;
+	ev.carrier_freq = fskp->b_mark * fskp->band_width;
+	ev.space_freq = fskp->b_space * fskp->band_width;
+	ev.search = rx->samplebuf_offset;
+	if ( rx->event_fn )
+	    rx->event_fn(rx->cb_arg, &ev);
+
+	rx->carrier = 1;
+	cfg->bfsk_databits_decode(&rx->dbs, 0, 0, 0, 0); // reset the frame processor
+
+	do_refine_frame = 1;
+	debug_log(" ... do_refine_frame rescan (acquired carrier)\n");
+    }
+
+    if ( do_refine_frame && rx->load_shed_level < 1 )
+    {
+	if ( confidence < INFINITY && try_step_nsamples > 1 ) {
+	    // FSK_ANALYZE_NSTEPS_FINE:
+	    // Scan again, but try harder to find the best frame.
+	    // Since we found a valid confidence frame in the "sloppy"
+	    // fsk_find_frame() call already, we're sure to find one at
+	    // least as good this time.
+#define FSK_ANALYZE_NSTEPS_FINE		8
+	    unsigned int analyze_nsteps_fine = FSK_ANALYZE_NSTEPS_FINE;
+	    if ( cfg->adaptive_search )
+		analyze_nsteps_fine
+		    = search_efforts[rx->effort_ctl.level].nsteps_fine;
+	    try_step_nsamples = try_max_nsamples / analyze_nsteps_fine;
+	    if ( try_step_nsamples == 0 )
+		try_step_nsamples = 1;
+	    try_confidence_search_limit = INFINITY;
+	    float confidence2, amplitude2;
+	    unsigned long long bits2;
+	    unsigned int frame_start_sample2;
+	    confidence2 = fsk_find_frame(fskp, samplebuf, rx->expect_nsamples,
+			try_first_sample,
+			try_max_nsamples,
+			try_step_nsamples,
+			try_confidence_search_limit,
+			expect_bits_string,
+			&bits2,
+			&amplitude2,
+			&frame_start_sample2
+			);
+	    if ( confidence2 > confidence ) {
+		bits = bits2;
+		amplitude = amplitude2;
+		frame_start_sample = frame_start_sample2;
+	    }
+	}
+    }
+
+    rx->track_amplitude = ( rx->track_amplitude + amplitude ) / 2;
+    if ( rx->peak_confidence < confidence )
+	rx->peak_confidence = confidence;
+    debug_log("@ confidence=%.3f peak_conf=%.3f amplitude=%.3f track_amplitude=%.3f\n",
+	    confidence, rx->peak_confidence, amplitude, rx->track_amplitude );
+
+    if ( cfg->adaptive_search ) {
+	rx->effort_total += rx->effort_ctl.level;
+	// timing skew: how far the frame was from where we expected it
+	float skew = fabsf((float)frame_start_sample
+			    - (float)try_first_sample) / nsamples_per_bit;
+	search_effort_update(&rx->effort_ctl, confidence,
+		    cfg->fsk_confidence_search_limit, skew);
+    }
+
+    rx->confidence_total += confidence;
+    rx->amplitude_total += amplitude;
+    rx->nframes_decoded++;
+    rx->noconfidence = 0;
+
+    rx->last_frame.offset = rx->samplebuf_offset + frame_start_sample;
+    rx->last_frame.nsamples = rx->frame_nsamples;
+    rx->last_frame.confidence = confidence;
+    rx->last_frame.amplitude = amplitude;
+
+    // Advance the sample stream forward past the junk before the
+    // frame starts (frame_start_sample), and then past decoded frame
+    // (see also NOTE about frame_n_bits and expect_n_bits)...
+    // But actually advance just a bit less than that to allow
+    // for tracking slightly fast signals, hence - nsamples_overscan.
+    rx->advance = frame_start_sample + rx->frame_nsamples - nsamples_overscan;
+
+    debug_log("@ nsamples_per_bit=%.3f n_data_bits=%u "
+		    " frame_start=%u advance=%zu\n",
+		nsamples_per_bit, cfg->bfsk_n_data_bits,
+		frame_start_sample, rx->advance);
+
+    // chop off the prev_stop bit
+    if ( cfg->bfsk_nstopbits != 0.0f )
+	bits = bits >> 1;
+
+
+    /*
+     * Send the raw data frame bits to the backend frame processor
+     * for final conversion to output data bytes.
+     */
+
+    // chop off framing bits
+    bits = bit_window(bits, cfg->bfsk_nstartbits, cfg->bfsk_n_data_bits);
+    if (cfg->bfsk_msb_first) {
+	    bits = bit_reverse(bits, cfg->bfsk_n_data_bits);
+    }
+    rx->last_frame.bits = bits;
+
+    debug_log("Input: %08x%08x - Databits: %u - Shift: %i\n", (unsigned int)(bits >> 32), (unsigned int)bits, cfg->bfsk_n_data_bits, cfg->bfsk_nstartbits);
+
+    unsigned int dataout_size = 4096;
+    char dataoutbuf[4096];
+    unsigned int dataout_nbytes = 0;
+
+    // suppress printing of bfsk_sync_byte bytes
+    if ( cfg->bfsk_do_rx_sync ) {
+	if ( dataout_nbytes == 0 && bits == cfg->bfsk_sync_byte )
+	    return 1;
+    }
+
+    dataout_nbytes += cfg->bfsk_databits_decode(&rx->dbs,
+					dataoutbuf + dataout_nbytes,
+					dataout_size - dataout_nbytes,
+					bits, (int)cfg->bfsk_n_data_bits);
+
+    if ( dataout_nbytes == 0 )
+	return 1;
+
+    if ( rx->data_fn )
+	rx->data_fn(rx->cb_arg, dataoutbuf, dataout_nbytes);
+
+    return 1;
+}
+
+/*
+ * Shift the samples in samplebuf by 'advance' samples.  If the advance
+ * runs past the samples we have, the rest of it stays pending.
+ */
+static void
+rx_consume_advance( minimodem_rx *rx )
+{
+    size_t advance = rx->advance;
+    if ( advance > rx->samples_nvalid )
+	advance = rx->samples_nvalid;
+    debug_log("advance=%zu\n", advance);
+    if ( advance ) {
+	memmove(rx->samplebuf, rx->samplebuf+advance,
+		(rx->samples_nvalid-advance)*sizeof(float));
+	rx->samples_nvalid -= advance;
+	rx->samplebuf_offset += advance;
+	rx->advance -= advance;
+    }
+}
+
+/*
+ * Run the main processing loop over the samplebuf for as long as it
+ * holds enough samples: at least half a samplebuf's worth, or when
+ * flushing (at the end of the stream) at least one whole frame.
+ * Returns 0 once the receiver is done (rx_one, or stopped), else 1.
+ */
+static int
+rx_process_samplebuf( minimodem_rx *rx, int flushing )
+{
+    while ( !rx->done ) {
+
+	if ( rx->stop ) {
+	    rx->done = 1;
+	    break;
+	}
+
+	rx_consume_advance(rx);
+	if ( rx->advance )
+	    return 1;
+
+	if ( !flushing && rx->samples_nvalid < rx->samplebuf_size/2 )
+	    return 1;
+
+	if ( rx->samples_nvalid == 0 )
+	    return 1;
+
+	if ( rx->samples_nvalid < rx->expect_nsamples )
+	    return 1;
+
+	if ( !rx_process(rx) )
+	    rx->done = 1;
+
+    } /* end of the main loop */
+
+    return 0;
+}
+
+int
+minimodem_rx_push( minimodem_rx *rx, const float *samples, size_t nsamples )
+{
+    if ( rx->samples_fn && nsamples && !rx->done )
+	rx->samples_fn(rx->samples_arg,
+		    rx->samplebuf_offset + rx->samples_nvalid,
+		    samples, nsamples);
+
+    while ( nsamples && !rx->done ) {
+	// drop any samples that a pending advance skips over
+	if ( rx->advance ) {
+	    size_t n = rx->advance < nsamples ? rx->advance : nsamples;
+	    rx->samplebuf_offset += n;
+	    rx->advance -= n;
+	    samples += n;
+	    nsamples -= n;
+	    continue;
+	}
+
+	size_t n = rx->samplebuf_size - rx->samples_nvalid;
+	if ( n > nsamples )
+	    n = nsamples;
+	memcpy(rx->samplebuf + rx->samples_nvalid, samples, n*sizeof(float));
+	rx->samples_nvalid += n;
+	samples += n;
+	nsamples -= n;
+
+	rx_process_samplebuf(rx, 0);
+    }
+    return rx->done;
+}
+
+int
+minimodem_rx_flush( minimodem_rx *rx )
+{
+    // (the last frame searches may look past the end of the samples)
+    memset(rx->samplebuf + rx->samples_nvalid, 0,
+	    (rx->samplebuf_size - rx->samples_nvalid) * sizeof(float));
+    rx_process_samplebuf(rx, 1);
+
+    if ( rx->carrier )
+	rx_end_carrier(rx);
+
+    // start over, with a new stream
+    rx->samplebuf_offset += rx->samples_nvalid + rx->advance;
+    rx->samples_nvalid = 0;
+    rx->advance = 0;
+    rx->noconfidence = 0;
+    rx->carrier_band = -1;
+    rx->preamble_found = 0;
+    rx->peak_confidence = 0;
+
+    return rx->done;
+}
+
+void
+minimodem_rx_seek( minimodem_rx *rx, unsigned long long pos )
+{
+    unsigned int idle_step = (unsigned int)rx->nsamples_per_bit
+				+ rx->nsamples_overscan;
+    rx->samplebuf_offset = pos;
+    rx->advance = (idle_step - pos % idle_step) % idle_step;
+}
+
+int
+minimodem_rx_checkpoint( const minimodem_rx *rx, unsigned long long *posp )
+{
+    unsigned int idle_step = (unsigned int)rx->nsamples_per_bit
+				+ rx->nsamples_overscan;
+    unsigned long long pos = rx->samplebuf_offset + rx->advance;
+    // (a receiver picked up with minimodem_rx_resume() may be off the
+    // idle search positions until its first carrier ends)
+    if ( rx->carrier || pos % idle_step )
+	return 0;
+    *posp = pos;
+    return 1;
+}
+
+int
+minimodem_rx_resume( minimodem_rx *rx, unsigned long long pos,
+	float mark_f, float space_f )
+{
+    fsk_plan *fskp = rx->fskp;
+    float half_bw = fskp->band_width / 2.0f;
+    int b_mark = (mark_f + half_bw) / fskp->band_width;
+    int b_space = (space_f + half_bw) / fskp->band_width;
+    if ( b_mark < 1 || b_mark >= fskp->nbands
+		|| b_space < 1 || b_space >= fskp->nbands
+		|| b_mark == b_space ) {
+	errno = EINVAL;
+	return -1;
+    }
+    if ( b_mark != fskp->b_mark || b_space != fskp->b_space )
+	fsk_set_tones_by_bandshift(fskp, b_mark, b_space - b_mark);
+    rx->carrier_band = b_mark;		// (no --auto-carrier detection)
+    rx->preamble_found = 1;		// (nor --preamble or --sync-correlate)
+    rx->samplebuf_offset = pos;
+    rx->advance = 0;
+    return 0;
+}
+
+unsigned long long
+minimodem_rx_tell( const minimodem_rx *rx )
+{
+    return rx->samplebuf_offset + rx->advance;
+}
+
+const minimodem_rx_frame *
+minimodem_rx_last_frame( const minimodem_rx *rx )
+{
+    return &rx->last_frame;
+}
+
+int
+minimodem_rx_run( minimodem_rx *rx, simpleaudio *sa )
+{
+    int ret = 0;
+
+    size_t shed_load_deadline_nsamples = 0;
+    if ( rx->cfg.shed_load ) {
+	size_t backlog_nsamples, capacity_nsamples;
+	if ( simpleaudio_get_backlog(sa, &backlog_nsamples,
+				&capacity_nsamples) < 0 ) {
+	    rx->cfg.shed_load = 0;
+	} else if ( rx->cfg.shed_load_deadline_ms > 0.0f ) {
+	    shed_load_deadline_nsamples = rx->cfg.shed_load_deadline_ms
+				* rx->cfg.sample_rate / 1000;
+	} else if ( capacity_nsamples ) {
+	    shed_load_deadline_nsamples = capacity_nsamples;
+	} else {
+	    shed_load_deadline_nsamples = rx->cfg.sample_rate; // arbitrary: 1 sec
+	}
+    }
+
+    // Like minimodem_rx_push(), but read straight into the samplebuf
+    while ( rx_process_samplebuf(rx, 0) ) {
+	size_t samplebuf_size = rx->samplebuf_size;
+	float	*samples_readptr = rx->samplebuf + rx->samples_nvalid;
+	size_t	read_nsamples = samplebuf_size/2;
+	/* Read more samples into samplebuf (fill it) */
+	assert ( read_nsamples > 0 );
+	assert ( rx->samples_nvalid + read_nsamples <= samplebuf_size );
+	ssize_t r;
+	r = simpleaudio_read(sa, samples_readptr, read_nsamples);
+	debug_log("simpleaudio_read(samplebuf+%td, n=%zu) returns %zd\n",
+		samples_readptr - rx->samplebuf, read_nsamples, r);
+	if ( r < 0 ) {
+	    fprintf(stderr, "simpleaudio_read: error\n");
+	    ret = -1;
+	    break;
+	}
+	if ( rx->samples_fn && r > 0 )
+	    rx->samples_fn(rx->samples_arg,
+			rx->samplebuf_offset + rx->samples_nvalid,
+			samples_readptr, r);
+	rx->samples_nvalid += r;
+
+	if ( rx->cfg.shed_load )
+	    load_shed_update(rx, sa, shed_load_deadline_nsamples);
+
+	if ( r == 0 )
+	    break;
+    }
+
+    minimodem_rx_flush(rx);
+
+    return ret;
+}
+
+
+/*
+ * Spectral feature cache
+ *
+ * Other than to measure the mark and space tone magnitudes over bit-long
+ * windows, the receiver has no use for the samples (without the options
+ * which rx_use_track() refuses).  So those magnitudes, for the window
+ * starting at every sample, can stand in for the recording: a receiver
+ * decoding from them does no spectral work, and reads no audio.  Any
+ * receiver with the same sample rate, tone bands (either way around, so
+ * both polarities) and bit window can use them.
+ *
+ * A cache file is the header below, then a (native-endian) float pair
+ * per sample: the mark and space magnitudes.  A minimodem_features holds
+ * the same in memory.  The header also names the recording the cache was
+ * built from, by its size, inode and modification time (as make and git
+ * tell a changed file), so a cache is not used for a recording which has
+ * since been replaced or rewritten.
+ */
+
+#define FEATURE_CACHE_MAGIC	"MMFCACH2"
+#define FEATURE_CACHE_CHUNK	65536	// positions per sliding DFT run
+
+struct feature_cache_header {
+	char		magic[8];
+	uint32_t	sample_rate;
+	uint32_t	fftsize;
+	uint32_t	b_mark;
+	uint32_t	b_space;
+	uint32_t	window_nsamples;
+	uint32_t	source_mtime_nsec;
+	uint64_t	nsamples;
+	uint64_t	source_size;
+	uint64_t	source_ino;
+	int64_t		source_mtime;	// (64 bytes: keeps the track aligned)
+};
+
+struct minimodem_features {
+	struct feature_cache_header h;
+	const float	*mags;
+	void		*map;
+	size_t		map_size;
+};
+
+/* the bit window of every fsk_find_frame() search */
+static unsigned int
+rx_feature_window( const minimodem_rx *rx )
+{
+    return (unsigned int)((float)rx->expect_nsamples / rx->expect_n_bits
+								+ 0.5f);
+}
+
+static void
+rx_feature_cache_key( const minimodem_rx *rx,
+	struct feature_cache_header *h )
+{
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, FEATURE_CACHE_MAGIC, sizeof(h->magic));
+    h->sample_rate = rx->fskp->sample_rate;
+    h->fftsize = rx->fskp->fftsize;
+    h->b_mark = rx->fskp->b_mark;
+    h->b_space = rx->fskp->b_space;
+    h->window_nsamples = rx_feature_window(rx);
+}
+
+/*
+ * Fill in the source fields of h from the recording at source.
+ * Returns 0, or -1 with errno set.
+ */
+static int
+rx_feature_cache_source( const char *source,
+	struct feature_cache_header *h )
+{
+    struct stat st;
+    if ( stat(source, &st) < 0 )
+	return -1;
+    h->source_size = st.st_size;
+    h->source_ino = st.st_ino;
+    h->source_mtime = st.st_mtim.tv_sec;
+    h->source_mtime_nsec = st.st_mtim.tv_nsec;
+    return 0;
+}
+
+/*
+ * Point the receiver's plan at the track described by h, if it fits.
+ * Returns 0, or -1 with errno set.
+ */
+static int
+rx_use_track( minimodem_rx *rx, const struct feature_cache_header *h,
+	const float *mags )
+{
+    minimodem_config *cfg = &rx->cfg;
+    if ( cfg->preamble_detect || cfg->sync_correlate
+		|| cfg->carrier_autodetect_threshold > 0.0f ) {
+	errno = EINVAL;
+	return -1;
+    }
+
+    struct feature_cache_header key;
+    rx_feature_cache_key(rx, &key);
+    key.nsamples = h->nsamples;
+    key.source_size = h->source_size;
+    key.source_ino = h->source_ino;
+    key.source_mtime = h->source_mtime;
+    key.source_mtime_nsec = h->source_mtime_nsec;
+    int swap = 0;
+    if ( memcmp(h, &key, sizeof(key)) != 0 ) {
+	// the other polarity?
+	key.b_mark = rx->fskp->b_space;
+	key.b_space = rx->fskp->b_mark;
+	if ( memcmp(h, &key, sizeof(key)) != 0 ) {
+	    errno = ESTALE;
+	    return -1;
+	}
+	swap = 1;
+    }
+
+    fsk_plan *fskp = rx->fskp;
+    fskp->track = mags;
+    fskp->track_nsamples = h->nsamples;
+    fskp->track_window = h->window_nsamples;
+    fskp->track_swap = swap;
+    return 0;
+}
+
+/*
+ * Compute the track of the whole stream sa for rx, a chunk at a time,
+ * into the sink.  Fills in the header h.  Returns 0, or -1 on an error.
+ */
+static int
+rx_build_track( minimodem_rx *rx, simpleaudio *sa,
+	struct feature_cache_header *h,
+	int (*sink)( void *arg, const float *mags, size_t npos ),
+	void *sink_arg )
+{
+    rx_feature_cache_key(rx, h);
+    unsigned int window = h->window_nsamples;
+
+    size_t buf_nsamples = FEATURE_CACHE_CHUNK + window - 1;
+    float *buf = malloc(buf_nsamples * sizeof(float));
+    float *mags = malloc(FEATURE_CACHE_CHUNK * 2 * sizeof(float));
+    if ( !buf || !mags ) {
+	perror("malloc");
+	free(buf);
+	free(mags);
+	return -1;
+    }
+
+    // buf holds the samples from stream position h->nsamples on
+    int ret = -1;
+    size_t nvalid = 0;
+    int eof = 0;
+    while ( 1 ) {
+	while ( !eof && nvalid < buf_nsamples ) {
+	    ssize_t r = simpleaudio_read(sa, buf + nvalid,
+				buf_nsamples - nvalid);
+	    if ( r < 0 ) {
+		fprintf(stderr, "simpleaudio_read: error\n");
+		goto out;
+	    }
+	    if ( r == 0 )
+		eof = 1;
+	    nvalid += r;
+	}
+	size_t npos = FEATURE_CACHE_CHUNK;
+	if ( eof ) {
+	    if ( nvalid < npos )
+		npos = nvalid;
+	    memset(buf + nvalid, 0, (buf_nsamples - nvalid) * sizeof(float));
+	}
+	if ( npos == 0 )
+	    break;
+	fsk_tone_track(rx->fskp, buf, npos, window, mags);
+	if ( sink(sink_arg, mags, npos) < 0 )
+	    goto out;
+	h->nsamples += npos;
+	nvalid -= npos;
+	memmove(buf, buf + npos, nvalid * sizeof(float));
+    }
+    ret = 0;
+
+out:
+    free(buf);
+    free(mags);
+    return ret;
+}
+
+static int
+track_file_sink( void *arg, const float *mags, size_t npos )
+{
+    return fwrite(mags, 2 * sizeof(float), npos, arg) == npos ? 0 : -1;
+}
+
+int
+minimodem_rx_build_feature_cache( minimodem_rx *rx, simpleaudio *sa,
+	const char *source, const char *path )
+{
+    // (taken first: a recording rewritten while this reads it is stale)
+    struct feature_cache_header src = { .nsamples = 0 };
+    if ( source && rx_feature_cache_source(source, &src) < 0 ) {
+	perror(source);
+	return -1;
+    }
+
+    size_t tmp_path_len = strlen(path) + sizeof(".tmp");
+    char *tmp_path = malloc(tmp_path_len);
+    if ( !tmp_path ) {
+	perror("malloc");
+	return -1;
+    }
+    snprintf(tmp_path, tmp_path_len, "%s.tmp", path);
+
+    int ret = -1;
+    struct feature_cache_header h = { .nsamples = 0 };
+    FILE *f = fopen(tmp_path, "w");
+    if ( !f ) {
+	perror(tmp_path);
+	goto out;
+    }
+    if ( fwrite(&h, sizeof(h), 1, f) != 1 )
+	goto write_error;
+    if ( rx_build_track(rx, sa, &h, track_file_sink, f) < 0 ) {
+	if ( ferror(f) )
+	    goto write_error;
+	goto out;
+    }
+    h.source_size = src.source_size;
+    h.source_ino = src.source_ino;
+    h.source_mtime = src.source_mtime;
+    h.source_mtime_nsec = src.source_mtime_nsec;
+    if ( fseek(f, 0, SEEK_SET) != 0 || fwrite(&h, sizeof(h), 1, f) != 1 )
+	goto write_error;
+    if ( fclose(f) != 0 ) {
+	f = NULL;
+	goto write_error;
+    }
+    f = NULL;
+    if ( rename(tmp_path, path) != 0 ) {
+	perror(path);
+	goto out;
+    }
+    ret = 0;
+    goto out;
+
+write_error:
+    perror(tmp_path);
+out:
+    if ( f )
+	fclose(f);
+    if ( ret < 0 )
+	unlink(tmp_path);
+    free(tmp_path);
+    return ret;
+}
+
+int
+minimodem_rx_open_feature_cache( minimodem_rx *rx, const char *source,
+	const char *path )
+{
+    struct feature_cache_header src = { .nsamples = 0 };
+    if ( source && rx_feature_cache_source(source, &src) < 0 )
+	return -1;
+
+    int fd = open(path, O_RDONLY);
+    if ( fd < 0 )
+	return -1;
+    struct stat st;
+    if ( fstat(fd, &st) < 0 ) {
+	close(fd);
+	return -1;
+    }
+    if ( (size_t)st.st_size < sizeof(struct feature_cache_header) ) {
+	close(fd);
+	errno = ESTALE;
+	return -1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if ( map == MAP_FAILED )
+	return -1;
+
+    const struct feature_cache_header *h = map;
+    int r = -1;
+    if ( (st.st_size - sizeof(*h)) / (2 * sizeof(float)) != h->nsamples )
+	errno = ESTALE;
+    else if ( source && (h->source_size != src.source_size
+		|| h->source_ino != src.source_ino
+		|| h->source_mtime != src.source_mtime
+		|| h->source_mtime_nsec != src.source_mtime_nsec) )
+	errno = ESTALE;
+    else
+	r = rx_use_track(rx, h, (const float *)(h + 1));
+    if ( r < 0 ) {
+	int err = errno;
+	munmap(map, st.st_size);
+	errno = err;
+	return -1;
+    }
+
+    if ( rx->cache_map )
+	munmap(rx->cache_map, rx->cache_map_size);
+    rx->cache_map = map;
+    rx->cache_map_size = st.st_size;
+    return 0;
+}
+
+/*
+ * The features of a long recording outgrow memory (8 bytes per sample:
+ * over 1.3 GB an hour at 48 kHz), so they go to an unlinked temporary
+ * file, as a cache file, and are mapped from there: the kernel can then
+ * page them out rather than the process running out of memory.
+ */
+minimodem_features *
+minimodem_features_new( minimodem_rx *rx, simpleaudio *sa )
+{
+    const char *tmpdir = getenv("TMPDIR");
+    if ( !tmpdir || !*tmpdir )
+	tmpdir = "/tmp";
+    size_t path_len = strlen(tmpdir) + sizeof("/minimodem-features-XXXXXX");
+    char *path = malloc(path_len);
+    minimodem_features *f = calloc(1, sizeof(*f));
+    if ( !path || !f ) {
+	perror("malloc");
+	free(path);
+	free(f);
+	return NULL;
+    }
+    snprintf(path, path_len, "%s/minimodem-features-XXXXXX", tmpdir);
+
+    FILE *file = NULL;
+    int fd = mkstemp(path);
+    if ( fd < 0 ) {
+	perror(path);
+	goto error;
+    }
+    unlink(path);
+    file = fdopen(fd, "w+");
+    if ( !file ) {
+	perror(path);
+	close(fd);
+	goto error;
+    }
+    if ( fwrite(&f->h, sizeof(f->h), 1, file) != 1 )
+	goto write_error;
+    if ( rx_build_track(rx, sa, &f->h, track_file_sink, file) < 0 ) {
+	if ( ferror(file) )
+	    goto write_error;
+	goto error;
+    }
+    if ( fflush(file) != 0 )
+	goto write_error;
+
+    f->map_size = sizeof(f->h) + f->h.nsamples * 2 * sizeof(float);
+    f->map = mmap(NULL, f->map_size, PROT_READ, MAP_SHARED, fileno(file), 0);
+    if ( f->map == MAP_FAILED ) {
+	f->map = NULL;
+	perror("mmap");
+	goto error;
+    }
+    f->mags = (const float *)((struct feature_cache_header *)f->map + 1);
+    fclose(file);
+    free(path);
+    return f;
+
+write_error:
+    perror(path);
+error:
+    if ( file )
+	fclose(file);
+    free(path);
+    minimodem_features_destroy(f);
+    return NULL;
+}
+
+void
+minimodem_features_destroy( minimodem_features *f )
+{
+    if ( f->map )
+	munmap(f->map, f->map_size);
+    free(f);
+}
+
+int
+minimodem_rx_use_features( minimodem_rx *rx, const minimodem_features *f )
+{
+    return rx_use_track(rx, &f->h, f->mags);
+}
+
+int
+minimodem_rx_run_feature_cache( minimodem_rx *rx )
+{
+    unsigned long long nsamples = rx->fskp->track_nsamples;
+
+    // Like minimodem_rx_run(), but "read" the positions only
+    while ( rx_process_samplebuf(rx, 0) ) {
+	unsigned long long pos = rx->samplebuf_offset + rx->samples_nvalid;
+	size_t read_nsamples = rx->samplebuf_size/2;
+	if ( pos >= nsamples )
+	    break;
+	if ( read_nsamples > nsamples - pos )
+	    read_nsamples = nsamples - pos;
+	rx->samples_nvalid += read_nsamples;
+    }
+
+    minimodem_rx_flush(rx);
+
+    return 0;
+}
@@ -0,0 +1,790 @@
+/*
+ * minimodem_survey.c
+ *
+ * minimodem - software audio Bell-type or RTTY FSK modem
+ *
+ * Copyright (C) 2011-2016 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "minimodem_survey.h"
+#include "fsk.h"
+
+
+/*
+ * Survey of unknown FSK transmissions.
+ *
+ * Pass 1 reads the stream in (Hann windowed, 40 ms) spectrogram frames.
+ * A frame is active if some 100 Hz band in it holds well over the median
+ * bin's power; runs of active frames (with short gaps) are the spans
+ * worth a closer look, and each span's frames are summed into its power
+ * spectrum.  Only the spans' samples are kept.
+ *
+ * Pass 2 works on one span at a time.  The band its spectrum holds is
+ * mixed down to 0 Hz and decimated, and its instantaneous frequency
+ * split into two tones (2-means).  The times between the crossings from
+ * one tone to the other are, mostly, small multiples of the bit time: the
+ * shortest of them give a first guess, and a least-squares fit of all the
+ * multiples refines it.  The tones are then re-measured over the middle
+ * of the runs of two bits or more (away from the transitions).
+ *
+ * Which tone is mark, and the framing, are tried by the receiver itself:
+ * each hypothesis decodes the first seconds of the span, the one decoding
+ * the most bits (weighted by their confidence) decodes the whole span.
+ * So the receiver only runs on the spans, with at most four sets of
+ * parameters each, whatever the length of the recording.
+ */
+
+#define SV_FRAME_SEC		0.04f	// spectrogram frames
+#define SV_MIN_F		200.0f	// (under it: hum, not FSK)
+#define SV_BAND_HZ		50.0f	// band smoothing half-width
+#define SV_ACTIVE_SNR		10.0f	// band power vs. the median bin
+#define SV_GAP_SEC		0.5f	// spans continue over gaps this short
+#define SV_PAD_SEC		0.25f	// kept before and after a span
+#define SV_MIN_SPAN_SEC		0.2f
+#define SV_MAX_SPAN_SEC		120.0f	// longer spans are cut there
+#define SV_ANALYZE_SEC		20.0f	// of a span, to estimate parameters
+#define SV_SCORE_SEC		5.0f 	// of a span, to try the hypotheses
+#define SV_MIN_SHIFT		20.0f	// Hz
+#define SV_MIN_NINTERVALS	20
+#define SV_SNAP_RATIO		0.02f
+
+static const float sv_std_bauds[] = {
+	45.45f, 50.0f, 75.0f, 100.0f, 110.0f, 150.0f, 200.0f, 300.0f,
+	520.0f + 5/6.0f, 600.0f, 1200.0f, 2400.0f,
+};
+
+struct sv_params {
+	float		lo_f, hi_f;		// the tones
+	float		baud;
+};
+
+struct sv_hyp {
+	float		mark_f, space_f;
+	int		baudot;
+};
+
+struct survey {
+	const minimodem_config	*cfg;
+	unsigned int	rate;
+
+	unsigned int	fftsize;		// = frame length
+	float		bin_width;
+	unsigned int	k_min, k_max;		// bins looked at
+	unsigned int	band_nbins;		// smoothing half-width
+	fftwf_plan	plan;
+	float		*window;		// [fftsize]
+	float		*frame;			// [fftsize]
+	fftwf_complex	*spectrum;		// [fftsize/2+1]
+	float		*power;			// [fftsize/2+1]
+	float		*span_power;		// [fftsize/2+1]
+	float		*smooth;		// [fftsize/2+1]
+	float		*sorted;		// [fftsize/2+1]
+
+	float		*buf;			// samples from buf_pos on
+	size_t		buf_n, buf_size;
+	unsigned long long buf_pos;
+	int		in_span;
+	unsigned long long span_from;		// (with its padding)
+	unsigned long long span_start, span_active_end;
+
+	unsigned int	nspans;
+	unsigned int	nentries;
+};
+
+/* one receiver run over a span */
+struct sv_decode {
+	struct survey		*sv;
+	minimodem_rx		*rx;
+	const struct sv_hyp	*h;
+	float			baud;
+	int			print;		// else only score it
+	char			*text;
+	size_t			text_len, text_size;
+	unsigned long long	start;
+	double			score;
+};
+
+
+static int
+sv_compare_float( const void *a, const void *b )
+{
+    float fa = *(const float *)a, fb = *(const float *)b;
+    return fa < fb ? -1 : fa > fb;
+}
+
+/* the q'th quantile of x[n] (reordered) */
+static float
+sv_quantile( float *x, size_t n, float q )
+{
+    qsort(x, n, sizeof(float), sv_compare_float);
+    size_t i = q * n;
+    return x[i < n ? i : n - 1];
+}
+
+
+/*
+ * Pass 1: the spectrogram
+ */
+
+/* the frame's power spectrum into sv->power; returns whether active */
+static int
+sv_frame_active( struct survey *sv, const float *x )
+{
+    unsigned int k, n;
+
+    for ( n=0; n<sv->fftsize; n++ )
+	sv->frame[n] = x[n] * sv->window[n];
+    fftwf_execute_dft_r2c(sv->plan, sv->frame, sv->spectrum);
+    for ( k=sv->k_min; k<=sv->k_max; k++ )
+	sv->power[k] = sv->spectrum[k][0] * sv->spectrum[k][0]
+			+ sv->spectrum[k][1] * sv->spectrum[k][1];
+
+    unsigned int nk = sv->k_max - sv->k_min + 1;
+    memcpy(sv->sorted, sv->power + sv->k_min, nk * sizeof(float));
+    float median = sv_quantile(sv->sorted, nk, 0.5f);
+
+    // the strongest band, by a running sum
+    unsigned int w = 2 * sv->band_nbins + 1;
+    double sum = 0.0, max_sum = 0.0;
+    for ( k=sv->k_min; k<=sv->k_max; k++ ) {
+	sum += sv->power[k];
+	if ( k >= sv->k_min + w )
+	    sum -= sv->power[k - w];
+	if ( sum > max_sum )
+	    max_sum = sum;
+    }
+    float band = max_sum / w;
+    return band > SV_ACTIVE_SNR * median && band > 1e-9f;
+}
+
+
+/*
+ * Pass 2: the parameters of a span
+ */
+
+static int
+sv_estimate( struct survey *sv, const float *x, size_t n,
+	struct sv_params *p )
+{
+    unsigned int k;
+    int ret = -1;
+
+    // the band: around the strongest (smoothed) bin, down to the noise
+    unsigned int nk = sv->k_max - sv->k_min + 1;
+    unsigned int k_peak = sv->k_min;
+    for ( k=sv->k_min; k<=sv->k_max; k++ ) {
+	unsigned int b_lo = k > sv->k_min + sv->band_nbins
+				? k - sv->band_nbins : sv->k_min;
+	unsigned int b_hi = k + sv->band_nbins < sv->k_max
+				? k + sv->band_nbins : sv->k_max;
+	unsigned int b;
+	float sum = 0.0f;
+	for ( b=b_lo; b<=b_hi; b++ )
+	    sum += sv->span_power[b];
+	sv->smooth[k] = sum / (b_hi - b_lo + 1);
+	if ( sv->smooth[k] > sv->smooth[k_peak] )
+	    k_peak = k;
+    }
+    memcpy(sv->sorted, sv->span_power + sv->k_min, nk * sizeof(float));
+    float floor = sv_quantile(sv->sorted, nk, 0.5f);
+    float thresh = fmaxf(4 * floor, 1e-3f * sv->smooth[k_peak]);
+    unsigned int k_lo = k_peak, k_hi = k_peak;
+    while ( k_lo > sv->k_min && sv->smooth[k_lo-1] > thresh )
+	k_lo--;
+    while ( k_hi < sv->k_max && sv->smooth[k_hi+1] > thresh )
+	k_hi++;
+    // its centre of power, and the width holding all but 2% of it
+    double csum = 0.0, cwsum = 0.0;
+    for ( k=k_lo; k<=k_hi; k++ ) {
+	float pw = sv->span_power[k] - floor;
+	if ( pw > 0.0f ) {
+	    csum += pw;
+	    cwsum += pw * k;
+	}
+    }
+    if ( csum <= 0.0 )
+	return -1;
+    float fc = cwsum / csum * sv->bin_width;
+    double cum = 0.0;
+    unsigned int k_1 = k_lo, k_99 = k_hi;
+    for ( k=k_lo; k<=k_hi; k++ ) {
+	float pw = sv->span_power[k] - floor;
+	if ( pw > 0.0f )
+	    cum += pw;
+	if ( cum < 0.01 * csum )
+	    k_1 = k;
+	if ( cum < 0.99 * csum )
+	    k_99 = k + 1;
+    }
+    float half_w = fmaxf(fc - k_1 * sv->bin_width, k_99 * sv->bin_width - fc)
+			+ sv->bin_width;
+    if ( half_w < SV_BAND_HZ )
+	half_w = SV_BAND_HZ;
+
+    // mix fc down to 0 Hz, low-pass (flat to half_w, down well before
+    // 1.5 * half_w, e.g. for a DC offset or hum), decimate
+    unsigned int decimate = sv->rate / (8 * half_w);
+    if ( decimate < 1 )
+	decimate = 1;
+    float fs2 = (float)sv->rate / decimate;
+    float cutoff = fminf(1.25f * half_w, 0.45f * sv->rate) / sv->rate;
+    unsigned int ntaps = (unsigned int)(12.0f * sv->rate / half_w) | 1;
+    if ( n > SV_ANALYZE_SEC * sv->rate )
+	n = SV_ANALYZE_SEC * sv->rate;
+    if ( n < ntaps + 16 * decimate )
+	return -1;
+    size_t m, nz = (n - ntaps) / decimate + 1;
+
+    float *taps = malloc(ntaps * sizeof(float));
+    float *mix_i = malloc(n * sizeof(float));
+    float *mix_q = malloc(n * sizeof(float));
+    float *f = malloc(nz * sizeof(float));		// Hz from fc, or NAN
+    float *amp = malloc(nz * sizeof(float));
+    float *tmp = malloc(nz * sizeof(float));
+    float *t_run = malloc(nz * sizeof(float));		// transitions
+    float *d = malloc(nz * sizeof(float));		// and intervals
+    int *state = malloc(nz * sizeof(int));		// tone before t_run
+    if ( !taps || !mix_i || !mix_q || !f || !amp || !tmp || !t_run || !d
+		|| !state ) {
+	perror("malloc");
+	goto out;
+    }
+
+    float mid = (ntaps - 1) / 2.0f;
+    float tsum = 0.0f;
+    for ( k=0; k<ntaps; k++ ) {
+	float xk = k - mid;
+	float sinc = xk == 0.0f ? 2 * cutoff
+			: sinf(2 * M_PI * cutoff * xk) / (M_PI * xk);
+	float w = 0.42f - 0.5f * cosf(2 * M_PI * k / (ntaps - 1))
+			+ 0.08f * cosf(4 * M_PI * k / (ntaps - 1));
+	taps[k] = sinc * w;
+	tsum += taps[k];
+    }
+    double omega = 2 * M_PI * fc / sv->rate;
+    size_t i;
+    for ( i=0; i<n; i++ ) {
+	double ph = fmod(omega * i, 2 * M_PI);
+	mix_i[i] = x[i] * cos(ph) / tsum;
+	mix_q[i] = -x[i] * sin(ph) / tsum;
+    }
+
+    // the instantaneous frequency, where there is signal
+    float zi_prev = 0.0f, zq_prev = 0.0f;
+    for ( m=0; m<nz; m++ ) {
+	const float *pi = mix_i + m * decimate, *pq = mix_q + m * decimate;
+	float zi = 0.0f, zq = 0.0f;
+	for ( k=0; k<ntaps; k++ ) {
+	    zi += taps[k] * pi[k];
+	    zq += taps[k] * pq[k];
+	}
+	amp[m] = hypotf(zi, zq);
+	f[m] = m ? atan2f(zq * zi_prev - zi * zq_prev,
+			zi * zi_prev + zq * zq_prev) * fs2 / (2 * M_PI)
+		: 0.0f;
+	zi_prev = zi;
+	zq_prev = zq;
+    }
+    memcpy(tmp, amp, nz * sizeof(float));
+    float amp_thresh = 0.5f * sv_quantile(tmp, nz, 0.8f);
+    size_t nvalid = 0;
+    for ( m=0; m<nz; m++ ) {
+	// (and clicks: no tone lies outside the band)
+	if ( m == 0 || amp[m] < amp_thresh || amp[m-1] < amp_thresh
+		|| fabsf(f[m]) > half_w )
+	    f[m] = NAN;
+	else
+	    tmp[nvalid++] = f[m];
+    }
+    if ( nvalid < 16 )
+	goto out;
+
+    // two tones (2-means)
+    float lo = sv_quantile(tmp, nvalid, 0.1f);
+    float hi = sv_quantile(tmp, nvalid, 0.9f);
+    int iter;
+    for ( iter=0; iter<20; iter++ ) {
+	double s_lo = 0.0, s_hi = 0.0;
+	size_t n_lo = 0, n_hi = 0;
+	float split = (lo + hi) / 2;
+	for ( i=0; i<nvalid; i++ ) {
+	    if ( tmp[i] < split ) {
+		s_lo += tmp[i];
+		n_lo++;
+	    } else {
+		s_hi += tmp[i];
+		n_hi++;
+	    }
+	}
+	if ( !n_lo || !n_hi )
+	    goto out;
+	lo = s_lo / n_lo;
+	hi = s_hi / n_hi;
+    }
+    if ( hi - lo < SV_MIN_SHIFT )
+	goto out;
+
+    // the tone to tone transitions (with hysteresis), and the intervals
+    float split = (lo + hi) / 2;
+    float hyst = 0.15f * (hi - lo);
+    int s = -1;			// -1: no signal
+    float cross = 0.0f;		// the last crossing of split
+    size_t ntrans = 0, nint = 0;
+    for ( m=1; m<nz; m++ ) {
+	if ( isnan(f[m]) ) {
+	    s = -1;
+	    continue;
+	}
+	if ( s < 0 ) {
+	    s = f[m] > split;
+	    cross = m;
+	    if ( ntrans && !isnan(t_run[ntrans-1]) )
+		t_run[ntrans++] = NAN;	// (a break in the signal)
+	    continue;
+	}
+	if ( !isnan(f[m-1]) && (f[m-1] > split) != (f[m] > split) )
+	    cross = m - 1 + (split - f[m-1]) / (f[m] - f[m-1]);
+	if ( (s == 0 && f[m] > split + hyst)
+		|| (s == 1 && f[m] < split - hyst) ) {
+	    if ( ntrans && !isnan(t_run[ntrans-1]) )
+		d[nint++] = cross - t_run[ntrans-1];
+	    state[ntrans] = s;
+	    t_run[ntrans++] = cross;
+	    s = !s;
+	}
+    }
+    if ( nint < SV_MIN_NINTERVALS )
+	goto out;
+
+    // the bit time: the shortest intervals, then all multiples of it
+    memcpy(tmp, d, nint * sizeof(float));
+    float q10 = sv_quantile(tmp, nint, 0.1f);
+    double num = 0.0;
+    size_t den = 0;
+    for ( i=0; i<nint; i++ ) {
+	if ( tmp[i] >= 0.6f * q10 && tmp[i] <= 1.4f * q10 ) {
+	    num += tmp[i];
+	    den++;
+	}
+    }
+    float bit_t = num / den;
+    for ( iter=0; iter<3; iter++ ) {
+	num = 0.0;
+	den = 0;
+	for ( i=0; i<nint; i++ ) {
+	    float r = d[i] / bit_t;
+	    int kr = lrintf(r);
+	    if ( kr >= 1 && kr <= 12 && fabsf(r - kr) < 0.25f ) {
+		num += d[i];
+		den += kr;
+	    }
+	}
+	if ( den == 0 )
+	    goto out;
+	bit_t = num / den;
+    }
+    float baud = fs2 / bit_t;
+    if ( baud < 10.0f || baud > fs2 / 3 )
+	goto out;
+    for ( k=0; k<sizeof(sv_std_bauds)/sizeof(sv_std_bauds[0]); k++ )
+	if ( fabsf(baud / sv_std_bauds[k] - 1.0f) < SV_SNAP_RATIO )
+	    baud = sv_std_bauds[k];
+    bit_t = fs2 / baud;
+
+    // the tones again, from the middle of the longer runs
+    double t_sum[2] = { 0.0, 0.0 };
+    size_t t_n[2] = { 0, 0 };
+    for ( i=1; i<ntrans; i++ ) {
+	if ( isnan(t_run[i-1]) || isnan(t_run[i]) )
+	    continue;
+	if ( t_run[i] - t_run[i-1] < 1.8f * bit_t )
+	    continue;
+	for ( m=t_run[i-1] + 0.5f * bit_t; m<t_run[i] - 0.5f * bit_t; m++ ) {
+	    if ( isnan(f[m]) )
+		continue;
+	    t_sum[state[i]] += f[m];
+	    t_n[state[i]]++;
+	}
+    }
+    if ( t_n[0] )
+	lo = t_sum[0] / t_n[0];
+    if ( t_n[1] )
+	hi = t_sum[1] / t_n[1];
+
+    p->lo_f = fc + lo;
+    p->hi_f = fc + hi;
+    p->baud = baud;
+    ret = 0;
+
+out:
+    free(taps);
+    free(mix_i);
+    free(mix_q);
+    free(f);
+    free(amp);
+    free(tmp);
+    free(t_run);
+    free(d);
+    free(state);
+    return ret;
+}
+
+
+/*
+ * Pass 2: decoding a span
+ */
+
+static void
+sv_print_entry( struct survey *sv, unsigned long long start,
+	unsigned long long end, const struct sv_hyp *h, float baud,
+	float confidence, const char *text, size_t text_len )
+{
+    size_t i;
+
+    printf("%.3f\t%.3f\t%.1f\t%.1f\t%.2f\t%s\t%.2f\t",
+	    (double)start / sv->rate, (double)end / sv->rate,
+	    h->mark_f, h->space_f, baud,
+	    h->baudot ? "baudot" : "ascii",
+	    confidence);
+    for ( i=0; i<text_len; i++ ) {
+	unsigned char c = text[i];
+	switch ( c ) {
+	    case '\\':	fputs("\\\\", stdout);	break;
+	    case '\n':	fputs("\\n", stdout);	break;
+	    case '\r':	fputs("\\r", stdout);	break;
+	    case '\t':	fputs("\\t", stdout);	break;
+	    default:
+		if ( c >= 0x20 && c < 0x7f )
+		    putchar(c);
+		else
+		    printf("\\x%02x", c);
+	}
+    }
+    putchar('\n');
+    sv->nentries++;
+}
+
+static void
+sv_rx_data( void *arg, const char *data, unsigned int nbytes )
+{
+    struct sv_decode *dec = arg;
+
+    if ( !dec->print )
+	return;
+    if ( dec->text_len + nbytes > dec->text_size ) {
+	size_t size = 2 * (dec->text_len + nbytes);
+	char *text = realloc(dec->text, size);
+	if ( !text ) {
+	    perror("realloc");
+	    return;
+	}
+	dec->text = text;
+	dec->text_size = size;
+    }
+    memcpy(dec->text + dec->text_len, data, nbytes);
+    dec->text_len += nbytes;
+}
+
+static void
+sv_rx_event( void *arg, const minimodem_rx_event *ev )
+{
+    struct sv_decode *dec = arg;
+    float frame_nbits = dec->h->baudot ? 7.5f : 10.0f;
+
+    switch ( ev->type ) {
+	case MINIMODEM_RX_CARRIER:
+	    dec->start = minimodem_rx_tell(dec->rx);
+	    dec->text_len = 0;
+	    break;
+	case MINIMODEM_RX_NOCARRIER:
+	    dec->score += ev->nframes_decoded * frame_nbits * ev->confidence;
+	    if ( dec->print )
+		sv_print_entry(dec->sv, dec->start, minimodem_rx_tell(dec->rx),
+			dec->h, dec->baud, ev->confidence,
+			dec->text, dec->text_len);
+	    break;
+	case MINIMODEM_RX_LOADSHED:
+	    break;
+    }
+}
+
+/* returns the hypothesis' score, or < 0 on error */
+static double
+sv_decode( struct survey *sv, const float *x, size_t n,
+	unsigned long long pos, const struct sv_hyp *h, float baud, int print )
+{
+    minimodem_config cfg = *sv->cfg;
+    cfg.sample_rate = sv->rate;
+    cfg.bfsk_data_rate = baud;
+    cfg.bfsk_mark_f = h->mark_f;
+    cfg.bfsk_space_f = h->space_f;
+    cfg.bfsk_inverted_freqs = 0;
+    cfg.shed_load = 0;
+    if ( h->baudot ) {
+	cfg.bfsk_databits_decode = databits_decode_baudot;
+	cfg.bfsk_n_data_bits = 5;
+	cfg.bfsk_nstopbits = 1.5;
+    } else {
+	cfg.bfsk_databits_decode = databits_decode_ascii8;
+	cfg.bfsk_n_data_bits = 8;
+    }
+    minimodem_config_finish(&cfg);
+
+    struct sv_decode dec = {
+	.sv = sv,
+	.h = h,
+	.baud = baud,
+	.print = print,
+    };
+    dec.rx = minimodem_rx_new(&cfg, sv_rx_data, sv_rx_event, &dec);
+    if ( !dec.rx )
+	return -1.0;
+    minimodem_rx_seek(dec.rx, pos);
+    minimodem_rx_push(dec.rx, x, n);
+    minimodem_rx_flush(dec.rx);
+    minimodem_rx_destroy(dec.rx);
+    free(dec.text);
+    return dec.score;
+}
+
+static void
+sv_span( struct survey *sv, const float *x, size_t n, unsigned long long pos )
+{
+    struct sv_params p;
+
+    sv->nspans++;
+    if ( sv_estimate(sv, x, n, &p) < 0 )
+	return;
+
+    struct sv_hyp hyps[4] = {
+	{ p.hi_f, p.lo_f, 0 },
+	{ p.lo_f, p.hi_f, 0 },
+	{ p.hi_f, p.lo_f, 1 },
+	{ p.lo_f, p.hi_f, 1 },
+    };
+    unsigned int nhyps = p.baud < 100.0f ? 4 : 2;
+
+    size_t score_n = n < SV_SCORE_SEC * sv->rate ? n : SV_SCORE_SEC * sv->rate;
+    unsigned int i, best = 0;
+    double best_score = 0.0;
+    for ( i=0; i<nhyps; i++ ) {
+	double score = sv_decode(sv, x, score_n, pos, &hyps[i], p.baud, 0);
+	if ( score > best_score ) {
+	    best_score = score;
+	    best = i;
+	}
+    }
+
+    if ( best_score > 0.0 ) {
+	sv_decode(sv, x, n, pos, &hyps[best], p.baud, 1);
+    } else {
+	// a signal, but no frames: list it with what was found of it
+	struct sv_hyp h = { p.hi_f, p.lo_f, 0 };
+	printf("%.3f\t%.3f\t%.1f\t%.1f\t%.2f\t-\t0.00\t\n",
+		(double)pos / sv->rate, (double)(pos + n) / sv->rate,
+		h.mark_f, h.space_f, p.baud);
+	sv->nentries++;
+    }
+    fflush(stdout);
+}
+
+
+/*
+ * The spans
+ */
+
+static void
+sv_close_span( struct survey *sv, unsigned long long end )
+{
+    unsigned long long buf_end = sv->buf_pos + sv->buf_n;
+    unsigned long long from = sv->span_from > sv->buf_pos
+				? sv->span_from : sv->buf_pos;
+    if ( end > buf_end )
+	end = buf_end;
+
+    if ( sv->span_active_end - sv->span_start
+		>= (unsigned long long)(SV_MIN_SPAN_SEC * sv->rate) )
+	sv_span(sv, sv->buf + (from - sv->buf_pos), end - from, from);
+    sv->in_span = 0;
+
+    // keep what may be the next span's padding
+    unsigned long long pad_n = SV_PAD_SEC * sv->rate;
+    unsigned long long keep = end > pad_n ? end - pad_n : 0;
+    if ( keep > sv->buf_pos ) {
+	size_t ndrop = keep - sv->buf_pos;
+	memmove(sv->buf, sv->buf + ndrop, (sv->buf_n - ndrop) * sizeof(float));
+	sv->buf_n -= ndrop;
+	sv->buf_pos = keep;
+    }
+}
+
+static void
+sv_open_span( struct survey *sv, unsigned long long from,
+	unsigned long long start )
+{
+    sv->in_span = 1;
+    sv->span_from = from;
+    sv->span_start = start;
+    sv->span_active_end = start;
+    memset(sv->span_power, 0, (sv->fftsize/2 + 1) * sizeof(float));
+}
+
+int
+minimodem_survey_run( simpleaudio *sa, const minimodem_config *cfg,
+	int quiet_mode )
+{
+    struct timespec ts0, ts1;
+    clock_gettime(CLOCK_MONOTONIC, &ts0);
+
+    struct survey sv = {
+	.cfg = cfg,
+	.rate = simpleaudio_get_rate(sa),
+    };
+    int ret = 1;
+    unsigned int k;
+
+    // a power of two near SV_FRAME_SEC
+    sv.fftsize = 256;
+    while ( sv.fftsize < SV_FRAME_SEC * sv.rate )
+	sv.fftsize *= 2;
+    sv.bin_width = (float)sv.rate / sv.fftsize;
+    sv.k_min = SV_MIN_F / sv.bin_width;
+    sv.k_max = sv.fftsize / 2 - 1;
+    sv.band_nbins = SV_BAND_HZ / sv.bin_width;
+    if ( sv.k_min >= sv.k_max ) {
+	fprintf(stderr, "E: --survey: sample rate too low\n");
+	return 1;
+    }
+
+    unsigned int nbins = sv.fftsize / 2 + 1;
+    sv.window = malloc(sv.fftsize * sizeof(float));
+    sv.frame = fftwf_malloc(sv.fftsize * sizeof(float));
+    sv.spectrum = fftwf_malloc(nbins * sizeof(fftwf_complex));
+    sv.power = calloc(nbins, sizeof(float));
+    sv.span_power = calloc(nbins, sizeof(float));
+    sv.smooth = calloc(nbins, sizeof(float));
+    sv.sorted = calloc(nbins, sizeof(float));
+    sv.buf_size = 16 * sv.fftsize;
+    sv.buf = malloc(sv.buf_size * sizeof(float));
+    sv.plan = fsk_fft_plan_get(sv.fftsize, /*inverse*/0);
+    if ( !sv.window || !sv.frame || !sv.spectrum || !sv.power
+		|| !sv.span_power || !sv.smooth || !sv.sorted || !sv.buf ) {
+	perror("malloc");
+	goto out;
+    }
+    if ( !sv.plan ) {
+	fprintf(stderr, "fftwf_plan_dft_r2c_1d() failed\n");
+	goto out;
+    }
+    for ( k=0; k<sv.fftsize; k++ )
+	sv.window[k] = 0.5f - 0.5f * cosf(2 * M_PI * k / sv.fftsize);
+
+    unsigned long long gap_n = SV_GAP_SEC * sv.rate;
+    unsigned long long pad_n = SV_PAD_SEC * sv.rate;
+    unsigned long long max_n = SV_MAX_SPAN_SEC * sv.rate;
+
+    printf("#start\tend\tmark\tspace\tbaud\tframing\tconfidence\ttext\n");
+
+    ret = 0;
+    for ( ;; ) {
+	if ( sv.buf_n + sv.fftsize > sv.buf_size ) {
+	    size_t size = 2 * sv.buf_size;
+	    float *buf = realloc(sv.buf, size * sizeof(float));
+	    if ( !buf ) {
+		perror("realloc");
+		ret = 1;
+		break;
+	    }
+	    sv.buf = buf;
+	    sv.buf_size = size;
+	}
+
+	// a whole frame
+	float *fr = sv.buf + sv.buf_n;
+	size_t nread = 0;
+	while ( nread < sv.fftsize ) {
+	    ssize_t r = simpleaudio_read(sa, fr + nread, sv.fftsize - nread);
+	    if ( r < 0 ) {
+		fprintf(stderr, "simpleaudio_read: error\n");
+		ret = 1;
+	    }
+	    if ( r <= 0 )
+		break;
+	    nread += r;
+	}
+	unsigned long long frame_pos = sv.buf_pos + sv.buf_n;
+	sv.buf_n += nread;
+	if ( nread < sv.fftsize )
+	    break;
+	unsigned long long frame_end = frame_pos + sv.fftsize;
+
+	if ( sv_frame_active(&sv, fr) ) {
+	    if ( !sv.in_span )
+		sv_open_span(&sv, frame_pos > pad_n ? frame_pos - pad_n : 0,
+				frame_pos);
+	    sv.span_active_end = frame_end;
+	    for ( k=sv.k_min; k<=sv.k_max; k++ )
+		sv.span_power[k] += sv.power[k];
+	    if ( frame_end - sv.span_start >= max_n ) {
+		// cut it here, and carry straight on
+		sv_close_span(&sv, frame_end);
+		sv_open_span(&sv, frame_end, frame_end);
+	    }
+	} else if ( sv.in_span && frame_end - sv.span_active_end >= gap_n ) {
+	    sv_close_span(&sv, sv.span_active_end + pad_n);
+	}
+
+	if ( !sv.in_span && sv.buf_n > pad_n + 8 * sv.fftsize ) {
+	    size_t ndrop = sv.buf_n - pad_n;
+	    memmove(sv.buf, sv.buf + ndrop, pad_n * sizeof(float));
+	    sv.buf_n = pad_n;
+	    sv.buf_pos += ndrop;
+	}
+    }
+    if ( sv.in_span )
+	sv_close_span(&sv, sv.span_active_end + pad_n);
+
+    clock_gettime(CLOCK_MONOTONIC, &ts1);
+    double wall = (ts1.tv_sec - ts0.tv_sec) + (ts1.tv_nsec - ts0.tv_nsec) / 1e9;
+    if ( !quiet_mode )
+	fprintf(stderr, "### SURVEY audio=%.1fs spans=%u entries=%u"
+			" wall=%.2fs ###\n",
+		(double)(sv.buf_pos + sv.buf_n) / sv.rate,
+		sv.nspans, sv.nentries, wall);
+
+out:
+    if ( sv.plan )
+	fsk_fft_plan_put(sv.plan);
+    free(sv.window);
+    fftwf_free(sv.frame);
+    fftwf_free(sv.spectrum);
+    free(sv.power);
+    free(sv.span_power);
+    free(sv.smooth);
+    free(sv.sorted);
+    free(sv.buf);
+    return ret;
+}
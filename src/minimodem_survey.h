@@ -0,0 +1,39 @@
+/*
+ * minimodem_survey.h
+ *
+ * Copyright (C) 2011-2016 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MINIMODEM_SURVEY_H
+#define MINIMODEM_SURVEY_H
+
+#include "simpleaudio.h"
+#include "libminimodem.h"
+
+/*
+ * Catalog every FSK transmission in the (mono, float) stream sa, without
+ * knowing its tones or baud rate: each span of the stream holding a
+ * signal gets its mark, space, baud rate and framing estimated, and is
+ * then decoded with them.  Writes the catalog to stdout, a line per
+ * carrier: its time span, parameters, confidence and decoded text.  cfg
+ * supplies the receiver options other than those (e.g. the confidence
+ * threshold).  Returns the process exit status.
+ */
+int
+minimodem_survey_run( simpleaudio *sa, const minimodem_config *cfg,
+	int quiet_mode );
+
+#endif
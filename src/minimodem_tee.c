@@ -0,0 +1,296 @@
+/*
+ * minimodem_tee.c
+ *
+ * minimodem - software audio Bell-type or RTTY FSK modem
+ *
+ * Copyright (C) 2011-2016 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "simpleaudio.h"
+#include "minimodem_tee.h"
+
+
+#define TEE_CHUNK	8192		// samples per write
+
+struct minimodem_tee {
+	char		*path;
+	unsigned int	sample_rate;
+	size_t		max_file_nsamples;	// 0: no rotation
+
+	/* the buffer: the receiver adds at head, the writer takes at tail
+	 * (each only moves its own index, under lock) */
+	float		*ring;
+	size_t		ring_size;
+	size_t		head, tail;		// (free-running)
+	unsigned long long ndropped;
+
+	pthread_t	thread;
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	int		shutdown;
+
+	/* the writer's */
+	simpleaudio	*sa;
+	unsigned int	file_seq;
+	size_t		file_nsamples;
+	int		error;
+};
+
+
+/*
+ * The writer thread
+ */
+
+/* path, numbered if the archive rotates */
+static char *
+tee_file_path( minimodem_tee *tee )
+{
+    size_t len = strlen(tee->path) + 16;
+    char *path = malloc(len);
+    if ( !path )
+	return NULL;
+    if ( !tee->max_file_nsamples ) {
+	strcpy(path, tee->path);
+	return path;
+    }
+    const char *ext = strrchr(tee->path, '.');
+    if ( !ext || strchr(ext, '/') )
+	ext = tee->path + strlen(tee->path);
+    snprintf(path, len, "%.*s-%u%s", (int)(ext - tee->path), tee->path,
+	    tee->file_seq, ext);
+    return path;
+}
+
+static int
+tee_open_file( minimodem_tee *tee )
+{
+    tee->file_seq++;
+    tee->file_nsamples = 0;
+    char *path = tee_file_path(tee);
+    if ( !path ) {
+	perror("malloc");
+	return -1;
+    }
+    tee->sa = simpleaudio_open_stream(SA_BACKEND_FILE, NULL,
+				SA_STREAM_PLAYBACK, SA_SAMPLE_FORMAT_S16,
+				tee->sample_rate, 1, "minimodem", path);
+    free(path);
+    return tee->sa ? 0 : -1;
+}
+
+static void
+tee_write( minimodem_tee *tee, const float *samples, size_t nsamples )
+{
+    short buf[TEE_CHUNK];
+
+    while ( nsamples && !tee->error ) {
+	if ( tee->sa && tee->max_file_nsamples
+		&& tee->file_nsamples == tee->max_file_nsamples ) {
+	    simpleaudio_close(tee->sa);
+	    tee->sa = NULL;
+	}
+	if ( !tee->sa && tee_open_file(tee) < 0 ) {
+	    tee->error = 1;
+	    break;
+	}
+
+	size_t n = nsamples < TEE_CHUNK ? nsamples : TEE_CHUNK;
+	if ( tee->max_file_nsamples
+		&& n > tee->max_file_nsamples - tee->file_nsamples )
+	    n = tee->max_file_nsamples - tee->file_nsamples;
+	// (the inverse of how 16-bit captures are read, so they are
+	// archived exactly)
+	size_t i;
+	for ( i=0; i<n; i++ ) {
+	    float v = samples[i] * 32768.0f;
+	    buf[i] = v > 32767.0f ? 32767 : v < -32768.0f ? -32768
+		    : (short)lrintf(v);
+	}
+	if ( simpleaudio_write(tee->sa, buf, n) != (ssize_t)n ) {
+	    fprintf(stderr, "E: --tee: write failed\n");
+	    tee->error = 1;
+	    break;
+	}
+	tee->file_nsamples += n;
+	samples += n;
+	nsamples -= n;
+    }
+}
+
+static void *
+tee_thread( void *arg )
+{
+    minimodem_tee *tee = arg;
+
+    pthread_mutex_lock(&tee->lock);
+    while ( 1 ) {
+	while ( tee->head == tee->tail && !tee->shutdown )
+	    pthread_cond_wait(&tee->cond, &tee->lock);
+	size_t tail = tee->tail;
+	size_t n = tee->head - tail;
+	if ( n == 0 )
+	    break;		// (shut down, with nothing left to write)
+	pthread_mutex_unlock(&tee->lock);
+
+	// the contiguous part of it, at most
+	size_t i = tail % tee->ring_size;
+	if ( n > tee->ring_size - i )
+	    n = tee->ring_size - i;
+	tee_write(tee, tee->ring + i, n);
+
+	pthread_mutex_lock(&tee->lock);
+	tee->tail = tail + n;
+    }
+    pthread_mutex_unlock(&tee->lock);
+    return NULL;
+}
+
+
+void
+minimodem_tee_samples( minimodem_tee *tee,
+	const float *samples, size_t nsamples )
+{
+    pthread_mutex_lock(&tee->lock);
+    size_t head = tee->head;
+    size_t nfree = tee->ring_size - (head - tee->tail);
+    pthread_mutex_unlock(&tee->lock);
+
+    if ( nsamples > nfree ) {
+	tee->ndropped += nsamples - nfree;
+	nsamples = nfree;
+    }
+    size_t i = head % tee->ring_size;
+    size_t n1 = nsamples < tee->ring_size - i ? nsamples : tee->ring_size - i;
+    memcpy(tee->ring + i, samples, n1 * sizeof(float));
+    memcpy(tee->ring, samples + n1, (nsamples - n1) * sizeof(float));
+
+    pthread_mutex_lock(&tee->lock);
+    tee->head = head + nsamples;
+    pthread_cond_signal(&tee->cond);
+    pthread_mutex_unlock(&tee->lock);
+}
+
+minimodem_tee *
+minimodem_tee_new( const char *spec, unsigned int sample_rate )
+{
+    float max_mb = 0.0f, max_sec = 0.0f;
+
+    minimodem_tee *tee = calloc(1, sizeof(*tee));
+    char *opts = tee ? strdup(spec) : NULL;
+    if ( !opts ) {
+	perror("malloc");
+	free(tee);
+	return NULL;
+    }
+
+    char *saveptr, *key;
+    char *path = strtok_r(opts, ",", &saveptr);
+    if ( !path ) {
+	fprintf(stderr, "E: --tee takes a {path}\n");
+	goto fail;
+    }
+    tee->path = strdup(path);
+    while ( (key = strtok_r(NULL, ",", &saveptr)) ) {
+	char *value = strchr(key, '=');
+	if ( value )
+	    *value++ = 0;
+	if ( value && strcmp(key, "size") == 0 ) {
+	    max_mb = atof(value);
+	    if ( max_mb > 0.0f )
+		continue;
+	} else if ( value && strcmp(key, "time") == 0 ) {
+	    max_sec = atof(value);
+	    if ( max_sec > 0.0f )
+		continue;
+	}
+	fprintf(stderr, "E: --tee: bad option '%s%s%s'\n",
+		key, value ? "=" : "", value ? value : "");
+	goto fail;
+    }
+
+    tee->sample_rate = sample_rate;
+    if ( max_mb > 0.0f )
+	tee->max_file_nsamples = max_mb * 1000000 / sizeof(short);
+    if ( max_sec > 0.0f && (!tee->max_file_nsamples
+		|| max_sec * sample_rate < tee->max_file_nsamples) )
+	tee->max_file_nsamples = max_sec * sample_rate;
+    if ( (max_mb > 0.0f || max_sec > 0.0f) && !tee->max_file_nsamples )
+	tee->max_file_nsamples = 1;
+    tee->ring_size = (size_t)MINIMODEM_TEE_BUFFER_SECONDS * sample_rate;
+    tee->ring = malloc(tee->ring_size * sizeof(float));
+    if ( !tee->path || !tee->ring ) {
+	perror("malloc");
+	goto fail;
+    }
+
+    // open the (first) file now, to fail early
+    if ( tee_open_file(tee) < 0 )
+	goto fail;
+
+    pthread_mutex_init(&tee->lock, NULL);
+    pthread_cond_init(&tee->cond, NULL);
+    if ( pthread_create(&tee->thread, NULL, tee_thread, tee) != 0 ) {
+	perror("pthread_create");
+	pthread_mutex_destroy(&tee->lock);
+	pthread_cond_destroy(&tee->cond);
+	simpleaudio_close(tee->sa);
+	goto fail;
+    }
+
+    free(opts);
+    return tee;
+
+fail:
+    free(opts);
+    free(tee->path);
+    free(tee->ring);
+    free(tee);
+    return NULL;
+}
+
+int
+minimodem_tee_destroy( minimodem_tee *tee )
+{
+    pthread_mutex_lock(&tee->lock);
+    tee->shutdown = 1;
+    pthread_cond_signal(&tee->cond);
+    pthread_mutex_unlock(&tee->lock);
+    pthread_join(tee->thread, NULL);
+
+    if ( tee->sa )
+	simpleaudio_close(tee->sa);
+    if ( tee->ndropped )
+	fprintf(stderr, "W: --tee fell behind, and dropped %llu samples\n",
+		tee->ndropped);
+
+    int ret = tee->error ? -1 : 0;
+    pthread_mutex_destroy(&tee->lock);
+    pthread_cond_destroy(&tee->cond);
+    free(tee->path);
+    free(tee->ring);
+    free(tee);
+    return ret;
+}
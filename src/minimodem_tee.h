@@ -0,0 +1,61 @@
+/*
+ * minimodem_tee.h
+ *
+ * Copyright (C) 2011-2016 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MINIMODEM_TEE_H
+#define MINIMODEM_TEE_H
+
+#include <stddef.h>
+
+/*
+ * Capture tee: archives a receiver's input samples to audio files (of
+ * 16-bit samples, in the format of the path's extension, e.g. .flac or
+ * .wav) while it decodes them.  The receiver only copies its samples
+ * into a buffer; a thread of the tee's own writes them out, so a slow
+ * disk never holds up decoding.  If the writer falls more than
+ * MINIMODEM_TEE_BUFFER_SECONDS behind, samples are dropped (and counted)
+ * instead.
+ *
+ * spec is "{path}[,size={megabytes}][,time={seconds}]".  With either
+ * limit, the archive rotates to a new file whenever the current one
+ * would exceed it, and the files are numbered: "{path}" with "-{n}"
+ * (from 1) before its extension.
+ */
+
+#define MINIMODEM_TEE_BUFFER_SECONDS	10
+
+typedef struct minimodem_tee minimodem_tee;
+
+/* Returns NULL on an error (reported on stderr). */
+minimodem_tee *
+minimodem_tee_new( const char *spec, unsigned int sample_rate );
+
+/* the receiver's samples (see minimodem_rx_samples_fn) */
+void
+minimodem_tee_samples( minimodem_tee *tee,
+	const float *samples, size_t nsamples );
+
+/*
+ * Writes out what is still buffered, closes the archive and frees tee,
+ * noting any samples dropped on stderr.  Returns -1 if any of the
+ * archive could not be written.
+ */
+int
+minimodem_tee_destroy( minimodem_tee *tee );
+
+#endif
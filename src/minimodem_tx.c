@@ -0,0 +1,380 @@
+/*
+ * minimodem_tx.c
+ *
+ * minimodem - software audio Bell-type or RTTY FSK modem
+ *
+ * Copyright (C) 2011-2016 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "libminimodem.h"
+
+
+struct minimodem_tx {
+	minimodem_config	cfg;
+	simpleaudio		*sa_out;
+	size_t			bit_nsamples;
+	databits_state		dbs;
+
+	// 0: idle  1: transmitting (leader sent)  2: sync bytes sent
+	volatile int		transmitting;
+
+	/* render (pull-style) contexts only */
+	float			sample_rate;
+	float			tone_mag;
+	float			tone_cphase;	// turns
+	char			*queue;		// ring buffer
+	size_t			queue_size;
+	size_t			queue_head;
+	size_t			queue_len;
+	int			ending;
+	unsigned int		sync_nframes;	// sync bytes still to send
+	unsigned int		words[2];
+	unsigned int		nwords;
+	unsigned int		word_next;
+	// the tones of the frame being rendered: start + data + stop
+	struct tx_segment {
+	    float		freq;
+	    size_t		nsamples;
+	}			segs[2+32];
+	unsigned int		nsegs;
+	unsigned int		seg_next;
+};
+
+
+minimodem_tx *
+minimodem_tx_new( const minimodem_config *cfg, simpleaudio *sa_out )
+{
+    minimodem_tx *tx = calloc(1, sizeof(minimodem_tx));
+    if ( !tx )
+	return NULL;
+    tx->cfg = *cfg;
+    tx->sa_out = sa_out;
+    size_t sample_rate = simpleaudio_get_rate(sa_out);
+    tx->bit_nsamples = sample_rate / cfg->bfsk_data_rate + 0.5f;
+    return tx;
+}
+
+minimodem_tx *
+minimodem_tx_new_render( const minimodem_config *cfg,
+	size_t queue_size, float mag )
+{
+    assert( queue_size > 0 );
+    minimodem_tx *tx = calloc(1, sizeof(minimodem_tx));
+    if ( !tx )
+	return NULL;
+    tx->queue = malloc(queue_size);
+    if ( !tx->queue ) {
+	free(tx);
+	return NULL;
+    }
+    tx->cfg = *cfg;
+    tx->sample_rate = cfg->sample_rate;
+    tx->bit_nsamples = tx->sample_rate / cfg->bfsk_data_rate + 0.5f;
+    tx->tone_mag = mag;
+    tx->queue_size = queue_size;
+    return tx;
+}
+
+void
+minimodem_tx_destroy( minimodem_tx *tx )
+{
+    free(tx->queue);
+    free(tx);
+}
+
+int
+minimodem_tx_transmitting( minimodem_tx *tx )
+{
+    if ( !tx->sa_out && tx->seg_next < tx->nsegs )
+	return 1;	// render context: the trailer is still pending
+    return tx->transmitting;
+}
+
+
+/*
+ * rudimentary BFSK transmitter
+ */
+
+static void fsk_transmit_frame(
+	simpleaudio *sa_out,
+	unsigned int bits,
+	unsigned int n_data_bits,
+	size_t bit_nsamples,
+	float bfsk_mark_f,
+	float bfsk_space_f,
+	float bfsk_nstartbits,
+	float bfsk_nstopbits,
+	int invert_start_stop,
+	int bfsk_msb_first
+	)
+{
+    int i;
+    if ( bfsk_nstartbits > 0 )
+	simpleaudio_tone(sa_out, invert_start_stop ? bfsk_mark_f : bfsk_space_f,
+			bit_nsamples * bfsk_nstartbits);	// start
+    for ( i=0; i<n_data_bits; i++ ) {				// data
+	unsigned int bit;
+	if (bfsk_msb_first) {
+		bit = ( bits >> (n_data_bits - i - 1) ) & 1;
+	} else {
+		bit = ( bits >> i ) & 1;
+	}
+
+	float tone_freq = bit == 1 ? bfsk_mark_f : bfsk_space_f;
+	simpleaudio_tone(sa_out, tone_freq, bit_nsamples);
+    }
+    if ( bfsk_nstopbits > 0 )
+	simpleaudio_tone(sa_out, invert_start_stop ? bfsk_space_f : bfsk_mark_f,
+			bit_nsamples * bfsk_nstopbits);		// stop
+}
+
+void
+minimodem_tx_write( minimodem_tx *tx, const char *buf, size_t nbytes )
+{
+    minimodem_config *cfg = &tx->cfg;
+    float idle_f = cfg->invert_start_stop ? cfg->bfsk_space_f
+					  : cfg->bfsk_mark_f;
+    size_t n;
+    for ( n=0; n<nbytes; n++ ) {
+	unsigned int nwords;
+	unsigned int bits[2];
+	unsigned int j;
+	nwords = cfg->bfsk_databits_encode(&tx->dbs, bits, buf[n]);
+
+	if ( !tx->transmitting )
+	{
+	    tx->transmitting = 1;
+	    /* emit leader tone (mark) */
+	    for ( j=0; j<cfg->tx_leader_bits_len; j++ )
+		simpleaudio_tone(tx->sa_out, idle_f, tx->bit_nsamples);
+	}
+	if ( tx->transmitting < 2)
+	{
+	    tx->transmitting = 2;
+	    /* emit "preamble" of sync bytes */
+	    for ( j=0; j<cfg->bfsk_do_tx_sync_bytes; j++ )
+		fsk_transmit_frame(tx->sa_out, cfg->bfsk_sync_byte,
+			cfg->bfsk_n_data_bits, tx->bit_nsamples,
+			cfg->bfsk_mark_f, cfg->bfsk_space_f,
+			cfg->bfsk_nstartbits, cfg->bfsk_nstopbits,
+			cfg->invert_start_stop, 0);
+	}
+
+	/* emit data bits */
+	for ( j=0; j<nwords; j++ )
+	    fsk_transmit_frame(tx->sa_out, bits[j],
+			cfg->bfsk_n_data_bits, tx->bit_nsamples,
+			cfg->bfsk_mark_f, cfg->bfsk_space_f,
+			cfg->bfsk_nstartbits, cfg->bfsk_nstopbits,
+			cfg->invert_start_stop, cfg->bfsk_msb_first);
+    }
+}
+
+void
+minimodem_tx_idle( minimodem_tx *tx, size_t nsamples )
+{
+    minimodem_config *cfg = &tx->cfg;
+    tx->transmitting = 1;
+    /* emit idle tone (mark) */
+    simpleaudio_tone(tx->sa_out,
+	    cfg->invert_start_stop ? cfg->bfsk_space_f : cfg->bfsk_mark_f,
+	    nsamples);
+}
+
+void
+minimodem_tx_stop( minimodem_tx *tx, size_t flush_nsamples )
+{
+    if ( !tx->sa_out ) {
+	// render context: end after the queue drains
+	if ( tx->transmitting || tx->queue_len )
+	    tx->ending = 1;
+	return;
+    }
+
+    int j;
+    for ( j=0; j<tx->cfg.tx_trailer_bits_len; j++ )
+	simpleaudio_tone(tx->sa_out, tx->cfg.bfsk_mark_f, tx->bit_nsamples);
+
+    if ( flush_nsamples )
+	simpleaudio_tone(tx->sa_out, 0, flush_nsamples);
+
+    tx->transmitting = 0;
+}
+
+
+/*
+ * Pull-style rendering
+ *
+ * The same framing as minimodem_tx_write() and friends, but kept as a
+ * list of tone segments for one frame at a time, so that rendering can
+ * stop and resume at any sample.
+ */
+
+size_t
+minimodem_tx_queue( minimodem_tx *tx, const char *buf, size_t nbytes )
+{
+    size_t n;
+    for ( n=0; n<nbytes && tx->queue_len<tx->queue_size; n++ ) {
+	size_t tail = (tx->queue_head + tx->queue_len) % tx->queue_size;
+	tx->queue[tail] = buf[n];
+	tx->queue_len++;
+    }
+    return n;
+}
+
+static void
+tx_render_push_segment( minimodem_tx *tx, float freq, size_t nsamples )
+{
+    if ( nsamples == 0 )
+	return;
+    assert( tx->nsegs < sizeof(tx->segs)/sizeof(tx->segs[0]) );
+    tx->segs[tx->nsegs].freq = freq;
+    tx->segs[tx->nsegs].nsamples = nsamples;
+    tx->nsegs++;
+}
+
+/* cf. fsk_transmit_frame() */
+static void
+tx_render_push_frame( minimodem_tx *tx, unsigned int bits, int msb_first )
+{
+    minimodem_config *cfg = &tx->cfg;
+    unsigned int n_data_bits = cfg->bfsk_n_data_bits;
+    int i;
+    if ( cfg->bfsk_nstartbits > 0 )
+	tx_render_push_segment(tx,
+		cfg->invert_start_stop ? cfg->bfsk_mark_f : cfg->bfsk_space_f,
+		tx->bit_nsamples * (float)cfg->bfsk_nstartbits);	// start
+    for ( i=0; i<n_data_bits; i++ ) {				// data
+	unsigned int bit;
+	if ( msb_first )
+	    bit = ( bits >> (n_data_bits - i - 1) ) & 1;
+	else
+	    bit = ( bits >> i ) & 1;
+	tx_render_push_segment(tx,
+		bit == 1 ? cfg->bfsk_mark_f : cfg->bfsk_space_f,
+		tx->bit_nsamples);
+    }
+    if ( cfg->bfsk_nstopbits > 0 )
+	tx_render_push_segment(tx,
+		cfg->invert_start_stop ? cfg->bfsk_space_f : cfg->bfsk_mark_f,
+		tx->bit_nsamples * cfg->bfsk_nstopbits);		// stop
+}
+
+/*
+ * Refill the segment list.  Returns 0 if there is nothing to send.
+ */
+static int
+tx_render_next( minimodem_tx *tx )
+{
+    minimodem_config *cfg = &tx->cfg;
+    float idle_f = cfg->invert_start_stop ? cfg->bfsk_space_f
+					  : cfg->bfsk_mark_f;
+
+    tx->nsegs = 0;
+    tx->seg_next = 0;
+
+    if ( tx->sync_nframes ) {
+	/* "preamble" of sync bytes */
+	tx->sync_nframes--;
+	tx_render_push_frame(tx, cfg->bfsk_sync_byte, 0);
+	return 1;
+    }
+
+    if ( tx->word_next < tx->nwords ) {
+	/* data bits */
+	tx_render_push_frame(tx, tx->words[tx->word_next++],
+				cfg->bfsk_msb_first);
+	return 1;
+    }
+
+    if ( tx->queue_len ) {
+	char c = tx->queue[tx->queue_head];
+	tx->queue_head = (tx->queue_head + 1) % tx->queue_size;
+	tx->queue_len--;
+	tx->nwords = cfg->bfsk_databits_encode(&tx->dbs, tx->words, c);
+	tx->word_next = 0;
+
+	if ( !tx->transmitting ) {
+	    tx->transmitting = 1;
+	    /* leader tone (mark) */
+	    tx_render_push_segment(tx, idle_f,
+		    tx->bit_nsamples * cfg->tx_leader_bits_len);
+	}
+	if ( tx->transmitting < 2 ) {
+	    tx->transmitting = 2;
+	    tx->sync_nframes = cfg->bfsk_do_tx_sync_bytes;
+	}
+	return 1;
+    }
+
+    if ( !tx->transmitting ) {
+	tx->ending = 0;
+	return 0;
+    }
+
+    if ( tx->ending ) {
+	/* trailer */
+	tx_render_push_segment(tx, cfg->bfsk_mark_f,
+		tx->bit_nsamples * cfg->tx_trailer_bits_len);
+	tx->transmitting = 0;
+	tx->ending = 0;
+	return 1;
+    }
+
+    /* idle tone (mark), until more data is queued */
+    tx_render_push_segment(tx, idle_f, tx->bit_nsamples);
+    return 1;
+}
+
+void
+minimodem_tx_render( minimodem_tx *tx, float *samples, size_t nsamples )
+{
+    assert( !tx->sa_out );
+
+    while ( nsamples ) {
+	if ( tx->seg_next == tx->nsegs ) {
+	    if ( !tx_render_next(tx) ) {
+		// idle: silence
+		memset(samples, 0, nsamples * sizeof(float));
+		tx->tone_cphase = 0.0f;
+		return;
+	    }
+	    continue;
+	}
+
+	struct tx_segment *seg = &tx->segs[tx->seg_next];
+	size_t n = seg->nsamples < nsamples ? seg->nsamples : nsamples;
+
+	// continuous phase, as in simpleaudio_tone()
+	float wave_nsamples = tx->sample_rate / seg->freq;
+	size_t i;
+	for ( i=0; i<n; i++ )
+	    samples[i] = tx->tone_mag * sinf( (float)M_PI*2
+			* ((float)i/wave_nsamples + tx->tone_cphase) );
+	tx->tone_cphase = fmodf(tx->tone_cphase + (float)n/wave_nsamples, 1.0);
+
+	samples += n;
+	nsamples -= n;
+	seg->nsamples -= n;
+	if ( seg->nsamples == 0 )
+	    tx->seg_next++;
+    }
+}
@@ -25,48 +25,43 @@
 #include <stdio.h>
 
 #include "simpleaudio.h"
+#include "simpleaudio_internal.h"
 
 
-
-static float tone_mag = 1.0;
-
-static unsigned int sin_table_len;
-static short *sin_table_short;
-static float *sin_table_float;
-
 void
-simpleaudio_tone_init( unsigned int new_sin_table_len, float mag )
+simpleaudio_tone_init( simpleaudio *sa_out,
+		unsigned int new_sin_table_len, float mag )
 {
-    sin_table_len = new_sin_table_len;
-    tone_mag = mag;
+    sa_out->sin_table_len = new_sin_table_len;
+    sa_out->tone_mag = mag;
 
-    if ( sin_table_len != 0 ) {
-	sin_table_short = realloc(sin_table_short, sin_table_len * sizeof(short));
-	sin_table_float = realloc(sin_table_float, sin_table_len * sizeof(float));
-	if ( !sin_table_short || !sin_table_float ) {
+    if ( sa_out->sin_table_len != 0 ) {
+	sa_out->sin_table_short = realloc(sa_out->sin_table_short, sa_out->sin_table_len * sizeof(short));
+	sa_out->sin_table_float = realloc(sa_out->sin_table_float, sa_out->sin_table_len * sizeof(float));
+	if ( !sa_out->sin_table_short || !sa_out->sin_table_float ) {
 	    perror("malloc");
 	    assert(0);
 	}
 
 	unsigned int i;
-	unsigned short mag_s = 32767.0f * tone_mag + 0.5f;
-	if ( tone_mag > 1.0f ) // clamp to 1.0 to avoid overflow
+	unsigned short mag_s = 32767.0f * sa_out->tone_mag + 0.5f;
+	if ( sa_out->tone_mag > 1.0f ) // clamp to 1.0 to avoid overflow
 	    mag_s = 32767;
 	if ( mag_s < 1 ) // "short epsilon"
 	    mag_s = 1;
-	for ( i=0; i<sin_table_len; i++ )
-	    sin_table_short[i] = lroundf( mag_s * sinf((float)M_PI*2*i/sin_table_len) );
-	for ( i=0; i<sin_table_len; i++ )
-	    sin_table_float[i] = tone_mag * sinf((float)M_PI*2*i/sin_table_len);
+	for ( i=0; i<sa_out->sin_table_len; i++ )
+	    sa_out->sin_table_short[i] = lroundf( mag_s * sinf((float)M_PI*2*i/sa_out->sin_table_len) );
+	for ( i=0; i<sa_out->sin_table_len; i++ )
+	    sa_out->sin_table_float[i] = sa_out->tone_mag * sinf((float)M_PI*2*i/sa_out->sin_table_len);
 
     } else {
-	if ( sin_table_short ) {
-	    free(sin_table_short);
-	    sin_table_short = NULL;
+	if ( sa_out->sin_table_short ) {
+	    free(sa_out->sin_table_short);
+	    sa_out->sin_table_short = NULL;
 	}
-	if ( sin_table_float ) {
-	    free(sin_table_float);
-	    sin_table_float = NULL;
+	if ( sa_out->sin_table_float ) {
+	    free(sa_out->sin_table_float);
+	    sa_out->sin_table_float = NULL;
 	}
     }
 }
@@ -75,32 +70,29 @@ simpleaudio_tone_init( unsigned int new_sin_table_len, float mag )
  * in: turns (0.0 to 1.0)    out: (-32767 to +32767)
  */
 static inline short
-sin_lu_short( float turns )
+sin_lu_short( simpleaudio *sa_out, float turns )
 {
-    int t = (float)sin_table_len * turns + 0.5f;
-    t %= sin_table_len;
-    return sin_table_short[t];
+    int t = (float)sa_out->sin_table_len * turns + 0.5f;
+    t %= sa_out->sin_table_len;
+    return sa_out->sin_table_short[t];
 }
 
 /*
  * in: turns (0.0 to 1.0)    out: -1.0 to +1.0
  */
 static inline float
-sin_lu_float( float turns )
+sin_lu_float( simpleaudio *sa_out, float turns )
 {
-    int t = (float)sin_table_len * turns + 0.5f;
-    t %= sin_table_len;
-    return sin_table_float[t];
+    int t = (float)sa_out->sin_table_len * turns + 0.5f;
+    t %= sa_out->sin_table_len;
+    return sa_out->sin_table_float[t];
 }
 
 
-/* "current" phase state of the tone generator */
-static float sa_tone_cphase = 0.0;
-
 void
-simpleaudio_tone_reset()
+simpleaudio_tone_reset( simpleaudio *sa_out )
 {
-    sa_tone_cphase = 0.0;
+    sa_out->tone_cphase = 0.0;
 }
 
 void
@@ -118,7 +110,7 @@ simpleaudio_tone(simpleaudio *sa_out, float tone_freq, size_t nsamples_dur)
 
 #define TURNS_TO_RADIANS(t)	( (float)M_PI*2 * (t) )
 
-#define SINE_PHASE_TURNS	( (float)i/wave_nsamples + sa_tone_cphase )
+#define SINE_PHASE_TURNS	( (float)i/wave_nsamples + sa_out->tone_cphase )
 #define SINE_PHASE_RADIANS	TURNS_TO_RADIANS(SINE_PHASE_TURNS)
 
 	switch ( simpleaudio_get_format(sa_out) ) {
@@ -126,12 +118,12 @@ simpleaudio_tone(simpleaudio *sa_out, float tone_freq, size_t nsamples_dur)
 	    case SA_SAMPLE_FORMAT_FLOAT:
 		{
 		    float *float_buf = buf;
-		    if ( sin_table_float ) {
+		    if ( sa_out->sin_table_float ) {
 			for ( i=0; i<nsamples_dur; i++ )
-			    float_buf[i] = sin_lu_float(SINE_PHASE_TURNS);
+			    float_buf[i] = sin_lu_float(sa_out, SINE_PHASE_TURNS);
 		    } else {
 			for ( i=0; i<nsamples_dur; i++ )
-			    float_buf[i] = tone_mag * sinf(SINE_PHASE_RADIANS);
+			    float_buf[i] = sa_out->tone_mag * sinf(SINE_PHASE_RADIANS);
 		    }
 		}
 		break;
@@ -139,12 +131,12 @@ simpleaudio_tone(simpleaudio *sa_out, float tone_freq, size_t nsamples_dur)
 	    case SA_SAMPLE_FORMAT_S16:
 		{
 		    short *short_buf = buf;
-		    if ( sin_table_short ) {
+		    if ( sa_out->sin_table_short ) {
 			for ( i=0; i<nsamples_dur; i++ )
-			    short_buf[i] = sin_lu_short(SINE_PHASE_TURNS);
+			    short_buf[i] = sin_lu_short(sa_out, SINE_PHASE_TURNS);
 		    } else {
-			unsigned short mag_s = 32767.0f * tone_mag + 0.5f;
-			if ( tone_mag > 1.0f ) // clamp to 1.0 to avoid overflow
+			unsigned short mag_s = 32767.0f * sa_out->tone_mag + 0.5f;
+			if ( sa_out->tone_mag > 1.0f ) // clamp to 1.0 to avoid overflow
 			    mag_s = 32767;
 			if ( mag_s < 1 ) // "short epsilon"
 			    mag_s = 1;
@@ -159,13 +151,13 @@ simpleaudio_tone(simpleaudio *sa_out, float tone_freq, size_t nsamples_dur)
 		break;
 	}
 
-	sa_tone_cphase
-	    = fmodf(sa_tone_cphase + (float)nsamples_dur/wave_nsamples, 1.0);
+	sa_out->tone_cphase
+	    = fmodf(sa_out->tone_cphase + (float)nsamples_dur/wave_nsamples, 1.0);
 
     } else {
 
 	bzero(buf, nsamples_dur * framesize);
-	sa_tone_cphase = 0.0;
+	sa_out->tone_cphase = 0.0;
 
     }
 
@@ -94,6 +94,34 @@ sa_alsa_write( simpleaudio *sa, void *buf, size_t nframes )
 }
 
 
+static int
+sa_alsa_backlog( simpleaudio *sa,
+		size_t *backlog_nframesp, size_t *capacity_nframesp )
+{
+    snd_pcm_t *pcm = (snd_pcm_t *)sa->backend_handle;
+    snd_pcm_sframes_t avail = snd_pcm_avail(pcm);
+    if ( avail < 0 )
+	return 0;
+    snd_pcm_uframes_t buffer_size, period_size;
+    if ( snd_pcm_get_params(pcm, &buffer_size, &period_size) < 0 )
+	buffer_size = 0;
+    *backlog_nframesp = avail;
+    *capacity_nframesp = buffer_size;
+    return 1;
+}
+
+
+static int
+sa_alsa_pollfd( simpleaudio *sa )
+{
+    snd_pcm_t *pcm = (snd_pcm_t *)sa->backend_handle;
+    struct pollfd pfd;
+    if ( snd_pcm_poll_descriptors(pcm, &pfd, 1) != 1 )
+	return -1;
+    return pfd.fd;
+}
+
+
 static void
 sa_alsa_close( simpleaudio *sa )
 {
@@ -194,6 +222,9 @@ const struct simpleaudio_backend simpleaudio_backend_alsa = {
     sa_alsa_read,
     sa_alsa_write,
     sa_alsa_close,
+    sa_alsa_backlog,
+    sa_alsa_pollfd,
+    NULL /* seek */,
 };
 
 #endif /* USE_ALSA */
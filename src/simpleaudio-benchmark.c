@@ -112,6 +112,9 @@ const struct simpleaudio_backend simpleaudio_backend_benchmark = {
     sa_benchmark_dummy_readwrite /* read */,
     sa_benchmark_dummy_readwrite /* write */,
     sa_benchmark_close,
+    NULL /* backlog */,
+    NULL /* pollfd */,
+    NULL /* seek */,
 };
 
 #endif /* USE_BENCHMARKS */
@@ -0,0 +1,283 @@
+/*
+ * simpleaudio-iq.c
+ *
+ * Copyright (C) 2011-2016 Kamal Mostafa <kamal@whence.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "simpleaudio.h"
+#include "simpleaudio_internal.h"
+
+
+/*
+ * complex I/Q input backend for simpleaudio
+ *
+ * A digital down-converter: the I/Q samples are mixed by a numerically
+ * controlled oscillator so that the wanted band sits around 0 Hz, low-pass
+ * filtered to a quarter of the output rate either side and decimated in
+ * one FIR (only the kept outputs are computed), then shifted up by a
+ * quarter of the output rate, whose real part is the audio.  Frequencies
+ * from iq_offset_f - audio_f up to half the output rate above that come
+ * out as audio from 0 Hz, iq_offset_f at audio_f.  The same distance
+ * below that window is their image, which the FIR has to stop: taking
+ * the real part would fold it onto the same audio.
+ */
+
+#define IQ_CHUNK_NPAIRS		4096
+#define IQ_FIR_SPAN		128	// output samples per FIR length
+
+struct iq_data {
+    FILE		*f;
+    sa_format_t		iq_format;
+    void		*raw;			// [IQ_CHUNK_NPAIRS] pairs
+    size_t		raw_npairs, raw_pos;
+
+    unsigned int	decimate;
+    unsigned int	ntaps;
+    float		*taps;			// [ntaps]
+    float		*hist_i, *hist_q;	// [2 * ntaps], each sample
+    unsigned int	hist_pos;		//   stored twice
+    unsigned int	phase;			// input samples since output
+
+    float		nco_re, nco_im;		// the mixer's phasor
+    float		nco_step_re, nco_step_im;
+    unsigned int	nco_count;
+    unsigned int	out_count;		// (for the rate/4 shift)
+};
+
+
+/* the next I/Q input pair, or 0 at the end of the stream */
+static int
+iq_next_pair( struct iq_data *d, float *ip, float *qp )
+{
+    if ( d->raw_pos == d->raw_npairs ) {
+	d->raw_npairs = fread(d->raw,
+		d->iq_format == SA_SAMPLE_FORMAT_FLOAT
+			? 2 * sizeof(float) : 2 * sizeof(short),
+		IQ_CHUNK_NPAIRS, d->f);
+	d->raw_pos = 0;
+	if ( d->raw_npairs == 0 )
+	    return 0;
+    }
+    if ( d->iq_format == SA_SAMPLE_FORMAT_FLOAT ) {
+	const float *p = (const float *)d->raw + 2 * d->raw_pos;
+	*ip = p[0];
+	*qp = p[1];
+    } else {
+	const short *p = (const short *)d->raw + 2 * d->raw_pos;
+	*ip = p[0] * (1.0f / 32768);
+	*qp = p[1] * (1.0f / 32768);
+    }
+    d->raw_pos++;
+    return 1;
+}
+
+static float
+iq_fir( struct iq_data *d )
+{
+    const float *hi = d->hist_i + d->hist_pos;
+    const float *hq = d->hist_q + d->hist_pos;
+    float acc_i = 0.0f, acc_q = 0.0f;
+    unsigned int k;
+    for ( k=0; k<d->ntaps; k++ ) {
+	acc_i += d->taps[k] * hi[k];
+	acc_q += d->taps[k] * hq[k];
+    }
+
+    // shift up by a quarter of the rate (multiply by j^n), take the real
+    float out;
+    switch ( d->out_count++ & 3 ) {
+	case 0:	 out = acc_i;  break;
+	case 1:	 out = -acc_q; break;
+	case 2:	 out = -acc_i; break;
+	default: out = acc_q;  break;
+    }
+    return out;
+}
+
+static ssize_t
+sa_iq_read( simpleaudio *sa, void *buf, size_t nframes )
+{
+    struct iq_data *d = sa->backend_handle;
+    size_t n = 0;
+
+    while ( n < nframes ) {
+	float i, q;
+	if ( !iq_next_pair(d, &i, &q) ) {
+	    if ( ferror(d->f) ) {
+		perror("iq read");
+		return -1;
+	    }
+	    break;
+	}
+
+	// mix
+	float mi = i * d->nco_re - q * d->nco_im;
+	float mq = i * d->nco_im + q * d->nco_re;
+	float re = d->nco_re * d->nco_step_re - d->nco_im * d->nco_step_im;
+	float im = d->nco_re * d->nco_step_im + d->nco_im * d->nco_step_re;
+	if ( ++d->nco_count == 1024 ) {	// (keep the phasor's length 1)
+	    float mag = sqrtf(re * re + im * im);
+	    re /= mag;
+	    im /= mag;
+	    d->nco_count = 0;
+	}
+	d->nco_re = re;
+	d->nco_im = im;
+
+	// into the FIR's history, which is hist_pos .. hist_pos + ntaps - 1
+	d->hist_i[d->hist_pos] = d->hist_i[d->hist_pos + d->ntaps] = mi;
+	d->hist_q[d->hist_pos] = d->hist_q[d->hist_pos + d->ntaps] = mq;
+	d->hist_pos = (d->hist_pos + 1) % d->ntaps;
+
+	if ( ++d->phase < d->decimate )
+	    continue;
+	d->phase = 0;
+
+	float out = iq_fir(d);
+	if ( sa->format == SA_SAMPLE_FORMAT_FLOAT ) {
+	    ((float *)buf)[n++] = out;
+	} else {
+	    float s = out * 32767.0f;
+	    ((short *)buf)[n++] = s > 32767.0f ? 32767
+				: s < -32768.0f ? -32768 : (short)s;
+	}
+    }
+    return n;
+}
+
+static ssize_t
+sa_iq_write( simpleaudio *sa, void *buf, size_t nframes )
+{
+    return -1;
+}
+
+static void
+sa_iq_close( simpleaudio *sa )
+{
+    struct iq_data *d = sa->backend_handle;
+    if ( d->f && d->f != stdin )
+	fclose(d->f);
+    free(d->raw);
+    free(d->taps);
+    free(d->hist_i);
+    free(d->hist_q);
+    free(d);
+}
+
+static const struct simpleaudio_backend simpleaudio_backend_iq = {
+    NULL,		// (opened by simpleaudio_open_source_iq() only)
+    sa_iq_read,
+    sa_iq_write,
+    sa_iq_close,
+    NULL /* backlog */,
+    NULL /* pollfd */,
+    NULL /* seek */,
+};
+
+
+simpleaudio *
+simpleaudio_open_source_iq( const char *path,
+		sa_format_t iq_format, unsigned int iq_rate,
+		float iq_offset_f, float audio_f,
+		sa_format_t sa_format, unsigned int rate )
+{
+    simpleaudio *sa = calloc(1, sizeof(simpleaudio));
+    struct iq_data *d = calloc(1, sizeof(struct iq_data));
+    if ( !sa || !d ) {
+	perror("malloc");
+	free(sa);
+	free(d);
+	return NULL;
+    }
+
+    sa->backend = &simpleaudio_backend_iq;
+    sa->backend_handle = d;
+    sa->format = sa_format;
+    sa->channels = 1;
+    sa->samplesize = sa_format == SA_SAMPLE_FORMAT_FLOAT
+				? sizeof(float) : sizeof(short);
+    sa->backend_framesize = sa->samplesize;
+    sa->tone_mag = 1.0;
+
+    // the largest decimation leaving at least the asked-for rate
+    d->decimate = rate && iq_rate > rate ? iq_rate / rate : 1;
+    sa->rate = (iq_rate + d->decimate / 2) / d->decimate;
+
+    // A Blackman windowed sinc, cut off at a quarter of the output rate,
+    // at the input rate.  Its transition band is about 5.5 / IQ_FIR_SPAN
+    // of the output rate wide (2 kHz at 48000 Hz), so a tone more than
+    // half that far inside the window passes, and its image is stopped.
+    d->ntaps = IQ_FIR_SPAN * d->decimate + 1;
+    d->taps = malloc(d->ntaps * sizeof(float));
+    d->hist_i = calloc(2 * d->ntaps, sizeof(float));
+    d->hist_q = calloc(2 * d->ntaps, sizeof(float));
+    d->iq_format = iq_format;
+    d->raw = malloc(IQ_CHUNK_NPAIRS * 2 * (iq_format == SA_SAMPLE_FORMAT_FLOAT
+				? sizeof(float) : sizeof(short)));
+    if ( !d->taps || !d->hist_i || !d->hist_q || !d->raw ) {
+	perror("malloc");
+	goto err_out;
+    }
+
+    float fc = 0.25f / d->decimate;		// cycles per input sample
+    float mid = (d->ntaps - 1) / 2.0f;
+    float sum = 0.0f;
+    unsigned int k;
+    for ( k=0; k<d->ntaps; k++ ) {
+	float x = k - mid;
+	float sinc = x == 0.0f ? 2 * fc : sinf(2 * M_PI * fc * x) / (M_PI * x);
+	float w = 0.42f - 0.5f * cosf(2 * M_PI * k / (d->ntaps - 1))
+			+ 0.08f * cosf(4 * M_PI * k / (d->ntaps - 1));
+	d->taps[k] = sinc * w;
+	sum += d->taps[k];
+    }
+    for ( k=0; k<d->ntaps; k++ )
+	d->taps[k] /= sum;
+
+    // mix iq_offset_f down to audio_f less a quarter of the output rate
+    double nco_f = iq_offset_f - audio_f + (double)iq_rate / d->decimate / 4;
+    double step = -2 * M_PI * nco_f / iq_rate;
+    d->nco_re = 1.0f;
+    d->nco_im = 0.0f;
+    d->nco_step_re = cos(step);
+    d->nco_step_im = sin(step);
+
+    if ( strcmp(path, "-") == 0 ) {
+	d->f = stdin;
+    } else {
+	d->f = fopen(path, "rb");
+	if ( !d->f ) {
+	    perror(path);
+	    goto err_out;
+	}
+    }
+
+    return sa;
+
+err_out:
+    sa_iq_close(sa);
+    free(sa);
+    return NULL;
+}
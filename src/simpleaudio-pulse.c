@@ -72,6 +72,21 @@ sa_pulse_write( simpleaudio *sa, void *buf, size_t nframes )
 }
 
 
+static int
+sa_pulse_backlog( simpleaudio *sa,
+		size_t *backlog_nframesp, size_t *capacity_nframesp )
+{
+    int error;
+    pa_simple *s = (pa_simple *)sa->backend_handle;
+    pa_usec_t latency = pa_simple_get_latency(s, &error);
+    if ( latency == (pa_usec_t)-1 )
+	return 0;
+    *backlog_nframesp = latency * sa->rate / 1000000;
+    *capacity_nframesp = 0;	// the server's buffer; we can't know
+    return 1;
+}
+
+
 static void
 sa_pulse_close( simpleaudio *sa )
 {
@@ -153,6 +168,9 @@ const struct simpleaudio_backend simpleaudio_backend_pulseaudio = {
     sa_pulse_read,
     sa_pulse_write,
     sa_pulse_close,
+    sa_pulse_backlog,
+    NULL /* pollfd */,
+    NULL /* seek */,
 };
 
 #endif /* USE_PULSEAUDIO */
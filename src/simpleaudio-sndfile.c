@@ -107,6 +107,14 @@ sa_sndfile_close( simpleaudio *sa )
 }
 
 
+static int
+sa_sndfile_seek( simpleaudio *sa, unsigned long long pos )
+{
+    SNDFILE *s = (SNDFILE *)sa->backend_handle;
+    return sf_seek(s, (sf_count_t)pos, SEEK_SET) == (sf_count_t)pos;
+}
+
+
 /* (Why) doesn't libsndfile provide an API for this?... */
 static const struct sndfile_format {
     unsigned int major_format;
@@ -225,6 +233,9 @@ const struct simpleaudio_backend simpleaudio_backend_sndfile = {
     sa_sndfile_read,
     sa_sndfile_write,
     sa_sndfile_close,
+    NULL,
+    NULL,
+    sa_sndfile_seek,
 };
 
 #endif /* USE_SNDFILE */
@@ -49,6 +49,7 @@ simpleaudio_open_stream(
     sa->format = sa_format;
     sa->rate = rate;
     sa->channels = channels;
+    sa->tone_mag = 1.0;
 
     switch ( sa_format ) {
 	case SA_SAMPLE_FORMAT_FLOAT:
@@ -164,6 +165,13 @@ simpleaudio_set_rxnoise( simpleaudio *sa, float rxnoise_factor )
     sa->rxnoise = rxnoise_factor;
 }
 
+void
+simpleaudio_set_xbacklog( simpleaudio *sa, size_t backlog_nframes )
+{
+    sa->xbacklog_set = 1;
+    sa->xbacklog_nframes = backlog_nframes;
+}
+
 ssize_t
 simpleaudio_read( simpleaudio *sa, void *buf, size_t nframes )
 {
@@ -176,9 +184,45 @@ simpleaudio_write( simpleaudio *sa, void *buf, size_t nframes )
     return sa->backend->simpleaudio_write(sa, buf, nframes);
 }
 
+int
+simpleaudio_get_backlog( simpleaudio *sa,
+		size_t *backlog_nframesp, size_t *capacity_nframesp )
+{
+    if ( sa->xbacklog_set ) {
+	*backlog_nframesp = sa->xbacklog_nframes;
+	*capacity_nframesp = 0;
+	return 0;
+    }
+    if ( !sa->backend->simpleaudio_backlog )
+	return -1;
+    if ( !sa->backend->simpleaudio_backlog(sa,
+			backlog_nframesp, capacity_nframesp) )
+	return -1;
+    return 0;
+}
+
+int
+simpleaudio_get_pollfd( simpleaudio *sa )
+{
+    if ( !sa->backend->simpleaudio_pollfd )
+	return -1;
+    return sa->backend->simpleaudio_pollfd(sa);
+}
+
+int
+simpleaudio_seek( simpleaudio *sa, unsigned long long pos )
+{
+    if ( !sa->backend->simpleaudio_seek )
+	return -1;
+    if ( !sa->backend->simpleaudio_seek(sa, pos) )
+	return -1;
+    return 0;
+}
+
 void
 simpleaudio_close( simpleaudio *sa )
 {
     sa->backend->simpleaudio_close(sa);
+    simpleaudio_tone_init(sa, 0, sa->tone_mag);	// free the sine tables
     free(sa);
 }
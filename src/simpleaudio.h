@@ -79,6 +79,10 @@ simpleaudio_get_samplesize( simpleaudio *sa );
 void
 simpleaudio_set_rxnoise( simpleaudio *sa, float rxnoise_factor );
 
+/* (for testing) make simpleaudio_get_backlog() report a fixed backlog */
+void
+simpleaudio_set_xbacklog( simpleaudio *sa, size_t backlog_nframes );
+
 ssize_t
 simpleaudio_read( simpleaudio *sa, void *buf, size_t nframes );
 
@@ -88,18 +92,47 @@ simpleaudio_write( simpleaudio *sa, void *buf, size_t nframes );
 void
 simpleaudio_close( simpleaudio *sa );
 
+/* returns 0, or -1 if the backend can't tell (e.g. audio files) */
+int
+simpleaudio_get_backlog( simpleaudio *sa,
+		size_t *backlog_nframesp, size_t *capacity_nframesp );
+
+/* returns a file descriptor which polls readable when samples are
+ * available, or -1 if the backend has none (e.g. audio files) */
+int
+simpleaudio_get_pollfd( simpleaudio *sa );
+
+/* makes frame pos the next one read; returns 0, or -1 if the backend
+ * can't (e.g. audio devices, pipes) */
+int
+simpleaudio_seek( simpleaudio *sa, unsigned long long pos );
+
+
+/*
+ * simpleaudio-iq.c: receive from complex I/Q samples (interleaved I,Q
+ * pairs of iq_format at iq_rate, from the file path or "-" for stdin),
+ * down-converted to real audio at iq_rate divided by a whole number, at
+ * least rate (if iq_rate allows), with iq_offset_f coming out at audio_f.
+ */
+simpleaudio *
+simpleaudio_open_source_iq( const char *path,
+		sa_format_t iq_format, unsigned int iq_rate,
+		float iq_offset_f, float audio_f,
+		sa_format_t sa_format, unsigned int rate );
+
 
 /*
- * simpleaudio tone generator
+ * simpleaudio tone generator (the phase and sine tables are per-stream)
  */
 
 void
-simpleaudio_tone_reset();
+simpleaudio_tone_reset( simpleaudio *sa_out );
 
 void
 simpleaudio_tone(simpleaudio *sa_out, float tone_freq, size_t nsamples_dur);
 
 void
-simpleaudio_tone_init( unsigned int new_sin_table_len, float mag );
+simpleaudio_tone_init( simpleaudio *sa_out,
+		unsigned int new_sin_table_len, float mag );
 
 #endif
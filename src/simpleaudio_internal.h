@@ -36,6 +36,15 @@ struct simpleaudio {
 	unsigned int	samplesize;
 	unsigned int	backend_framesize;
 	float		rxnoise;		// only for the sndfile backend
+	int		xbacklog_set;		// (debug: a fixed backlog)
+	size_t		xbacklog_nframes;
+
+	/* tone generator (simple-tone-generator.c) */
+	float		tone_mag;
+	float		tone_cphase;		// "current" phase state
+	unsigned int	sin_table_len;
+	short		*sin_table_short;
+	float		*sin_table_float;
 };
 
 struct simpleaudio_backend {
@@ -57,6 +66,21 @@ struct simpleaudio_backend {
 
 	void
 	(*simpleaudio_close)( simpleaudio *sa );
+
+	/* optional: frames captured but not yet read, and the capacity of
+	 * the capture buffer (0 if unknown) */
+	int /* boolean 'ok' value */
+	(*simpleaudio_backlog)( simpleaudio *sa,
+		size_t *backlog_nframesp, size_t *capacity_nframesp );
+
+	/* optional: a file descriptor to poll(2) for readable samples,
+	 * or -1 */
+	int
+	(*simpleaudio_pollfd)( simpleaudio *sa );
+
+	/* optional: reposition the stream to frame pos */
+	int /* boolean 'ok' value */
+	(*simpleaudio_seek)( simpleaudio *sa, unsigned long long pos );
 };
 
 extern const struct simpleaudio_backend simpleaudio_backend_benchmark;